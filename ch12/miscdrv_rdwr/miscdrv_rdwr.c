@@ -21,14 +21,76 @@
  * read upon it, we pass back the 'secret' to it. When it writes data to us,
  * we consider that data to be the new 'secret' and update it here (in memory).
  *
+ * Optionally (module parameter ringsz_kb > 0), the driver instead operates in
+ * 'ring' (streaming) mode: it maintains a power-of-2 sized circular buffer;
+ * writes append (any number of) bytes to it and reads consume them, copying
+ * straight to/from the ring with no per-call memory allocation. The ring (and
+ * a small control page holding it's head/tail indices) can also be mmap()'ed
+ * by userspace, allowing producers and consumers to exchange data with no
+ * system call per record (see miscdrv_rdwr.h for the layout). Readers block
+ * while the ring is empty and writers while it's full (unless O_NONBLOCK),
+ * and the poll method lets [e]poll-based event loops multiplex the device.
+ * Alternatively (module parameter pipeline > 0), the driver operates in
+ * 'pipeline' mode: each write(2) is a record that's merely queued - on a
+ * per-CPU lock-free list - and the writer returns; the (expensive, here
+ * simulated) processing is deferred to a workqueue - per-CPU by default, or
+ * unbound (pipe_unbound=1) - whose work functions transform the records and
+ * post them on a completion queue; each read(2) returns a processed record.
+ * At most 'pipeline' records can be in flight (written but not yet read);
+ * beyond that, writers block (or get -EAGAIN), so a slow reader throttles
+ * the writers rather than let the queue grow without bound.
+ * The driver statistics (tx, rx, err) are per-CPU 64-bit counters, retrieved
+ * via the ioctl IOCTL_LLKD_MISCDRV_GETSTATS command. With callers=1, they're
+ * also kept per calling process - looked up lock-free, on every read and
+ * write, in our klib's llkd_tctx table - and shown in
+ *  <debugfs_mount>/miscdrv_rdwr/callers
+ * The driver can create several device instances (module parameter ndevs),
+ * /dev/llkd_miscdrv_rdwr0 .. N-1, each with it's own context - secret, ring,
+ * lock and statistics - allocated on a given NUMA node (module parameter
+ * nodes; round-robin across the online nodes by default). So, say, one
+ * consumer per socket, each on it's 'own' device, shares no hot cache lines
+ * with the others and touches no remote memory.
+ * The (plentiful!) diagnostic printks on the driver methods are off by default
+ * (costing just a NOP); toggle them at runtime via
+ *  <debugfs_mount>/miscdrv_rdwr/verbose
+ * For low-overhead instrumentation, we rather provide tracepoints (see
+ * miscdrv_rdwr_trace.h) on read/write (with byte counts and latency) and
+ * ioctl; and, with lathist=1, read and write latency histograms (see
+ * convenient.h), in <debugfs_mount>/miscdrv_rdwr/{read_ns,write_ns}.
+ * The data paths are the iov_iter based read_iter / write_iter methods; so
+ * a readv(2)/writev(2) (or io_uring request) of many buffers is serviced in
+ * one call, and splice(2) - device data straight into a pipe (and on to a
+ * socket, say), or pipe data into the device - works too, with no bounce
+ * through a userspace buffer (the splice_read / splice_write methods are the
+ * generic iter-based ones).
+ *
  * For details, please refer the book, Ch 9.
  */
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/miscdevice.h>
 #include <linux/slab.h>         // k[m|z]alloc(), k[z]free(), ...
-#include <linux/mm.h>           // kvmalloc()
+#include <linux/mm.h>           // kvmalloc(), remap_pfn_range()
 #include <linux/fs.h>		// the fops
+#include <linux/mutex.h>
+#include <linux/log2.h>         // roundup_pow_of_two()
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/ioctl.h>
+#include <linux/ktime.h>
+#include <linux/uio.h>          // struct iov_iter, copy_[to|from]_iter()
+#include <linux/splice.h>
+#include <linux/nodemask.h>     // for_each_online_node(), ...
+#include <linux/gfp.h>          // alloc_pages_exact_nid()
+#include <linux/llist.h>
+#include <linux/kfifo.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/ctype.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
 
 // copy_[to|from]_user()
 #include <linux/version.h>
@@ -38,7 +100,13 @@
 #include <asm/uaccess.h>
 #endif
 
+#define LLKD_USE_VERBOSE	/* runtime-switchable VPRINT*() diagnostics */
+#define LLKD_USE_TIMING		/* latency histograms */
 #include "../../convenient.h"
+#include "../../klib_llkd.h"
+#include "miscdrv_rdwr.h"
+#define CREATE_TRACE_POINTS
+#include "miscdrv_rdwr_trace.h"
 
 #define OURMODNAME   "miscdrv_rdwr"
 MODULE_AUTHOR("Kaiwan N Billimoria");
@@ -49,19 +117,536 @@ MODULE_VERSION("0.1");
 
 static int ga, gb = 1; /* ignore for now ... */
 
-static struct device *dev;  /* device pointer */
-/* The driver 'context' data structure;
- * all relevant 'state info' reg the driver is here.
+/* Module parameters */
+static int ringsz_kb;
+module_param(ringsz_kb, int, 0444);
+MODULE_PARM_DESC(ringsz_kb,
+ "Size of the ring buffer in KB (rounded up to a power of 2); 0 (default)"
+ " => the usual 'secret' mode, > 0 => streaming 'ring' mode");
+
+#define LLKD_PIPE_MAXDEPTH	65536
+static int pipeline;
+module_param(pipeline, int, 0444);
+MODULE_PARM_DESC(pipeline,
+ "Max # of records in flight in 'pipeline' mode; 0 (default) => off, > 0 =>"
+ " writes are queued and processed by a workqueue (not with ringsz_kb; max "
+ __stringify(LLKD_PIPE_MAXDEPTH) ")");
+
+static bool pipe_unbound;
+module_param(pipe_unbound, bool, 0444);
+MODULE_PARM_DESC(pipe_unbound,
+ "'pipeline' mode: process on an unbound workqueue, on any CPU of the"
+ " writer's node (default 0: per-CPU, on the writer's CPU)");
+
+static uint pipe_cost_us;
+module_param(pipe_cost_us, uint, 0644);
+MODULE_PARM_DESC(pipe_cost_us,
+ "'pipeline' mode: simulated processing cost per record, in microseconds"
+ " (default 0)");
+
+static bool lathist;
+module_param(lathist, bool, 0444);
+MODULE_PARM_DESC(lathist,
+ "Keep read/write latency histograms, in <debugfs_mount>/" OURMODNAME
+ "/{read_ns,write_ns} (default 0)");
+
+static bool callers;
+module_param(callers, bool, 0444);
+MODULE_PARM_DESC(callers,
+ "Keep the statistics per calling process too, in <debugfs_mount>/" OURMODNAME
+ "/callers (default 0)");
+
+#define MAX_NDEVS	16
+static int ndevs = 1;
+module_param(ndevs, int, 0444);
+MODULE_PARM_DESC(ndevs,
+ "Number of device instances to create, /dev/llkd_miscdrv_rdwr0 .. ndevs-1"
+ " (default 1, max " __stringify(MAX_NDEVS) ")");
+
+static int nodes[MAX_NDEVS];
+static int nnodes;
+module_param_array(nodes, int, &nnodes, 0444);
+MODULE_PARM_DESC(nodes,
+ "Comma-separated list of the NUMA node to allocate each instance's context"
+ " (and ring) on; instances beyond the list go round-robin across the online"
+ " nodes (the default); -1 => no preference");
+
+static int verbose;
+module_param(verbose, int, 0444);
+MODULE_PARM_DESC(verbose,
+ "Initial verbosity of the driver method diagnostics; 0 = off (default),"
+ " 1 = on (toggle at runtime via <debugfs_mount>/" OURMODNAME "/verbose)");
+
+/* The driver 'context' data structure - one per device instance;
+ * all relevant 'state info' reg the device is here.
+ */
+/*
+ * 'pipeline' mode: a record, as written, and - once processed - as it'll be
+ * read; and the per-CPU queue of records awaiting processing. Writers push
+ * onto their CPU's lock-free list and kick it's work item, which takes the
+ * whole list in one go.
  */
+struct pipe_rec {
+	struct llist_node node;
+	u32 len, off;			/* off: how much has been read */
+	char data[];
+};
+
+struct drv_ctx;
+struct pipe_pcpu {
+	struct llist_head list;
+	struct work_struct work;
+	struct drv_ctx *ctx;
+};
+
+/* Per-CPU statistics; 'syncp' lets 64-bit counter reads be consistent even on
+ * 32-bit systems. Summed up across all CPUs on demand (see stats_get()). */
+struct drv_stats {
+	u64 tx, rx, err;
+	struct u64_stats_sync syncp;
+};
+
 struct drv_ctx {
-	int tx, rx, err, myword;
+	struct miscdevice miscdev;	/* misc_open() points filp->private_data
+					 * at this; see filp_ctx() */
+	char name[32];
+	int nid;			/* NUMA node we're allocated on */
+	struct drv_stats __percpu *stats;
+	int myword;
 	u32 config1, config2;
 	u64 config3;
-#define MAXBYTES    128   /* Must match the userspace app; we should actually
-			   * use a common header file for things like this */
-	char oursecret[MAXBYTES];
+	char oursecret[MAXBYTES];	/* MAXBYTES is in our common header */
+	/* The (optional) ring buffer; the data pages are allocated via
+	 * alloc_pages_exact() and it's head/tail indices live in a separate
+	 * (zeroed) control page, as both are mmap-able by userspace. The mutex
+	 * serializes in-kernel readers and writers; readers block on 'rdwq'
+	 * while the ring is empty, writers on 'wrwq' while it's full.
+	 * The control page is mapped (writable) by userspace, so it's
+	 * untrusted: the ring's size and mask, and the indices we advance,
+	 * are our own copies here (the page only gets a copy of them); from
+	 * the page, we only ever take the peer's index, and check it.
+	 */
+	struct mutex lock;
+	wait_queue_head_t rdwq, wrwq;
+	char *ringbuf;
+	struct llkd_ring_ctl *ringctl;
+	u32 rsize, rmask;		/* the ring data area's */
+	u32 rhead, rtail;		/* as advanced by write() / read() */
+	/* The (optional) pipeline: 'pinflight' counts records written but not
+	 * yet (fully) read, and is capped at 'pipeline' - so the completion
+	 * queue 'pdone' (sized for that many) can never overflow. Records are
+	 * posted to it by the work functions (serialized by 'plock') and taken
+	 * off by readers (serialized by the mutex); 'pcur' is a record that's
+	 * been partially read.
+	 */
+	struct pipe_pcpu __percpu *ppc;
+	atomic_t pinflight;
+	spinlock_t plock;
+	DECLARE_KFIFO_PTR(pdone, struct pipe_rec *);
+	struct pipe_rec *pcur;
+};
+static struct drv_ctx *ctxs[MAX_NDEVS];
+static struct workqueue_struct *gpipe_wq;
+static struct llkd_hist ghist_rd, ghist_wr;
+
+/* Per calling process statistics (callers=1); see llkd_tctx in klib_llkd.c */
+struct caller_stats {
+	atomic64_t tx, rx, err;		/* the process' threads all update them */
+};
+static struct llkd_tctx_table *gcallers;
+
+static inline struct drv_ctx *filp_ctx(const struct file *filp)
+{
+	return container_of(filp->private_data, struct drv_ctx, miscdev);
+}
+
+/*--- statistics helpers ---*/
+/* Update this CPU's counters; lock-free, and no cache line is shared with the
+ * other CPUs. (Process context only; we keep preemption off across it). And
+ * the caller's, if we're keeping them: a lock-free lookup too */
+static void stats_add(struct drv_ctx *ctx, u64 tx, u64 rx, u64 err)
+{
+	struct drv_stats *st = get_cpu_ptr(ctx->stats);
+
+	u64_stats_update_begin(&st->syncp);
+	st->tx += tx;
+	st->rx += rx;
+	st->err += err;
+	u64_stats_update_end(&st->syncp);
+	put_cpu_ptr(ctx->stats);
+
+	if (gcallers) {
+		struct caller_stats *cs = llkd_tctx_get(gcallers, GFP_KERNEL);
+
+		if (likely(cs)) {
+			atomic64_add(tx, &cs->tx);
+			atomic64_add(rx, &cs->rx);
+			atomic64_add(err, &cs->err);
+		}
+	}
+}
+
+static void caller_show(struct seq_file *m, pid_t tgid, void *data)
+{
+	struct caller_stats *cs = data;
+
+	seq_printf(m, "%d %lld %lld %lld\n", tgid, atomic64_read(&cs->tx),
+		   atomic64_read(&cs->rx), atomic64_read(&cs->err));
+}
+
+static int callers_show(struct seq_file *m, void *v)
+{
+	seq_puts(m, "# tgid tx rx err\n");
+	llkd_tctx_show(m, gcallers, caller_show);
+	return 0;
+}
+
+static int callers_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, callers_show, NULL);
+}
+
+static const struct file_operations callers_fops = {
+	.open = callers_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
-static struct drv_ctx *ctx;
+
+/* Sum the per-CPU counters into @res */
+static void stats_get(struct drv_ctx *ctx, struct llkd_miscdrv_stats *res)
+{
+	unsigned int start;
+	u64 tx, rx, err;
+	int cpu;
+
+	memset(res, 0, sizeof(*res));
+	for_each_possible_cpu(cpu) {
+		const struct drv_stats *st = per_cpu_ptr(ctx->stats, cpu);
+
+		do {
+			start = u64_stats_fetch_begin(&st->syncp);
+			tx = st->tx;
+			rx = st->rx;
+			err = st->err;
+		} while (u64_stats_fetch_retry(&st->syncp, start));
+		res->tx += tx;
+		res->rx += rx;
+		res->err += err;
+	}
+}
+
+/*--- 'ring' mode helpers ---*/
+/* # of bytes available to read / room available to write in the ring; safe
+ * to call locklessly (f.e. as a wait condition or from the poll method).
+ * Just hints, clamped to the ring size; read() and write() check the
+ * indices properly (and fail with -EIO on a bogus one) */
+static inline u32 ring_avail(const struct drv_ctx *ctx)
+{
+	struct llkd_ring_ctl *rc = ctx->ringctl;
+	u32 n = smp_load_acquire(&rc->head) - smp_load_acquire(&rc->tail);
+
+	return min(n, ctx->rsize);
+}
+
+static inline u32 ring_room(const struct drv_ctx *ctx)
+{
+	return ctx->rsize - ring_avail(ctx);
+}
+
+/* Must this I/O not block? (O_NONBLOCK, or f.e. io_uring's first attempt) */
+static inline bool io_nowait(const struct kiocb *iocb)
+{
+	return (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+		(iocb->ki_flags & IOCB_NOWAIT);
+}
+
+static inline int ring_lock(struct drv_ctx *ctx, const struct kiocb *iocb)
+{
+	if (iocb->ki_flags & IOCB_NOWAIT)
+		return mutex_trylock(&ctx->lock) ? 0 : -EAGAIN;
+	return mutex_lock_interruptible(&ctx->lock) ? -ERESTARTSYS : 0;
+}
+
+/*
+ * ring_read()
+ * Consume up to iov_iter_count(@to) bytes from the ring, copying them
+ * straight to the destination - user buffer(s), or pipe pages when
+ * splicing - in at most two pieces, as the data may wrap around the end of
+ * the ring. If the ring is empty, we block until a writer pushes some data
+ * in (or fail with -EAGAIN if the I/O mustn't block). A zero-length read()
+ * just wakes up any blocked writers (useful for an mmap consumer).
+ * Returns the number of bytes read or a -ve errno.
+ */
+static ssize_t ring_read(struct drv_ctx *ctx, struct kiocb *iocb,
+			 struct iov_iter *to)
+{
+	struct llkd_ring_ctl *rc = ctx->ringctl;
+	size_t count = iov_iter_count(to);
+	u32 head, tail, pos, len1;
+	size_t n, done;
+	int ret;
+
+	if (!count) {
+		wake_up_interruptible(&ctx->wrwq);
+		return 0;
+	}
+	for (;;) {
+		ret = ring_lock(ctx, iocb);
+		if (ret)
+			return ret;
+		/* 'head' may be advanced by a userspace producer (via mmap) */
+		head = smp_load_acquire(&rc->head);
+		tail = ctx->rtail;
+		if (unlikely(head - tail > ctx->rsize)) {
+			mutex_unlock(&ctx->lock);
+			stats_add(ctx, 0, 0, 1);
+			return -EIO;
+		}
+		if (head != tail)
+			break;
+		mutex_unlock(&ctx->lock);
+		if (io_nowait(iocb))
+			return -EAGAIN;
+		if (wait_event_interruptible(ctx->rdwq, ring_avail(ctx)))
+			return -ERESTARTSYS;
+	}
+	n = min_t(size_t, count, head - tail);
+	pos = tail & ctx->rmask;
+	len1 = min_t(u32, n, ctx->rsize - pos);
+
+	/* a fault (or a full pipe) part way through is a short read */
+	done = copy_to_iter(ctx->ringbuf + pos, len1, to);
+	if (done == len1 && n > len1)
+		done += copy_to_iter(ctx->ringbuf, n - len1, to);
+	n = done;
+	if (!n) {
+		mutex_unlock(&ctx->lock);
+		stats_add(ctx, 0, 0, 1);
+		return -EFAULT;
+	}
+	ctx->rtail = tail + n;
+	smp_store_release(&rc->tail, ctx->rtail);
+	iocb->ki_pos += n;
+	mutex_unlock(&ctx->lock);
+	stats_add(ctx, n, 0, 0);
+
+	wake_up_interruptible(&ctx->wrwq);	/* there's room now */
+	return n;
+}
+
+/*
+ * ring_write()
+ * Append up to iov_iter_count(@from) bytes - from user buffer(s), or pipe
+ * pages when splicing - to the ring (a short write is performed when there
+ * isn't enough room). If the ring is full, we block until a reader makes
+ * some room (or fail with -EAGAIN if the I/O mustn't block). A zero-length
+ * write() just wakes up any blocked readers (useful for an mmap producer).
+ * Returns the number of bytes written or a -ve errno.
+ */
+static ssize_t ring_write(struct drv_ctx *ctx, struct kiocb *iocb,
+			  struct iov_iter *from)
+{
+	struct llkd_ring_ctl *rc = ctx->ringctl;
+	size_t count = iov_iter_count(from);
+	u32 head, tail, pos, len1;
+	size_t n, done;
+	int ret;
+
+	if (!count) {
+		wake_up_interruptible(&ctx->rdwq);
+		return 0;
+	}
+	for (;;) {
+		ret = ring_lock(ctx, iocb);
+		if (ret)
+			return ret;
+		/* 'tail' may be advanced by a userspace consumer (via mmap) */
+		tail = smp_load_acquire(&rc->tail);
+		head = ctx->rhead;
+		if (unlikely(head - tail > ctx->rsize)) {
+			mutex_unlock(&ctx->lock);
+			stats_add(ctx, 0, 0, 1);
+			return -EIO;
+		}
+		if (head - tail < ctx->rsize)
+			break;
+		mutex_unlock(&ctx->lock);
+		if (io_nowait(iocb))
+			return -EAGAIN;
+		if (wait_event_interruptible(ctx->wrwq, ring_room(ctx)))
+			return -ERESTARTSYS;
+	}
+	n = min_t(size_t, count, ctx->rsize - (head - tail));
+	pos = head & ctx->rmask;
+	len1 = min_t(u32, n, ctx->rsize - pos);
+
+	/* a fault part way through is a short write */
+	done = copy_from_iter(ctx->ringbuf + pos, len1, from);
+	if (done == len1 && n > len1)
+		done += copy_from_iter(ctx->ringbuf, n - len1, from);
+	n = done;
+	if (!n) {
+		mutex_unlock(&ctx->lock);
+		stats_add(ctx, 0, 0, 1);
+		return -EFAULT;
+	}
+	ctx->rhead = head + n;
+	smp_store_release(&rc->head, ctx->rhead);
+	iocb->ki_pos += n;
+	mutex_unlock(&ctx->lock);
+	stats_add(ctx, 0, n, 0);
+
+	wake_up_interruptible(&ctx->rdwq);	/* there's data now */
+	return n;
+}
+
+/*--- 'pipeline' mode helpers ---*/
+/* Is there a record to read / room to write one? Safe to call locklessly */
+static inline bool pipe_avail(struct drv_ctx *ctx)
+{
+	return READ_ONCE(ctx->pcur) || !kfifo_is_empty(&ctx->pdone);
+}
+
+static inline bool pipe_room(const struct drv_ctx *ctx)
+{
+	return atomic_read(&ctx->pinflight) < pipeline;
+}
+
+/*
+ * The pipeline stage proper: in a 'real' driver, this is where we'd write
+ * the record to the device hardware (or whatever) and collect the result.
+ * Here, we upper-case it, taking (optionally) pipe_cost_us to do so.
+ */
+static void pipe_process(struct pipe_rec *rec)
+{
+	unsigned int cost = READ_ONCE(pipe_cost_us);
+	u32 i;
+
+	for (i = 0; i < rec->len; i++)
+		rec->data[i] = toupper(rec->data[i]);
+	if (cost >= 20)
+		usleep_range(cost, cost + cost / 8);
+	else if (cost)
+		udelay(cost);
+}
+
+/* The work function: process all of this CPU's queued records, in order */
+static void pipe_work(struct work_struct *work)
+{
+	struct pipe_pcpu *pc = container_of(work, struct pipe_pcpu, work);
+	struct drv_ctx *ctx = pc->ctx;
+	struct pipe_rec *rec, *tmp;
+	struct llist_node *list;
+
+	/* llist_add() pushes at the head; reverse to get FIFO order */
+	list = llist_reverse_order(llist_del_all(&pc->list));
+	llist_for_each_entry_safe(rec, tmp, list, node) {
+		pipe_process(rec);
+		/* can't fail: there are at most 'pipeline' records in flight */
+		kfifo_in_spinlocked(&ctx->pdone, &rec, 1, &ctx->plock);
+		wake_up_interruptible(&ctx->rdwq);
+	}
+}
+
+/*
+ * pipe_write()
+ * Queue up to LLKD_PIPE_RECMAX bytes from @from as one record (a short write
+ * is performed for more), for processing on this CPU's work item, and
+ * return; we block (or fail with -EAGAIN if the I/O mustn't block) only while
+ * the pipeline's full.
+ * Returns the number of bytes written or a -ve errno.
+ */
+static ssize_t pipe_write(struct drv_ctx *ctx, struct kiocb *iocb,
+			  struct iov_iter *from)
+{
+	size_t n = min_t(size_t, iov_iter_count(from), LLKD_PIPE_RECMAX);
+	struct pipe_pcpu *pc;
+	struct pipe_rec *rec;
+
+	if (!n)
+		return 0;
+	/* backpressure: claim an in-flight slot */
+	while (!atomic_add_unless(&ctx->pinflight, 1, pipeline)) {
+		if (io_nowait(iocb))
+			return -EAGAIN;
+		if (wait_event_interruptible(ctx->wrwq, pipe_room(ctx)))
+			return -ERESTARTSYS;
+	}
+	rec = kmalloc(struct_size(rec, data, n), GFP_KERNEL);
+	if (unlikely(!rec)) {
+		atomic_dec(&ctx->pinflight);
+		wake_up_interruptible(&ctx->wrwq);
+		return -ENOMEM;
+	}
+	if (!copy_from_iter_full(rec->data, n, from)) {
+		kfree(rec);
+		atomic_dec(&ctx->pinflight);
+		wake_up_interruptible(&ctx->wrwq);
+		stats_add(ctx, 0, 0, 1);
+		return -EFAULT;
+	}
+	rec->len = n;
+	rec->off = 0;
+
+	/* on an unbound wq, queue_work_on() runs it on the CPU's node */
+	pc = get_cpu_ptr(ctx->ppc);
+	llist_add(&rec->node, &pc->list);
+	queue_work_on(smp_processor_id(), gpipe_wq, &pc->work);
+	put_cpu_ptr(ctx->ppc);
+
+	iocb->ki_pos += n;
+	stats_add(ctx, 0, n, 0);
+	return n;
+}
+
+/*
+ * pipe_read()
+ * Return (as much as fits in @to of) the next processed record; what
+ * doesn't fit is returned by the next read. If there's none, we block until
+ * one's ready (or fail with -EAGAIN if the I/O mustn't block).
+ * Returns the number of bytes read or a -ve errno.
+ */
+static ssize_t pipe_read(struct drv_ctx *ctx, struct kiocb *iocb,
+			 struct iov_iter *to)
+{
+	struct pipe_rec *rec;
+	size_t n;
+	int ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+	for (;;) {
+		ret = ring_lock(ctx, iocb);
+		if (ret)
+			return ret;
+		if (ctx->pcur || kfifo_out(&ctx->pdone, &ctx->pcur, 1))
+			break;
+		mutex_unlock(&ctx->lock);
+		if (io_nowait(iocb))
+			return -EAGAIN;
+		if (wait_event_interruptible(ctx->rdwq, pipe_avail(ctx)))
+			return -ERESTARTSYS;
+	}
+	rec = ctx->pcur;
+	n = copy_to_iter(rec->data + rec->off, rec->len - rec->off, to);
+	if (!n) {
+		mutex_unlock(&ctx->lock);
+		stats_add(ctx, 0, 0, 1);
+		return -EFAULT;
+	}
+	rec->off += n;
+	if (rec->off == rec->len) {
+		WRITE_ONCE(ctx->pcur, NULL);
+		kfree(rec);
+		atomic_dec(&ctx->pinflight);
+		wake_up_interruptible(&ctx->wrwq);	/* there's room now */
+	}
+	iocb->ki_pos += n;
+	mutex_unlock(&ctx->lock);
+	stats_add(ctx, n, 0, 0);
+	return n;
+}
 
 /*--- The driver 'methods' follow ---*/
 /*
@@ -74,15 +659,15 @@ static struct drv_ctx *ctx;
  */
 static int open_miscdrv_rdwr(struct inode *inode, struct file *filp)
 {
-	PRINT_CTX(); // displays process (or intr) context info
+	VPRINT_CTX(); // displays process (or intr) context info
 
 	ga ++; gb --;
-	pr_info("%s:%s():\n"
-		" filename: \"%s\"\n"
+	VPRINT("%s:%s():\n"
+		" filename: \"%s\" (node %d)\n"
 		" wrt open file: f_flags = 0x%x\n"
 		" ga = %d, gb = %d\n",
 	       OURMODNAME, __func__, filp->f_path.dentry->d_iname,
-	       filp->f_flags, ga, gb);
+	       filp_ctx(filp)->nid, filp->f_flags, ga, gb);
 
 	return 0;
 }
@@ -95,15 +680,31 @@ static int open_miscdrv_rdwr(struct inode *inode, struct file *filp)
  * the number of bytes read or written on success, 0 on EOF and -1 (-ve errno)
  * on failure; here, we copy the 'secret' from our driver context structure
  * to the userspace app.
+ * Being a read_iter method, the destination is described by @to: the single
+ * buffer of a read(2), the iovec array of a readv(2), or the pipe of a
+ * splice(2); the VFS wraps each of these up for us.
  */
-static ssize_t read_miscdrv_rdwr(struct file *filp, char __user *ubuf,
-				size_t count, loff_t *off)
+static ssize_t read_miscdrv_rdwr(struct kiocb *iocb, struct iov_iter *to)
 {
-	int ret = count, secret_len = strlen(ctx->oursecret);
+	struct drv_ctx *ctx = filp_ctx(iocb->ki_filp);
+	size_t count = iov_iter_count(to);
+	ssize_t ret = count;
+	int secret_len = strlen(ctx->oursecret);
+	/* only bother timing it when someone's listening on the tracepoint */
+	u64 t0 = (lathist || trace_miscdrv_read_enabled()) ? llkd_now_ns() : 0;
+	u64 lat;
 
-	PRINT_CTX();
-	pr_info("%s:%s():\n %s wants to read (upto) %zu bytes\n",
+	VPRINT_CTX();
+	VPRINT("%s:%s():\n %s wants to read (upto) %zu bytes\n",
 			OURMODNAME, __func__, current->comm, count);
+	if (ctx->ringbuf) {
+		ret = ring_read(ctx, iocb, to);
+		goto out_notok;
+	}
+	if (ctx->ppc) {
+		ret = pipe_read(ctx, iocb, to);
+		goto out_notok;
+	}
 
 	ret = -EINVAL;
 	if (count < MAXBYTES) {
@@ -120,28 +721,33 @@ static ssize_t read_miscdrv_rdwr(struct file *filp, char __user *ubuf,
 	}
 
 	/* In a 'real' driver, we would now actually read the content of the
-	 * device hardware (or whatever) into the user supplied buffer 'ubuf'
-	 * for 'count' bytes, and then copy it to the userspace process (via
-	 * the copy_to_user() routine).
-	 * (FYI, the copy_to_user() routine is the *right* way to copy data from
-	 * userspace to kernel-space; the parameters are:
-	 *  'to-buffer', 'from-buffer', count
-	 *  Returns 0 on success, i.e., non-zero return implies an I/O fault).
+	 * device hardware (or whatever) for 'count' bytes, and then copy it to
+	 * the destination (via the copy_to_iter() routine).
+	 * (FYI, copy_to_iter() is the *right* way to copy data from
+	 * kernel-space to whatever the iov_iter describes - userspace
+	 * buffer(s) or pipe pages; the parameters are:
+	 *  'from-buffer', count, 'to-iter'
+	 *  It returns the # of bytes copied, i.e., a short return implies an
+	 *  I/O fault).
 	 * Here, we simply copy the content of our context structure's 'secret'
-	 * member to userspace.
+	 * member.
 	 */
 	ret = -EFAULT;
-	if (copy_to_user(ubuf, ctx->oursecret, secret_len)) {
-		pr_warn("%s:%s(): copy_to_user() failed\n", OURMODNAME, __func__);
+	if (copy_to_iter(ctx->oursecret, secret_len, to) != secret_len) {
+		pr_warn("%s:%s(): copy_to_iter() failed\n", OURMODNAME, __func__);
+		stats_add(ctx, 0, 0, 1);
 		goto out_notok;
 	}
 	ret = secret_len;
 
 	// Update stats
-	ctx->tx += secret_len; // our 'transmit' is wrt this driver
-	pr_info(" %d bytes read, returning... (stats: tx=%d, rx=%d)\n",
-			secret_len, ctx->tx, ctx->rx);
+	stats_add(ctx, secret_len, 0, 0); // our 'transmit' is wrt this driver
+	VPRINT(" %d bytes read, returning...\n", secret_len);
 out_notok:
+	lat = t0 ? llkd_now_ns() - t0 : 0;
+	trace_miscdrv_read(count, ret, lat);
+	if (lathist)
+		llkd_hist_add(&ghist_rd, lat);
 	return ret;
 }
 
@@ -153,20 +759,34 @@ out_notok:
  * the number of bytes read or written on success, 0 on EOF and -1 (-ve errno)
  * on failure; Here, we accept the string passed to us and update our 'secret'
  * value to it.
+ * As with read, @from is whatever the write(2), writev(2) or splice(2) gave
+ * us; a writev() of several pieces is gathered into the one secret.
  */
-static ssize_t write_miscdrv_rdwr(struct file *filp, const char __user *ubuf,
-				size_t count, loff_t *off)
+static ssize_t write_miscdrv_rdwr(struct kiocb *iocb, struct iov_iter *from)
 {
-	int ret = count;
+	struct drv_ctx *ctx = filp_ctx(iocb->ki_filp);
+	size_t count = iov_iter_count(from);
+	ssize_t ret = count;
 	void *kbuf = NULL;
+	/* only bother timing it when someone's listening on the tracepoint */
+	u64 t0 = (lathist || trace_miscdrv_write_enabled()) ? llkd_now_ns() : 0;
+	u64 lat;
 
-	PRINT_CTX();
+	VPRINT_CTX();
+	if (ctx->ringbuf) {
+		ret = ring_write(ctx, iocb, from);
+		goto out_nomem;
+	}
+	if (ctx->ppc) {
+		ret = pipe_write(ctx, iocb, from);
+		goto out_nomem;
+	}
 	if (unlikely(count > MAXBYTES)) {   /* paranoia */
 		pr_warn("%s:%s(): count %zu exceeds max # of bytes allowed, "
 			"aborting write\n", OURMODNAME, __func__, count);
 		goto out_nomem;
 	}
-	pr_info("%s:%s():\n %s wants to write %zu bytes\n",
+	VPRINT("%s:%s():\n %s wants to write %zu bytes\n",
 			OURMODNAME, __func__, current->comm, count);
 
 	ret = -ENOMEM;
@@ -177,21 +797,22 @@ static ssize_t write_miscdrv_rdwr(struct file *filp, const char __user *ubuf,
 	}
 	memset(kbuf, 0, count);
 
-	/* Copy in the user supplied buffer 'ubuf' - the data content to write -
-	 * via the copy_from_user() macro.
-	 * (FYI, the copy_from_user() macro is the *right* way to copy data from
-	 * kernel-space to userspace; the parameters are:
-	 *  'to-buffer', 'from-buffer', count
-	 *  Returns 0 on success, i.e., non-zero return implies an I/O fault).
+	/* Copy in the data content to write - from the user supplied buffer(s)
+	 * or pipe pages - via the copy_from_iter_full() routine.
+	 * (FYI, it's the *right* way to copy data from whatever the iov_iter
+	 * describes into kernel-space; the parameters are:
+	 *  'to-buffer', count, 'from-iter'
+	 *  It returns false on a short copy, i.e., an I/O fault).
 	 */
 	ret = -EFAULT;
-	if (copy_from_user(kbuf, ubuf, count)) {
-		pr_warn("%s:%s(): copy_from_user() failed\n", OURMODNAME, __func__);
+	if (!copy_from_iter_full(kbuf, count, from)) {
+		pr_warn("%s:%s(): copy_from_iter_full() failed\n", OURMODNAME, __func__);
+		stats_add(ctx, 0, 0, 1);
 		goto out_cfu;
 	}
 
 	/* In a 'real' driver, we would now actually write (for 'count' bytes)
-	 * the content of the 'ubuf' buffer to the device hardware (or whatever),
+	 * the content of the 'kbuf' buffer to the device hardware (or whatever),
 	 * and then return.
 	 * Here, we do nothing, we just pretend we've done everything :-)
 	 */
@@ -202,15 +823,139 @@ static ssize_t write_miscdrv_rdwr(struct file *filp, const char __user *ubuf,
 				ctx, sizeof(struct drv_ctx));
 #endif
 	// Update stats
-	ctx->rx += count; // our 'receive' is wrt this driver
+	stats_add(ctx, 0, count, 0); // our 'receive' is wrt this driver
 
 	ret = count;
-	pr_info(" %zu bytes written, returning... (stats: tx=%d, rx=%d)\n",
-		count, ctx->tx, ctx->rx);
+	VPRINT(" %zu bytes written, returning...\n", count);
 
 out_cfu:
 	kvfree(kbuf);
 out_nomem:
+	lat = t0 ? llkd_now_ns() - t0 : 0;
+	trace_miscdrv_write(count, ret, lat);
+	if (lathist)
+		llkd_hist_add(&ghist_wr, lat);
+	return ret;
+}
+
+/*
+ * poll_miscdrv_rdwr()
+ * The driver's poll 'method'; supports the poll/select/epoll system calls.
+ * In 'ring' mode, we're readable when there's data in the ring and writable
+ * when there's room in it; in 'pipeline' mode, readable when a processed
+ * record's ready and writable when the pipeline isn't full; in the usual
+ * 'secret' mode, we always are both.
+ */
+static __poll_t poll_miscdrv_rdwr(struct file *filp, poll_table *wait)
+{
+	struct drv_ctx *ctx = filp_ctx(filp);
+	__poll_t mask = 0;
+
+	if (!ctx->ringbuf && !ctx->ppc)
+		return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filp, &ctx->rdwq, wait);
+	poll_wait(filp, &ctx->wrwq, wait);
+	if (ctx->ringbuf ? ring_avail(ctx) != 0 : pipe_avail(ctx))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (ctx->ringbuf ? ring_room(ctx) != 0 : pipe_room(ctx))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+/*
+ * mmap_miscdrv_rdwr()
+ * The driver's mmap 'method'; valid only in 'ring' mode. We map the ring
+ * control page (page offset 0) and/or the ring data pages (page offset 1
+ * onward) straight into the caller's VAS, so that data can be exchanged
+ * with no copying at all. As both were allocated via the page allocator,
+ * they're physically contiguous; a remap_pfn_range() on each suffices.
+ * The mapping must be MAP_SHARED: a private (CoW) copy of the ring would just
+ * silently detach the caller from it. One that's mapped read-only stays so.
+ */
+static int mmap_miscdrv_rdwr(struct file *filp, struct vm_area_struct *vma)
+{
+	struct drv_ctx *ctx = filp_ctx(filp);
+	unsigned long uaddr = vma->vm_start;
+	unsigned long npages = vma_pages(vma), pgoff = vma->vm_pgoff;
+	unsigned long ndatapg, len;
+	int ret;
+
+	VPRINT_CTX();
+	if (!ctx->ringbuf) {
+		pr_warn("%s:%s(): mmap is only supported in 'ring' mode\n",
+			OURMODNAME, __func__);
+		return -ENODEV;
+	}
+	/* not VM_SHARED: the kernel clears that for a MAP_SHARED, O_RDONLY fd */
+	if (!(vma->vm_flags & VM_MAYSHARE)) {
+		pr_warn("%s:%s(): the ring can only be mapped MAP_SHARED\n",
+			OURMODNAME, __func__);
+		return -EINVAL;
+	}
+	ndatapg = ctx->rsize >> PAGE_SHIFT;
+	if (pgoff + npages > LLKD_RING_DATA_PGOFF + ndatapg) {
+		pr_warn("%s:%s(): mmap range (pgoff %lu, %lu pages) out of bounds\n",
+			OURMODNAME, __func__, pgoff, npages);
+		return -EINVAL;
+	}
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	if (!(vma->vm_flags & VM_WRITE))
+		vma->vm_flags &= ~VM_MAYWRITE;	/* no mprotect() to writable later */
+
+	if (pgoff == LLKD_RING_CTL_PGOFF) {
+		ret = remap_pfn_range(vma, uaddr,
+			virt_to_phys(ctx->ringctl) >> PAGE_SHIFT,
+			PAGE_SIZE, vma->vm_page_prot);
+		if (ret)
+			return ret;
+		uaddr += PAGE_SIZE;
+		pgoff++;
+		npages--;
+	}
+	if (!npages)
+		return 0;
+
+	len = npages << PAGE_SHIFT;
+	return remap_pfn_range(vma, uaddr,
+		(virt_to_phys(ctx->ringbuf) >> PAGE_SHIFT) +
+			(pgoff - LLKD_RING_DATA_PGOFF),
+		len, vma->vm_page_prot);
+}
+
+/*
+ * ioctl_miscdrv_rdwr()
+ * The driver's ioctl 'method'. Currently supports just the GETSTATS command:
+ * it returns the driver statistics (tx, rx, errors; summed across all CPUs)
+ * to the calling app.
+ */
+static long ioctl_miscdrv_rdwr(struct file *filp, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct drv_ctx *ctx = filp_ctx(filp);
+	struct llkd_miscdrv_stats st;
+	long ret = -ENOTTY;
+
+	/* Verify stuff: is the ioctl's for us? etc.. */
+	if (_IOC_TYPE(cmd) != IOCTL_LLKD_MISCDRV_MAGIC) {
+		pr_info("ioctl fail; magic # mismatch\n");
+		goto out;
+	}
+	if (_IOC_NR(cmd) > IOCTL_LLKD_MISCDRV_MAXIOCTL) {
+		pr_info("ioctl fail; invalid cmd?\n");
+		goto out;
+	}
+
+	switch (cmd) {
+	case IOCTL_LLKD_MISCDRV_GETSTATS:	/* Get: arg is pointer to result */
+		stats_get(ctx, &st);
+		ret = 0;
+		if (copy_to_user((void __user *)arg, &st, sizeof(st)))
+			ret = -EFAULT;
+		break;
+	}
+out:
+	trace_miscdrv_ioctl(cmd, ret);
 	return ret;
 }
 
@@ -222,10 +967,10 @@ out_nomem:
  */
 static int close_miscdrv_rdwr(struct inode *inode, struct file *filp)
 {
-        PRINT_CTX(); // displays process (or intr) context info
+        VPRINT_CTX(); // displays process (or intr) context info
 
 	ga --; gb ++;
-        pr_info("%s:%s(): filename: \"%s\"\n"
+        VPRINT("%s:%s(): filename: \"%s\"\n"
 		" ga = %d, gb = %d\n",
 			OURMODNAME, __func__, filp->f_path.dentry->d_iname,
 			ga, gb);
@@ -234,42 +979,196 @@ static int close_miscdrv_rdwr(struct inode *inode, struct file *filp)
 
 /* The driver 'functionality' is encoded via the fops */
 static const struct file_operations llkd_misc_fops = {
+	.owner = THIS_MODULE,	/* an mmap can outlive the close; hold a module ref */
 	.open = open_miscdrv_rdwr,
-	.read = read_miscdrv_rdwr,
-	.write = write_miscdrv_rdwr,
+	.read_iter = read_miscdrv_rdwr,   // read(2), readv(2), io_uring
+	.write_iter = write_miscdrv_rdwr, // write(2), writev(2), io_uring
+	.splice_read = generic_file_splice_read, // via our read_iter
+	.splice_write = iter_file_splice_write,  // via our write_iter
+	.poll = poll_miscdrv_rdwr,
+	.mmap = mmap_miscdrv_rdwr,
+	.unlocked_ioctl = ioctl_miscdrv_rdwr, // GETSTATS: tx, rx, errors
 	.llseek = no_llseek,             // dummy, we don't support lseek(2)
 	.release = close_miscdrv_rdwr,
-	/* As you learn more reg device drivers, you'll realize that the
-	 * ioctl() would be a very useful method here. As an exercise,
-	 * implement an ioctl method; when issued with the 'GETSTATS' 'command',
-	 * it should return the statistics (tx, rx, errors) to the calling app
-	 */
 };
 
-static struct miscdevice llkd_miscdev = {
-	.minor = MISC_DYNAMIC_MINOR, /* kernel dynamically assigns a free minor# */
-	.name = "llkd_miscdrv_rdwr", /* when misc_register() is invoked, the kernel
-                      will auto-create device file as /dev/llkd_miscdrv_rdwr;
-	    also populated within /sys/class/misc/ and /sys/devices/virtual/misc/ */
-	.mode = 0666,                /* ... dev node perms set as specified here */
-	.fops = &llkd_misc_fops,     /* connect to this driver's 'functionality' */
-};
+/*
+ * ring_alloc()
+ * Allocate the ring data pages (a power-of-2 size, at least a page and
+ * at most what a single call to the page allocator can provide) and the
+ * ring control page, both on the instance's NUMA node.
+ */
+static int ring_alloc(struct drv_ctx *ctx, size_t sz)
+{
+	struct page *pg;
 
-static int __init miscdrv_init(void)
+	sz = roundup_pow_of_two(max_t(size_t, sz, PAGE_SIZE));
+	if (sz > (PAGE_SIZE << (MAX_ORDER - 1))) {
+		pr_notice("%s: ring size %zu bytes is too large (max %lu)\n",
+			OURMODNAME, sz, PAGE_SIZE << (MAX_ORDER - 1));
+		return -EINVAL;
+	}
+
+	pg = alloc_pages_node(ctx->nid, GFP_KERNEL | __GFP_ZERO, 0);
+	if (unlikely(!pg))
+		return -ENOMEM;
+	ctx->ringctl = page_address(pg);
+	ctx->ringbuf = alloc_pages_exact_nid(ctx->nid, sz,
+					     GFP_KERNEL | __GFP_ZERO);
+	if (unlikely(!ctx->ringbuf)) {
+		free_page((unsigned long)ctx->ringctl);
+		return -ENOMEM;
+	}
+	ctx->rsize = sz;
+	ctx->rmask = sz - 1;
+	/* for userspace's information only; we never read them back */
+	ctx->ringctl->size = sz;
+	ctx->ringctl->mask = sz - 1;
+	return 0;
+}
+
+static void ring_free(struct drv_ctx *ctx)
 {
-	int ret;
+	if (!ctx->ringbuf)
+		return;
+	free_pages_exact(ctx->ringbuf, ctx->rsize);
+	free_page((unsigned long)ctx->ringctl);
+}
+
+/*
+ * pipe_alloc()
+ * Set up the instance's pipeline: the per-CPU queues and the completion
+ * queue, with room for the max # of records in flight.
+ */
+static int pipe_alloc(struct drv_ctx *ctx)
+{
+	int cpu;
+
+	ctx->ppc = alloc_percpu(struct pipe_pcpu);
+	if (unlikely(!ctx->ppc))
+		return -ENOMEM;
+	/* kfifo_alloc() rounds up to a power of 2, but rejects a size < 2 */
+	if (kfifo_alloc(&ctx->pdone, max(pipeline, 2), GFP_KERNEL)) {
+		free_percpu(ctx->ppc);
+		ctx->ppc = NULL;
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		struct pipe_pcpu *pc = per_cpu_ptr(ctx->ppc, cpu);
+
+		init_llist_head(&pc->list);
+		INIT_WORK(&pc->work, pipe_work);
+		pc->ctx = ctx;
+	}
+	atomic_set(&ctx->pinflight, 0);
+	spin_lock_init(&ctx->plock);
+	return 0;
+}
+
+/* Called once there can be no more writers: let the work drain, then free */
+static void pipe_free(struct drv_ctx *ctx)
+{
+	struct pipe_rec *rec;
+	int cpu;
+
+	if (!ctx->ppc)
+		return;
+	for_each_possible_cpu(cpu)
+		flush_work(&per_cpu_ptr(ctx->ppc, cpu)->work);
+	while (kfifo_out(&ctx->pdone, &rec, 1))
+		kfree(rec);
+	kfree(ctx->pcur);
+	kfifo_free(&ctx->pdone);
+	free_percpu(ctx->ppc);
+}
+
+/* The NUMA node for instance @i: as given in nodes[], else round-robin */
+static int instance_node(int i)
+{
+	int nid, n;
+
+	if (i < nnodes) {
+		if (nodes[i] == NUMA_NO_NODE)
+			return NUMA_NO_NODE;
+		if (nodes[i] < 0 || nodes[i] >= MAX_NUMNODES ||
+		    !node_online(nodes[i])) {
+			pr_notice("%s: node %d (instance %d) isn't online; using"
+				  " no node preference\n", OURMODNAME, nodes[i], i);
+			return NUMA_NO_NODE;
+		}
+		return nodes[i];
+	}
+	n = i % num_online_nodes();
+	for_each_online_node(nid)
+		if (n-- == 0)
+			break;
+	return nid;
+}
+
+/*
+ * instance_create()
+ * Allocate, on it's NUMA node, and initialize instance @i's context, then
+ * register it's misc device (/dev/llkd_miscdrv_rdwr<i>). The device is live
+ * as soon as misc_register() returns, so that's the last thing we do.
+ */
+static struct drv_ctx *instance_create(int i)
+{
+	struct drv_ctx *ctx;
+	int ret, cpu, nid = instance_node(i);
 
-	if ((ret = misc_register(&llkd_miscdev))) {
+	ctx = kzalloc_node(sizeof(struct drv_ctx), GFP_KERNEL, nid);
+	if (unlikely(!ctx)) {
+		pr_notice("%s: kzalloc_node failed! aborting\n", OURMODNAME);
+		return ERR_PTR(-ENOMEM);
+	}
+	ctx->nid = nid;
+	/* the per-CPU stats are, by definition, local to each CPU */
+	ret = -ENOMEM;
+	ctx->stats = alloc_percpu(struct drv_stats);
+	if (unlikely(!ctx->stats)) {
+		pr_notice("%s: alloc_percpu failed! aborting\n", OURMODNAME);
+		goto out_free;
+	}
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(ctx->stats, cpu)->syncp);
+	strlcpy(ctx->oursecret, "initmsg", 8);
+	mutex_init(&ctx->lock);
+	init_waitqueue_head(&ctx->rdwq);
+	init_waitqueue_head(&ctx->wrwq);
+
+	if (ringsz_kb > 0) {
+		ret = ring_alloc(ctx, (size_t)ringsz_kb * 1024);
+		if (ret)
+			goto out_stats;
+	} else if (pipeline > 0) {
+		ret = pipe_alloc(ctx);
+		if (ret)
+			goto out_stats;
+	}
+
+	snprintf(ctx->name, sizeof(ctx->name), "llkd_miscdrv_rdwr%d", i);
+	/* misc dynamically assigns a free minor#; the kernel will auto-create
+	 * the device file as /dev/<name>, also populated within /sys/class/misc/
+	 * and /sys/devices/virtual/misc/, with the perms set via 'mode' */
+	ctx->miscdev.minor = MISC_DYNAMIC_MINOR;
+	ctx->miscdev.name = ctx->name;
+	ctx->miscdev.mode = 0666;
+	ctx->miscdev.fops = &llkd_misc_fops; /* connect to this driver's 'functionality' */
+	ret = misc_register(&ctx->miscdev);
+	if (ret) {
 		pr_notice("%s: misc device registration failed, aborting\n",
 			       OURMODNAME);
-		return ret;
+		goto out_mode;
 	}
-	/* Retrieve the device pointer for this device */
-	dev = llkd_miscdev.this_device;
 	pr_info("%s: LLKD misc driver (major # 10) registered, minor# = %d,"
-			" dev node is /dev/llkd_miscdrv_rdwr\n",
-			OURMODNAME, llkd_miscdev.minor);
-
+			" dev node is /dev/%s (node %d)\n",
+			OURMODNAME, ctx->miscdev.minor, ctx->name, nid);
+	if (ctx->ringbuf)
+		pr_info("%s: 'ring' mode: ring buffer of %u bytes\n",
+			ctx->name, ctx->rsize);
+	else if (ctx->ppc)
+		pr_info("%s: 'pipeline' mode: upto %d records in flight, %s wq\n",
+			ctx->name, pipeline, pipe_unbound ? "unbound" : "per-CPU");
 #if 0
 	/* Now, for the purpose of creating the device node (file), we require
 	 * both the major and minor numbers. The major number will always be 10
@@ -283,27 +1182,130 @@ static int __init miscdrv_init(void)
 	 * Here, we do provide a utility script (cr8devnode.sh) to do this and create the
 	 * device node.
 	 */
-	pr_info("%s:minor=%d\n", OURMODNAME, llkd_miscdev.minor);
+	pr_info("%s:minor=%d\n", OURMODNAME, ctx->miscdev.minor);
 #endif
-	ctx = devm_kzalloc(dev, sizeof(struct drv_ctx), GFP_KERNEL);
-	if (unlikely(!ctx)) {
-		pr_notice("%s: kzalloc failed! aborting\n", OURMODNAME);
-		return -ENOMEM;
+	dev_dbg(ctx->miscdev.this_device,
+		"A sample print via the dev_dbg(): device %s initialized\n",
+		ctx->name);
+	return ctx;
+
+out_mode:
+	ring_free(ctx);
+	pipe_free(ctx);
+out_stats:
+	free_percpu(ctx->stats);
+out_free:
+	kfree(ctx);
+	return ERR_PTR(ret);
+}
+
+static void instance_destroy(struct drv_ctx *ctx)
+{
+	dev_dbg(ctx->miscdev.this_device,
+		"A sample print via the dev_dbg(): device %s deregistered\n",
+		ctx->name);
+	/* no new opens; an existing mmap holds a module ref (.owner), so we
+	 * can't get here while the ring's still mapped */
+	misc_deregister(&ctx->miscdev);
+	ring_free(ctx);
+	pipe_free(ctx);
+	free_percpu(ctx->stats);
+	kfree(ctx);
+}
+
+static int __init miscdrv_init(void)
+{
+	int i;
+
+	if (ndevs < 1 || ndevs > MAX_NDEVS) {
+		pr_notice("%s: ndevs (%d) must be in the range [1-%d]\n",
+			OURMODNAME, ndevs, MAX_NDEVS);
+		return -EINVAL;
 	}
-	strlcpy(ctx->oursecret, "initmsg", 8);
-	dev_dbg(dev, "A sample print via the dev_dbg(): driver %s initialized\n",
-		OURMODNAME);
+	/* the most a single call to the page allocator can provide */
+	if (ringsz_kb > (int)((PAGE_SIZE << (MAX_ORDER - 1)) >> 10)) {
+		pr_notice("%s: ringsz_kb (%d) is too large (max %lu)\n",
+			OURMODNAME, ringsz_kb, (PAGE_SIZE << (MAX_ORDER - 1)) >> 10);
+		return -EINVAL;
+	}
+	if (pipeline < 0 || pipeline > LLKD_PIPE_MAXDEPTH ||
+	    (pipeline && ringsz_kb > 0)) {
+		pr_notice("%s: pipeline (%d) must be in the range [0-%d], and"
+			" can't be used along with ringsz_kb\n",
+			OURMODNAME, pipeline, LLKD_PIPE_MAXDEPTH);
+		return -EINVAL;
+	}
+	if (callers) {
+		gcallers = llkd_tctx_create(OURMODNAME "_callers",
+				sizeof(struct caller_stats), LLKD_TCTX_TGID, NULL);
+		if (!gcallers)
+			return -ENOMEM;
+	}
+	if (lathist) {
+		if (llkd_hist_init(&ghist_rd, "read_ns") ||
+		    llkd_hist_init(&ghist_wr, "write_ns")) {
+			llkd_hist_destroy(&ghist_rd);
+			llkd_tctx_destroy(gcallers);
+			return -ENOMEM;
+		}
+	}
+	if (pipeline) {
+		/* per-CPU (the default) or unbound; either way, concurrency's
+		 * managed (max_active 0 => the default) */
+		gpipe_wq = alloc_workqueue(OURMODNAME "_pipe",
+				pipe_unbound ? WQ_UNBOUND : 0, 0);
+		if (!gpipe_wq) {
+			llkd_hist_destroy(&ghist_rd);
+			llkd_hist_destroy(&ghist_wr);
+			llkd_tctx_destroy(gcallers);
+			return -ENOMEM;
+		}
+	}
+	for (i = 0; i < ndevs; i++) {
+		ctxs[i] = instance_create(i);
+		if (IS_ERR(ctxs[i])) {
+			int ret = PTR_ERR(ctxs[i]);
+
+			while (--i >= 0)
+				instance_destroy(ctxs[i]);
+			if (gpipe_wq)
+				destroy_workqueue(gpipe_wq);
+			llkd_hist_destroy(&ghist_rd);
+			llkd_hist_destroy(&ghist_wr);
+			llkd_tctx_destroy(gcallers);
+			return ret;
+		}
+	}
+	if (llkd_verbose_init(OURMODNAME, verbose))	/* not fatal */
+		pr_notice("%s: couldn't setup the debugfs 'verbose' file\n",
+			OURMODNAME);
+	else if (lathist &&
+		 (IS_ERR_OR_NULL(llkd_hist_debugfs(&ghist_rd, llkd_verbose_dir)) ||
+		  IS_ERR_OR_NULL(llkd_hist_debugfs(&ghist_wr, llkd_verbose_dir))))
+		pr_notice("%s: couldn't setup the debugfs histogram files\n",
+			OURMODNAME);
+	if (gcallers && !IS_ERR_OR_NULL(llkd_verbose_dir) &&
+	    IS_ERR_OR_NULL(debugfs_create_file("callers", 0444, llkd_verbose_dir,
+					       NULL, &callers_fops)))
+		pr_notice("%s: couldn't setup the debugfs 'callers' file\n",
+			OURMODNAME);
 
 	return 0;		/* success */
 }
 
 static void __exit miscdrv_exit(void)
 {
-	//kzfree(ctx);
-	misc_deregister(&llkd_miscdev);
+	int i;
+
+	llkd_verbose_exit();
+	for (i = 0; i < ndevs; i++)
+		instance_destroy(ctxs[i]);
+	if (gpipe_wq)
+		destroy_workqueue(gpipe_wq);
+	llkd_hist_destroy(&ghist_rd);
+	llkd_hist_destroy(&ghist_wr);
+	llkd_tctx_destroy(gcallers);
 	pr_info("%s: LKDC misc driver deregistered, bye\n", OURMODNAME);
-	dev_dbg(dev, "A sample print via the dev_dbg(): driver %s deregistered, bye\n",
-		OURMODNAME);
 }
 
 module_init(miscdrv_init);
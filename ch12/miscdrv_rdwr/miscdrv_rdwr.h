@@ -0,0 +1,72 @@
+/*
+ * ch12/miscdrv_rdwr/miscdrv_rdwr.h
+ *
+ * Common header for both the miscdrv_rdwr.c kernel module and the userspace
+ * C app rdwr_drv_secret.c
+ */
+#ifndef __MISCDRV_RDWR_H__
+#define __MISCDRV_RDWR_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define MAXBYTES    128   /* max size of the 'secret' */
+
+/*
+ * 'ring' mode: the layout of the mmap(2)-able region of the device.
+ * Page 0 is the ring control (index) page, a struct llkd_ring_ctl; pages
+ * 1 .. (ring size/page size) are the ring data pages. So, mapping
+ * (1 + size/page size) pages at offset 0 gets one the whole ring.
+ *
+ * 'head' is only ever advanced by the producer and 'tail' only by the
+ * consumer; both are free-running (mask them with 'mask' to get the byte
+ * offset into the data pages), so (head - tail) is the number of bytes
+ * available to read. The producer must store-release 'head' after writing
+ * the data, the consumer must load-acquire it before reading the data
+ * (and symmetrically for 'tail').
+ * Of course, there must be only one producer and one consumer at a time; the
+ * driver's read()/write() paths count as one (they're serialized in-kernel).
+ * As the driver can't 'see' index updates made via the mapping, an mmap
+ * producer should issue a zero-length write(2) (and an mmap consumer a
+ * zero-length read(2)) to wake up any peers blocked in read/write/poll.
+ * 'size' and 'mask' are for your information; the driver keeps (and uses)
+ * it's own copies, as it does of the index it advances. Of the indices in
+ * this page, it only ever reads the peer's, and a bogus one - more data
+ * (or room) than the ring holds - fails the read(2) or write(2) with EIO.
+ */
+struct llkd_ring_ctl {
+	__u32 head;
+	__u32 tail;
+	__u32 size;   /* size of the ring data area in bytes; a power of 2 */
+	__u32 mask;   /* size - 1 */
+};
+#define LLKD_RING_CTL_PGOFF	0	/* mmap page offset of the control page */
+#define LLKD_RING_DATA_PGOFF	1	/* mmap page offset of the data pages */
+
+/*
+ * 'pipeline' mode: each write(2) of up to LLKD_PIPE_RECMAX bytes is one
+ * record (more is a short write); each read(2) returns (as much as fits of)
+ * the next processed record. Records written on different CPUs may be
+ * processed - and so, read - out of order wrt each other.
+ */
+#define LLKD_PIPE_RECMAX	4096
+
+/*--- ioctl's ---*/
+/* The 'magic' number for our driver; see
+ * Documentation/ioctl/ioctl-number.rst
+ * (We pick a different one than the ch13/ioctl_intf demo driver's 0xA8).
+ */
+#define IOCTL_LLKD_MISCDRV_MAGIC	0xA9
+
+#define IOCTL_LLKD_MISCDRV_MAXIOCTL	0
+
+/* The driver statistics (summed across all CPUs) */
+struct llkd_miscdrv_stats {
+	__u64 tx;     /* # bytes read by userspace ('transmitted' by us) */
+	__u64 rx;     /* # bytes written by userspace ('received' by us) */
+	__u64 err;    /* # of failed transfers */
+};
+/* our ioctl (IOC) GETSTATS command: retrieve the driver statistics */
+#define IOCTL_LLKD_MISCDRV_GETSTATS	_IOR(IOCTL_LLKD_MISCDRV_MAGIC, 0, struct llkd_miscdrv_stats)
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * ch12/miscdrv_rdwr/miscdrv_rdwr_trace.h
+ *
+ * Tracepoints for the miscdrv_rdwr driver.
+ * When nothing is attached, each tracepoint costs just a NOP (it's gated by a
+ * static key); attach via ftrace, perf or eBPF, f.e.:
+ *  echo 1 > /sys/kernel/debug/tracing/events/miscdrv_rdwr/enable
+ *  perf record -e 'miscdrv_rdwr:*' -a
+ *  bpftrace -e 'tracepoint:miscdrv_rdwr:miscdrv_read { @ns = hist(args->lat_ns); }'
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM miscdrv_rdwr
+
+#if !defined(_MISCDRV_RDWR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MISCDRV_RDWR_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* read/write: bytes requested, the return value and the time taken */
+DECLARE_EVENT_CLASS(miscdrv_xfer,
+	TP_PROTO(size_t count, ssize_t ret, u64 lat_ns),
+	TP_ARGS(count, ret, lat_ns),
+	TP_STRUCT__entry(
+		__field(size_t, count)
+		__field(ssize_t, ret)
+		__field(u64, lat_ns)
+	),
+	TP_fast_assign(
+		__entry->count = count;
+		__entry->ret = ret;
+		__entry->lat_ns = lat_ns;
+	),
+	TP_printk("count=%zu ret=%zd lat_ns=%llu",
+		  __entry->count, __entry->ret, __entry->lat_ns)
+);
+
+DEFINE_EVENT(miscdrv_xfer, miscdrv_read,
+	TP_PROTO(size_t count, ssize_t ret, u64 lat_ns),
+	TP_ARGS(count, ret, lat_ns)
+);
+
+DEFINE_EVENT(miscdrv_xfer, miscdrv_write,
+	TP_PROTO(size_t count, ssize_t ret, u64 lat_ns),
+	TP_ARGS(count, ret, lat_ns)
+);
+
+/* ioctl command dispatch */
+TRACE_EVENT(miscdrv_ioctl,
+	TP_PROTO(unsigned int cmd, long ret),
+	TP_ARGS(cmd, ret),
+	TP_STRUCT__entry(
+		__field(unsigned int, cmd)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->ret = ret;
+	),
+	TP_printk("cmd=0x%x (nr %u) ret=%ld",
+		  __entry->cmd, _IOC_NR(__entry->cmd), __entry->ret)
+);
+
+#endif /* _MISCDRV_RDWR_TRACE_H */
+
+/* This part must be outside the multi-read protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE miscdrv_rdwr_trace
+#include <trace/define_trace.h>
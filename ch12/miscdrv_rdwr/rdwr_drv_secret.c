@@ -16,9 +16,21 @@
  * Also, again as a demo, we use the read(2) to retreive the 'secret' <eye-roll>
  * from the driver within kernel-space. Equivalently, one can use the write(2)
  * change the 'secret' (just plain text).
+ * When the driver is in 'ring' mode, option 'm' has us mmap(2) the ring and
+ * drain whatever data is available from it, with no read(2) at all.
+ * Option 's' retrieves and displays the driver statistics via the ioctl(2).
+ * Option 'l' turns it into a load generator: N reader and M writer threads,
+ * optionally pinned to given CPUs, hammer the device with records of a given
+ * size for a given duration; we then report, per role, the ops/sec, MB/s and
+ * latency percentiles (and the driver's own tx/rx byte counts, cross-checked
+ * via the GETSTATS ioctl). In 'secret' mode the driver's constraints apply:
+ * writes are capped at MAXBYTES bytes and reads need at least MAXBYTES; in
+ * 'ring' mode, any size goes (and a full / empty ring makes threads wait in
+ * poll(2), counted as 'stalls').
  *
  * For details, please refer the book, Ch 9.
  */
+#define _GNU_SOURCE	/* pthread_setaffinity_np(), CPU_SET() */
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -27,18 +39,412 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include "miscdrv_rdwr.h"
 
-#define MAXBYTES    128   /* Must match the driver; we should actually use a
-			   * common header file for things like this */
 static int stay_alive = 0;
 
 static inline void usage(char *prg)
 {
-	fprintf(stderr,"Usage: %s opt=read/write device_file [\"secret-msg\"]\n"
+	fprintf(stderr,"Usage: %s opt=read/write/mmap device_file [\"secret-msg\"]\n"
 			" opt = 'r' => we shall issue the read(2), retrieving the 'secret' form the driver\n"
 			" opt = 'w' => we shall issue the write(2), writing the secret message <secret-msg>\n"
-			"  (max %d bytes)\n",
-		       prg, MAXBYTES);
+			"  (max %d bytes)\n"
+			" opt = 'm' => ('ring' mode only) we shall mmap(2) the ring and drain it\n"
+			" opt = 's' => we shall issue the ioctl(2) to retrieve the driver statistics\n"
+			" opt = 'l' => load generator; further options (after device_file):\n"
+			"  -r N  : # of reader threads (default 1)\n"
+			"  -w M  : # of writer threads (default 1)\n"
+			"  -s sz : record size in bytes (default %d)\n"
+			"  -d s  : duration in seconds (default 5)\n"
+			"  -c cpulist : pin the threads - readers first, then writers - round\n"
+			"               robin to these CPUs, f.e. 0,2-3 (default: no pinning)\n",
+		       prg, MAXBYTES, MAXBYTES);
+}
+
+/*------------------ the load generator ('l') ------------------------------*/
+#define LG_MAXTHREADS	256
+#define LG_MAXCPUS	1024
+/* Latency histogram: log2(ns) buckets, each split into LG_SUB linear ones */
+#define LG_SUBBITS	3
+#define LG_SUB		(1 << LG_SUBBITS)
+#define LG_NBUCKETS	(64 * LG_SUB)
+
+struct lg_thread {
+	pthread_t tid;
+	int id, writer, cpu;
+	const char *devfile;
+	size_t recsz;
+	/* results */
+	uint64_t ops, bytes, errs, stalls, max_ns;
+	uint64_t hist[LG_NBUCKETS];
+	int fatal;
+} __attribute__((aligned(64)));
+
+static volatile int lg_stop;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int lg_bucket(uint64_t ns)
+{
+	unsigned int lg;
+
+	if (ns < LG_SUB)
+		return ns;
+	lg = 63 - __builtin_clzll(ns);
+	/* the top LG_SUBBITS bits below the leading one pick the sub-bucket */
+	return (lg - LG_SUBBITS + 1) * LG_SUB +
+		((ns >> (lg - LG_SUBBITS)) & (LG_SUB - 1));
+}
+
+/* The upper bound (ns) of bucket @b */
+static inline uint64_t lg_bucket_max(unsigned int b)
+{
+	unsigned int lg, sub;
+
+	if (b < LG_SUB)
+		return b;
+	lg = b / LG_SUB + LG_SUBBITS - 1;
+	sub = b % LG_SUB;
+	return ((uint64_t)(LG_SUB + sub + 1) << (lg - LG_SUBBITS)) - 1;
+}
+
+static void *lg_worker(void *arg)
+{
+	struct lg_thread *t = arg;
+	struct pollfd pfd;
+	uint64_t t0, d;
+	char *buf;
+	ssize_t n;
+	int fd;
+
+	if (t->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(t->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+			fprintf(stderr, "thread %d: pinning to cpu %d failed\n",
+				t->id, t->cpu);
+	}
+	/* non-blocking: so that a full/empty ring can't keep us from seeing
+	 * lg_stop; we wait in poll(2) instead */
+	fd = open(t->devfile, (t->writer ? O_WRONLY : O_RDONLY) | O_NONBLOCK, 0);
+	if (fd == -1) {
+		perror("open");
+		t->fatal = 1;
+		return NULL;
+	}
+	buf = malloc(t->recsz);
+	if (!buf) {
+		close(fd);
+		t->fatal = 1;
+		return NULL;
+	}
+	memset(buf, 'a' + t->id % 26, t->recsz);
+	buf[t->recsz - 1] = '\0';
+	pfd.fd = fd;
+	pfd.events = t->writer ? POLLOUT : POLLIN;
+
+	while (!lg_stop) {
+		t0 = now_ns();
+		n = t->writer ? write(fd, buf, t->recsz) : read(fd, buf, t->recsz);
+		d = now_ns() - t0;
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				t->stalls++;
+				(void)poll(&pfd, 1, 10);
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			t->errs++;
+			continue;
+		}
+		t->ops++;
+		t->bytes += n;
+		t->hist[lg_bucket(d)]++;
+		if (d > t->max_ns)
+			t->max_ns = d;
+	}
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+/* Parse a CPU list, f.e. "0,2-3,8"; returns the # of CPUs, -1 on error */
+static int parse_cpulist(const char *str, int *cpus, int max)
+{
+	int n = 0, lo, hi;
+	char *end;
+
+	while (*str) {
+		lo = strtol(str, &end, 10);
+		if (end == str || lo < 0)
+			return -1;
+		hi = lo;
+		if (*end == '-') {
+			str = end + 1;
+			hi = strtol(str, &end, 10);
+			if (end == str || hi < lo)
+				return -1;
+		}
+		for (; lo <= hi && n < max; lo++)
+			cpus[n++] = lo;
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		str = end;
+	}
+	return n;
+}
+
+static int get_stats(const char *devfile, struct llkd_miscdrv_stats *st)
+{
+	int fd = open(devfile, O_RDONLY | O_NONBLOCK, 0), ret;
+
+	if (fd == -1)
+		return -1;
+	ret = ioctl(fd, IOCTL_LLKD_MISCDRV_GETSTATS, st);
+	close(fd);
+	return ret;
+}
+
+static void lg_report(const char *role, struct lg_thread *t, int nthr,
+		      uint64_t elapsed_ns)
+{
+	static uint64_t hist[LG_NBUCKETS];
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	uint64_t ops = 0, bytes = 0, errs = 0, stalls = 0, max_ns = 0, cum;
+	double secs = elapsed_ns / 1e9;
+	unsigned int i, b;
+	int j;
+
+	if (!nthr)
+		return;
+	memset(hist, 0, sizeof(hist));
+	for (j = 0; j < nthr; j++) {
+		ops += t[j].ops;
+		bytes += t[j].bytes;
+		errs += t[j].errs;
+		stalls += t[j].stalls;
+		if (t[j].max_ns > max_ns)
+			max_ns = t[j].max_ns;
+		for (b = 0; b < LG_NBUCKETS; b++)
+			hist[b] += t[j].hist[b];
+	}
+	printf("%-7s (%3d thr): %10llu ops %12.0f ops/s %9.2f MB/s  errs %llu stalls %llu\n",
+	       role, nthr, (unsigned long long)ops, ops / secs,
+	       bytes / secs / (1024 * 1024), (unsigned long long)errs,
+	       (unsigned long long)stalls);
+	if (!ops)
+		return;
+	printf("         latency (ns):");
+	for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+		uint64_t want = (uint64_t)(ops * pcts[i] / 100.0 + 0.5);
+
+		if (!want)
+			want = 1;
+		for (b = 0, cum = 0; b < LG_NBUCKETS; b++) {
+			cum += hist[b];
+			if (cum >= want)
+				break;
+		}
+		printf(" p%g<=%llu", pcts[i], (unsigned long long)lg_bucket_max(b));
+	}
+	printf(" max=%llu\n", (unsigned long long)max_ns);
+}
+
+static int loadgen(const char *prg, const char *devfile, int argc, char **argv)
+{
+	int nrd = 1, nwr = 1, secs = 5, ncpus = 0, opt, i, ret = EXIT_SUCCESS;
+	static int cpus[LG_MAXCPUS];
+	struct llkd_miscdrv_stats st0, st1;
+	size_t recsz = MAXBYTES;
+	struct lg_thread *thr;
+	uint64_t t0, elapsed;
+	int have_stats;
+
+	optind = 1;
+	while ((opt = getopt(argc, argv, "r:w:s:d:c:")) != -1) {
+		switch (opt) {
+		case 'r':
+			nrd = atoi(optarg);
+			break;
+		case 'w':
+			nwr = atoi(optarg);
+			break;
+		case 's':
+			recsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			secs = atoi(optarg);
+			break;
+		case 'c':
+			ncpus = parse_cpulist(optarg, cpus, LG_MAXCPUS);
+			if (ncpus <= 0) {
+				fprintf(stderr, "%s: bad cpulist \"%s\"\n", prg, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage((char *)prg);
+			return EXIT_FAILURE;
+		}
+	}
+	if (nrd < 0 || nwr < 0 || nrd + nwr == 0 || nrd + nwr > LG_MAXTHREADS ||
+	    secs <= 0 || !recsz) {
+		fprintf(stderr, "%s: need 1..%d threads in all, a duration and a"
+			" record size > 0\n", prg, LG_MAXTHREADS);
+		return EXIT_FAILURE;
+	}
+
+	thr = aligned_alloc(64, sizeof(*thr) * (nrd + nwr));
+	if (!thr) {
+		fprintf(stderr, "%s: out of memory!\n", prg);
+		return EXIT_FAILURE;
+	}
+	memset(thr, 0, sizeof(*thr) * (nrd + nwr));
+	have_stats = !get_stats(devfile, &st0);
+
+	printf("%s: load: %d reader(s), %d writer(s), %zu-byte records, %d s, %s\n",
+	       prg, nrd, nwr, recsz, secs, ncpus ? "pinned" : "not pinned");
+	t0 = now_ns();
+	for (i = 0; i < nrd + nwr; i++) {
+		struct lg_thread *t = &thr[i];
+
+		t->id = i;
+		t->writer = i >= nrd;
+		t->cpu = ncpus ? cpus[i % ncpus] : -1;
+		t->devfile = devfile;
+		t->recsz = recsz;
+		if (pthread_create(&t->tid, NULL, lg_worker, t)) {
+			fprintf(stderr, "%s: pthread_create failed\n", prg);
+			lg_stop = 1;
+			while (--i >= 0)
+				pthread_join(thr[i].tid, NULL);
+			free(thr);
+			return EXIT_FAILURE;
+		}
+	}
+	sleep(secs);
+	lg_stop = 1;
+	for (i = 0; i < nrd + nwr; i++) {
+		pthread_join(thr[i].tid, NULL);
+		if (thr[i].fatal)
+			ret = EXIT_FAILURE;
+	}
+	elapsed = now_ns() - t0;
+
+	lg_report("readers", thr, nrd, elapsed);
+	lg_report("writers", thr + nrd, nwr, elapsed);
+	if (have_stats && !get_stats(devfile, &st1))
+		printf("driver: tx +%llu rx +%llu err +%llu bytes\n",
+		       (unsigned long long)(st1.tx - st0.tx),
+		       (unsigned long long)(st1.rx - st0.rx),
+		       (unsigned long long)(st1.err - st0.err));
+	free(thr);
+	return ret;
+}
+
+/*
+ * mmap_drain()
+ * Map the ring control page and the ring data pages, consume (and display)
+ * all the data currently available in the ring, then publish the new 'tail'
+ * so the producer can reuse the space - all without a single read(2).
+ */
+static int mmap_drain(const char *prg, const char *devfile)
+{
+	long pgsz = sysconf(_SC_PAGESIZE);
+	struct llkd_ring_ctl *ctl;
+	unsigned int head, tail, pos, n;
+	size_t maplen;
+	char *data;
+	int fd;
+
+	if ((fd = open(devfile, O_RDWR, 0)) == -1) {
+		fprintf(stderr, "%s: open(2) on %s failed\n", prg, devfile);
+		perror("open");
+		return EXIT_FAILURE;
+	}
+	/* First map just the control page, to learn the ring size */
+	ctl = mmap(NULL, pgsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		   LLKD_RING_CTL_PGOFF * pgsz);
+	if (ctl == MAP_FAILED) {
+		perror("mmap (ctl page) failed");
+		fprintf(stderr, "Tip: is the driver in 'ring' mode? see kernel log\n");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	maplen = ctl->size;
+	data = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd,
+		    LLKD_RING_DATA_PGOFF * pgsz);
+	if (data == MAP_FAILED) {
+		perror("mmap (data pages) failed");
+		munmap(ctl, pgsz);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	printf("%s: ring of %u bytes mapped @ %p (ctl page @ %p)\n",
+		prg, ctl->size, data, ctl);
+
+	head = __atomic_load_n(&ctl->head, __ATOMIC_ACQUIRE);
+	tail = ctl->tail;
+	printf("%s: %u bytes available (head=%u tail=%u):\n",
+		prg, head - tail, head, tail);
+	while (tail != head) {
+		pos = tail & ctl->mask;
+		n = head - tail;
+		if (n > ctl->size - pos)
+			n = ctl->size - pos;
+		(void)!write(STDOUT_FILENO, data + pos, n);
+		tail += n;
+	}
+	__atomic_store_n(&ctl->tail, tail, __ATOMIC_RELEASE);
+	(void)!read(fd, NULL, 0);	/* wake up any blocked writer */
+	printf("\n");
+
+	munmap(data, maplen);
+	munmap(ctl, pgsz);
+	close(fd);
+	return EXIT_SUCCESS;
+}
+
+/* show_stats(): retrieve the driver statistics via our GETSTATS ioctl */
+static int show_stats(const char *prg, const char *devfile)
+{
+	struct llkd_miscdrv_stats st;
+	int fd;
+
+	if ((fd = open(devfile, O_RDONLY, 0)) == -1) {
+		fprintf(stderr, "%s: open(2) on %s failed\n", prg, devfile);
+		perror("open");
+		return EXIT_FAILURE;
+	}
+	if (ioctl(fd, IOCTL_LLKD_MISCDRV_GETSTATS, &st) == -1) {
+		perror("ioctl IOCTL_LLKD_MISCDRV_GETSTATS failed");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	printf("%s: driver stats: tx=%llu rx=%llu err=%llu\n", prg,
+		(unsigned long long)st.tx, (unsigned long long)st.rx,
+		(unsigned long long)st.err);
+	close(fd);
+	return EXIT_SUCCESS;
 }
 
 int main(int argc, char **argv)
@@ -55,6 +461,17 @@ int main(int argc, char **argv)
 	}
 
 	opt = argv[1][0];
+	if (opt == 'l')
+		exit(loadgen(argv[0], argv[2], argc - 2, argv + 2));
+	if (opt == 'm' || opt == 's') {
+		if (argc != 3) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (opt == 'm')
+			exit(mmap_drain(argv[0], argv[2]));
+		exit(show_stats(argv[0], argv[2]));
+	}
 	if (opt != 'r' && opt != 'w') {
 		usage(argv[0]);
 		exit(EXIT_FAILURE);
@@ -6,6 +6,11 @@
  * This code is part of a quick demo of using the ioctl() method in a Linux
  * device driver / kernel module.
  */
+#ifndef __IOCTL_LLKD_H__
+#define __IOCTL_LLKD_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
 
 /* The 'magic' number for our driver; see
  * Documentation/ioctl/ioctl-number.rst 
@@ -15,7 +20,7 @@
  */
 #define IOCTL_LLKD_MAGIC		0xA8
 
-#define	IOCTL_LLKD_MAXIOCTL		3
+#define	IOCTL_LLKD_MAXIOCTL		5
 /*
  * The _IO{R|W}() macros can be summarized as follows:
 _IO(type,nr)                  ioctl command with no argument
@@ -31,3 +36,101 @@ _IOWR(type,nr,datatype)       ioctl command for read/write transfers
 
 /* our dummy ioctl (IOC) Set POWER command */
 #define IOCTL_LLKD_IOCSPOWER		_IOW(IOCTL_LLKD_MAGIC, 2, int)
+
+/*
+ * our ioctl (IOC) BATCH command: execute a whole array of the above
+ * commands in one go. The array is copied in once, all it's entries are
+ * executed in order, and the results are copied back once. Each entry gets
+ * it's own status (0 or -errno); a failed entry doesn't stop the batch.
+ * On return, ndone is the # of entries that succeeded. The ioctl itself
+ * fails only if the array can't be accessed (-EFAULT), is too large
+ * (-E2BIG; max LLKD_IOC_BATCH_MAX entries) or on a fatal signal (-EINTR).
+ * Nesting (IOCTL_LLKD_IOCBATCH as an entry) isn't allowed (-EINVAL).
+ */
+#define LLKD_IOC_BATCH_MAX		256
+
+struct llkd_ioc_ent {
+	__u32 cmd;		/* in: IOCTL_LLKD_IOC{RESET|QPOWER|SPOWER} */
+	__s32 status;		/* out: 0 or -errno */
+	__u64 arg;		/* in: the command's argument (SPOWER: the value;
+				 * ignored for QPOWER) */
+	__s64 result;		/* out: the command's result (QPOWER: the power
+				 * state), else 0 */
+};
+
+struct llkd_ioc_batch {
+	__u64 ents;		/* user virtual address of the array */
+	__u32 nents;
+	__u32 ndone;		/* out */
+};
+#define IOCTL_LLKD_IOCBATCH		_IOWR(IOCTL_LLKD_MAGIC, 3, struct llkd_ioc_batch)
+
+/*
+ * Asynchronous submission, io_uring style: a submission queue (SQ) ring of
+ * struct llkd_sqe's and a completion queue (CQ) ring of struct llkd_cqe's, in
+ * memory shared between the driver and the app.
+ *  1. IOCTL_LLKD_IOCRSETUP (once per open file) creates the rings; the
+ *     params are rounded up to powers of 2 and tell you the layout.
+ *  2. mmap(2) ring_size bytes at offset 0; there's a struct llkd_ring_hdr at
+ *     the start, the SQE array at sqes_off and the CQE array at cqes_off.
+ *  3. Submit: fill in sqes[sq_tail & sq_mask], then store-release the
+ *     incremented sq_tail and issue IOCTL_LLKD_IOCRENTER (optionally
+ *     waiting for min_complete completions to be pending in the CQ).
+ *  4. Reap: when cq_head != cq_tail (load-acquire cq_tail; poll(2)/epoll
+ *     report POLLIN), consume cqes[cq_head & cq_mask], then store-release
+ *     the incremented cq_head.
+ * The app owns (writes) sq_tail and cq_head, the driver sq_head and cq_tail.
+ * Commands execute concurrently on kernel workers, so they complete in
+ * whatever order they finish; match them up via user_data. The driver
+ * never has more commands in flight than there's free CQ space for, so the
+ * CQ can't overflow; IOCTL_LLKD_IOCRENTER submits fewer (or fails with
+ * -EBUSY) when the CQ's full - reap and retry.
+ */
+#define LLKD_RING_DEF_ENTRIES		64
+#define LLKD_RING_MAX_ENTRIES		4096
+
+struct llkd_ring_params {
+	__u32 sq_entries;	/* in: requested (0 => default), out: actual */
+	__u32 cq_entries;	/* in: requested (0 => 2 * sq_entries), out: actual */
+	__u32 ring_size;	/* out: bytes to mmap(2) */
+	__u32 sqes_off;		/* out: offset of the SQE array */
+	__u32 cqes_off;		/* out: offset of the CQE array */
+	__u32 resv[3];
+};
+
+struct llkd_ring_hdr {
+	__u32 sq_head;		/* driver: next SQE to consume */
+	__u32 sq_tail;		/* app: next SQE to fill */
+	__u32 sq_mask;
+	__u32 sq_entries;
+	__u32 cq_head;		/* app: next CQE to consume */
+	__u32 cq_tail;		/* driver: next CQE to fill */
+	__u32 cq_mask;
+	__u32 cq_entries;
+};
+
+struct llkd_sqe {
+	__u64 user_data;	/* passed back as is in the CQE */
+	__u64 arg;		/* the command's argument */
+	__u32 cmd;		/* IOCTL_LLKD_IOC{RESET|QPOWER|SPOWER} */
+	__u32 flags;		/* must be 0 */
+};
+
+struct llkd_cqe {
+	__u64 user_data;
+	__s64 result;		/* the command's result (QPOWER: the power state) */
+	__s32 status;		/* 0 or -errno */
+	__u32 resv;
+};
+
+struct llkd_ring_enter {
+	__u32 to_submit;	/* in: # of SQEs to consume (at most) */
+	__u32 min_complete;	/* in: wait till this many CQEs are pending */
+	__u32 submitted;	/* out */
+	__u32 resv;
+};
+
+#define IOCTL_LLKD_IOCRSETUP		_IOWR(IOCTL_LLKD_MAGIC, 4, struct llkd_ring_params)
+#define IOCTL_LLKD_IOCRENTER		_IOWR(IOCTL_LLKD_MAGIC, 5, struct llkd_ring_enter)
+
+#endif
@@ -6,12 +6,36 @@
  * Architected as a simple device driver for a fictional 'device'; we use
  * the ioctl(2) system call to interface with the device from/to a usermode
  * 'C' application.
+ * Every ioctl command dispatched is visible via the ioctl_llkd:ioctl_llkd_cmd
+ * tracepoint (see ioctl_llkd_trace.h).
+ * Besides the one-command-per-syscall ioctl's, IOCTL_LLKD_IOCBATCH executes a
+ * whole array of them with a single syscall, and the IOCTL_LLKD_IOCR{SETUP|
+ * ENTER} pair provides asynchronous submission via mmap'ed submission and
+ * completion rings: the commands run concurrently on our workqueue and the
+ * app reaps their completions (poll(2)/epoll can wait for them); see
+ * ioctl_llkd.h.
+ * With callers=1, we keep per calling process counts of the ioctl's issued
+ * (and failed), looked up lock-free on every ioctl in our klib's llkd_tctx
+ * table; see <debugfs_mount>/ioctl_llkd_kdrv/callers.
  */
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/fs.h>
 #include <linux/ioctl.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/sched/signal.h>
+#include <linux/delay.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
 
 //--- copy_[to|from]_user()
 #include <linux/version.h>
@@ -23,6 +47,9 @@
 
 #include "../ioctl_llkd.h"
 #include "../../../convenient.h"
+#include "../../../klib_llkd.h"
+#define CREATE_TRACE_POINTS
+#include "ioctl_llkd_trace.h"
 
 #define OURMODNAME   "ioctl_llkd_kdrv"
 MODULE_AUTHOR("<insert name here>");
@@ -34,94 +61,504 @@ MODULE_VERSION("0.1");
 static int ioctl_intf_major = 0,
 	power = 1; /* 'powered on' by default */
 
-/* 
- * The key method - the ioctl - for our demo driver; note how we take into
- * account the fact that the ioctl's signtaure changed from 2.6.36 (as the
- * BKL was finally removed).
- */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,36)
-static long ioctl_intf_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
-#else
-static int ioctl_intf_ioctl(struct inode *ino, struct file *filp, unsigned int cmd,
-		     unsigned long arg)
-#endif
-{
-	int retval = 0;
+static uint devop_delay_us;
+module_param(devop_delay_us, uint, 0644);
+MODULE_PARM_DESC(devop_delay_us,
+ "Simulated device latency of the RESET and SPOWER commands, in us (default=0)");
 
-	MSG("In ioctl method, cmd=%d\n", _IOC_NR(cmd));
+static bool callers;
+module_param(callers, bool, 0444);
+MODULE_PARM_DESC(callers,
+ "Keep per calling process ioctl counts, in <debugfs_mount>/" OURMODNAME
+ "/callers (default 0)");
 
-	/* Verify stuff: is the ioctl's for us? etc.. */
-	if (_IOC_TYPE(cmd) != IOCTL_LLKD_MAGIC) {
-		pr_info("ioctl fail; magic # mismatch\n");
-		return -ENOTTY;
-	}
-	if (_IOC_NR(cmd) > IOCTL_LLKD_MAXIOCTL) {
-		pr_info("ioctl fail; invalid cmd?\n");
-		return -ENOTTY;
-	}
+static struct workqueue_struct *gwq;	/* runs the async (ring) commands */
+
+/* Per calling process state (callers=1); see llkd_tctx in klib_llkd.c */
+struct caller_ctx {
+	atomic64_t ncmds, nerrs;	/* the process' threads all update them */
+	atomic_t last_cmd;		/* _IOC_NR() of the latest */
+};
+static struct llkd_tctx_table *gcallers;
+static struct dentry *gparent;
+
+/*
+ * Per open file: the (optional) async rings. The shared memory is
+ * untrusted; we only ever read the fields the app owns (sq_tail, cq_head)
+ * from it, keeping our own (authoritative) copies of sq_head and cq_tail.
+ */
+struct ioctl_file {
+	struct mutex mtx;		/* serializes setup and submission */
+	spinlock_t lock;		/* protects cq_tail, inflight */
+	wait_queue_head_t wq;		/* completions */
+	void *ring;			/* vmalloc_user()'ed: hdr, SQEs, CQEs */
+	size_t ring_size;
+	struct llkd_ring_hdr *hdr;
+	struct llkd_sqe *sqes;
+	struct llkd_cqe *cqes;
+	u32 sq_entries, cq_entries;
+	u32 sq_head, cq_tail;
+	u32 inflight;
+};
 
+struct ring_req {
+	struct work_struct work;
+	struct ioctl_file *f;
+	u64 user_data, arg;
+	u32 cmd, flags;
+	bool admin;		/* captured at submit time, in the app's context */
+};
+
+/*
+ * Carry out one (non-batch) command; the result, if any (QPOWER), is placed
+ * in *@result. Doesn't touch user memory, so that it serves both the single
+ * ioctl's and the batched ones. @admin tells us if the caller's privileged.
+ */
+static int ioctl_do_cmd(unsigned int cmd, unsigned long arg, bool admin,
+			s64 *result)
+{
+	*result = 0;
 	switch (cmd) {
 	case IOCTL_LLKD_IOCRESET:
 		MSG("In ioctl cmd option: IOCTL_LLKD_IOCRESET\n");
 		/* ... Insert the code here to write to a control register to reset the
 		 * device ... */
-		break;
-	case IOCTL_LLKD_IOCQPOWER:	/* Get: arg is pointer to result */
+		if (devop_delay_us)
+			usleep_range(devop_delay_us, devop_delay_us + 1);
+		return 0;
+	case IOCTL_LLKD_IOCQPOWER:	/* Get: the result's the power state */
 		MSG("In ioctl cmd option: IOCTL_LLKD_IOCQPOWER\n"
 			"arg=0x%x (drv) power=%d\n", (unsigned int)arg, power);
-		if (!capable(CAP_SYS_ADMIN))
+		if (!admin)
 			return -EPERM;
 		/* ... Insert the code here to read a status register to query the
 		 * power state of the device ...
 		 * here, imagine we've done that and placed it into a variable 'power'
 		 */
-		retval = __put_user(power, (int __user *)arg);
-		break;
+		*result = power;
+		return 0;
 	case IOCTL_LLKD_IOCSPOWER:	/* Set: arg is the value to set */
-		if (!capable(CAP_SYS_ADMIN))
+		if (!admin)
 			return -EPERM;
 		power = arg;
 		/* ... Insert the code here to write a control register to set the
 		 * power state of the device ...
 		 */
+		if (devop_delay_us)
+			usleep_range(devop_delay_us, devop_delay_us + 1);
 		MSG("In ioctl cmd option: IOCTL_LLKD_IOCSPOWER\n"
 			"power=%d now.\n", power);
-		break;
-	default:
-		return -ENOTTY;
+		return 0;
+	}
+	return -ENOTTY;
+}
+
+/*
+ * IOCTL_LLKD_IOCBATCH: copy the whole array in, run the commands, and copy
+ * the results back out; two user copies instead of a syscall per command.
+ * Every entry's still dispatched (and traced) individually.
+ */
+static long ioctl_do_batch(unsigned long arg)
+{
+	struct llkd_ioc_batch __user *ubatch = (struct llkd_ioc_batch __user *)arg;
+	struct llkd_ioc_batch batch;
+	struct llkd_ioc_ent *ents;
+	bool admin = capable(CAP_SYS_ADMIN);
+	long retval = 0;
+	u32 i, ndone = 0;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (batch.nents > LLKD_IOC_BATCH_MAX)
+		return -E2BIG;
+	if (!batch.nents)
+		goto out;
+
+	ents = memdup_user(u64_to_user_ptr(batch.ents),
+			   batch.nents * sizeof(*ents));
+	if (IS_ERR(ents))
+		return PTR_ERR(ents);
+
+	for (i = 0; i < batch.nents; i++) {
+		struct llkd_ioc_ent *e = &ents[i];
+
+		if (fatal_signal_pending(current)) {
+			retval = -EINTR;
+			break;
+		}
+		if (e->cmd == IOCTL_LLKD_IOCBATCH) {
+			e->status = -EINVAL;
+			e->result = 0;
+		} else
+			e->status = ioctl_do_cmd(e->cmd, e->arg, admin, &e->result);
+		trace_ioctl_llkd_cmd(e->cmd, e->arg, e->status);
+		if (!e->status)
+			ndone++;
 	}
+
+	/* on -EINTR, still copy back what we did get done */
+	if (copy_to_user(u64_to_user_ptr(batch.ents), ents, i * sizeof(*ents)))
+		retval = -EFAULT;
+	kfree(ents);
+ out:
+	if (put_user(ndone, &ubatch->ndone))
+		retval = -EFAULT;
 	return retval;
 }
 
-static struct file_operations ioctl_intf_fops = {
-	.llseek = no_llseek,
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 36)
-	.unlocked_ioctl = ioctl_intf_ioctl,	// use the 'unlocked' version
+/*------------------ the async submission / completion rings ---------------*/
+static inline u32 cq_pending(struct ioctl_file *f)
+{
+	u32 n = f->cq_tail - READ_ONCE(f->hdr->cq_head);
+
+	/* a bogus cq_head from the app: treat the CQ as full */
+	return n > f->cq_entries ? f->cq_entries : n;
+}
+
+static void ring_req_work(struct work_struct *work)
+{
+	struct ring_req *req = container_of(work, struct ring_req, work);
+	struct ioctl_file *f = req->f;
+	struct llkd_cqe *cqe;
+	s64 result = 0;
+	int status;
+
+	if (req->flags)
+		status = -EINVAL;
+	else
+		status = ioctl_do_cmd(req->cmd, req->arg, req->admin, &result);
+	trace_ioctl_llkd_cmd(req->cmd, req->arg, status);
+
+	spin_lock(&f->lock);
+	/* submission guarantees there's room: inflight + pending <= cq_entries */
+	cqe = &f->cqes[f->cq_tail & (f->cq_entries - 1)];
+	WRITE_ONCE(cqe->user_data, req->user_data);
+	WRITE_ONCE(cqe->result, result);
+	WRITE_ONCE(cqe->status, status);
+	/* the CQE must be visible before the new tail is */
+	smp_store_release(&f->hdr->cq_tail, ++f->cq_tail);
+	f->inflight--;
+	/* wake under the lock: release() syncs on it before freeing f */
+	wake_up_all(&f->wq);
+	spin_unlock(&f->lock);
+	kfree(req);
+}
+
+static long ioctl_ring_setup(struct ioctl_file *f, unsigned long arg)
+{
+	struct llkd_ring_params __user *uparams = (struct llkd_ring_params __user *)arg;
+	struct llkd_ring_params p;
+	size_t sqes_off, cqes_off, sz;
+	long retval = 0;
+	void *ring;
+
+	if (copy_from_user(&p, uparams, sizeof(p)))
+		return -EFAULT;
+	if (!p.sq_entries)
+		p.sq_entries = LLKD_RING_DEF_ENTRIES;
+	if (!p.cq_entries)
+		p.cq_entries = 2 * p.sq_entries;
+	if (p.sq_entries > LLKD_RING_MAX_ENTRIES || p.cq_entries > 2 * LLKD_RING_MAX_ENTRIES)
+		return -EINVAL;
+	p.sq_entries = roundup_pow_of_two(p.sq_entries);
+	p.cq_entries = roundup_pow_of_two(p.cq_entries);
+
+	sqes_off = ALIGN(sizeof(struct llkd_ring_hdr), SMP_CACHE_BYTES);
+	cqes_off = ALIGN(sqes_off + p.sq_entries * sizeof(struct llkd_sqe),
+			 SMP_CACHE_BYTES);
+	sz = PAGE_ALIGN(cqes_off + p.cq_entries * sizeof(struct llkd_cqe));
+
+	mutex_lock(&f->mtx);
+	if (f->ring) {
+		retval = -EBUSY;
+		goto out_unlock;
+	}
+	ring = vmalloc_user(sz);	/* zeroed, and fit for remap_vmalloc_range() */
+	if (!ring) {
+		retval = -ENOMEM;
+		goto out_unlock;
+	}
+	p.ring_size = sz;
+	p.sqes_off = sqes_off;
+	p.cqes_off = cqes_off;
+	memset(p.resv, 0, sizeof(p.resv));
+	if (copy_to_user(uparams, &p, sizeof(p))) {
+		vfree(ring);
+		retval = -EFAULT;
+		goto out_unlock;
+	}
+
+	f->hdr = ring;
+	f->hdr->sq_mask = p.sq_entries - 1;
+	f->hdr->sq_entries = p.sq_entries;
+	f->hdr->cq_mask = p.cq_entries - 1;
+	f->hdr->cq_entries = p.cq_entries;
+	f->sqes = ring + sqes_off;
+	f->cqes = ring + cqes_off;
+	f->sq_entries = p.sq_entries;
+	f->cq_entries = p.cq_entries;
+	f->ring_size = sz;
+	/* publish last: mmap and poll go by f->ring */
+	smp_store_release(&f->ring, ring);
+	MSG("rings set up: %u SQEs, %u CQEs, %zu bytes\n",
+		p.sq_entries, p.cq_entries, sz);
+ out_unlock:
+	mutex_unlock(&f->mtx);
+	return retval;
+}
+
+/*
+ * Consume up to to_submit new SQEs and queue them up on our workqueue; we
+ * copy each SQE out of the shared memory (and validate the copy) first, as
+ * the app can scribble on it at any time. Then optionally wait for
+ * min_complete CQEs.
+ */
+static long ioctl_ring_enter(struct ioctl_file *f, unsigned long arg)
+{
+	struct llkd_ring_enter __user *uenter = (struct llkd_ring_enter __user *)arg;
+	struct llkd_ring_enter e;
+	bool admin = capable(CAP_SYS_ADMIN);
+	u32 sq_tail, avail, n = 0;
+	long retval = 0;
+
+	if (copy_from_user(&e, uenter, sizeof(e)))
+		return -EFAULT;
+
+	mutex_lock(&f->mtx);
+	if (!f->ring) {
+		mutex_unlock(&f->mtx);
+		return -ENXIO;
+	}
+	/* pairs with the app's store-release of sq_tail: SQEs first */
+	sq_tail = smp_load_acquire(&f->hdr->sq_tail);
+	avail = min3(e.to_submit, sq_tail - f->sq_head, f->sq_entries);
+
+	for (n = 0; n < avail; n++) {
+		struct llkd_sqe *sqe = &f->sqes[f->sq_head & (f->sq_entries - 1)];
+		struct ring_req *req;
+		bool full;
+
+		req = kmalloc(sizeof(*req), GFP_KERNEL);
+		if (!req) {
+			retval = -ENOMEM;
+			break;
+		}
+		spin_lock(&f->lock);
+		full = f->inflight + cq_pending(f) >= f->cq_entries;
+		if (!full)
+			f->inflight++;
+		spin_unlock(&f->lock);
+		if (full) {
+			kfree(req);
+			retval = -EBUSY;
+			break;
+		}
+
+		INIT_WORK(&req->work, ring_req_work);
+		req->f = f;
+		req->user_data = READ_ONCE(sqe->user_data);
+		req->arg = READ_ONCE(sqe->arg);
+		req->cmd = READ_ONCE(sqe->cmd);
+		req->flags = READ_ONCE(sqe->flags);
+		req->admin = admin;
+		f->sq_head++;
+		queue_work(gwq, &req->work);
+	}
+	/* the SQ slots are free for the app to reuse */
+	smp_store_release(&f->hdr->sq_head, f->sq_head);
+	mutex_unlock(&f->mtx);
+
+	if (n)
+		retval = 0;	/* partial submission isn't an error */
+	if (!retval && e.min_complete) {
+		if (wait_event_interruptible(f->wq,
+				cq_pending(f) >= min(e.min_complete, f->cq_entries)))
+			retval = -EINTR;
+	}
+	if (put_user(n, &uenter->submitted))
+		retval = -EFAULT;
+	return retval;
+}
+
+static __poll_t ioctl_intf_poll(struct file *filp, poll_table *wait)
+{
+	struct ioctl_file *f = filp->private_data;
+	__poll_t mask = 0;
+
+	if (!smp_load_acquire(&f->ring))
+		return EPOLLERR;
+	poll_wait(filp, &f->wq, wait);
+	spin_lock(&f->lock);
+	if (cq_pending(f))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	spin_unlock(&f->lock);
+	return mask;
+}
+
+static int ioctl_intf_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ioctl_file *f = filp->private_data;
+
+	if (!smp_load_acquire(&f->ring))
+		return -ENXIO;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > f->ring_size)
+		return -EINVAL;
+	/* the mapping holds a reference to the file, so the ring stays put */
+	return remap_vmalloc_range(vma, f->ring, 0);
+}
+
+/* 
+ * The key method - the ioctl - for our demo driver; note how we take into
+ * account the fact that the ioctl's signtaure changed from 2.6.36 (as the
+ * BKL was finally removed).
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,36)
+static long ioctl_intf_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 #else
-	.ioctl = ioctl_intf_ioctl,   // 'old' way
+static int ioctl_intf_ioctl(struct inode *ino, struct file *filp, unsigned int cmd,
+		     unsigned long arg)
 #endif
+{
+	long retval = 0;
+	s64 result;
+
+	MSG("In ioctl method, cmd=%d\n", _IOC_NR(cmd));
+
+	/* Verify stuff: is the ioctl's for us? etc.. */
+	if (_IOC_TYPE(cmd) != IOCTL_LLKD_MAGIC) {
+		pr_info("ioctl fail; magic # mismatch\n");
+		retval = -ENOTTY;
+		goto out;
+	}
+	if (_IOC_NR(cmd) > IOCTL_LLKD_MAXIOCTL) {
+		pr_info("ioctl fail; invalid cmd?\n");
+		retval = -ENOTTY;
+		goto out;
+	}
+
+	switch (cmd) {
+	case IOCTL_LLKD_IOCBATCH:
+		retval = ioctl_do_batch(arg);
+		goto out;
+	case IOCTL_LLKD_IOCRSETUP:
+		retval = ioctl_ring_setup(filp->private_data, arg);
+		goto out;
+	case IOCTL_LLKD_IOCRENTER:
+		retval = ioctl_ring_enter(filp->private_data, arg);
+		goto out;
+	}
+	retval = ioctl_do_cmd(cmd, arg, capable(CAP_SYS_ADMIN), &result);
+	if (!retval && cmd == IOCTL_LLKD_IOCQPOWER)	/* Get: arg is pointer to result */
+		retval = put_user((int)result, (int __user *)arg);
+ out:
+	trace_ioctl_llkd_cmd(cmd, arg, retval);
+	if (gcallers) {
+		struct caller_ctx *cc = llkd_tctx_get(gcallers, GFP_KERNEL);
+
+		if (likely(cc)) {
+			atomic64_inc(&cc->ncmds);
+			if (retval < 0)
+				atomic64_inc(&cc->nerrs);
+			atomic_set(&cc->last_cmd, _IOC_NR(cmd));
+		}
+	}
+	return retval;
+}
+
+static void caller_show(struct seq_file *m, pid_t tgid, void *data)
+{
+	struct caller_ctx *cc = data;
+
+	seq_printf(m, "%d %lld %lld %d\n", tgid, atomic64_read(&cc->ncmds),
+		   atomic64_read(&cc->nerrs), atomic_read(&cc->last_cmd));
+}
+
+static int callers_show(struct seq_file *m, void *v)
+{
+	seq_puts(m, "# tgid ioctls failed last_cmd\n");
+	llkd_tctx_show(m, gcallers, caller_show);
+	return 0;
+}
+
+static int callers_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, callers_show, NULL);
+}
+
+static const struct file_operations callers_fops = {
+	.open = callers_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
+/* The per-caller table and it's debugfs file; returns 0 or -errno */
+static int callers_setup(void)
+{
+	gcallers = llkd_tctx_create(OURMODNAME "_callers",
+			sizeof(struct caller_ctx), LLKD_TCTX_TGID, NULL);
+	if (!gcallers)
+		return -ENOMEM;
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("callers", 0444, gparent, NULL,
+					       &callers_fops)))
+		pr_notice("%s: couldn't setup the debugfs 'callers' file\n",
+			OURMODNAME);	/* not fatal */
+	return 0;
+}
+
+static void callers_cleanup(void)
+{
+	debugfs_remove_recursive(gparent);
+	llkd_tctx_destroy(gcallers);
+}
+
 static int ioctl_intf_open(struct inode *inode, struct file *filp)
 {
+	struct ioctl_file *f;
+
 	MSG("Device node with minor # %d being used\n", iminor(inode));
 
-	switch (iminor(inode)) {
-	case 0:
-		filp->f_op = &ioctl_intf_fops;
-		break;
-	default:
+	/* just the one 'device': minor # 0 */
+	if (iminor(inode) != 0)
 		return -ENXIO;
-	}
-	if (filp->f_op && filp->f_op->open)
-		return filp->f_op->open(inode, filp);	/* Minor-specific open */
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+	mutex_init(&f->mtx);
+	spin_lock_init(&f->lock);
+	init_waitqueue_head(&f->wq);
+	filp->private_data = f;
+	return 0;
+}
+
+static int ioctl_intf_release(struct inode *inode, struct file *filp)
+{
+	struct ioctl_file *f = filp->private_data;
 
+	/* commands still in flight reference f: let them complete */
+	wait_event(f->wq, READ_ONCE(f->inflight) == 0);
+	/* ... and the last one get out of it's critical section (the wakeup) */
+	spin_lock(&f->lock);
+	spin_unlock(&f->lock);
+	vfree(f->ring);
+	kfree(f);
 	return 0;
 }
 
-/* Major-wide open routine */
-static struct file_operations ioctl_intf_open_fops = {
-	.open = ioctl_intf_open,	/* just a means to get at the real open */
+static const struct file_operations ioctl_intf_fops = {
+	.owner = THIS_MODULE,
+	.open = ioctl_intf_open,
+	.release = ioctl_intf_release,
+	.poll = ioctl_intf_poll,
+	.mmap = ioctl_intf_mmap,
+	.llseek = no_llseek,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 36)
+	.unlocked_ioctl = ioctl_intf_ioctl,	// use the 'unlocked' version
+#else
+	.ioctl = ioctl_intf_ioctl,   // 'old' way
+#endif
 };
 
 static int __init ioctl_llkd_kdrv_init(void)
@@ -130,14 +567,28 @@ static int __init ioctl_llkd_kdrv_init(void)
 
 	MSG("ioctl_intf_major=%d\n", ioctl_intf_major);
 
+	/* unbound: the (possibly long-running) async commands run concurrently */
+	gwq = alloc_workqueue("%s", WQ_UNBOUND, 0, OURMODNAME);
+	if (!gwq)
+		return -ENOMEM;
+	if (callers) {
+		result = callers_setup();
+		if (result) {
+			destroy_workqueue(gwq);
+			return result;
+		}
+	}
+
 	/*
 	 * Register the major, and accept a dynamic number.
 	 * The return value is the actual major # assigned.
 	 */
-	result = register_chrdev(ioctl_intf_major, OURMODNAME, &ioctl_intf_open_fops);
+	result = register_chrdev(ioctl_intf_major, OURMODNAME, &ioctl_intf_fops);
 	if (result < 0) {
 		pr_info("register_chrdev() failed trying to get ioctl_intf_major=%d\n",
 		    ioctl_intf_major);
+		callers_cleanup();
+		destroy_workqueue(gwq);
 		return result;
 	}
 
@@ -152,6 +603,8 @@ static int __init ioctl_llkd_kdrv_init(void)
 static void ioctl_llkd_kdrv_cleanup(void)
 {
 	unregister_chrdev(ioctl_intf_major, OURMODNAME);
+	callers_cleanup();
+	destroy_workqueue(gwq);
 	pr_info("%s removed\n", OURMODNAME);
 }
 
@@ -0,0 +1,44 @@
+/*
+ * ioctl_llkd_trace.h
+ *
+ * Tracepoints for the ioctl_llkd_kdrv driver.
+ * When nothing is attached, the tracepoint costs just a NOP (it's gated by a
+ * static key); attach via ftrace, perf or eBPF, f.e.:
+ *  echo 1 > /sys/kernel/debug/tracing/events/ioctl_llkd/enable
+ *  perf record -e 'ioctl_llkd:*' -a
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ioctl_llkd
+
+#if !defined(_IOCTL_LLKD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _IOCTL_LLKD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* ioctl command dispatch: the command, it's argument and the result */
+TRACE_EVENT(ioctl_llkd_cmd,
+	TP_PROTO(unsigned int cmd, unsigned long arg, long ret),
+	TP_ARGS(cmd, arg, ret),
+	TP_STRUCT__entry(
+		__field(unsigned int, cmd)
+		__field(unsigned long, arg)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->arg = arg;
+		__entry->ret = ret;
+	),
+	TP_printk("cmd=0x%x (nr %u) arg=0x%lx ret=%ld",
+		  __entry->cmd, _IOC_NR(__entry->cmd), __entry->arg,
+		  __entry->ret)
+);
+
+#endif /* _IOCTL_LLKD_TRACE_H */
+
+/* This part must be outside the multi-read protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ioctl_llkd_trace
+#include <trace/define_trace.h>
@@ -1,7 +1,14 @@
 /*
  * ioctl_llkd_userspace.c
+ *
+ * Usage: ioctl_llkd_userspace device_file [bench-iterations]
+ * With bench-iterations, we also time a burst of LLKD_IOC_BATCH_MAX commands
+ * issued one ioctl at a time vs as a single IOCTL_LLKD_IOCBATCH.
  */
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -11,12 +18,68 @@
 #include <sys/ioctl.h>
 #include "../ioctl_llkd.h"
 
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Time a burst of (RESET, QPOWER)s: one ioctl per command vs one batch */
+static int batch_bench(int fd, long iters)
+{
+	static struct llkd_ioc_ent ents[LLKD_IOC_BATCH_MAX];
+	struct llkd_ioc_batch batch;
+	uint64_t t0, t_single, t_batch;
+	long it;
+	int i, power;
+
+	if (iters <= 0)
+		return 0;
+	for (i = 0; i < LLKD_IOC_BATCH_MAX; i++) {
+		ents[i].cmd = (i & 1) ? IOCTL_LLKD_IOCQPOWER : IOCTL_LLKD_IOCRESET;
+		ents[i].arg = 0;
+	}
+
+	t0 = now_ns();
+	for (it = 0; it < iters; it++) {
+		for (i = 0; i < LLKD_IOC_BATCH_MAX; i++) {
+			if (ioctl(fd, ents[i].cmd, (i & 1) ? &power : 0) == -1) {
+				perror("ioctl (bench) failed");
+				return -1;
+			}
+		}
+	}
+	t_single = now_ns() - t0;
+
+	t0 = now_ns();
+	for (it = 0; it < iters; it++) {
+		batch.ents = (uintptr_t)ents;
+		batch.nents = LLKD_IOC_BATCH_MAX;
+		if (ioctl(fd, IOCTL_LLKD_IOCBATCH, &batch) == -1) {
+			perror("ioctl IOCTL_LLKD_IOCBATCH (bench) failed");
+			return -1;
+		}
+	}
+	t_batch = now_ns() - t0;
+
+	printf("bench: %ld x %d commands: single %.1f ns/cmd, batched %.1f ns/cmd"
+	       " (%.1fx)\n", iters, LLKD_IOC_BATCH_MAX,
+	       (double)t_single / (iters * LLKD_IOC_BATCH_MAX),
+	       (double)t_batch / (iters * LLKD_IOC_BATCH_MAX),
+	       t_batch ? (double)t_single / t_batch : 0.0);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
-	int fd, power;
+	struct llkd_ioc_ent ents[3];
+	struct llkd_ioc_batch batch;
+	int fd, power, i;
 
 	if (argc < 2) {
-		fprintf(stderr, "Usage: %s device_file\n\
+		fprintf(stderr, "Usage: %s device_file [bench-iterations]\n\
   If device_file does not exist, create it using mknod(1) (as root)\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
@@ -50,6 +113,30 @@ int main(int argc, char **argv)
 	}
 	printf("%s: power=%d\n", argv[0], power);
 
+	// 2a. The same again, and a (re)set of the power state, in one batch
+	memset(ents, 0, sizeof(ents));
+	ents[0].cmd = IOCTL_LLKD_IOCRESET;
+	ents[1].cmd = IOCTL_LLKD_IOCSPOWER;
+	ents[1].arg = power;
+	ents[2].cmd = IOCTL_LLKD_IOCQPOWER;
+	batch.ents = (uintptr_t)ents;
+	batch.nents = 3;
+	if (ioctl(fd, IOCTL_LLKD_IOCBATCH, &batch) == -1) {
+		perror("ioctl IOCTL_LLKD_IOCBATCH failed");
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+	printf("%s: batch: %u of %u ok:", argv[0], batch.ndone, batch.nents);
+	for (i = 0; i < 3; i++)
+		printf(" [nr %u: status %d result %lld]", _IOC_NR(ents[i].cmd),
+		       ents[i].status, (long long)ents[i].result);
+	printf("\n");
+
+	if (argc >= 3 && batch_bench(fd, atol(argv[2])) < 0) {
+		close(fd);
+		exit(EXIT_FAILURE);
+	}
+
 	// 3. Toggle it's power status
 	if (0 == power) {
 		printf("%s: Device OFF, powering it On now ...\n", argv[0]);
@@ -0,0 +1,46 @@
+/*
+ * ipc_bench.h
+ *
+ * Common header for both the ipc_bench_kmod.c kernel module and the
+ * userspace benchmark driver ipc_bench_user.c
+ * The kernel module exposes the very same driver context value - a payload
+ * of payload_sz bytes - via each of the five kernel <-> user pathways
+ * covered in this chapter; the user app measures the cost of reading it.
+ */
+#ifndef __IPC_BENCH_H__
+#define __IPC_BENCH_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define IPCB_NAME		"ipc_bench"
+
+/* The largest payload; it must fit in a sysfs 'show' page */
+#define IPCB_MAXPAYLOAD		4000
+
+/* The pathways (pseudo-files / device nodes / sockets) */
+#define IPCB_PROCFS_PATH	"/proc/" IPCB_NAME "/value"
+#define IPCB_SYSFS_PATH		"/sys/devices/platform/llkd_" IPCB_NAME "/value"
+#define IPCB_DEBUGFS_PATH	"/sys/kernel/debug/" IPCB_NAME "/value"
+#define IPCB_DEV_PATH		"/dev/" IPCB_NAME		/* misc device */
+#define IPCB_PAYLOAD_SZ_PARAM	"/sys/module/ipc_bench_kmod/parameters/payload_sz"
+
+/* ioctl: copy (up to) len bytes of the payload to the user buffer at 'buf';
+ * returns the # of bytes copied */
+#define IOCTL_IPCB_MAGIC	0xAA
+#define IOCTL_IPCB_MAXIOCTL	0
+
+struct ipcb_ioc {
+	__u64 buf;		/* user virtual address (of the buffer) */
+	__u32 len;
+	__u32 __pad;
+};
+#define IOCTL_IPCB_GET		_IOWR(IOCTL_IPCB_MAGIC, 0, struct ipcb_ioc)
+
+/* netlink: a (payload-less) IPCB_NLMSG_GET request is replied to with an
+ * IPCB_NLMSG_GET message (same nlmsg_seq) carrying the payload. (31 is
+ * taken by the netlink_simple_intf module) */
+#define IPCB_NETLINK_PROTO	30
+#define IPCB_NLMSG_GET		(NLMSG_MIN_TYPE + 1)
+
+#endif
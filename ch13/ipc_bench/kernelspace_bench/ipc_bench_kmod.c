@@ -0,0 +1,321 @@
+/*
+ * ch13/ipc_bench/kernelspace_bench/ipc_bench_kmod.c
+ ***************************************************************
+ * Brief Description:
+ * The kernel half of the cross-interface kernel <-> user IPC benchmark.
+ * ch13's simple_intf modules implement the same "read a driver context
+ * value" pattern via procfs, sysfs, debugfs, ioctl and netlink; here, one
+ * module exposes one driver context value - a payload of payload_sz bytes -
+ * via all five, so that the userspace driver (../userapp_bench/) can measure
+ * and compare them like for like:
+ *  procfs  : /proc/ipc_bench/value                     (seq_file read)
+ *  sysfs   : /sys/devices/platform/llkd_ipc_bench/value (attribute 'show')
+ *  debugfs : <debugfs_mount>/ipc_bench/value            (file read)
+ *  ioctl   : /dev/ipc_bench, IOCTL_IPCB_GET             (misc device)
+ *  netlink : protocol IPCB_NETLINK_PROTO, IPCB_NLMSG_GET (request/reply)
+ * (see ../ipc_bench.h).
+ * Like the simple_intf modules, each read takes the driver context mutex by
+ * default; set the 'locked' parameter to 0 to measure just the channel.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/platform_device.h>
+#include <linux/miscdevice.h>
+#include <net/sock.h>
+#include <net/netlink.h>
+#include <linux/netlink.h>
+#include <linux/skbuff.h>
+
+// copy_[to|from]_user()
+#include <linux/version.h>
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 11, 0)
+#include <linux/uaccess.h>
+#else
+#include <asm/uaccess.h>
+#endif
+
+#include "../ipc_bench.h"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION
+    ("LLKD book:ch13/ipc_bench: one value, five kernel-user pathways, benchmarked");
+/* GPL, as the platform device and sysfs APIs are EXPORT_SYMBOL_GPL() */
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+#define OURMODNAME	"ipc_bench"
+#define PLAT_NAME	"llkd_" IPCB_NAME
+
+static uint payload_sz = 8;
+module_param(payload_sz, uint, 0644);
+MODULE_PARM_DESC(payload_sz,
+ "Size (bytes) of the value returned by every interface (default 8, max "
+ __stringify(IPCB_MAXPAYLOAD) "); the benchmark app sets it per run");
+
+static bool locked = true;
+module_param(locked, bool, 0644);
+MODULE_PARM_DESC(locked,
+ "Read the value under the driver context mutex, like ch13's simple_intf"
+ " modules do (default 1); 0 => lockless (measures just the channel)");
+
+struct drv_ctx {
+	struct mutex mtx;
+	char payload[IPCB_MAXPAYLOAD];
+};
+static struct drv_ctx *gdrvctx;
+
+static struct proc_dir_entry *gprocdir;
+static struct dentry *gdbgfsdir;
+static struct platform_device *gplatdev;
+static struct sock *gnlsock;
+
+/*
+ * Every interface fetches the value via this pair; it returns the payload
+ * (and it's size) with the context locked (if so configured)
+ */
+static inline const char *value_get(size_t *sz)
+{
+	*sz = min_t(uint, READ_ONCE(payload_sz), IPCB_MAXPAYLOAD);
+	if (locked)
+		mutex_lock(&gdrvctx->mtx);
+	return gdrvctx->payload;
+}
+
+static inline void value_put(void)
+{
+	if (locked)
+		mutex_unlock(&gdrvctx->mtx);
+}
+
+/*------------------ procfs -------------------------------------------*/
+static int proc_show_value(struct seq_file *seq, void *v)
+{
+	const char *val;
+	size_t sz;
+
+	val = value_get(&sz);
+	seq_write(seq, val, sz);
+	value_put();
+	return 0;
+}
+
+static int proc_open_value(struct inode *inode, struct file *file)
+{
+	return single_open_size(file, proc_show_value, NULL,
+				IPCB_MAXPAYLOAD + 1);
+}
+
+static const struct file_operations fops_proc_value = {
+	.owner = THIS_MODULE,
+	.open = proc_open_value,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*------------------ sysfs --------------------------------------------*/
+static ssize_t value_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	const char *val;
+	size_t sz;
+
+	val = value_get(&sz);
+	memcpy(buf, val, sz);
+	value_put();
+	return sz;
+}
+static DEVICE_ATTR_RO(value);
+
+/*------------------ debugfs ------------------------------------------*/
+static ssize_t dbgfs_read_value(struct file *filp, char __user *ubuf,
+				size_t count, loff_t *fpos)
+{
+	const char *val;
+	ssize_t ret;
+	size_t sz;
+
+	/* copying to userspace under a mutex is fine (it may fault & sleep) */
+	val = value_get(&sz);
+	ret = simple_read_from_buffer(ubuf, count, fpos, val, sz);
+	value_put();
+	return ret;
+}
+
+static const struct file_operations fops_dbgfs_value = {
+	.read = dbgfs_read_value,
+};
+
+/*------------------ ioctl --------------------------------------------*/
+static long ipcb_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct ipcb_ioc ioc;
+	const char *val;
+	size_t sz;
+	long ret;
+
+	if (_IOC_TYPE(cmd) != IOCTL_IPCB_MAGIC ||
+	    _IOC_NR(cmd) > IOCTL_IPCB_MAXIOCTL)
+		return -ENOTTY;
+	if (cmd != IOCTL_IPCB_GET)
+		return -ENOTTY;
+	if (copy_from_user(&ioc, (void __user *)arg, sizeof(ioc)))
+		return -EFAULT;
+
+	val = value_get(&sz);
+	sz = min_t(size_t, sz, ioc.len);
+	ret = copy_to_user(u64_to_user_ptr(ioc.buf), val, sz) ? -EFAULT : sz;
+	value_put();
+	return ret;
+}
+
+static const struct file_operations fops_ipcb_dev = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = ipcb_ioctl,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice ipcb_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = IPCB_NAME,	/* /dev/ipc_bench */
+	.mode = 0600,
+	.fops = &fops_ipcb_dev,
+};
+
+/*------------------ netlink ------------------------------------------*/
+/* Reply to every IPCB_NLMSG_GET request in @skb with the payload; as with
+ * the other interfaces, it's one reply per request (no coalescing) */
+static void ipcb_nl_recv(struct sk_buff *skb)
+{
+	u32 portid = NETLINK_CB(skb).portid;
+	int rem = skb->len;
+	struct nlmsghdr *nlh;
+
+	for (nlh = nlmsg_hdr(skb); nlmsg_ok(nlh, rem);
+	     nlh = nlmsg_next(nlh, &rem)) {
+		struct sk_buff *skb_tx;
+		struct nlmsghdr *nlh_tx;
+		const char *val;
+		size_t sz;
+
+		if (nlh->nlmsg_type != IPCB_NLMSG_GET)
+			continue;
+		skb_tx = nlmsg_new(IPCB_MAXPAYLOAD, GFP_KERNEL);
+		if (!skb_tx)
+			return;
+		val = value_get(&sz);
+		nlh_tx = nlmsg_put(skb_tx, 0, nlh->nlmsg_seq, IPCB_NLMSG_GET,
+				   sz, 0);
+		memcpy(nlmsg_data(nlh_tx), val, sz);
+		value_put();
+		nlmsg_unicast(gnlsock, skb_tx, portid);
+	}
+}
+
+static struct netlink_kernel_cfg ipcb_nl_cfg = {
+	.input = ipcb_nl_recv,
+};
+
+static int __init ipc_bench_init(void)
+{
+	int stat, i;
+
+	gdrvctx = kzalloc(sizeof(struct drv_ctx), GFP_KERNEL);
+	if (!gdrvctx)
+		return -ENOMEM;
+	mutex_init(&gdrvctx->mtx);
+	for (i = 0; i < IPCB_MAXPAYLOAD; i++)	/* a recognizable pattern */
+		gdrvctx->payload[i] = 'a' + i % 26;
+
+	// 1. procfs
+	stat = -ENOMEM;
+	gprocdir = proc_mkdir(OURMODNAME, NULL);
+	if (!gprocdir) {
+		pr_warn("%s: proc_mkdir failed, aborting...\n", OURMODNAME);
+		goto out_free;
+	}
+	if (!proc_create("value", 0444, gprocdir, &fops_proc_value)) {
+		pr_warn("%s: proc_create failed, aborting...\n", OURMODNAME);
+		goto out_proc;
+	}
+
+	// 2. sysfs: via a (dummy) platform device, as in sysfs_simple_intf
+	gplatdev = platform_device_register_simple(PLAT_NAME, -1, NULL, 0);
+	if (IS_ERR(gplatdev)) {
+		stat = PTR_ERR(gplatdev);
+		pr_warn("%s: registering our platform device failed (%d)\n",
+			OURMODNAME, stat);
+		goto out_proc;
+	}
+	stat = device_create_file(&gplatdev->dev, &dev_attr_value);
+	if (stat) {
+		pr_warn("%s: device_create_file failed (%d)\n", OURMODNAME, stat);
+		goto out_plat;
+	}
+
+	// 3. debugfs
+	gdbgfsdir = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gdbgfsdir)) {
+		pr_warn("%s: debugfs_create_dir failed\n", OURMODNAME);
+		stat = gdbgfsdir ? PTR_ERR(gdbgfsdir) : -ENOMEM;
+		goto out_sysfs;
+	}
+	debugfs_create_file("value", 0440, gdbgfsdir, NULL, &fops_dbgfs_value);
+
+	// 4. ioctl: via a misc device
+	stat = misc_register(&ipcb_miscdev);
+	if (stat) {
+		pr_warn("%s: misc device registration failed (%d)\n",
+			OURMODNAME, stat);
+		goto out_dbgfs;
+	}
+
+	// 5. netlink
+	gnlsock = netlink_kernel_create(&init_net, IPCB_NETLINK_PROTO,
+					&ipcb_nl_cfg);
+	if (!gnlsock) {
+		pr_warn("%s: netlink_kernel_create failed\n", OURMODNAME);
+		stat = -ENOMEM;
+		goto out_misc;
+	}
+
+	pr_info("%s initialized (payload_sz=%u, locked=%d)\n",
+		OURMODNAME, payload_sz, locked);
+	return 0;		/* success */
+
+ out_misc:
+	misc_deregister(&ipcb_miscdev);
+ out_dbgfs:
+	debugfs_remove_recursive(gdbgfsdir);
+ out_sysfs:
+	device_remove_file(&gplatdev->dev, &dev_attr_value);
+ out_plat:
+	platform_device_unregister(gplatdev);
+ out_proc:
+	remove_proc_subtree(OURMODNAME, NULL);
+ out_free:
+	kfree(gdrvctx);
+	return stat;
+}
+
+static void __exit ipc_bench_exit(void)
+{
+	netlink_kernel_release(gnlsock);
+	misc_deregister(&ipcb_miscdev);
+	debugfs_remove_recursive(gdbgfsdir);
+	device_remove_file(&gplatdev->dev, &dev_attr_value);
+	platform_device_unregister(gplatdev);
+	remove_proc_subtree(OURMODNAME, NULL);
+	kfree(gdrvctx);
+	pr_info("%s removed\n", OURMODNAME);
+}
+
+module_init(ipc_bench_init);
+module_exit(ipc_bench_exit);
@@ -0,0 +1,345 @@
+/*
+ * ipc_bench_user.c
+ *
+ ***********************************************************
+ * Brief Description
+ * The userspace driver of the cross-interface kernel <-> user IPC benchmark
+ * (the kernel half is ../kernelspace_bench/ipc_bench_kmod.c).
+ * For every combination of interface (procfs, sysfs, debugfs, ioctl,
+ * netlink), thread count and payload size, it runs N threads - each with
+ * it's own open file / socket - that read the driver context value as fast
+ * as they can for a given duration, and reports (as CSV, on stdout):
+ *  iface,threads,payload,ops,ops_per_sec,syscalls,syscalls_per_op,
+ *  p50_us,p99_us,errors
+ * A (file-based) op is one pread(2) at offset 0; an ioctl op is one ioctl(2);
+ * a netlink op is a send(2) of the request plus a recv(2) of the reply.
+ * Latency is sampled per op (up to MAXSAMPLES per thread).
+ * Needs root (for debugfs and /dev/ipc_bench) and the module loaded.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "../ipc_bench.h"
+
+#define MAXTHREADS	256
+#define MAXLIST		32
+#define MAXSAMPLES	(256*1024)	/* latency samples kept per thread */
+
+enum iface { IF_PROCFS, IF_SYSFS, IF_DEBUGFS, IF_IOCTL, IF_NETLINK, IF_MAX };
+static const char *iface_name[IF_MAX] = {
+	"procfs", "sysfs", "debugfs", "ioctl", "netlink"
+};
+static const char *iface_path[IF_MAX] = {
+	IPCB_PROCFS_PATH, IPCB_SYSFS_PATH, IPCB_DEBUGFS_PATH, IPCB_DEV_PATH, NULL
+};
+
+struct thrd {
+	pthread_t tid;
+	enum iface iface;
+	int payload;
+	long ops, syscalls, errors, nlat;
+	double *lat;
+};
+
+static atomic_int go, stop;
+
+static inline double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s [-i iface,...] [-t nthreads,...] [-s payload,...] [-d secs]\n"
+		" -i : interfaces, any of procfs,sysfs,debugfs,ioctl,netlink (default all)\n"
+		" -t : thread counts (default 1,2,4,8; max %d)\n"
+		" -s : payload sizes in bytes (default 8,64,512,4000; max %d)\n"
+		" -d : duration of each run in seconds (default 2)\n",
+		prg, MAXTHREADS, IPCB_MAXPAYLOAD);
+}
+
+/* Parse a comma-separated list of ints into @v; returns the count */
+static int parse_list(char *s, int *v, int max)
+{
+	char *tok, *save = NULL;
+	int n = 0;
+
+	for (tok = strtok_r(s, ",", &save); tok && n < max;
+	     tok = strtok_r(NULL, ",", &save))
+		v[n++] = atoi(tok);
+	return n;
+}
+
+static int set_payload(int sz)
+{
+	FILE *fp = fopen(IPCB_PAYLOAD_SZ_PARAM, "w");
+
+	if (!fp) {
+		perror("ipc_bench: fopen " IPCB_PAYLOAD_SZ_PARAM);
+		return -1;
+	}
+	fprintf(fp, "%d\n", sz);
+	return fclose(fp);
+}
+
+static int nl_open(void)
+{
+	struct sockaddr_nl src_nl, dest_nl;
+	int sd;
+
+	sd = socket(PF_NETLINK, SOCK_RAW, IPCB_NETLINK_PROTO);
+	if (sd < 0)
+		return -1;
+	memset(&src_nl, 0, sizeof(src_nl));
+	src_nl.nl_family = AF_NETLINK;	/* nl_pid 0 => kernel assigns one */
+	memset(&dest_nl, 0, sizeof(dest_nl));
+	dest_nl.nl_family = AF_NETLINK;	/* nl_pid 0 => the kernel */
+	/* connect(), so that we can use plain send(2) */
+	if (bind(sd, (struct sockaddr *)&src_nl, sizeof(src_nl)) < 0 ||
+	    connect(sd, (struct sockaddr *)&dest_nl, sizeof(dest_nl)) < 0) {
+		close(sd);
+		return -1;
+	}
+	return sd;
+}
+
+/* One op on @fd; returns the # of payload bytes read, or -1 on failure */
+static ssize_t do_op(struct thrd *t, int fd, char *buf, struct nlmsghdr *req)
+{
+	struct ipcb_ioc ioc;
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	ssize_t n;
+
+	switch (t->iface) {
+	case IF_PROCFS:
+	case IF_SYSFS:
+	case IF_DEBUGFS:
+		t->syscalls++;
+		return pread(fd, buf, IPCB_MAXPAYLOAD, 0);
+	case IF_IOCTL:
+		ioc.buf = (unsigned long)buf;
+		ioc.len = IPCB_MAXPAYLOAD;
+		t->syscalls++;
+		return ioctl(fd, IOCTL_IPCB_GET, &ioc);
+	case IF_NETLINK:
+		req->nlmsg_seq++;
+		t->syscalls += 2;
+		if (send(fd, req, req->nlmsg_len, 0) < 0)
+			return -1;
+		n = recv(fd, buf, NLMSG_SPACE(IPCB_MAXPAYLOAD), 0);
+		if (n < 0 || !NLMSG_OK(nlh, n) || nlh->nlmsg_type != IPCB_NLMSG_GET ||
+		    nlh->nlmsg_seq != req->nlmsg_seq)
+			return -1;
+		return NLMSG_PAYLOAD(nlh, 0);
+	default:
+		return -1;
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct thrd *t = arg;
+	struct nlmsghdr req;
+	char *buf;
+	double t0, t1;
+	ssize_t n;
+	int fd;
+
+	buf = malloc(NLMSG_SPACE(IPCB_MAXPAYLOAD));
+	if (t->iface == IF_NETLINK)
+		fd = nl_open();
+	else
+		fd = open(iface_path[t->iface], t->iface == IF_IOCTL ? O_RDWR : O_RDONLY);
+	if (!buf || fd < 0) {
+		fprintf(stderr, "ipc_bench: %s: open failed: %s\n",
+			iface_name[t->iface], strerror(errno));
+		t->errors = -1;
+		free(buf);
+		return NULL;
+	}
+	memset(&req, 0, sizeof(req));
+	req.nlmsg_len = NLMSG_LENGTH(0);
+	req.nlmsg_type = IPCB_NLMSG_GET;
+	req.nlmsg_flags = NLM_F_REQUEST;
+
+	while (!atomic_load(&go))
+		;
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		t0 = now_sec();
+		n = do_op(t, fd, buf, &req);
+		t1 = now_sec();
+		if (n != t->payload)
+			t->errors++;
+		if (t->nlat < MAXSAMPLES)
+			t->lat[t->nlat++] = t1 - t0;
+		t->ops++;
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* One run: @nthr threads reading a @payload byte value via @iface */
+static int run(enum iface iface, int nthr, int payload, int secs,
+	       struct thrd *thr, double *alllat)
+{
+	long ops = 0, syscalls = 0, errors = 0, nlat = 0, p50, p99;
+	double start, elapsed;
+	int i;
+
+	atomic_store(&go, 0);
+	atomic_store(&stop, 0);
+	for (i = 0; i < nthr; i++) {
+		thr[i].iface = iface;
+		thr[i].payload = payload;
+		thr[i].ops = thr[i].syscalls = thr[i].errors = thr[i].nlat = 0;
+		if (pthread_create(&thr[i].tid, NULL, worker, &thr[i])) {
+			perror("ipc_bench: pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	usleep(100000);		/* let them all open up and get ready */
+	start = now_sec();
+	atomic_store(&go, 1);
+	sleep(secs);
+	atomic_store(&stop, 1);
+	for (i = 0; i < nthr; i++)
+		pthread_join(thr[i].tid, NULL);
+	elapsed = now_sec() - start;
+
+	for (i = 0; i < nthr; i++) {
+		if (thr[i].errors < 0)
+			return -1;
+		ops += thr[i].ops;
+		syscalls += thr[i].syscalls;
+		errors += thr[i].errors;
+		memcpy(alllat + nlat, thr[i].lat, thr[i].nlat * sizeof(double));
+		nlat += thr[i].nlat;
+	}
+	qsort(alllat, nlat, sizeof(double), cmp_double);
+	p50 = nlat ? (nlat * 50 + 99) / 100 - 1 : 0;
+	p99 = nlat ? (nlat * 99 + 99) / 100 - 1 : 0;
+	printf("%s,%d,%d,%ld,%.0f,%ld,%.2f,%.2f,%.2f,%ld\n",
+		iface_name[iface], nthr, payload, ops, ops / elapsed, syscalls,
+		ops ? (double)syscalls / ops : 0.0,
+		nlat ? alllat[p50] * 1e6 : 0.0, nlat ? alllat[p99] * 1e6 : 0.0,
+		errors);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int ifaces[IF_MAX], nthreads[MAXLIST] = { 1, 2, 4, 8 },
+	    payloads[MAXLIST] = { 8, 64, 512, IPCB_MAXPAYLOAD };
+	int nif = 0, nnt = 4, npl = 4, secs = 2, maxthr = 0, opt, i, j, k;
+	char *tok, *save = NULL;
+	struct thrd *thr;
+	double *alllat;
+
+	while ((opt = getopt(argc, argv, "i:t:s:d:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			for (tok = strtok_r(optarg, ",", &save); tok;
+			     tok = strtok_r(NULL, ",", &save)) {
+				for (i = 0; i < IF_MAX; i++)
+					if (!strcmp(tok, iface_name[i]))
+						break;
+				if (i == IF_MAX || nif == IF_MAX) {
+					usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				ifaces[nif++] = i;
+			}
+			break;
+		case 't':
+			nnt = parse_list(optarg, nthreads, MAXLIST);
+			break;
+		case 's':
+			npl = parse_list(optarg, payloads, MAXLIST);
+			break;
+		case 'd':
+			secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!nif)
+		for (nif = 0; nif < IF_MAX; nif++)
+			ifaces[nif] = nif;
+	for (i = 0; i < nnt; i++) {
+		if (nthreads[i] < 1 || nthreads[i] > MAXTHREADS) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if (nthreads[i] > maxthr)
+			maxthr = nthreads[i];
+	}
+	for (i = 0; i < npl; i++) {
+		if (payloads[i] < 1 || payloads[i] > IPCB_MAXPAYLOAD) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!nnt || !npl || secs < 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	thr = calloc(maxthr, sizeof(struct thrd));
+	alllat = malloc((size_t)maxthr * MAXSAMPLES * sizeof(double));
+	if (!thr || !alllat) {
+		fprintf(stderr, "%s: out of memory!\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < maxthr; i++) {
+		thr[i].lat = malloc(MAXSAMPLES * sizeof(double));
+		if (!thr[i].lat) {
+			fprintf(stderr, "%s: out of memory!\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("iface,threads,payload,ops,ops_per_sec,syscalls,syscalls_per_op,"
+		"p50_us,p99_us,errors\n");
+	for (k = 0; k < npl; k++) {
+		if (set_payload(payloads[k]) < 0)
+			exit(EXIT_FAILURE);
+		for (i = 0; i < nif; i++)
+			for (j = 0; j < nnt; j++)
+				if (run(ifaces[i], nthreads[j], payloads[k], secs,
+					thr, alllat) < 0)
+					fprintf(stderr, "%s: %s run failed; is the"
+						" module loaded (and are you root)?\n",
+						argv[0], iface_name[ifaces[i]]);
+	}
+
+	for (i = 0; i < maxthr; i++)
+		free(thr[i].lat);
+	free(alllat);
+	free(thr);
+	exit(EXIT_SUCCESS);
+}
@@ -3,7 +3,15 @@
 
  ***************************************************************
  * Brief Description:
- *
+ * A simple netlink kernel module: it receives netlink messages from userspace
+ * (any number of them per sendmsg(2)) and replies to each, coalescing
+ * the replies into as few skb's as possible; the replies are also multicast
+ * to the LLKD_NL_GRP_REPLIES group (see ../netlink_simple_intf.h), if anyone's
+ * listening.
+ * It also supports a bulk mode: a LLKD_NLMSG_DUMP_THREADS dump request has
+ * it stream a snapshot of all threads on the system back to the requester,
+ * as fixed-size records packed as many per skb as fit (via the netlink core's
+ * dump machinery, so it's paced by the receiver's recvmsg(2) calls).
  */
 #include <linux/init.h>
 #include <linux/kernel.h>
@@ -11,7 +19,13 @@
 #include <net/sock.h>
 #include <linux/netlink.h>
 #include <linux/skbuff.h>
+#include <linux/sched/signal.h>
+#include <linux/pid.h>
+#define LLKD_USE_VERBOSE	/* runtime-switchable VPRINT*() diagnostics */
 #include "../../../convenient.h"
+#include "../netlink_simple_intf.h"	/* NETLINK_MY_UNIT_PROTO, ... */
+#define CREATE_TRACE_POINTS
+#include "netlink_simple_intf_trace.h"
 
 MODULE_AUTHOR("<insert your name here>");
 MODULE_DESCRIPTION("ch12/netlink_simple_intf: simple netlink recv/send demo kernel module");
@@ -19,61 +33,198 @@ MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
 
 #define OURMODNAME   "netlink_simple_intf"
-#define NETLINK_MY_UNIT_PROTO   31
-	// kernel netlink protocol # that we're registering..
 
 static struct sock *nlsock;
 
+/* Module parameters */
+static int verbose;
+module_param(verbose, int, 0444);
+MODULE_PARM_DESC(verbose,
+ "Initial verbosity of the recv/reply diagnostics; 0 = off (default), 1 = on"
+ " (toggle at runtime via <debugfs_mount>/" OURMODNAME "/verbose)");
+
+static uint dump_min_alloc;
+module_param(dump_min_alloc, uint, 0644);
+MODULE_PARM_DESC(dump_min_alloc,
+ "Minimum size (bytes) of each bulk mode (thread dump) skb; 0 (default) lets"
+ " the netlink core size it to the receiver's recvmsg(2) buffer"
+ " (max 65535)");
+
+/*
+ * nl_flush_replies
+ * Send off the (batch of) replies in @skb_tx to the sender @portid and, if
+ * anyone's listening on our multicast group, fan it out to them as well.
+ * nlmsg_notify() does both, taking care of the skb reference counting.
+ */
+static void nl_flush_replies(struct sk_buff *skb_tx, u32 portid)
+{
+	u32 group = 0, len = skb_tx->len;
+	int stat;
+
+	if (netlink_has_listeners(nlsock, LLKD_NL_GRP_REPLIES))
+		group = LLKD_NL_GRP_REPLIES;
+	stat = nlmsg_notify(nlsock, skb_tx, portid, group, 1, GFP_KERNEL);
+	trace_nl_tx(portid, len, stat);
+	if (stat < 0)
+		pr_warn("%s: nlmsg_notify() failed (err=%d)\n",
+			OURMODNAME, stat);
+	else
+		VPRINT("%s: reply batch (%u bytes) sent\n", OURMODNAME, len);
+}
+
+/*
+ * nl_dump_threads
+ * The dump callback for the bulk mode; the netlink core invokes it (first
+ * from netlink_dump_start(), then from within the requester's recvmsg(2)
+ * calls) with a fresh (large) skb each time, until we return 0.
+ * We fill the skb with a single LLKD_NLMSG_THRD_RECS message that carries as
+ * many records as fit. Our position in the walk - the next PID to look up -
+ * is kept in cb->args[0]; walking the PID namespace via find_ge_pid() (as
+ * /proc's readdir does) lets us resume after a dropped RCU read lock without
+ * holding any reference on the tasks. Threads that come and go during the
+ * dump may or may not be reported; it's a (cheap) snapshot, not an atomic one.
+ */
+static int nl_dump_threads(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlmsghdr *nlh;
+	struct llkd_nl_thrd_rec *rec;
+	pid_t nr = cb->args[0];
+	int n = 0;
+
+	nlh = nlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			LLKD_NLMSG_THRD_RECS, 0, NLM_F_MULTI);
+	if (!nlh)
+		return -EMSGSIZE;
+
+	rcu_read_lock();
+	while (skb_tailroom(skb) >= sizeof(*rec)) {
+		struct pid *pid = find_ge_pid(nr, &init_pid_ns);
+		struct task_struct *t;
+
+		if (!pid)
+			break;	/* walked them all */
+		nr = pid_nr(pid) + 1;
+		t = pid_task(pid, PIDTYPE_PID);
+		if (!t)
+			continue;
+
+		rec = skb_put(skb, sizeof(*rec));
+		rec->tgid = task_tgid_nr(t);
+		rec->pid = task_pid_nr(t);
+		rec->flags = t->flags;
+		rec->nr_threads = get_nr_threads(t);
+		/* no task_lock() here (we can't, under RCU); a racing
+		 * rename may give us a torn comm, which is harmless */
+		memcpy(rec->comm, t->comm, LLKD_NL_COMMLEN);
+		rec->comm[LLKD_NL_COMMLEN - 1] = '\0';
+		n++;
+	}
+	rcu_read_unlock();
+	cb->args[0] = nr;
+
+	if (!n) {		/* done; the core appends the NLMSG_DONE */
+		nlmsg_cancel(skb, nlh);
+		trace_nl_dump(NETLINK_CB(cb->skb).portid, 0, 0);
+		return 0;
+	}
+	nlmsg_end(skb, nlh);
+	trace_nl_dump(NETLINK_CB(cb->skb).portid, skb->len, n);
+	VPRINT("%s: dump: %d thread records (%u bytes) in this skb\n",
+		OURMODNAME, n, skb->len);
+	return skb->len;
+}
+
+static void nl_start_dump(struct sk_buff *skb, struct nlmsghdr *nlh)
+{
+	struct netlink_dump_control c = {
+		.dump = nl_dump_threads,
+		.min_dump_alloc = min_t(uint, dump_min_alloc, U16_MAX),
+	};
+	int stat;
+
+	/* We're no dump-based protocol family (with an rtnl or genl
+	 * doing this for us); the dump state lives in the requester's
+	 * socket, the core takes it from here */
+	stat = netlink_dump_start(nlsock, skb, nlh, &c);
+	if (stat < 0 && stat != -EINTR)	/* -EINTR => started fine */
+		pr_warn("%s: netlink_dump_start() failed (err=%d)\n",
+			OURMODNAME, stat);
+}
+
 /*
  * netlink_recv_and_reply
  * When a userspace process (or thread) provides any input (i.e. transmits
  * something) to us, this callback function is invoked. It's important to
  * understand that it runs in process context (and not any kind of interrupt
  * context).
- * Here, we simply display the received 'message' and then reply by sending
- * a sample message to our userspace peer (process).
+ * A single skb can carry several netlink messages; we iterate over all of
+ * them, displaying each received 'message' and replying with a sample
+ * message to our userspace peer (process). The replies are coalesced into
+ * as few (NLMSG_GOODSIZE) skb's as possible, so that a batch of N requests
+ * typically costs just one reply skb and one send.
+ * A bulk mode (LLKD_NLMSG_DUMP_THREADS + NLM_F_DUMP) request starts a dump
+ * instead (see nl_dump_threads()).
  */
 static void netlink_recv_and_reply(struct sk_buff *skb)
 {
 	struct nlmsghdr *nlh;
-	struct sk_buff *skb_tx;
-	char *reply = "Reply from kernel netlink";
-	int pid, msgsz, stat;
+	struct sk_buff *skb_tx = NULL;
+	const char *reply = LLKD_NL_REPLY_MSG;
+	u32 portid = NETLINK_CB(skb).portid;	/* port id of the sender */
+	int msgsz = strlen(reply), rem = skb->len;
 
 	/* Find that this code runs in process context, the process
 	 * (or thread) being the one that issued the sendmsg(2) */
-	PRINT_CTX();
-
-	nlh = (struct nlmsghdr *)skb->data;
-	pid = nlh->nlmsg_pid;	/*pid of sending process */
-	pr_info("%s: received from PID %d:\n"
-		"\"%s\"\n",
-		OURMODNAME, pid, (char *)NLMSG_DATA(nlh));
-
-	//--- Lets be polite and reply
-	msgsz = strlen(reply);
-	skb_tx = nlmsg_new(msgsz, 0);
-	if (!skb_tx) {
-		pr_warn("skb alloc failed!\n");
-		return;
-	}
+	VPRINT_CTX();
 
-	// Setup the payload
-	nlh = nlmsg_put(skb_tx, 0, 0, NLMSG_DONE, msgsz, 0);
-	NETLINK_CB(skb_tx).dst_group = 0;  // unicast only (cb is the
-		// skb's control buffer), dest group 0 => unicast
-	strncpy(nlmsg_data(nlh), reply, msgsz);
+	for (nlh = nlmsg_hdr(skb); nlmsg_ok(nlh, rem);
+	     nlh = nlmsg_next(nlh, &rem)) {
+		struct nlmsghdr *nlh_tx;
 
-	// Send it
-	stat = nlmsg_unicast(nlsock, skb_tx, pid);
-	if (stat < 0)
-		pr_warn("%s: nlmsg_unicast() failed (err=%d)\n",
-			OURMODNAME, stat);
-	pr_info("%s: reply sent\n", OURMODNAME);
+		trace_nl_rx(portid, nlh->nlmsg_len, 0);
+		VPRINT("%s: received from port %u (seq %u):\n"
+			"\"%.*s\"\n",
+			OURMODNAME, portid, nlh->nlmsg_seq,
+			nlmsg_len(nlh), (char *)nlmsg_data(nlh));
+
+		if (nlh->nlmsg_type == LLKD_NLMSG_DUMP_THREADS &&
+		    (nlh->nlmsg_flags & NLM_F_DUMP)) {
+			nl_start_dump(skb, nlh);
+			continue;
+		}
+
+		//--- Lets be polite and reply
+		if (!skb_tx) {
+			skb_tx = nlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+			if (!skb_tx) {
+				pr_warn("skb alloc failed!\n");
+				return;
+			}
+		}
+		// Setup the payload; echo the seq # so the sender can match it
+		nlh_tx = nlmsg_put(skb_tx, 0, nlh->nlmsg_seq, LLKD_NLMSG_REPLY,
+				   msgsz, 0);
+		if (!nlh_tx) {	/* this reply skb's full; send it off */
+			nl_flush_replies(skb_tx, portid);
+			skb_tx = nlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+			if (!skb_tx) {
+				pr_warn("skb alloc failed!\n");
+				return;
+			}
+			nlh_tx = nlmsg_put(skb_tx, 0, nlh->nlmsg_seq,
+					   LLKD_NLMSG_REPLY, msgsz, 0);
+		}
+		memcpy(nlmsg_data(nlh_tx), reply, msgsz);
+	}
+
+	// Send it (whatever's left)
+	if (skb_tx)
+		nl_flush_replies(skb_tx, portid);
 }
 
 static struct netlink_kernel_cfg nl_kernel_cfg = {
 	.input = netlink_recv_and_reply,
+	.groups = LLKD_NL_NGROUPS,	/* our multicast group(s) */
 };
 
 static int __init netlink_simple_intf_init(void)
@@ -90,6 +241,10 @@ static int __init netlink_simple_intf_init(void)
 		return PTR_ERR(nlsock);
 	}
 
+	if (llkd_verbose_init(OURMODNAME, verbose))	/* not fatal */
+		pr_notice("%s: couldn't setup the debugfs 'verbose' file\n",
+			OURMODNAME);
+
 	pr_info("%s: inserted\n", OURMODNAME);
 	return 0;		/* success */
 }
@@ -97,6 +252,7 @@ static int __init netlink_simple_intf_init(void)
 static void __exit netlink_simple_intf_exit(void)
 {
 	netlink_kernel_release(nlsock);
+	llkd_verbose_exit();
 	pr_info("%s: removed\n", OURMODNAME);
 }
 
@@ -0,0 +1,73 @@
+/*
+ * netlink_simple_intf_trace.h
+ *
+ * Tracepoints for the netlink_simple_intf kernel module.
+ * When nothing is attached, each tracepoint costs just a NOP (it's gated by a
+ * static key); attach via ftrace, perf or eBPF, f.e.:
+ *  echo 1 > /sys/kernel/debug/tracing/events/netlink_simple_intf/enable
+ *  perf record -e 'netlink_simple_intf:*' -a
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM netlink_simple_intf
+
+#if !defined(_NETLINK_SIMPLE_INTF_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _NETLINK_SIMPLE_INTF_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* a netlink message received from (rx) / sent to (tx) userspace port @portid;
+ * @len is the message length and @ret the result (0 for rx) */
+DECLARE_EVENT_CLASS(nl_msg,
+	TP_PROTO(u32 portid, u32 len, int ret),
+	TP_ARGS(portid, len, ret),
+	TP_STRUCT__entry(
+		__field(u32, portid)
+		__field(u32, len)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->portid = portid;
+		__entry->len = len;
+		__entry->ret = ret;
+	),
+	TP_printk("portid=%u len=%u ret=%d",
+		  __entry->portid, __entry->len, __entry->ret)
+);
+
+DEFINE_EVENT(nl_msg, nl_rx,
+	TP_PROTO(u32 portid, u32 len, int ret),
+	TP_ARGS(portid, len, ret)
+);
+
+DEFINE_EVENT(nl_msg, nl_tx,
+	TP_PROTO(u32 portid, u32 len, int ret),
+	TP_ARGS(portid, len, ret)
+);
+
+/* a bulk mode (dump) skb of @len bytes carrying @nrecs thread records sent
+ * to port @portid; the final (nrecs=0) one marks the end of the dump */
+TRACE_EVENT(nl_dump,
+	TP_PROTO(u32 portid, u32 len, int nrecs),
+	TP_ARGS(portid, len, nrecs),
+	TP_STRUCT__entry(
+		__field(u32, portid)
+		__field(u32, len)
+		__field(int, nrecs)
+	),
+	TP_fast_assign(
+		__entry->portid = portid;
+		__entry->len = len;
+		__entry->nrecs = nrecs;
+	),
+	TP_printk("portid=%u len=%u nrecs=%d",
+		  __entry->portid, __entry->len, __entry->nrecs)
+);
+
+#endif /* _NETLINK_SIMPLE_INTF_TRACE_H */
+
+/* This part must be outside the multi-read protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE netlink_simple_intf_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,62 @@
+/*
+ * netlink_simple_intf.h
+ *
+ * Common header for both the netlink_simple_intf.c kernel module and the
+ * userspace C app netlink_userapp.c
+ */
+#ifndef __NETLINK_SIMPLE_INTF_H__
+#define __NETLINK_SIMPLE_INTF_H__
+
+#include <linux/types.h>
+
+#define NETLINK_MY_UNIT_PROTO   31
+	// kernel netlink protocol # that the kernel module registers
+
+/*
+ * Multicast group(s). Every batch of replies the kernel module sends is also
+ * multicast (fanned out) to this group, if anyone's listening. A userspace
+ * listener joins it by bind()'ing with
+ *   nl_groups = (1 << (LLKD_NL_GRP_REPLIES - 1))
+ * (or via the NETLINK_ADD_MEMBERSHIP socket option).
+ */
+#define LLKD_NL_GRP_REPLIES     1
+#define LLKD_NL_NGROUPS         1
+
+/* The type of the reply messages; message types below NLMSG_MIN_TYPE
+ * are reserved for netlink control messages */
+#define LLKD_NLMSG_REPLY        (NLMSG_MIN_TYPE + 1)
+
+/*
+ * A single sendmsg(2) can carry several netlink messages back-to-back; the
+ * kernel module replies to each (echoing the sequence # nlmsg_seq), coalescing
+ * the replies into as few skb's as possible.
+ */
+#define LLKD_NL_REPLY_MSG       "Reply from kernel netlink"
+
+/*
+ * Bulk mode.
+ * Send a (payload-less) LLKD_NLMSG_DUMP_THREADS request with the
+ * NLM_F_REQUEST | NLM_F_DUMP flags set, and the kernel module streams back a
+ * snapshot of all threads alive on the system as an array of
+ * struct llkd_nl_thrd_rec records. The records are packed as many per
+ * message as fit, one (NLM_F_MULTI) LLKD_NLMSG_THRD_RECS message per skb;
+ * the stream ends with a NLMSG_DONE message.
+ * The kernel sizes each skb to (at least) what your recvmsg(2) buffer can
+ * take (subject to an internal cap), so use a large receive buffer (and a
+ * large SO_RCVBUF) to get more records per skb (and fewer syscalls).
+ */
+#define LLKD_NLMSG_DUMP_THREADS (NLMSG_MIN_TYPE + 2)
+#define LLKD_NLMSG_THRD_RECS    (NLMSG_MIN_TYPE + 3)
+
+#define LLKD_NL_COMMLEN         16	/* == TASK_COMM_LEN */
+
+/* Keep it a multiple of 4 bytes (NLMSG_ALIGNTO); it's 32 bytes */
+struct llkd_nl_thrd_rec {
+	__s32 tgid;
+	__s32 pid;
+	__u32 flags;		/* the task's PF_* flags */
+	__s32 nr_threads;	/* # of threads in this thread group */
+	char comm[LLKD_NL_COMMLEN];
+};
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * netlink_bench.c
+ *
+ ***********************************************************
+ * Brief Description
+ * A throughput / latency benchmark for the netlink_simple_intf kernel module.
+ *
+ * Request/reply mode (the default): for each batch size (1, 2, 4, ... up to
+ * -B max), repeatedly send a batch of messages in one sendmsg(2) and receive
+ * all the (coalesced) replies; the time taken for this is one round trip.
+ * Reports msgs/sec and the p50/p99 round-trip latency per batch size.
+ *
+ * Bulk (dump) mode (-D): for each receive buffer size (4 KB, 8 KB, ... up to
+ * -R max), repeatedly have the kernel stream a snapshot of all threads (as
+ * struct llkd_nl_thrd_rec records packed many per skb); the time to receive
+ * the whole dump is one round trip. Reports records/sec, the average # of
+ * records per skb and the p50/p99 per-dump latency per buffer size.
+ * (The kernel sizes each dump skb to the largest recvmsg(2) buffer it has
+ * seen on the socket - capped at 32 KB - so the sweep goes small to large;
+ * leave the module's dump_min_alloc parameter at 0 for it to be meaningful.)
+ *
+ * -c emits CSV instead of a table, for plotting / comparison with the other
+ * kernel-user channels (procfs, sysfs, debugfs, ioctl).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <time.h>
+#include <errno.h>
+#include "../netlink_simple_intf.h"	/* NETLINK_MY_UNIT_PROTO, ... */
+
+#define MAXBATCH	1024
+#define MAXRXBUF	(1024*1024)
+#define NLSOCKBUF	(8*1024*1024)
+#define MAXSAMPLES	(1024*1024)	/* latency samples kept per run */
+
+static const char *thedata = "sample user data to send to kernel via netlink";
+static int csv;
+
+static inline double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s [-B maxbatch] [-D [-R maxrxbuf]] [-d secs] [-c]\n"
+		" -B maxbatch : sweep the batch size 1, 2, 4, ... maxbatch (default 256, max %d)\n"
+		" -D          : bulk mode; time thread dumps instead of request/reply\n"
+		" -R maxrxbuf : (bulk mode) sweep the recv buffer size 4 KB, 8 KB, ...\n"
+		"               maxrxbuf bytes (default 64 KB, max %d)\n"
+		" -d secs     : duration of each run (default 2)\n"
+		" -c          : CSV output\n",
+		prg, MAXBATCH, MAXRXBUF);
+}
+
+static int nl_open(void)
+{
+	struct sockaddr_nl src_nl;
+	int sd, bufsz = NLSOCKBUF;
+
+	sd = socket(PF_NETLINK, SOCK_RAW, NETLINK_MY_UNIT_PROTO);
+	if (sd < 0) {
+		perror("netlink_bench: netlink socket creation failed");
+		return -1;
+	}
+	/* Large socket buffers: a whole batch of replies (or a dump skb of
+	 * the largest size we ask for) must fit */
+	setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+	setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+
+	memset(&src_nl, 0, sizeof(src_nl));
+	src_nl.nl_family = AF_NETLINK;
+	src_nl.nl_pid = 0;	/* let the kernel assign a unique port id */
+	if (bind(sd, (struct sockaddr *)&src_nl, sizeof(src_nl)) < 0) {
+		perror("netlink_bench: bind failed");
+		close(sd);
+		return -1;
+	}
+	return sd;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The @pct'th percentile of the @n (sorted) samples in @v */
+static inline double pctile(const double *v, long n, int pct)
+{
+	long i = (n * pct + 99) / 100 - 1;
+
+	return n ? v[i < 0 ? 0 : i] : 0.0;
+}
+
+static void report_hdr(int bulk)
+{
+	if (csv)
+		printf("channel,%s,iters,%s,p50_us,p99_us\n",
+			bulk ? "rxbuf_bytes" : "batch",
+			bulk ? "recs_per_sec,recs_per_skb" : "msgs_per_sec,msgs_per_skb");
+	else
+		printf("%10s %10s %14s %12s %10s %10s\n",
+			bulk ? "rxbuf" : "batch", "iters",
+			bulk ? "recs/sec" : "msgs/sec",
+			bulk ? "recs/skb" : "msgs/skb", "p50(us)", "p99(us)");
+}
+
+static void report(int bulk, long x, long iters, double persec, double perskb,
+		   double *lat, long nlat)
+{
+	qsort(lat, nlat, sizeof(double), cmp_double);
+	if (csv)
+		printf("netlink%s,%ld,%ld,%.0f,%.1f,%.2f,%.2f\n",
+			bulk ? "_dump" : "", x, iters, persec, perskb,
+			pctile(lat, nlat, 50) * 1e6, pctile(lat, nlat, 99) * 1e6);
+	else
+		printf("%10ld %10ld %14.0f %12.1f %10.2f %10.2f\n",
+			x, iters, persec, perskb,
+			pctile(lat, nlat, 50) * 1e6, pctile(lat, nlat, 99) * 1e6);
+	fflush(stdout);
+}
+
+/*
+ * One request/reply run: @batch messages per sendmsg(2), for @secs seconds.
+ * Returns 0 on success, -1 on failure.
+ */
+static int run_batch(int sd, const char *prg, int batch, int secs,
+		     char *rxbuf, double *lat)
+{
+	int size = strlen(thedata) + 1;
+	size_t txlen = (size_t)batch * NLMSG_SPACE(size);
+	struct sockaddr_nl dest_nl;
+	struct nlmsghdr *nlh;
+	struct iovec iov;
+	struct msghdr msg;
+	long iters = 0, nlat = 0, skbs = 0, pending;
+	unsigned int seq = 0;
+	double start, t0, t;
+	char *txbuf;
+	ssize_t n;
+	int i;
+
+	txbuf = calloc(1, txlen);
+	if (!txbuf) {
+		fprintf(stderr, "%s: out of memory!\n", prg);
+		return -1;
+	}
+	for (i = 0; i < batch; i++) {
+		nlh = (struct nlmsghdr *)(txbuf + i * NLMSG_SPACE(size));
+		nlh->nlmsg_len = NLMSG_LENGTH(size);
+		nlh->nlmsg_type = NLMSG_MIN_TYPE;
+		nlh->nlmsg_flags = NLM_F_REQUEST;
+		memcpy(NLMSG_DATA(nlh), thedata, size);
+	}
+	memset(&dest_nl, 0, sizeof(dest_nl));
+	dest_nl.nl_family = AF_NETLINK;	/* nl_pid 0 => destined for the kernel */
+	iov.iov_base = txbuf;
+	iov.iov_len = txlen;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &dest_nl;
+	msg.msg_namelen = sizeof(dest_nl);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	start = t = now_sec();
+	while (t - start < secs) {
+		for (i = 0; i < batch; i++)
+			((struct nlmsghdr *)(txbuf + i * NLMSG_SPACE(size)))->nlmsg_seq = seq++;
+		t0 = t;
+		if (sendmsg(sd, &msg, 0) < 0) {
+			perror("netlink_bench: sendmsg(2) failed");
+			goto out_fail;
+		}
+		for (pending = batch; pending > 0; skbs++) {
+			n = recv(sd, rxbuf, MAXRXBUF, 0);
+			if (n < 0) {
+				perror("netlink_bench: recv(2) failed");
+				goto out_fail;
+			}
+			for (nlh = (struct nlmsghdr *)rxbuf; NLMSG_OK(nlh, n);
+			     nlh = NLMSG_NEXT(nlh, n))
+				if (nlh->nlmsg_type == LLKD_NLMSG_REPLY)
+					pending--;
+		}
+		t = now_sec();
+		if (nlat < MAXSAMPLES)
+			lat[nlat++] = t - t0;
+		iters++;
+	}
+	report(0, batch, iters, iters * batch / (t - start),
+	       (double)iters * batch / skbs, lat, nlat);
+	free(txbuf);
+	return 0;
+
+ out_fail:
+	free(txbuf);
+	return -1;
+}
+
+/*
+ * One bulk mode run: thread dumps, received with a @rxbufsz byte buffer, for
+ * @secs seconds. Returns 0 on success, -1 on failure.
+ */
+static int run_dump(int sd, const char *prg, int rxbufsz, int secs,
+		    char *rxbuf, double *lat)
+{
+	struct sockaddr_nl dest_nl;
+	struct nlmsghdr req, *nlh;
+	long iters = 0, nlat = 0, skbs = 0, recs = 0;
+	unsigned int seq = 0;
+	double start, t0, t;
+	ssize_t n;
+	int done;
+
+	memset(&dest_nl, 0, sizeof(dest_nl));
+	dest_nl.nl_family = AF_NETLINK;
+	memset(&req, 0, sizeof(req));
+	req.nlmsg_len = NLMSG_LENGTH(0);
+	req.nlmsg_type = LLKD_NLMSG_DUMP_THREADS;
+	req.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+
+	start = t = now_sec();
+	while (t - start < secs) {
+		req.nlmsg_seq = ++seq;
+		t0 = t;
+		if (sendto(sd, &req, req.nlmsg_len, 0,
+			   (struct sockaddr *)&dest_nl, sizeof(dest_nl)) < 0) {
+			perror("netlink_bench: sendto(2) failed");
+			return -1;
+		}
+		for (done = 0; !done; ) {
+			/* the size of our buffer determines the size of the
+			 * skb the kernel fills next */
+			n = recv(sd, rxbuf, rxbufsz, 0);
+			if (n < 0) {
+				perror("netlink_bench: recv(2) failed");
+				return -1;
+			}
+			skbs++;
+			for (nlh = (struct nlmsghdr *)rxbuf; NLMSG_OK(nlh, n);
+			     nlh = NLMSG_NEXT(nlh, n)) {
+				if (nlh->nlmsg_seq != seq)
+					continue;	/* a stray reply */
+				if (nlh->nlmsg_type == NLMSG_DONE) {
+					done = 1;
+					skbs--;	/* don't count the final (empty) one */
+					break;
+				}
+				if (nlh->nlmsg_type == NLMSG_ERROR) {
+					fprintf(stderr, "%s: dump request failed (err=%d)\n",
+						prg, ((struct nlmsgerr *)NLMSG_DATA(nlh))->error);
+					return -1;
+				}
+				if (nlh->nlmsg_type == LLKD_NLMSG_THRD_RECS)
+					recs += NLMSG_PAYLOAD(nlh, 0) /
+						sizeof(struct llkd_nl_thrd_rec);
+			}
+		}
+		t = now_sec();
+		if (nlat < MAXSAMPLES)
+			lat[nlat++] = t - t0;
+		iters++;
+	}
+	report(1, rxbufsz, iters, recs / (t - start),
+	       skbs ? (double)recs / skbs : 0.0, lat, nlat);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int maxbatch = 256, maxrxbuf = 64 * 1024, secs = 2, bulk = 0, opt, x;
+	int sd, ret = EXIT_FAILURE;
+	char *rxbuf;
+	double *lat;
+
+	while ((opt = getopt(argc, argv, "B:DR:d:ch")) != -1) {
+		switch (opt) {
+		case 'B':
+			maxbatch = atoi(optarg);
+			break;
+		case 'D':
+			bulk = 1;
+			break;
+		case 'R':
+			maxrxbuf = atoi(optarg);
+			break;
+		case 'd':
+			secs = atoi(optarg);
+			break;
+		case 'c':
+			csv = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (maxbatch < 1 || maxbatch > MAXBATCH || maxrxbuf < 4096 ||
+	    maxrxbuf > MAXRXBUF || secs < 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	rxbuf = malloc(MAXRXBUF);
+	lat = malloc(MAXSAMPLES * sizeof(double));
+	if (!rxbuf || !lat) {
+		fprintf(stderr, "%s: out of memory!\n", argv[0]);
+		goto out_free;
+	}
+	sd = nl_open();
+	if (sd < 0)
+		goto out_free;
+
+	report_hdr(bulk);
+	if (bulk) {
+		for (x = 4096; x <= maxrxbuf; x *= 2)
+			if (run_dump(sd, argv[0], x, secs, rxbuf, lat) < 0)
+				goto out_close;
+	} else {
+		for (x = 1; x <= maxbatch; x *= 2)
+			if (run_batch(sd, argv[0], x, secs, rxbuf, lat) < 0)
+				goto out_close;
+	}
+	ret = EXIT_SUCCESS;
+
+ out_close:
+	close(sd);
+ out_free:
+	free(lat);
+	free(rxbuf);
+	exit(ret);
+}
@@ -3,7 +3,15 @@
  *
  ***********************************************************
  * Brief Description
- *
+ * Userspace peer of the netlink_simple_intf kernel module.
+ * Run without arguments, it's a simple (and verbose) demo: it sends one
+ * message to the kernel via netlink and displays the reply.
+ * With options, it becomes a persistent load generator: it keeps it's netlink
+ * socket open and sends batches of messages (many per sendmsg(2)) at a
+ * configurable rate for a given duration, receiving and counting the
+ * (coalesced) replies and reporting throughput every second. With -l, it
+ * instead just listens on the module's multicast group, counting the replies
+ * fanned out to it.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,14 +20,235 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <linux/netlink.h>
+#include <time.h>
+#include <errno.h>
+#include "../netlink_simple_intf.h"	/* NETLINK_MY_UNIT_PROTO, ... */
 
-#define NETLINK_MY_UNIT_PROTO  31
-  // kernel netlink protocol # (regd by our kernel module)
 #define NLSPACE              1024
 
 static const char *thedata = "sample user data to send to kernel via netlink";
 
-int main(int argc, char **argv)
+/*--- The load generator ---*/
+#define MAXBATCH	1024
+#define RXBUFSZ		(64*1024)
+#define NLSOCKBUF	(4*1024*1024)
+
+static inline double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s [-r rate] [-b batch] [-s size] [-d secs] | [-l]\n"
+		" (no options: send one message and display the reply)\n"
+		" -r rate  : target rate in messages/sec (default 0 => as fast as possible)\n"
+		" -b batch : # of messages per sendmsg(2) (default 1, max %d)\n"
+		" -s size  : payload size (bytes) per message (default %zu, max %d)\n"
+		" -d secs  : duration to run for (default 5)\n"
+		" -l       : listen-only; join the kernel's multicast group and count\n"
+		"            the replies fanned out to it (until interrupted)\n",
+		prg, MAXBATCH, strlen(thedata) + 1, NLSPACE);
+}
+
+/* Get a netlink socket bound to our port id (and to @groups, if any) */
+static int nl_open(unsigned int groups)
+{
+	struct sockaddr_nl src_nl;
+	int sd, bufsz = NLSOCKBUF;
+
+	sd = socket(PF_NETLINK, SOCK_RAW, NETLINK_MY_UNIT_PROTO);
+	if (sd < 0) {
+		perror("netlink_u: netlink socket creation failed");
+		return -1;
+	}
+	/* Large socket buffers, so that bursts of replies aren't dropped */
+	setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+	setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+
+	memset(&src_nl, 0, sizeof(src_nl));
+	src_nl.nl_family = AF_NETLINK;
+	src_nl.nl_pid = 0;	/* let the kernel assign a unique port id */
+	src_nl.nl_groups = groups;
+	if (bind(sd, (struct sockaddr *)&src_nl, sizeof(src_nl)) < 0) {
+		perror("netlink_u: bind failed");
+		close(sd);
+		return -1;
+	}
+	return sd;
+}
+
+/* Count the reply messages in the @len bytes received in @buf */
+static long count_replies(char *buf, ssize_t len)
+{
+	struct nlmsghdr *nlh;
+	long n = 0;
+
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+	     nlh = NLMSG_NEXT(nlh, len))
+		if (nlh->nlmsg_type == LLKD_NLMSG_REPLY)
+			n++;
+	return n;
+}
+
+/* Listen-only mode: count the replies multicast to our group */
+static int listener(const char *prg)
+{
+	char *rxbuf = malloc(RXBUFSZ);
+	long total = 0, persec = 0;
+	double t0 = now_sec(), t;
+	ssize_t nrecv;
+	int sd;
+
+	if (!rxbuf)
+		return EXIT_FAILURE;
+	sd = nl_open(1 << (LLKD_NL_GRP_REPLIES - 1));
+	if (sd < 0) {
+		free(rxbuf);
+		return EXIT_FAILURE;
+	}
+	printf("%s: listening on multicast group %d ...\n", prg,
+		LLKD_NL_GRP_REPLIES);
+	for (;;) {
+		nrecv = recv(sd, rxbuf, RXBUFSZ, 0);
+		if (nrecv < 0) {
+			if (errno == ENOBUFS) {	/* we couldn't keep up */
+				fprintf(stderr, "%s: overrun, replies lost\n", prg);
+				continue;
+			}
+			perror("netlink_u: recv(2) failed");
+			break;
+		}
+		persec += count_replies(rxbuf, nrecv);
+		t = now_sec();
+		if (t - t0 >= 1.0) {
+			total += persec;
+			printf("%s: %8.0f msgs/sec (total %ld)\n", prg,
+				persec / (t - t0), total);
+			persec = 0;
+			t0 = t;
+		}
+	}
+	close(sd);
+	free(rxbuf);
+	return EXIT_FAILURE;
+}
+
+/*
+ * loadgen
+ * Send @batch messages of @size payload bytes per sendmsg(2), paced to
+ * @rate msgs/sec (0 => unpaced), for @secs seconds; after each send, receive
+ * all the replies to the batch.
+ */
+static int loadgen(const char *prg, long rate, int batch, int size, int secs)
+{
+	struct sockaddr_nl dest_nl;
+	struct nlmsghdr *nlh;
+	struct iovec iov;
+	struct msghdr msg;
+	char *txbuf, *rxbuf;
+	size_t txlen = (size_t)batch * NLMSG_SPACE(size);
+	long sent = 0, rcvd = 0, last_sent = 0, last_rcvd = 0, pending;
+	unsigned int seq = 0;
+	double start, next, tick, interval = 0.0, t;
+	ssize_t n;
+	int sd, i, ret = EXIT_FAILURE;
+	struct timespec ts;
+
+	txbuf = calloc(1, txlen);
+	rxbuf = malloc(RXBUFSZ);
+	if (!txbuf || !rxbuf) {
+		fprintf(stderr, "%s: out of memory!\n", prg);
+		goto out_free;
+	}
+	sd = nl_open(0);
+	if (sd < 0)
+		goto out_free;
+
+	/* Setup the batch: 'batch' netlink messages back-to-back; we only
+	 * update their seq #'s per send */
+	for (i = 0; i < batch; i++) {
+		nlh = (struct nlmsghdr *)(txbuf + i * NLMSG_SPACE(size));
+		nlh->nlmsg_len = NLMSG_LENGTH(size);
+		nlh->nlmsg_type = NLMSG_MIN_TYPE;
+		nlh->nlmsg_flags = NLM_F_REQUEST;
+		snprintf(NLMSG_DATA(nlh), size, "%s", thedata);
+	}
+	memset(&dest_nl, 0, sizeof(dest_nl));
+	dest_nl.nl_family = AF_NETLINK;	/* nl_pid 0 => destined for the kernel */
+	iov.iov_base = txbuf;
+	iov.iov_len = txlen;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &dest_nl;
+	msg.msg_namelen = sizeof(dest_nl);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (rate > 0)
+		interval = (double)batch / rate;	/* secs per batch */
+	printf("%s: rate=%ld%s msgs/sec, batch=%d, size=%d bytes, duration=%ds\n",
+		prg, rate, rate ? "" : " (unpaced)", batch, size, secs);
+
+	start = next = tick = now_sec();
+	while ((t = now_sec()) - start < secs) {
+		for (i = 0; i < batch; i++)
+			((struct nlmsghdr *)(txbuf + i * NLMSG_SPACE(size)))->nlmsg_seq = seq++;
+		if (sendmsg(sd, &msg, 0) < 0) {
+			perror("netlink_u: sendmsg(2) failed");
+			goto out_close;
+		}
+		sent += batch;
+
+		/* The kernel processes our messages synchronously, within the
+		 * sendmsg(); so, the replies are already queued up for us */
+		pending = batch;
+		while (pending > 0) {
+			n = recv(sd, rxbuf, RXBUFSZ, 0);
+			if (n < 0) {
+				perror("netlink_u: recv(2) failed");
+				goto out_close;
+			}
+			i = count_replies(rxbuf, n);
+			rcvd += i;
+			pending -= i;
+		}
+
+		if (t - tick >= 1.0) {
+			printf("%s: %8.0f msgs/sec sent, %8.0f replies/sec\n", prg,
+				(sent - last_sent) / (t - tick),
+				(rcvd - last_rcvd) / (t - tick));
+			last_sent = sent;
+			last_rcvd = rcvd;
+			tick = t;
+		}
+		if (interval > 0.0) {	/* pace it */
+			next += interval;
+			t = now_sec();
+			if (next > t) {
+				ts.tv_sec = (time_t)(next - t);
+				ts.tv_nsec = (long)((next - t - ts.tv_sec) * 1e9);
+				nanosleep(&ts, NULL);
+			}
+		}
+	}
+	t = now_sec() - start;
+	printf("%s: total: %ld msgs sent, %ld replies received in %.2fs"
+		" => %.0f msgs/sec\n", prg, sent, rcvd, t, sent / t);
+	ret = EXIT_SUCCESS;
+
+ out_close:
+	close(sd);
+ out_free:
+	free(rxbuf);
+	free(txbuf);
+	return ret;
+}
+
+/*--- The simple (one message) demo ---*/
+static int oneshot(char **argv)
 {
 	int sd;
 	struct sockaddr_nl src_nl, dest_nl;
@@ -108,11 +337,53 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 	printf("%s:recvmsg(): *** success, received %ld bytes:"
-		"\nmsg from kernel netlink: \"%s\"\n",
-		argv[0], nrecv, (char *)NLMSG_DATA(nlhdr));
+		"\nmsg from kernel netlink: \"%.*s\"\n",
+		argv[0], nrecv, (int)NLMSG_PAYLOAD(nlhdr, 0),
+		(char *)NLMSG_DATA(nlhdr));
 
 	/* Shut shop */
 	free(nlhdr);
 	close(sd);
-	exit(EXIT_SUCCESS);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	long rate = 0;
+	int batch = 1, size = strlen(thedata) + 1, secs = 5, listen = 0, opt;
+
+	if (argc == 1)
+		exit(oneshot(argv));
+
+	while ((opt = getopt(argc, argv, "r:b:s:d:lh")) != -1) {
+		switch (opt) {
+		case 'r':
+			rate = atol(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'd':
+			secs = atoi(optarg);
+			break;
+		case 'l':
+			listen = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (rate < 0 || batch < 1 || batch > MAXBATCH || size < 1 ||
+	    size > NLSPACE || secs < 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (listen)
+		exit(listener(argv[0]));
+	exit(loadgen(argv[0], rate, batch, size, secs));
 }
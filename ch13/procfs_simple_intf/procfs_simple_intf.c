@@ -14,11 +14,11 @@
  * Simple kernel module to demo interfacing with userspace via procfs.
  * In order to demonstrate (and let you easily contrast) the different ways
  * in which one can create interfaces between the kernel and userspace,
- * we issue appropriate kernel APIs to have the interface create four 'files'
+ * we issue appropriate kernel APIs to have the interface create five 'files'
  * or 'objects'.
- * In this particular case, the interface is via procfs, so we create four
+ * In this particular case, the interface is via procfs, so we create five
  * procfs 'objects' - pseudo-files - under a directory whose name is the name
- * given to this kernel module. These four procfs 'files', what they are named
+ * given to this kernel module. These five procfs 'files', what they are named
  * and meant for is summarized below:
  * /proc
  *  ...
@@ -27,6 +27,7 @@
  *      |---llkdproc_show_pgoff
  *      |---llkdproc_show_drvctx
  *      |---llkdproc_config1
+ *      |---llkdproc_drvctx_blob
  *
  * Summary of our proc files and how they can be used (R=>read,W=>write)
  * (1) llkdproc_dbg_level   : RW
@@ -49,6 +50,21 @@
  *      file perms: 0644
  *  (for fun, we treat this value 'config1' as also representing the
  *   driver debug_level)
+ * (5) llkdproc_drvctx_blob : R-
+ *      R: read retrieves a consistent snapshot of the whole driver context
+ *         (and debug_level) as a fixed-layout, versioned binary struct
+ *         llkd_drvctx_blob (see procfs_simple_intf.h); one pread(2) at
+ *         offset 0 per sample
+ *      file perms: 0440
+ *
+ * The files are read far more often than written; so, readers take no
+ * locks at all:
+ *  - the driver context's configuration is published via RCU: a writer
+ *    (serialized by the mutex) copies it, updates the copy and swaps the
+ *    (global) pointer over, the old copy being freed after a grace period;
+ *  - it's (frequently updated, by the 'datapath') scalar statistics are
+ *    under a seqcount: readers retry on a concurrent update;
+ *  - debug_level is a single int, read and written with {READ|WRITE}_ONCE().
  *
  * For details, please refer the book, Ch 12.
  */
@@ -56,6 +72,8 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/proc_fs.h>  /* procfs APIs etc */
@@ -69,6 +87,8 @@
 #include <asm/uaccess.h>
 #endif
 
+#include "procfs_simple_intf.h"
+
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LLKD book:ch12/procfs_simple_intf: simple procfs interfacing demo");
 MODULE_LICENSE("Dual MIT/GPL");
@@ -83,6 +103,8 @@ MODULE_VERSION("0.1");
 #define	PROC_FILE3_PERMS	0440
 #define	PROC_FILE4		"llkdproc_config1"
 #define	PROC_FILE4_PERMS	0644
+#define	PROC_FILE5		"llkdproc_drvctx_blob"
+#define	PROC_FILE5_PERMS	0440
 
 //--- our MSG() macro
 #ifdef DEBUG
@@ -94,33 +116,134 @@ MODULE_VERSION("0.1");
 #define MSG(string, args...)
 #endif
 
-/* We use a mutex lock; details in Ch 15 and Ch 16 */
+/* We use a mutex lock - now, for writers only; details in Ch 15 and Ch 16 */
 DEFINE_MUTEX(mtx);
 
 /* Borrowed from ch11; the 'driver context' data structure;
  * all relevant 'state info' reg the driver and (fictional) 'device'
  * is maintained here.
+ * Readers access it under rcu_read_lock() only; writers replace it (see
+ * drvctx_update_config1()).
  */
 struct drv_ctx {
-	int tx, rx, err, myword, power;
 	u32 config1; /* treated as equivalent to 'debug level' of our driver */
 	u32 config2;
 	u64 config3;
-#define MAXBYTES   128
+#define MAXBYTES   LLKD_DRVCTX_SECRETLEN
 	char oursecret[MAXBYTES];
+	struct rcu_head rcu;
+};
+static struct drv_ctx __rcu *gdrvctx;
+
+/* The driver's scalar statistics; updated in place, under the seqcount */
+struct drv_stats {
+	int tx, rx, err, myword, power;
 };
-static struct drv_ctx *gdrvctx;
+static struct drv_stats gstats;
 static int debug_level; /* 'off' (0) by default ... */
+/* gseq covers gstats, and - for the benefit of readers wanting a consistent
+ * snapshot of everything (the stats blob) - the publication of a new
+ * gdrvctx and debug_level as well; writers: hold mtx, and keep preemption
+ * off across the write section (mtx being a sleeping lock, a reader that
+ * preempted the writer on its CPU would otherwise spin on it for good) */
+static seqcount_t gseq = SEQCNT_ZERO(gseq);
+
+/*
+ * Publish a new driver context, with config1 - and so, the debug_level - set
+ * to @config1: copy, update, swap; the old one's freed once all current
+ * readers are done with it. Call with mtx held.
+ */
+static int drvctx_update_config1(u32 config1)
+{
+	struct drv_ctx *old = rcu_dereference_protected(gdrvctx,
+					lockdep_is_held(&mtx));
+	struct drv_ctx *new = kmemdup(old, sizeof(*old), GFP_KERNEL);
+
+	if (!new)
+		return -ENOMEM;
+	new->config1 = config1;
+	preempt_disable();
+	write_seqcount_begin(&gseq);
+	rcu_assign_pointer(gdrvctx, new);
+	WRITE_ONCE(debug_level, config1);
+	write_seqcount_end(&gseq);
+	preempt_enable();
+	kfree_rcu(old, rcu);
+	return 0;
+}
+
+/* Update a statistic; call with mtx held (or under any other writer lock) */
+static inline void drvstats_set_power(int power)
+{
+	preempt_disable();
+	write_seqcount_begin(&gseq);
+	gstats.power = power;
+	write_seqcount_end(&gseq);
+	preempt_enable();
+}
+
+/*------------------ proc file 5 -------------------------------------*/
+/*
+ * Our proc file 5: the binary stats blob. Every read at offset 0 takes a
+ * fresh snapshot; under gseq, so that it's consistent across the stats, the
+ * configuration and debug_level.
+ */
+static void drvctx_snapshot(struct llkd_drvctx_blob *b)
+{
+	struct drv_ctx *ctx;
+	unsigned int sq;
+
+	memset(b, 0, sizeof(*b));
+	b->magic = LLKD_DRVCTX_BLOB_MAGIC;
+	b->version = LLKD_DRVCTX_BLOB_VERSION;
+	b->size = sizeof(*b);
+	rcu_read_lock();
+	do {
+		sq = read_seqcount_begin(&gseq);
+		ctx = rcu_dereference(gdrvctx);
+		b->seq = sq;
+		b->debug_level = READ_ONCE(debug_level);
+		b->tx = gstats.tx;
+		b->rx = gstats.rx;
+		b->err = gstats.err;
+		b->myword = gstats.myword;
+		b->power = gstats.power;
+		b->config1 = ctx->config1;
+		b->config2 = ctx->config2;
+		b->config3 = ctx->config3;
+		memcpy(b->oursecret, ctx->oursecret, sizeof(b->oursecret));
+	} while (read_seqcount_retry(&gseq, sq));
+	rcu_read_unlock();
+	b->oursecret[sizeof(b->oursecret) - 1] = '\0';
+}
+
+static ssize_t myproc_read_drvctx_blob(struct file *filp, char __user *ubuf,
+				       size_t count, loff_t *off)
+{
+	struct llkd_drvctx_blob b;
+
+	if (*off >= sizeof(b))
+		return 0;
+	drvctx_snapshot(&b);
+	return simple_read_from_buffer(ubuf, count, off, &b, sizeof(b));
+}
+
+static const struct file_operations fops_drvctx_blob = {
+	.owner = THIS_MODULE,
+	.read = myproc_read_drvctx_blob,
+	.llseek = default_llseek,
+};
 
 /*------------------ proc file 4 -------------------------------------*/
 /* Our proc file 4: displays the current driver context 'config1' value */
 static int proc_show_config1(struct seq_file *seq, void *v)
 {
-	if (mutex_lock_interruptible(&mtx))
-		return -ERESTARTSYS;
-	seq_printf(seq, "%s:config1:%d,0x%x\n",
-		OURMODNAME, gdrvctx->config1, gdrvctx->config1);
-	mutex_unlock(&mtx);
+	u32 config1;
+
+	rcu_read_lock();
+	config1 = rcu_dereference(gdrvctx)->config1;
+	rcu_read_unlock();
+	seq_printf(seq, "%s:config1:%d,0x%x\n", OURMODNAME, config1, config1);
 	return 0;
 }
 
@@ -148,9 +271,10 @@ static ssize_t myproc_write_config1(struct file *filp, const char __user *ubuf,
 	ret = kstrtoul(buf, 0, &configval);
 	if (ret)
 		goto out;
-	gdrvctx->config1 = configval;
-	/* As we're treating 'config1' as the 'debug level', update it */
-	debug_level = configval;
+	/* As we're treating 'config1' as the 'debug level', it's updated too */
+	ret = drvctx_update_config1(configval);
+	if (ret)
+		goto out;
 	ret = count;
 out:
 	mutex_unlock(&mtx);
@@ -175,17 +299,27 @@ static const struct file_operations fops_rdwr_config1 = {
 /* Our proc file 3: displays the 'driver context' data structure */
 static int proc_show_drvctx(struct seq_file *seq, void *v)
 {
-	if (mutex_lock_interruptible(&mtx))
-		return -ERESTARTSYS;
+	struct drv_stats st;
+	struct drv_ctx *ctx;
+	unsigned int sq;
+
+	/* a consistent snapshot of the statistics; retry if they changed */
+	do {
+		sq = read_seqcount_begin(&gseq);
+		st = gstats;
+	} while (read_seqcount_retry(&gseq, sq));
+
+	rcu_read_lock();
+	ctx = rcu_dereference(gdrvctx);
 	seq_printf(seq, "prodname:%s\n"
 			"tx:%d,rx:%d,err:%d,myword:%d,power:%d\n"
 			"config1:0x%x,config2:0x%x,config3:0x%llx\n"
 			"oursecret:%s\n",
 	OURMODNAME,
-	gdrvctx->tx, gdrvctx->rx, gdrvctx->err, gdrvctx->myword, gdrvctx->power,
-	gdrvctx->config1, gdrvctx->config2, gdrvctx->config3,
-	gdrvctx->oursecret);
-	mutex_unlock(&mtx);
+	st.tx, st.rx, st.err, st.myword, st.power,
+	ctx->config1, ctx->config2, ctx->config3,
+	ctx->oursecret);
+	rcu_read_unlock();
 	return 0;
 }
 
@@ -212,7 +346,7 @@ static struct drv_ctx *alloc_init_drvctx(void)
 	drvctx->config1 = 0x0;
 	drvctx->config2 = 0x48524a5f;
 	drvctx->config3 = 0x424c0a52;
-	drvctx->power = 1;
+	gstats.power = 1;	/* (no readers yet) */
 	strncpy(drvctx->oursecret, "AhA xxx", 8);
 
 	MSG("allocated and init the driver context structure\n");
@@ -239,7 +373,7 @@ static ssize_t myproc_write_debug_level(
 		loff_t *off)
 {
 	char buf[12];
-	int ret = count;
+	int ret = count, newlevel;
 
 	if (mutex_lock_interruptible(&mtx))
 		return -ERESTARTSYS;
@@ -254,15 +388,17 @@ static ssize_t myproc_write_debug_level(
 	}
 	buf[count - 1] = '\0';
 	MSG("user sent: buf = %s\n", buf);
-	ret = kstrtoint(buf, 0, &debug_level); /* update it! */
+	/* parse into a local, so that (lockless) readers never see an
+	 * invalid value */
+	ret = kstrtoint(buf, 0, &newlevel);
 	if (ret)
 		goto out;
-	if (debug_level < DEBUG_LEVEL_MIN || debug_level > DEBUG_LEVEL_MAX) {
+	if (newlevel < DEBUG_LEVEL_MIN || newlevel > DEBUG_LEVEL_MAX) {
 		pr_info("%s: trying to set invalid value for debug_level\n"
 			" [allowed range: %d-%d]\n",
 			OURMODNAME, DEBUG_LEVEL_MIN, DEBUG_LEVEL_MAX);
-		debug_level = DEBUG_LEVEL_DEFAULT;
-		ret = -EFAULT;
+		/* reset to the default - via config1, like any other update */
+		ret = drvctx_update_config1(DEBUG_LEVEL_DEFAULT) ?: -EINVAL;
 		goto out;
 	}
 
@@ -271,7 +407,9 @@ static ssize_t myproc_write_debug_level(
 
 	/* just for fun, lets say that our drv ctx 'config1'
 	   represents the debug level */
-	gdrvctx->config1 = debug_level;
+	ret = drvctx_update_config1(newlevel);	/* update it! */
+	if (ret)
+		goto out;
 	ret = count;
 out:
 	mutex_unlock(&mtx);
@@ -281,10 +419,7 @@ out:
 /* Our proc file 1: displays the current value of debug_level */
 static int proc_show_debug_level(struct seq_file *seq, void *v)
 {
-	if (mutex_lock_interruptible(&mtx))
-		return -ERESTARTSYS;
-	seq_printf(seq, "debug_level:%d\n", debug_level);
-	mutex_unlock(&mtx);
+	seq_printf(seq, "debug_level:%d\n", READ_ONCE(debug_level));
 	return 0;
 }
 
@@ -306,6 +441,7 @@ static struct proc_dir_entry *gprocdir;
 
 static int __init procfs_simple_intf_init(void)
 {
+	struct drv_ctx *ctx;
 	int stat = 0;
 
 	if(!IS_ENABLED(CONFIG_PROC_FS)) {
@@ -355,12 +491,13 @@ static int __init procfs_simple_intf_init(void)
 	 * When read from userspace, the callback function will dump the content
 	 * of our 'driver context' data structure.
 	 */
-	gdrvctx = alloc_init_drvctx();
-	if (IS_ERR(gdrvctx)) {
+	ctx = alloc_init_drvctx();
+	if (IS_ERR(ctx)) {
 		pr_warn("%s: drv ctx alloc failed, aborting...\n", OURMODNAME);
-		stat = PTR_ERR(gdrvctx);
+		stat = PTR_ERR(ctx);
 		goto out_fail_2;
 	}
+	RCU_INIT_POINTER(gdrvctx, ctx);
 	if (!proc_create(PROC_FILE3, PROC_FILE3_PERMS, gprocdir,
 			&fops_show_drvctx)) {
 		pr_warn("%s: proc_create [3] failed, aborting...\n", OURMODNAME);
@@ -379,11 +516,21 @@ static int __init procfs_simple_intf_init(void)
 	}
 	MSG("proc file 4 (/proc/%s/%s) created\n", OURMODNAME, PROC_FILE4);
 
+	/* 5. Create the PROC_FILE5 proc entry under the parent dir OURMODNAME;
+	 * the 'binary driver context snapshot' (pseudo) file
+	 */
+	if (!proc_create(PROC_FILE5, PROC_FILE5_PERMS, gprocdir, &fops_drvctx_blob)) {
+		pr_warn("%s: proc_create [5] failed, aborting...\n", OURMODNAME);
+		stat = -ENOMEM;
+		goto out_fail_3;
+	}
+	MSG("proc file 5 (/proc/%s/%s) created\n", OURMODNAME, PROC_FILE5);
+
 	pr_info("%s initialized\n", OURMODNAME);
 	return 0;	/* success */
 
  out_fail_3:
-	kfree(gdrvctx);
+	kfree(ctx);
  out_fail_2:
 	remove_proc_subtree(OURMODNAME, NULL);
  out_fail_1:
@@ -392,9 +539,12 @@ static int __init procfs_simple_intf_init(void)
 
 static void __exit procfs_simple_intf_cleanup(void)
 {
-	gdrvctx->power = 0;
+	mutex_lock(&mtx);
+	drvstats_set_power(0);
+	mutex_unlock(&mtx);
 	remove_proc_subtree(OURMODNAME, NULL);
-	kfree(gdrvctx);
+	/* no more readers or writers now */
+	kfree(rcu_dereference_protected(gdrvctx, 1));
 	pr_info("%s removed\n", OURMODNAME);
 }
 
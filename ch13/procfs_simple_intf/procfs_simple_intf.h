@@ -0,0 +1,40 @@
+/*
+ * procfs_simple_intf.h
+ *
+ * Common header for the procfs_simple_intf kernel module and userspace
+ * consumers of it's binary 'stats blob' proc file:
+ *  /proc/procfs_simple_intf/llkdproc_drvctx_blob
+ * A read(2) - or pread(2) - at offset 0 returns a fresh, consistent
+ * snapshot of the whole driver context as one struct llkd_drvctx_blob; no
+ * text to parse. Keep the file open and pread(fd, buf, sizeof(blob), 0) to
+ * re-sample (lseek(2)ing back to 0 and read(2)ing works too).
+ * Check magic and version; size is the kernel's sizeof(struct
+ * llkd_drvctx_blob), so newer (larger) versions are backward compatible.
+ */
+#ifndef __PROCFS_SIMPLE_INTF_H__
+#define __PROCFS_SIMPLE_INTF_H__
+
+#include <linux/types.h>
+
+#define LLKD_DRVCTX_BLOB_PATH		"/proc/procfs_simple_intf/llkdproc_drvctx_blob"
+#define LLKD_DRVCTX_BLOB_MAGIC		0x4c4b4443	/* "LKDC" */
+#define LLKD_DRVCTX_BLOB_VERSION	1
+#define LLKD_DRVCTX_SECRETLEN		128
+
+struct llkd_drvctx_blob {
+	__u32 magic;
+	__u16 version;
+	__u16 size;		/* sizeof(struct llkd_drvctx_blob) */
+	__u32 seq;		/* bumps (by 2) on every update; equal values
+				 * => nothing's changed in between */
+	__s32 debug_level;
+	/* the driver's statistics */
+	__s32 tx, rx, err, myword, power;
+	__u32 __pad;
+	/* the driver's configuration */
+	__u32 config1, config2;
+	__u64 config3;
+	char oursecret[LLKD_DRVCTX_SECRETLEN];
+};
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * drvctx_blob_rd.c
+ *
+ ***********************************************************
+ * Brief Description
+ * Sample the procfs_simple_intf kernel module's driver context via it's
+ * binary 'stats blob' proc file: open it once, then pread(2) it at offset 0
+ * every interval ms; each read is a consistent snapshot, no text parsing.
+ * A line's printed only when the blob's seq value changes (i.e. when the
+ * driver context's been updated), unless -a is passed.
+ *
+ * Usage: drvctx_blob_rd [-a] [-n samples] [-i interval_ms]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include "../procfs_simple_intf.h"	/* struct llkd_drvctx_blob, ... */
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a] [-n samples] [-i interval_ms]\n"
+		" -a : print every sample (default: only on change)\n"
+		" -n : # of samples to take (default 10; 0 => forever)\n"
+		" -i : sampling interval in milliseconds (default 1000)\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct llkd_drvctx_blob b;
+	unsigned long n = 10, i;
+	long interval_ms = 1000;
+	int fd, opt, all = 0, first = 1;
+	__u32 lastseq = 0;
+	struct timespec ts;
+	ssize_t ret;
+
+	while ((opt = getopt(argc, argv, "an:i:h")) != -1) {
+		switch (opt) {
+		case 'a':
+			all = 1;
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval_ms = strtol(optarg, NULL, 0);
+			if (interval_ms < 0)
+				interval_ms = 0;
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	fd = open(LLKD_DRVCTX_BLOB_PATH, O_RDONLY);
+	if (fd < 0) {
+		perror("open " LLKD_DRVCTX_BLOB_PATH " failed");
+		exit(EXIT_FAILURE);
+	}
+	ts.tv_sec = interval_ms / 1000;
+	ts.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+	printf("%10s %6s %6s %6s %6s %8s %6s %10s %10s %18s  %s\n",
+	       "seq", "dbglvl", "tx", "rx", "err", "myword", "power",
+	       "config1", "config2", "config3", "oursecret");
+	for (i = 0; n == 0 || i < n; i++) {
+		memset(&b, 0, sizeof(b));
+		ret = pread(fd, &b, sizeof(b), 0);
+		if (ret < 0) {
+			perror("pread failed");
+			close(fd);
+			exit(EXIT_FAILURE);
+		}
+		/* an older (smaller) kernel blob would be short; a newer one's
+		 * simply truncated to what we know about */
+		if ((size_t)ret < sizeof(b) || b.magic != LLKD_DRVCTX_BLOB_MAGIC ||
+		    b.version < LLKD_DRVCTX_BLOB_VERSION) {
+			fprintf(stderr, "unexpected blob (read %zd bytes, magic 0x%x, version %u)\n",
+				ret, b.magic, b.version);
+			close(fd);
+			exit(EXIT_FAILURE);
+		}
+		if (all || first || b.seq != lastseq) {
+			b.oursecret[sizeof(b.oursecret) - 1] = '\0';
+			printf("%10u %6d %6d %6d %6d %8d %6d 0x%08x 0x%08x 0x%016llx  %s\n",
+			       b.seq, b.debug_level, b.tx, b.rx, b.err, b.myword,
+			       b.power, b.config1, b.config2,
+			       (unsigned long long)b.config3, b.oursecret);
+			fflush(stdout);
+		}
+		first = 0;
+		lastseq = b.seq;
+		if ((n == 0 || i + 1 < n) && interval_ms)
+			nanosleep(&ts, NULL);
+	}
+	close(fd);
+	exit(EXIT_SUCCESS);
+}
@@ -43,6 +43,12 @@
  *         variable gpressure
  *      file perms: 0440
  *
+ * The 'show' methods take no locks: PAGE_OFFSET's a constant, gpressure's
+ * set before the file's created and debug_level's a single int, read and
+ * published with {READ|WRITE}_ONCE() (a plain load or store of an aligned
+ * word can't tear; there's nothing here that a seqcount or RCU would add).
+ * Only writers take the mutex, to serialize against one another.
+ *
  * For details, please refer the book, Ch 12.
  */
 #include <linux/kernel.h>
@@ -87,7 +93,7 @@ MODULE_VERSION("0.1");
 #define MSG(string, args...)
 #endif
 
-/* We use a mutex lock; details in Ch 15 and Ch 16 */
+/* We use a mutex lock - for writers only; details in Ch 15 and Ch 16 */
 static DEFINE_MUTEX(mtx);
 
 static int debug_level;		/* 'off' (0) by default ... */
@@ -115,13 +121,10 @@ struct device_attribute {
 static ssize_t llkdsysfs_pressure_show(struct device *dev,
 				       struct device_attribute *attr, char *buf)
 {
-	int n;
-	if (mutex_lock_interruptible(&mtx))
-		return -ERESTARTSYS;
-	MSG("In the 'show' method: pressure=%u\n", gpressure);
-	n = snprintf(buf, 25, "%u", gpressure);
-	mutex_unlock(&mtx);
-	return n;
+	u32 pressure = READ_ONCE(gpressure);
+
+	MSG("In the 'show' method: pressure=%u\n", pressure);
+	return snprintf(buf, 25, "%u", pressure);
 }
 
 /* The DEVICE_ATTR{_RW|RO|WO}() macro instantiates a struct device_attribute
@@ -134,13 +137,8 @@ static DEVICE_ATTR_RO(llkdsysfs_pressure);
 static ssize_t llkdsysfs_pgoff_show(struct device *dev,
 				    struct device_attribute *attr, char *buf)
 {
-	int n;
-	if (mutex_lock_interruptible(&mtx))
-		return -ERESTARTSYS;
 	MSG("In the 'show' method: PAGE_OFFSET=0x%lx\n", PAGE_OFFSET);
-	n = snprintf(buf, 25, "0x%lx", PAGE_OFFSET);
-	mutex_unlock(&mtx);
-	return n;
+	return snprintf(buf, 25, "0x%lx", PAGE_OFFSET);
 }
 
 /* The DEVICE_ATTR{_RW|RO|WO}() macro instantiates a struct device_attribute
@@ -157,14 +155,11 @@ static ssize_t llkdsysfs_debug_level_show(struct device *dev,
 					  struct device_attribute *attr,
 					  char *buf)
 {
-	int n;
-	if (mutex_lock_interruptible(&mtx))
-		return -ERESTARTSYS;
+	int level = READ_ONCE(debug_level);
+
 	MSG("In the 'show' method: name: %s, debug_level=%d\n", dev->kobj.name,
-	    debug_level);
-	n = snprintf(buf, 25, "%d\n", debug_level);
-	mutex_unlock(&mtx);
-	return n;
+	    level);
+	return snprintf(buf, 25, "%d\n", level);
 }
 
 /* debug_level: sysfs entry point for the 'store' (write) callback */
@@ -172,7 +167,7 @@ static ssize_t llkdsysfs_debug_level_store(struct device *dev,
 					   struct device_attribute *attr,
 					   const char *buf, size_t count)
 {
-	int ret = (int)count, prev_dbglevel;
+	int ret = (int)count, prev_dbglevel, newlevel;
 
 	if (mutex_lock_interruptible(&mtx))
 		return -ERESTARTSYS;
@@ -185,18 +180,20 @@ static ssize_t llkdsysfs_debug_level_store(struct device *dev,
 		goto out;
 	}
 
-	ret = kstrtoint(buf, 0, &debug_level);	/* update it! */
+	/* parse into a local, so that (lockless) readers never see an invalid
+	 * value */
+	ret = kstrtoint(buf, 0, &newlevel);
 	if (ret)
 		goto out;
-	if (debug_level < DEBUG_LEVEL_MIN || debug_level > DEBUG_LEVEL_MAX) {
+	if (newlevel < DEBUG_LEVEL_MIN || newlevel > DEBUG_LEVEL_MAX) {
 		pr_info("%s: trying to set invalid value (%d) for debug_level\n"
 			" [allowed range: %d-%d]; resetting to previous (%d)\n",
-			OURMODNAME, debug_level, DEBUG_LEVEL_MIN,
+			OURMODNAME, newlevel, DEBUG_LEVEL_MIN,
 			DEBUG_LEVEL_MAX, prev_dbglevel);
-		debug_level = prev_dbglevel;
 		ret = -EFAULT;
 		goto out;
 	}
+	WRITE_ONCE(debug_level, newlevel);	/* update it! */
 
 	ret = count;
  out:
@@ -0,0 +1,193 @@
+/*
+ * ch4/dlog_bench/dlog_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Learn Linux Kernel Development"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Learn-Linux-Kernel-Development
+ *
+ * From: Ch 4: Writing your First Kernel Module - LKMs Part 1
+ ****************************************************************
+ * Brief Description:
+ * What does a printk() cost, on a hot path, on many CPUs at once? And what
+ * if we defer the formatting (and the log buffer, and the console) instead,
+ * via our klib's llkd_dlog()?
+ * At insmod time, nthreads kernel threads - each bound to a different online
+ * CPU - log nmsgs messages each, all at once: first via printk() (at
+ * KERN_DEBUG, so that (usually) they don't hit the console at least), then
+ * via llkd_dlog(). We print the average cost per message of each.
+ * The deferred records can then be read (and are formatted only then) via
+ *  <debugfs_mount>/dlog_bench/dlog
+ * (drops, if any - logging outran the ring - are in .../dlog_stats).
+ *
+ * F.e.:
+ *  sudo insmod ./dlog_bench_lkm.ko nmsgs=2000 nrecs=4096
+ *
+ * For details, please refer the book, Ch 4.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include "../../klib_llkd.h"
+
+#define OURMODNAME   "dlog_bench"
+
+/* Our threads must not run module text past complete(): see ch9/slab_bench */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+#define db_complete_and_exit(c)	kthread_complete_and_exit(c, 0)
+#else
+#define db_complete_and_exit(c)	complete_and_exit(c, 0)
+#endif
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LLKD book:ch4/dlog_bench: printk() vs deferred (klib llkd_dlog) logging");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static uint nmsgs = 1000;
+module_param(nmsgs, uint, 0444);
+MODULE_PARM_DESC(nmsgs, "# of messages each thread logs, per mode (default 1000)");
+
+static uint nthreads;
+module_param(nthreads, uint, 0444);
+MODULE_PARM_DESC(nthreads,
+ "# of logging threads, one per online CPU; 0 (default) => all online CPUs");
+
+static uint nrecs = 4096;
+module_param(nrecs, uint, 0444);
+MODULE_PARM_DESC(nrecs, "llkd_dlog records per CPU (default 4096)");
+
+enum { M_PRINTK, M_DLOG, NMODES };
+static const char * const mode_name[NMODES] = { "printk", "llkd_dlog" };
+
+struct db_thread {
+	int mode;
+	int cpu;
+	u64 ns;
+	struct completion *go;
+	struct completion done;
+};
+
+static struct dentry *gparent;
+
+static int db_threadfn(void *arg)
+{
+	struct db_thread *th = arg;
+	unsigned int i;
+	u64 t0;
+
+	wait_for_completion(th->go);
+	t0 = ktime_get_ns();
+	for (i = 0; i < nmsgs; i++) {
+		if (th->mode == M_PRINTK)
+			printk(KERN_DEBUG "%s: cpu %d: msg %u, t0 %llu\n",
+			       OURMODNAME, th->cpu, i, t0);
+		else
+			llkd_dlog("%s: cpu %d: msg %u, t0 %llu\n",
+				  OURMODNAME, th->cpu, i, t0);
+	}
+	th->ns = ktime_get_ns() - t0;
+	db_complete_and_exit(&th->done);
+}
+
+/* Log via @mode on (upto) @nthr online CPUs at once; avg ns/msg in *@nspm */
+static int db_run(int mode, unsigned int nthr, u64 *nspm)
+{
+	DECLARE_COMPLETION_ONSTACK(go);
+	struct task_struct *tsk;
+	struct db_thread *th;
+	unsigned int i, n = 0;
+	u64 sum = 0;
+	int cpu, ret = 0;
+
+	th = kcalloc(nthr, sizeof(*th), GFP_KERNEL);
+	if (!th)
+		return -ENOMEM;
+	cpus_read_lock();
+	for_each_online_cpu(cpu) {
+		if (n == nthr)
+			break;
+		th[n].mode = mode;
+		th[n].cpu = cpu;
+		th[n].go = &go;
+		init_completion(&th[n].done);
+		tsk = kthread_create_on_cpu(db_threadfn, &th[n], cpu,
+					    OURMODNAME "/%u");
+		if (IS_ERR(tsk)) {
+			ret = PTR_ERR(tsk);
+			break;
+		}
+		wake_up_process(tsk);
+		n++;
+	}
+	/* the ones we did create are waiting on 'go'; let them run regardless */
+	complete_all(&go);
+	for (i = 0; i < n; i++) {
+		wait_for_completion(&th[i].done);
+		sum += th[i].ns;
+	}
+	cpus_read_unlock();
+	if (!ret && n)
+		*nspm = div64_u64(sum, (u64)n * nmsgs);
+	kfree(th);
+	return ret;
+}
+
+static int __init dlog_bench_init(void)
+{
+	unsigned int nthr;
+	u64 ns[NMODES];
+	int mode, ret;
+
+	if (!nmsgs) {
+		pr_warn("%s: nmsgs must be > 0\n", OURMODNAME);
+		return -EINVAL;
+	}
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("%s: debugfs_create_dir failed, aborting...\n", OURMODNAME);
+		return gparent ? PTR_ERR(gparent) : -ENOMEM;
+	}
+	ret = llkd_dlog_init(nrecs, gparent);
+	if (ret)
+		goto out_debugfs;
+
+	nthr = num_online_cpus();
+	if (nthreads)
+		nthr = min(nthreads, nthr);
+	for (mode = 0; mode < NMODES; mode++) {
+		ret = db_run(mode, nthr, &ns[mode]);
+		if (ret)
+			goto out_dlog;
+	}
+	pr_info("%s: %u threads x %u msgs: printk %llu ns/msg, llkd_dlog %llu ns/msg\n",
+		OURMODNAME, nthr, nmsgs, ns[M_PRINTK], ns[M_DLOG]);
+	return 0;		/* success */
+
+ out_dlog:
+	pr_warn("%s: %s run failed (%d)\n", OURMODNAME, mode_name[mode], ret);
+ out_debugfs:
+	debugfs_remove_recursive(gparent);
+	llkd_dlog_exit();
+	return ret;
+}
+
+static void __exit dlog_bench_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	llkd_dlog_exit();
+	pr_info("%s: removed\n", OURMODNAME);
+}
+
+module_init(dlog_bench_init);
+module_exit(dlog_bench_exit);
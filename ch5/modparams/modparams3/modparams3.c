@@ -0,0 +1,279 @@
+/*
+ * ch5/modparams/modparams3/modparams3.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Learn Linux Kernel Development"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Learn-Linux-Kernel-Development
+ *
+ * From: Ch 5: Writing your First Kernel Module- LKMs Part 2
+ ****************************************************************
+ * Brief Description:
+ * modparams1 and 2 read their parameters once, at init. Here, the parameters
+ * drive a workload - nthreads kernel threads in a hot loop - and can be
+ * retuned at runtime, by writing to /sys/module/modparams3/parameters/<param>;
+ * no rmmod / insmod cycle needed.
+ *
+ * The workload parameters (stepsz, order and delay_us) live together in one
+ * struct, published via RCU: a module_param_cb() setter validates the new
+ * value, copies the current struct, updates the copy, publishes it with
+ * rcu_assign_pointer() and frees the old one after a grace period. So the
+ * hot loop just does an rcu_dereference() per iteration to see the new
+ * values - no locks - and always sees a consistent set.
+ *
+ * The workload counts what it does in per-CPU ('sharded') counters: no
+ * cacheline bouncing between the threads; reading the (read-only) 'stats'
+ * parameter sums them up:
+ *  cat /sys/module/modparams3/parameters/stats
+ * Try f.e.
+ *  echo 2 > /sys/module/modparams3/parameters/order
+ * and watch the pages count (and the # of parameter updates the workload's
+ * seen) climb.
+ *
+ * For details, please refer the book, Ch 5.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kthread.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/delay.h>
+
+#define OUR_MODNAME    "modparams3"
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LLKD book:ch5/modparams/modparams3: runtime-tunable module parameters via RCU");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+/* The workload parameters; a consistent set, read via RCU */
+struct wl_params {
+	unsigned int stepsz;	/* bytes touched per step */
+	unsigned int order;	/* order of the page allocation per step */
+	unsigned int delay_us;	/* between steps */
+	unsigned int gen;	/* bumped on every update */
+	struct rcu_head rcu;
+};
+
+static struct wl_params wl_defaults = {
+	.stepsz = 4096,
+	.order = 0,
+	.delay_us = 100,
+};
+/* setters may run before our init (on insmod), so this is valid statically */
+static struct wl_params __rcu *gparams = RCU_INITIALIZER(&wl_defaults);
+static DEFINE_MUTEX(params_mtx);	/* serializes the updaters */
+static bool wl_exiting;			/* under params_mtx */
+
+/* Per-CPU workload statistics */
+struct wl_stats {
+	u64 steps;
+	u64 bytes;
+	u64 pages;
+	u64 allocfail;
+	u64 updates_seen;	/* # of times a thread saw a new param gen */
+};
+static DEFINE_PER_CPU(struct wl_stats, wl_stats);
+
+/* What's tunable, and it's range */
+struct wl_param_desc {
+	size_t off;		/* within struct wl_params */
+	unsigned int min, max;
+};
+
+static int wl_param_set(const char *val, const struct kernel_param *kp)
+{
+	const struct wl_param_desc *d = kp->arg;
+	struct wl_params *old, *new;
+	unsigned int v;
+	int ret;
+
+	ret = kstrtouint(val, 0, &v);
+	if (ret)
+		return ret;
+	if (v < d->min || v > d->max)
+		return -ERANGE;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	mutex_lock(&params_mtx);
+	/* our sysfs files outlive our exit routine (just); don't leak a copy */
+	if (wl_exiting) {
+		mutex_unlock(&params_mtx);
+		kfree(new);
+		return -ENODEV;
+	}
+	old = rcu_dereference_protected(gparams, lockdep_is_held(&params_mtx));
+	*new = *old;
+	*(unsigned int *)((char *)new + d->off) = v;
+	new->gen = old->gen + 1;
+	rcu_assign_pointer(gparams, new);
+	mutex_unlock(&params_mtx);
+	if (old != &wl_defaults)
+		kfree_rcu(old, rcu);
+	return 0;
+}
+
+static int wl_param_get(char *buf, const struct kernel_param *kp)
+{
+	const struct wl_param_desc *d = kp->arg;
+	unsigned int v;
+
+	rcu_read_lock();
+	v = *(unsigned int *)((char *)rcu_dereference(gparams) + d->off);
+	rcu_read_unlock();
+	return sprintf(buf, "%u\n", v);
+}
+
+static const struct kernel_param_ops wl_param_ops = {
+	.set = wl_param_set,
+	.get = wl_param_get,
+};
+
+#define WL_PARAM(name, lo, hi, desc)					\
+	static const struct wl_param_desc wl_desc_##name = {		\
+		.off = offsetof(struct wl_params, name),		\
+		.min = lo, .max = hi,					\
+	};								\
+	module_param_cb(name, &wl_param_ops, (void *)&wl_desc_##name, 0644); \
+	MODULE_PARM_DESC(name, desc "; tunable at runtime")
+
+WL_PARAM(stepsz, 1, PAGE_SIZE, "Bytes touched per workload step [1-PAGE_SIZE] (default 4096)");
+WL_PARAM(order, 0, 4, "Order of the page allocation per step [0-4] (default 0)");
+WL_PARAM(delay_us, 0, 1000000, "Delay between steps, in us [0-1000000] (default 100)");
+
+static int nthreads = 1;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "# of workload threads (default 1, max 64); read at init");
+
+/* The read-only 'stats' param: the sharded counters, summed up */
+static int wl_stats_get(char *buf, const struct kernel_param *kp)
+{
+	struct wl_stats sum = { 0 };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct wl_stats *s = per_cpu_ptr(&wl_stats, cpu);
+
+		/* (a value can be a step behind; they're just stats) */
+		sum.steps += READ_ONCE(s->steps);
+		sum.bytes += READ_ONCE(s->bytes);
+		sum.pages += READ_ONCE(s->pages);
+		sum.allocfail += READ_ONCE(s->allocfail);
+		sum.updates_seen += READ_ONCE(s->updates_seen);
+	}
+	return sprintf(buf, "steps=%llu bytes=%llu pages=%llu allocfail=%llu"
+		       " updates_seen=%llu\n", sum.steps, sum.bytes, sum.pages,
+		       sum.allocfail, sum.updates_seen);
+}
+
+static const struct kernel_param_ops wl_stats_ops = {
+	.get = wl_stats_get,
+};
+module_param_cb(stats, &wl_stats_ops, NULL, 0444);
+MODULE_PARM_DESC(stats, "(read-only) workload statistics, summed across CPUs");
+
+#define MAX_THREADS	64
+static struct task_struct *gthrd[MAX_THREADS];
+
+static int wl_thread(void *arg)
+{
+	unsigned int lastgen = 0, stepsz, order, delay_us, gen;
+	const struct wl_params *p;
+	struct page *pg;
+
+	while (!kthread_should_stop()) {
+		/* the hot path's read side: no locks, a consistent set */
+		rcu_read_lock();
+		p = rcu_dereference(gparams);
+		stepsz = p->stepsz;
+		order = p->order;
+		delay_us = p->delay_us;
+		gen = p->gen;
+		rcu_read_unlock();
+
+		pg = alloc_pages(GFP_KERNEL | __GFP_NOWARN, order);
+		if (pg) {
+			memset(page_address(pg), 0x5a, min_t(size_t, stepsz,
+							  PAGE_SIZE << order));
+			__free_pages(pg, order);
+		}
+
+		/* our shard's only ever written by this CPU; no atomics */
+		preempt_disable();
+		if (pg) {
+			__this_cpu_inc(wl_stats.steps);
+			__this_cpu_add(wl_stats.bytes, stepsz);
+			__this_cpu_add(wl_stats.pages, 1UL << order);
+		} else
+			__this_cpu_inc(wl_stats.allocfail);
+		if (gen != lastgen)
+			__this_cpu_inc(wl_stats.updates_seen);
+		preempt_enable();
+		lastgen = gen;
+
+		if (delay_us)
+			usleep_range(delay_us, delay_us + delay_us / 8 + 1);
+		else
+			cond_resched();
+	}
+	return 0;
+}
+
+static int __init modparams3_init(void)
+{
+	int i;
+
+	if (nthreads < 1 || nthreads > MAX_THREADS) {
+		pr_warn("%s: nthreads must be in the range [1-%d]\n",
+			OUR_MODNAME, MAX_THREADS);
+		return -EINVAL;
+	}
+	for (i = 0; i < nthreads; i++) {
+		gthrd[i] = kthread_run(wl_thread, NULL, "%s/%d", OUR_MODNAME, i);
+		if (IS_ERR(gthrd[i])) {
+			int ret = PTR_ERR(gthrd[i]);
+
+			pr_warn("%s: kthread_run() failed (%d)\n", OUR_MODNAME, ret);
+			while (--i >= 0)
+				kthread_stop(gthrd[i]);
+			return ret;
+		}
+	}
+	pr_info("%s: inserted; %d workload thread(s) running\n",
+		OUR_MODNAME, nthreads);
+	return 0;	/* success */
+}
+
+static void __exit modparams3_exit(void)
+{
+	struct wl_params *p;
+	char buf[160];
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+		kthread_stop(gthrd[i]);
+	wl_stats_get(buf, NULL);
+	pr_info("%s: %s", OUR_MODNAME, buf);
+
+	/* no more updates; getters may still be reading, so wait them out */
+	mutex_lock(&params_mtx);
+	wl_exiting = true;
+	p = rcu_dereference_protected(gparams, lockdep_is_held(&params_mtx));
+	rcu_assign_pointer(gparams, &wl_defaults);
+	mutex_unlock(&params_mtx);
+	if (p != &wl_defaults) {
+		synchronize_rcu();
+		kfree(p);
+	}
+	pr_info("%s: removed\n", OUR_MODNAME);
+}
+
+module_init(modparams3_init);
+module_exit(modparams3_exit);
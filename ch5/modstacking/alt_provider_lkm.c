@@ -0,0 +1,74 @@
+/*
+ * ch5/modstacking/alt_provider_lkm.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Learn Linux Kernel Development"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Learn-Linux-Kernel-Development
+ *
+ * From: Ch 5: Writing your First Kernel Module- LKMs Part 2
+ ****************************************************************
+ * Brief Description:
+ * This kernel module - alt_provider_lkm - is part of the 'modstacking' POC
+ * project:
+ *    user_lkm      alt_provider_lkm      [<--- this code]
+ *        |           |
+ *       core_lkm (service table)
+ * It registers an alternate implementation of the core_lkm services; while
+ * it's loaded, consumers (like user_lkm) calling via the service table get
+ * it's implementation; on unload, the previous one (core_lkm's own) takes
+ * over again. The consumers needn't be reloaded.
+ *
+ * For details, please refer the book, Ch 5.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include "core_lkm_svc.h"
+
+#define MODNAME   "alt_provider_lkm"
+MODULE_LICENSE("Dual MIT/GPL");
+
+static u64 alt_get_skey(int p)
+{
+	/* a (pretend) new key scheme */
+	return 0xa17a17a17ULL ^ (u32)p;
+}
+
+static int alt_get_int(void)
+{
+	return 42;
+}
+
+/* no sysinfo: consumers just skip it while we're the provider */
+static const struct llkd_svc_ops alt_svc_ops = {
+	.version = LLKD_SVC_VERSION,
+	.name = MODNAME,
+	.owner = THIS_MODULE,
+	.get_skey = alt_get_skey,
+	.get_int = alt_get_int,
+};
+
+static int __init alt_provider_lkm_init(void)
+{
+	int ret = llkd_svc_register(&alt_svc_ops);
+
+	if (ret) {
+		pr_warn("%s: registering with the service table failed (%d)\n",
+			MODNAME, ret);
+		return ret;
+	}
+	pr_info("%s: inserted; now providing the core_lkm services\n", MODNAME);
+	return 0;
+}
+
+static void __exit alt_provider_lkm_exit(void)
+{
+	/* returns only once no one can be running our code any longer */
+	llkd_svc_unregister(&alt_svc_ops);
+	pr_info("%s: bids you adieu\n", MODNAME);
+}
+
+module_init(alt_provider_lkm_init);
+module_exit(alt_provider_lkm_exit);
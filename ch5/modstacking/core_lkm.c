@@ -17,11 +17,20 @@
  *    core_lkm           [<--- this code]
  * The user_lkm kernel module calls an (exported) function that resides 
  * in the core_lkm kernel module.
+ * Besides the plain exports, core_lkm keeps a 'service table': a versioned,
+ * RCU-protected ops table that consumers call through, and that provider
+ * modules (f.e. alt_provider_lkm) can swap at runtime, without the
+ * consumers having to be unloaded; see core_lkm_svc.h.
  *
  * For details, please refer the book, Ch 5.
  */
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/cache.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include "core_lkm_svc.h"
 
 #define MODNAME   "core_lkm"
 #define THE_ONE   0xfedface
@@ -37,14 +46,17 @@ EXPORT_SYMBOL_GPL(exp_int);
  * David Wheeler's flawfinder(1) tool to detect possible vulnerabilities;
  * Based on it's report, we change the strlen, and replace the strncat with
  * strlcat.
+ * Other modules call this (often, at their init); so we build the message
+ * just once, at our init, and keep it read-only (__ro_after_init) after.
  */
-static void llkd_sysinfo2(void)
-{
 #define MSGLEN   128
-	char msg[MSGLEN];
+static char sysinfo_msg[MSGLEN] __ro_after_init;
 
-	memset(msg, 0, MSGLEN);
-	snprintf(msg, 48, "%s(): minimal Platform Info:\nCPU: ", __func__);
+static void __init llkd_sysinfo2_build(void)
+{
+	char *msg = sysinfo_msg;
+
+	snprintf(msg, 48, "%s(): minimal Platform Info:\nCPU: ", "llkd_sysinfo2");
 
 	/* Strictly speaking, all this #if... is considered ugly and should be
 	   isolated as far as is possible */
@@ -82,7 +94,11 @@ static void llkd_sysinfo2(void)
 #elif(BITS_PER_LONG == 64)
 	strlcat(msg, "64-bit OS.\n", MSGLEN);
 #endif
-	pr_info("%s", msg);
+}
+
+static void llkd_sysinfo2(void)
+{
+	pr_info("%s", sysinfo_msg);
 }
 EXPORT_SYMBOL(llkd_sysinfo2);
 
@@ -105,14 +121,116 @@ static u64 get_skey(int p)
 }
 EXPORT_SYMBOL(get_skey);
 
+/*------------------ the service table ------------------------------------*/
+const struct llkd_svc_ops __rcu *llkd_svc;
+EXPORT_SYMBOL_GPL(llkd_svc);
+
+/*
+ * The registered providers, oldest first; the last one's the current one.
+ * Only (un)registration takes the mutex; the call path's pure RCU.
+ */
+#define LLKD_SVC_MAX	8
+static const struct llkd_svc_ops *svc_stack[LLKD_SVC_MAX];
+static int svc_nr;
+static DEFINE_MUTEX(svc_mtx);
+
+int llkd_svc_register(const struct llkd_svc_ops *ops)
+{
+	int ret = 0;
+
+	if (!ops || ops->version != LLKD_SVC_VERSION) {
+		pr_warn("%s: provider %s: version %u, need %u\n", MODNAME,
+			ops && ops->name ? ops->name : "?",
+			ops ? ops->version : 0, LLKD_SVC_VERSION);
+		return -EINVAL;
+	}
+	mutex_lock(&svc_mtx);
+	if (svc_nr == LLKD_SVC_MAX) {
+		ret = -ENOSPC;
+		goto out_unlock;
+	}
+	svc_stack[svc_nr++] = ops;
+	rcu_assign_pointer(llkd_svc, ops);
+	pr_info("%s: service provider now: %s\n", MODNAME, ops->name);
+ out_unlock:
+	mutex_unlock(&svc_mtx);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(llkd_svc_register);
+
+/*
+ * On return, no CPU's still running in (or about to enter) any of @ops's
+ * functions, so the provider module can safely go away.
+ */
+void llkd_svc_unregister(const struct llkd_svc_ops *ops)
+{
+	int i;
+
+	mutex_lock(&svc_mtx);
+	for (i = svc_nr - 1; i >= 0; i--)
+		if (svc_stack[i] == ops)
+			break;
+	if (i < 0) {
+		mutex_unlock(&svc_mtx);
+		return;
+	}
+	memmove(&svc_stack[i], &svc_stack[i + 1],
+		(svc_nr - i - 1) * sizeof(svc_stack[0]));
+	svc_nr--;
+	/* the previous provider (if any) takes over */
+	rcu_assign_pointer(llkd_svc, svc_nr ? svc_stack[svc_nr - 1] : NULL);
+	pr_info("%s: service provider %s gone, now: %s\n", MODNAME, ops->name,
+		svc_nr ? svc_stack[svc_nr - 1]->name : "none");
+	mutex_unlock(&svc_mtx);
+	/* wait out callers that may still be using @ops */
+	synchronize_rcu();
+}
+EXPORT_SYMBOL_GPL(llkd_svc_unregister);
+
+const char *llkd_svc_provider(char *buf, size_t len)
+{
+	const struct llkd_svc_ops *ops;
+
+	rcu_read_lock();
+	ops = rcu_dereference(llkd_svc);
+	strscpy(buf, ops ? ops->name : "none", len);
+	rcu_read_unlock();
+	return buf;
+}
+EXPORT_SYMBOL_GPL(llkd_svc_provider);
+
+/* Our own, default, provider */
+static u64 core_get_skey(int p)
+{
+	return get_skey(p);
+}
+
+static int core_get_int(void)
+{
+	return READ_ONCE(exp_int);
+}
+
+static const struct llkd_svc_ops core_svc_ops = {
+	.version = LLKD_SVC_VERSION,
+	.name = MODNAME,
+	.owner = THIS_MODULE,
+	.get_skey = core_get_skey,
+	.get_int = core_get_int,
+	.sysinfo = llkd_sysinfo2,
+};
+
 static int __init core_lkm_init(void)
 {
 	pr_info("%s: inserted\n", MODNAME);
-	return 0;
+	llkd_sysinfo2_build();
+	return llkd_svc_register(&core_svc_ops);
 }
 
 static void __exit core_lkm_exit(void)
 {
+	/* consumers depend on us (our symbols), so they're all gone by now, and
+	 * so are providers; this is just for symmetry */
+	llkd_svc_unregister(&core_svc_ops);
 	pr_info("%s: bids you adieu\n", MODNAME);
 }
 
@@ -0,0 +1,82 @@
+/*
+ * ch5/modstacking/core_lkm_svc.h
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Learn Linux Kernel Development"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Learn-Linux-Kernel-Development
+ *
+ * From: Ch 5: Writing your First Kernel Module- LKMs Part 2
+ ****************************************************************
+ * Brief Description:
+ * The core_lkm 'service table': a versioned ops table that any number of
+ * consumer modules call through, and that provider modules can swap at
+ * runtime - without the consumers having to be unloaded (or even knowing).
+ * core_lkm registers the default provider (it's own functions); a provider
+ * registered later takes over, and on it's unregistration the previous one
+ * takes over again.
+ *
+ * Consumers call via llkd_svc_call(); this is just an rcu_dereference() of
+ * the current table plus a single indirect call, with no locks or atomics.
+ * The price: the ops must not sleep (they run under rcu_read_lock()).
+ */
+#ifndef __CORE_LKM_SVC_H__
+#define __CORE_LKM_SVC_H__
+
+#include <linux/types.h>
+#include <linux/rcupdate.h>
+
+/* Bump on any incompatible change to struct llkd_svc_ops */
+#define LLKD_SVC_VERSION	1
+
+struct module;
+
+struct llkd_svc_ops {
+	unsigned int version;	/* LLKD_SVC_VERSION, as built against */
+	const char *name;	/* the provider's name */
+	struct module *owner;
+	/* the services; any may be NULL (the caller's default's used) */
+	u64 (*get_skey)(int p);
+	int (*get_int)(void);
+	void (*sysinfo)(void);
+};
+
+/* The current provider's table; use llkd_svc_call*() to call through it */
+extern const struct llkd_svc_ops __rcu *llkd_svc;
+
+int llkd_svc_register(const struct llkd_svc_ops *ops);
+void llkd_svc_unregister(const struct llkd_svc_ops *ops);
+
+/* The current provider's name (for info only; it may change right away) */
+const char *llkd_svc_provider(char *buf, size_t len);
+
+/*
+ * Call @op of the current provider with the given args, evaluating to it's
+ * return value, or to @dflt if there's no provider or it lacks @op.
+ */
+#define llkd_svc_call(op, dflt, ...) ({					\
+	const struct llkd_svc_ops *__ops;				\
+	typeof(dflt) __ret = (dflt);					\
+									\
+	rcu_read_lock();						\
+	__ops = rcu_dereference(llkd_svc);				\
+	if (__ops && __ops->op)						\
+		__ret = __ops->op(__VA_ARGS__);				\
+	rcu_read_unlock();						\
+	__ret;								\
+})
+
+/* The same, for void ops */
+#define llkd_svc_call_void(op, ...) do {				\
+	const struct llkd_svc_ops *__ops;				\
+									\
+	rcu_read_lock();						\
+	__ops = rcu_dereference(llkd_svc);				\
+	if (__ops && __ops->op)						\
+		__ops->op(__VA_ARGS__);					\
+	rcu_read_unlock();						\
+} while (0)
+
+#endif
@@ -17,11 +17,15 @@
  *    core_lkm
  * The user_lkm kernel module calls an (exported) function that resides 
  * in the core_lkm kernel module.
+ * It then calls the same services via the core_lkm service table, again at
+ * unload time: load alt_provider_lkm in between and you'll see that it's
+ * the new provider that's called - with user_lkm never having been reloaded.
  *
  * For details, please refer the book, Ch 5.
  */
 #include <linux/init.h>
 #include <linux/module.h>
+#include "core_lkm_svc.h"
 
 #define MODNAME     "user_lkm"
 #if 1
@@ -34,10 +38,24 @@ extern void llkd_sysinfo2(void);
 extern long get_skey(int);
 extern int exp_int;
 
+#define THE_ONE   0xfedface
+
+/* Call the services via the service table: whoever's the provider now */
+static void call_svc(const char *when)
+{
+	char name[32];
+	u64 sk;
+
+	sk = llkd_svc_call(get_skey, (u64)0, THE_ONE);
+	pr_info("%s: %s: via the service table (provider %s): skey = 0x%llx, int = %d\n",
+		MODNAME, when, llkd_svc_provider(name, sizeof(name)), sk,
+		llkd_svc_call(get_int, -1));
+	llkd_svc_call_void(sysinfo);
+}
+
 /* Call some functions within the 'core' module */
 static int __init user_lkm_init(void)
 {
-#define THE_ONE   0xfedface
 	pr_info("%s: inserted\n", MODNAME);
 	u64 sk = get_skey(THE_ONE);
 	pr_debug("%s: Called get_skey(), ret = 0x%llx = %llu\n",
@@ -45,11 +63,13 @@ static int __init user_lkm_init(void)
 	pr_debug("%s: exp_int = %d\n", MODNAME, exp_int);
 	llkd_sysinfo2();
 
+	call_svc("init");
 	return 0;
 }
 
 static void __exit user_lkm_exit(void)
 {
+	call_svc("exit");
 	pr_info("%s: bids you adieu\n", MODNAME);
 }
 
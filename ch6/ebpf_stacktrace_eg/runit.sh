@@ -17,6 +17,9 @@ PID=$(ps -e|grep "helloworld_dbg" |tail -n1|awk '{print $1}')
 which stackcount-bpfcc >/dev/null
 [ $? -ne 0 ] && {
   echo "Oops, stackcount-bpfcc not installed? aborting..."
+  echo "(No BPF toolchain? The ../stackprof kernel module can do this too:
+ sudo insmod ../stackprof/stackprof.ko pid=${PID} probe=ksys_write
+ sudo cat /sys/kernel/debug/stackprof/stacks )"
   exit 1
 }
 
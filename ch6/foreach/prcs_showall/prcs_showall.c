@@ -14,6 +14,10 @@
  * This kernel module iterates over the task structures of all *processes*
  * currently alive on the box, printing out a few details for each of them.
  * We use the for_each_process() macro to do so here.
+ * It also sets up a debugfs file, <debugfs_mount>/prcs_showall/snapshot,
+ * that - on every open - takes a binary snapshot of all processes, walking
+ * the task list under RCU only; see ../tasksnap.h. (Pass print=0 to skip
+ * the printk-based walk at insmod.)
  *
  * For details, please refer the book, Ch 6.
  */
@@ -31,6 +35,8 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>	/* copy_to_user() */
 #include <linux/kallsyms.h>
+#define LLKD_TASKSNAP_FILE	/* the debugfs snapshot file */
+#include "../tasksnap.h"
 
 #define OURMODNAME	"prcs_showall"
 
@@ -40,6 +46,14 @@ MODULE_DESCRIPTION("LLKD book:ch4/foreach/prcs_showall: "
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
 
+static bool print = true;
+module_param(print, bool, 0444);
+MODULE_PARM_DESC(print,
+ "Print all processes to the kernel log at insmod (default 1); the binary"
+ " snapshot (debugfs) file is available regardless");
+
+static struct dentry *gsnapdir;
+
 static int show_prcs_in_tasklist(void)
 {
 	struct task_struct *p;
@@ -73,14 +87,23 @@ static int __init prcs_showall_init(void)
 	int total;
 
 	pr_debug("%s: inserted\n", OURMODNAME);
-	total = show_prcs_in_tasklist();
-	pr_info("%s: total # of processes on system: %d\n", OURMODNAME, total);
+	if (print) {
+		total = show_prcs_in_tasklist();
+		pr_info("%s: total # of processes on system: %d\n",
+			OURMODNAME, total);
+	}
+
+	gsnapdir = llkd_tasksnap_init(OURMODNAME, false);
+	if (!gsnapdir)		/* not fatal */
+		pr_notice("%s: couldn't setup the debugfs snapshot file\n",
+			OURMODNAME);
 
 	return 0;		/* success */
 }
 
 static void __exit prcs_showall_exit(void)
 {
+	debugfs_remove_recursive(gsnapdir);
 	pr_debug("%s: removed\n", OURMODNAME);
 }
 
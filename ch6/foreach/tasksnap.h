@@ -0,0 +1,230 @@
+/*
+ * ch6/foreach/tasksnap.h
+ ***************************************************************
+ * Binary task-list snapshots.
+ * Common header for the thrd_showall and prcs_showall kernel modules and
+ * their userspace consumers (f.e. tasksnap_rd/tasksnap_rd.c).
+ *
+ * The kernel modules export a snapshot of all threads (thrd_showall) or all
+ * processes (prcs_showall) via a debugfs 'snapshot' file:
+ *  <debugfs_mount>/<modname>/snapshot
+ * The snapshot is taken at open(2) time, walking the task list under
+ * rcu_read_lock() only (no per-task locks, no printk's), and is laid out as
+ * a struct llkd_tasksnap_hdr followed by hdr.nrecs fixed-size
+ * struct llkd_task_rec records; so, a single read(2) - with a large enough
+ * buffer - fetches the whole thing, no text parsing required.
+ * (As it's lockless, it's a cheap snapshot, not an atomic one: tasks that come
+ * and go during the walk may or may not show up.)
+ *
+ * The tasksnap_delta kernel module instead exports just the changes since a
+ * caller-supplied generation #, as a struct llkd_taskdelta_hdr followed by
+ * hdr.nrecs struct llkd_taskdelta_rec records; see
+ * tasksnap_delta/tasksnap_delta.c for the protocol.
+ */
+#ifndef __LLKD_TASKSNAP_H__
+#define __LLKD_TASKSNAP_H__
+
+#include <linux/types.h>
+
+#define LLKD_TASKSNAP_MAGIC	0x4c4b5453	/* "LKTS" */
+#define LLKD_TASKSNAP_VERSION	1
+#define LLKD_TASKSNAP_COMMLEN	16	/* == TASK_COMM_LEN */
+
+/* hdr.flags */
+#define LLKD_TASKSNAP_TRUNCATED	0x1	/* tasks were spawned during the
+					 * walk and didn't all fit */
+
+struct llkd_tasksnap_hdr {
+	__u32 magic;
+	__u16 version;
+	__u16 recsz;		/* sizeof(struct llkd_task_rec) */
+	__u32 nrecs;
+	__u32 flags;
+};
+
+struct llkd_task_rec {
+	__s32 tgid;
+	__s32 pid;
+	__u32 flags;		/* the task's PF_* flags; PF_KTHREAD (0x00200000)
+				 * => kernel thread */
+	__s32 nr_threads;	/* # of threads in the thread group */
+	char comm[LLKD_TASKSNAP_COMMLEN];
+};
+
+/* Delta snapshots */
+#define LLKD_TASKDELTA_MAGIC	0x4c4b5444	/* "LKTD" */
+#define LLKD_TASKDELTA_VERSION	1
+
+/* hdr.flags */
+#define LLKD_TASKDELTA_FULL	0x1	/* a full listing (all live tasks, as
+					 * SPAWNED events) rather than a delta;
+					 * the caller should discard it's state */
+
+/* rec.event */
+#define LLKD_TASKDELTA_SPAWNED	1
+#define LLKD_TASKDELTA_EXITED	2
+#define LLKD_TASKDELTA_RENAMED	3
+
+struct llkd_taskdelta_hdr {
+	__u32 magic;
+	__u16 version;
+	__u16 recsz;		/* sizeof(struct llkd_taskdelta_rec) */
+	__u32 nrecs;
+	__u32 flags;
+	__u64 gen;		/* the current generation; pass it next time */
+	__u64 since;		/* the generation asked for */
+};
+
+struct llkd_taskdelta_rec {
+	__u32 event;		/* LLKD_TASKDELTA_xxx */
+	__u32 __pad;
+	__u64 gen;		/* generation in which this change was seen */
+	struct llkd_task_rec task;
+};
+
+#ifdef __KERNEL__
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/mm.h>		/* kvzalloc() */
+#include <linux/overflow.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+
+struct llkd_tasksnap {
+	size_t len;		/* of the blob below (header + records) */
+	struct llkd_tasksnap_hdr hdr;
+	struct llkd_task_rec rec[];
+};
+
+static inline void llkd_tasksnap_fill(struct llkd_task_rec *rec,
+				      struct task_struct *t)
+{
+	rec->tgid = t->tgid;
+	rec->pid = t->pid;
+	rec->flags = t->flags;
+	rec->nr_threads = get_nr_threads(t);
+	/* no task_lock() (and thus no get_task_comm()); a racing rename
+	 * may give us a torn comm, which is harmless */
+	memcpy(rec->comm, t->comm, LLKD_TASKSNAP_COMMLEN);
+	rec->comm[LLKD_TASKSNAP_COMMLEN - 1] = '\0';
+}
+
+/*
+ * llkd_tasksnap_take
+ * Take a snapshot of all threads (@threads true) or all processes (thread
+ * group leaders) into a freshly kvzalloc'ed buffer; kvfree() it when done.
+ * We first count the tasks (cheap: no formatting) to size the buffer, with
+ * some slack for tasks spawned in between; if even that isn't enough, the
+ * snapshot's flagged LLKD_TASKSNAP_TRUNCATED.
+ * The idle thread of CPU 0 (swapper/0, PID 0, not on the task list) is
+ * included in the thread snapshot, as in thrd_showall's text output.
+ * Returns NULL on allocation failure.
+ */
+static inline struct llkd_tasksnap *llkd_tasksnap_take(bool threads)
+{
+	struct task_struct *g, *t;
+	struct llkd_tasksnap *snap;
+	unsigned int n = 0, max;
+
+	rcu_read_lock();
+	if (threads)
+		for_each_process_thread(g, t)
+			n++;
+	else
+		for_each_process(g)
+			n++;
+	rcu_read_unlock();
+
+	max = n + n / 8 + 32 + (threads ? 1 : 0);
+	snap = kvzalloc(struct_size(snap, rec, max), GFP_KERNEL);
+	if (!snap)
+		return NULL;
+
+	n = 0;
+	if (threads)
+		llkd_tasksnap_fill(&snap->rec[n++], &init_task);
+	rcu_read_lock();
+	if (threads) {
+		for_each_process_thread(g, t) {
+			if (n == max)
+				goto out_truncated;
+			llkd_tasksnap_fill(&snap->rec[n++], t);
+		}
+	} else {
+		for_each_process(g) {
+			if (n == max)
+				goto out_truncated;
+			llkd_tasksnap_fill(&snap->rec[n++], g);
+		}
+	}
+	goto out_unlock;
+
+ out_truncated:
+	snap->hdr.flags |= LLKD_TASKSNAP_TRUNCATED;
+ out_unlock:
+	rcu_read_unlock();
+
+	snap->hdr.magic = LLKD_TASKSNAP_MAGIC;
+	snap->hdr.version = LLKD_TASKSNAP_VERSION;
+	snap->hdr.recsz = sizeof(struct llkd_task_rec);
+	snap->hdr.nrecs = n;
+	snap->len = sizeof(snap->hdr) + n * sizeof(struct llkd_task_rec);
+	return snap;
+}
+
+#ifdef LLKD_TASKSNAP_FILE	/* #define'd by modules that want the file */
+/*
+ * The debugfs 'snapshot' file: every open(2) takes a fresh snapshot, which
+ * read(2)s then return (from the file offset on); it's freed on close.
+ * Pass as the i_private data: (void *)1 for threads, NULL for processes.
+ */
+static int llkd_tasksnap_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = llkd_tasksnap_take(inode->i_private != NULL);
+	return filp->private_data ? 0 : -ENOMEM;
+}
+
+static ssize_t llkd_tasksnap_read(struct file *filp, char __user *ubuf,
+				  size_t count, loff_t *fpos)
+{
+	struct llkd_tasksnap *snap = filp->private_data;
+
+	return simple_read_from_buffer(ubuf, count, fpos, &snap->hdr,
+				       snap->len);
+}
+
+static int llkd_tasksnap_release(struct inode *inode, struct file *filp)
+{
+	kvfree(filp->private_data);
+	return 0;
+}
+
+static const struct file_operations llkd_tasksnap_fops = {
+	.owner = THIS_MODULE,
+	.open = llkd_tasksnap_open,
+	.read = llkd_tasksnap_read,
+	.llseek = default_llseek,
+	.release = llkd_tasksnap_release,
+};
+
+/* Create <debugfs_mount>/@dirname/snapshot; returns the (new) directory's
+ * dentry, to be debugfs_remove_recursive()'d, or NULL on failure */
+static inline struct dentry *llkd_tasksnap_init(const char *dirname,
+						bool threads)
+{
+	struct dentry *dir = debugfs_create_dir(dirname, NULL);
+
+	if (IS_ERR_OR_NULL(dir))
+		return NULL;
+	if (IS_ERR_OR_NULL(debugfs_create_file("snapshot", 0400, dir,
+				threads ? (void *)1 : NULL,
+				&llkd_tasksnap_fops))) {
+		debugfs_remove_recursive(dir);
+		return NULL;
+	}
+	return dir;
+}
+#endif /* LLKD_TASKSNAP_FILE */
+#endif /* __KERNEL__ */
+
+#endif /* __LLKD_TASKSNAP_H__ */
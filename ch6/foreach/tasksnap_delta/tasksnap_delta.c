@@ -0,0 +1,355 @@
+/*
+ * ch6/foreach/tasksnap_delta/tasksnap_delta.c
+ ***************************************************************
+ * Brief Description:
+ * Incremental (delta) task snapshots.
+ * Agents that poll the thread list every so often mostly see the very same
+ * threads; this module keeps a kernel-side hash table of the last-seen
+ * threads and exports only what changed - threads spawned, exited or renamed
+ * - since a generation # the caller supplies.
+ *
+ * Protocol (via <debugfs_mount>/tasksnap_delta/delta, see ../tasksnap.h):
+ *  open(2) it, write(2) the last generation # you received (as a decimal
+ *  string; "0" the first time), then read(2) back a struct llkd_taskdelta_hdr
+ *  followed by hdr.nrecs struct llkd_taskdelta_rec records; pass hdr.gen next
+ *  time. If the generation you pass is older than the exit events we retain
+ *  (the keep_gens parameter), or is 0, you get a full listing (flagged
+ *  LLKD_TASKDELTA_FULL) instead. A read(2) with no prior write(2) is
+ *  treated as "since 0".
+ *
+ * Every request runs one scan (at most one per min_interval_ms, shared by
+ * all callers), which bumps the generation: we walk the task list under RCU,
+ * looking each thread up in our hash table. Three lists keep the rest of the
+ * work proportional to the churn rather than to the # of threads:
+ *  - alive_list : live entries, ordered by when last seen; every thread seen
+ *    is moved to the tail, so the ones not seen in this scan (i.e., that
+ *    exited) are precisely those left at the head;
+ *  - chg_list   : all entries (exit 'tombstones' too), ordered by the
+ *    generation of their last change; a delta is the tail of this list;
+ *  - dead_list  : the tombstones, ordered by exit; aged out from the head.
+ * (The walk itself is a lookup per thread, with no per-task locks, no text
+ * formatting and no allocation save for new threads; the output, and the
+ * caller's parsing of it, scale with the churn alone.)
+ *
+ * For details, please refer the book, Ch 6.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/hashtable.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/jiffies.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include "../tasksnap.h"
+
+#define OURMODNAME   "tasksnap_delta"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LLKD book:ch6/foreach/tasksnap_delta:"
+		   " incremental (delta) thread list snapshots");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static uint keep_gens = 64;
+module_param(keep_gens, uint, 0644);
+MODULE_PARM_DESC(keep_gens,
+ "# of generations to retain exit events (tombstones) for (default 64);"
+ " callers lagging further behind get a full listing");
+
+static uint min_interval_ms = 100;
+module_param(min_interval_ms, uint, 0644);
+MODULE_PARM_DESC(min_interval_ms,
+ "Minimum interval between task list scans (ms, default 100); requests"
+ " within it share the last scan's generation");
+
+#define TD_HASH_BITS	14
+
+struct tdent {
+	struct hlist_node hnode;	/* in tdtbl, keyed by PID */
+	struct list_head alive;		/* on alive_list, or dead_list once
+					 * it's exited (a tombstone) */
+	struct list_head chg;		/* on chg_list */
+	u64 start_time;			/* tells apart tasks reusing a PID */
+	u64 seen;			/* generation last seen in */
+	u64 gen;			/* generation of the last change */
+	u32 event;			/* ... and what it was */
+	struct llkd_task_rec task;
+};
+
+static DEFINE_HASHTABLE(tdtbl, TD_HASH_BITS);
+static LIST_HEAD(alive_list);
+static LIST_HEAD(chg_list);
+static LIST_HEAD(dead_list);
+static DEFINE_MUTEX(td_mtx);	/* protects all of the above, and below */
+static u64 curgen, pruned_gen;	/* pruned_gen: the latest gen we've dropped
+				 * tombstones of */
+static unsigned long last_scan;	/* jiffies */
+static unsigned int nr_alive;
+
+static struct kmem_cache *td_cachep;
+static struct dentry *gparent;
+
+static struct tdent *td_lookup(pid_t pid)
+{
+	struct tdent *e;
+
+	hash_for_each_possible(tdtbl, e, hnode, pid)
+		if (e->task.pid == pid)
+			return e;
+	return NULL;
+}
+
+static inline void td_changed(struct tdent *e, u32 event, u64 gen)
+{
+	e->event = event;
+	e->gen = gen;
+	list_move_tail(&e->chg, &chg_list);
+}
+
+/* Scan the task list, recording what changed as generation curgen + 1 */
+static void td_scan(void)
+{
+	u64 gen = curgen + 1;
+	struct task_struct *g, *t;
+	struct tdent *e, *tmp;
+
+	rcu_read_lock();
+	for_each_process_thread(g, t) {
+		e = td_lookup(t->pid);
+		if (!e) {
+			/* We can't sleep here; should this fail, we'll simply
+			 * pick this thread up as new in a later scan */
+			e = kmem_cache_alloc(td_cachep, GFP_NOWAIT | __GFP_NOWARN);
+			if (!e)
+				continue;
+			INIT_LIST_HEAD(&e->chg);
+			list_add_tail(&e->chg, &chg_list);
+			INIT_LIST_HEAD(&e->alive);
+			e->event = LLKD_TASKDELTA_EXITED;	/* not alive yet */
+			hash_add(tdtbl, &e->hnode, t->pid);
+		}
+		if (e->event == LLKD_TASKDELTA_EXITED ||
+		    e->start_time != t->start_time) {
+			/* it's new, or a tombstone's PID got reused, or (if
+			 * it got reused between two scans) a live entry's */
+			if (e->event == LLKD_TASKDELTA_EXITED)
+				nr_alive++;
+			e->start_time = t->start_time;
+			llkd_tasksnap_fill(&e->task, t);
+			td_changed(e, LLKD_TASKDELTA_SPAWNED, gen);
+		} else if (memcmp(e->task.comm, t->comm,
+				  LLKD_TASKSNAP_COMMLEN - 1)) {
+			llkd_tasksnap_fill(&e->task, t);
+			td_changed(e, LLKD_TASKDELTA_RENAMED, gen);
+		}
+		e->seen = gen;
+		list_move_tail(&e->alive, &alive_list);
+	}
+	rcu_read_unlock();
+
+	/* Threads we didn't see have exited; they're left at the head */
+	list_for_each_entry_safe(e, tmp, &alive_list, alive) {
+		if (e->seen == gen)
+			break;
+		list_move_tail(&e->alive, &dead_list);
+		nr_alive--;
+		td_changed(e, LLKD_TASKDELTA_EXITED, gen);
+	}
+
+	/* Drop the tombstones that have aged out; they're the oldest */
+	list_for_each_entry_safe(e, tmp, &dead_list, alive) {
+		if (e->gen + keep_gens >= gen)
+			break;
+		pruned_gen = max(pruned_gen, e->gen);
+		hash_del(&e->hnode);
+		list_del(&e->chg);
+		list_del(&e->alive);
+		kmem_cache_free(td_cachep, e);
+	}
+
+	curgen = gen;
+	last_scan = jiffies;
+}
+
+static inline void td_emit(struct llkd_taskdelta_rec *rec, struct tdent *e,
+			   u32 event)
+{
+	rec->event = event;
+	rec->gen = e->gen;
+	rec->task = e->task;
+}
+
+/*
+ * Build the reply to a 'since @since' request, in a kvzalloc'ed buffer
+ * (returned, with it's length in *@len); NULL on allocation failure.
+ */
+static struct llkd_taskdelta_hdr *td_build(u64 since, size_t *len)
+{
+	struct llkd_taskdelta_hdr *hdr;
+	struct llkd_taskdelta_rec *rec;
+	unsigned int n = 0, i = 0;
+	bool full;
+	struct tdent *e;
+
+	mutex_lock(&td_mtx);
+	if (!curgen || time_after_eq(jiffies, last_scan +
+				     msecs_to_jiffies(min_interval_ms)))
+		td_scan();
+
+	full = (since == 0 || since < pruned_gen || since > curgen);
+	if (full) {
+		n = nr_alive;
+	} else {
+		list_for_each_entry_reverse(e, &chg_list, chg) {
+			if (e->gen <= since)
+				break;
+			n++;
+		}
+	}
+
+	*len = sizeof(*hdr) + n * sizeof(*rec);
+	hdr = kvzalloc(*len, GFP_KERNEL);
+	if (!hdr)
+		goto out_unlock;
+	rec = (struct llkd_taskdelta_rec *)(hdr + 1);
+	if (full) {
+		list_for_each_entry(e, &alive_list, alive)
+			td_emit(&rec[i++], e, LLKD_TASKDELTA_SPAWNED);
+	} else if (n) {
+		/* rewind n entries from the tail, then emit oldest first */
+		e = list_last_entry(&chg_list, struct tdent, chg);
+		for (i = 1; i < n; i++)
+			e = list_prev_entry(e, chg);
+		for (i = 0; i < n; i++, e = list_next_entry(e, chg))
+			td_emit(&rec[i], e, e->event);
+	}
+	hdr->magic = LLKD_TASKDELTA_MAGIC;
+	hdr->version = LLKD_TASKDELTA_VERSION;
+	hdr->recsz = sizeof(*rec);
+	hdr->nrecs = n;
+	hdr->flags = full ? LLKD_TASKDELTA_FULL : 0;
+	hdr->gen = curgen;
+	hdr->since = since;
+ out_unlock:
+	mutex_unlock(&td_mtx);
+	return hdr;
+}
+
+/*--- The debugfs 'delta' file ---*/
+/*
+ * Per open file; threads sharing the fd are serialized on @mtx, so that one
+ * can't kvfree() the reply another's still (re)building or reading.
+ * Lock order: mtx, then td_mtx (taken in td_build()).
+ */
+struct td_reply {
+	struct mutex mtx;
+	size_t len;
+	struct llkd_taskdelta_hdr *hdr;
+};
+
+static int td_open(struct inode *inode, struct file *filp)
+{
+	struct td_reply *r = kzalloc(sizeof(*r), GFP_KERNEL);
+
+	if (!r)
+		return -ENOMEM;
+	mutex_init(&r->mtx);
+	filp->private_data = r;
+	return 0;
+}
+
+/* Writing a generation # (re)builds the reply to be read */
+static ssize_t td_write(struct file *filp, const char __user *ubuf,
+			size_t count, loff_t *off)
+{
+	struct td_reply *r = filp->private_data;
+	u64 since;
+	ssize_t ret;
+
+	ret = kstrtou64_from_user(ubuf, count, 0, &since);
+	if (ret)
+		return ret;
+	mutex_lock(&r->mtx);
+	kvfree(r->hdr);
+	r->hdr = td_build(since, &r->len);
+	ret = r->hdr ? count : -ENOMEM;
+	mutex_unlock(&r->mtx);
+	if (ret > 0)
+		*off = 0;	/* read the new reply from the start */
+	return ret;
+}
+
+static ssize_t td_read(struct file *filp, char __user *ubuf, size_t count,
+		       loff_t *fpos)
+{
+	struct td_reply *r = filp->private_data;
+	ssize_t ret = -ENOMEM;
+
+	mutex_lock(&r->mtx);
+	if (!r->hdr)
+		r->hdr = td_build(0, &r->len);
+	if (r->hdr)
+		ret = simple_read_from_buffer(ubuf, count, fpos, r->hdr,
+					      r->len);
+	mutex_unlock(&r->mtx);
+	return ret;
+}
+
+static int td_release(struct inode *inode, struct file *filp)
+{
+	struct td_reply *r = filp->private_data;
+
+	kvfree(r->hdr);
+	kfree(r);
+	return 0;
+}
+
+static const struct file_operations td_fops = {
+	.owner = THIS_MODULE,
+	.open = td_open,
+	.read = td_read,
+	.write = td_write,
+	.llseek = default_llseek,
+	.release = td_release,
+};
+
+static int __init tasksnap_delta_init(void)
+{
+	td_cachep = KMEM_CACHE(tdent, 0);
+	if (!td_cachep)
+		return -ENOMEM;
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("delta", 0600, gparent, NULL,
+					       &td_fops))) {
+		pr_warn("%s: debugfs setup failed\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		kmem_cache_destroy(td_cachep);
+		return -ENODEV;
+	}
+	pr_info("%s: inserted (<debugfs_mount>/%s/delta)\n",
+		OURMODNAME, OURMODNAME);
+	return 0;		/* success */
+}
+
+static void __exit tasksnap_delta_exit(void)
+{
+	struct tdent *e, *tmp;
+
+	debugfs_remove_recursive(gparent);
+	/* every entry's on the chg_list */
+	list_for_each_entry_safe(e, tmp, &chg_list, chg)
+		kmem_cache_free(td_cachep, e);
+	kmem_cache_destroy(td_cachep);
+	pr_info("%s: removed\n", OURMODNAME);
+}
+
+module_init(tasksnap_delta_init);
+module_exit(tasksnap_delta_exit);
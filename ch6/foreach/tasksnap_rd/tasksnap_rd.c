@@ -0,0 +1,182 @@
+/*
+ * ch6/foreach/tasksnap_rd/tasksnap_rd.c
+ ***************************************************************
+ * Brief Description:
+ * Userspace consumer of the binary task-list snapshots exported by the
+ * thrd_showall and prcs_showall kernel modules (see ../tasksnap.h): it
+ * fetches a whole snapshot with a single read(2) and displays it (or just
+ * the totals, with -q).
+ * With -w <secs>, it instead polls the tasksnap_delta module every <secs>
+ * seconds, displaying just the threads spawned / exited / renamed since the
+ * previous poll.
+ * Usage: tasksnap_rd [-q] [snapshot-file] | -w secs
+ *  (default: /sys/kernel/debug/thrd_showall/snapshot; needs root)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "../tasksnap.h"
+
+#define DEF_SNAPFILE	"/sys/kernel/debug/thrd_showall/snapshot"
+#define PF_KTHREAD	0x00200000	/* from the kernel's linux/sched.h */
+#define MAXSNAP		(64*1024*1024)
+#define DELTAFILE	"/sys/kernel/debug/tasksnap_delta/delta"
+
+/*
+ * Delta mode: every @secs seconds, send the kernel the last generation # we
+ * got, and display the changes since.
+ */
+static int delta_watch(int secs)
+{
+	const char *evname[] = { "?", "SPAWNED", "EXITED", "RENAMED" };
+	size_t bufsz = 1024 * 1024;
+	struct llkd_taskdelta_hdr *hdr;
+	struct llkd_taskdelta_rec *rec;
+	unsigned long long gen = 0;
+	char genstr[32], *buf;
+	unsigned int i;
+	ssize_t n;
+	int fd;
+
+	fd = open(DELTAFILE, O_RDWR);
+	if (fd < 0) {
+		perror("tasksnap_rd: open " DELTAFILE);
+		return EXIT_FAILURE;
+	}
+	buf = malloc(bufsz);
+	if (!buf) {
+		fprintf(stderr, "tasksnap_rd: out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (;;) {
+		n = snprintf(genstr, sizeof(genstr), "%llu", gen);
+		if (pwrite(fd, genstr, n, 0) < 0) {
+			perror("tasksnap_rd: write");
+			break;
+		}
+		n = pread(fd, buf, bufsz, 0);
+		hdr = (struct llkd_taskdelta_hdr *)buf;
+		if (n < (ssize_t)sizeof(*hdr) || hdr->magic != LLKD_TASKDELTA_MAGIC ||
+		    hdr->recsz != sizeof(*rec)) {
+			fprintf(stderr, "tasksnap_rd: invalid delta\n");
+			break;
+		}
+		if ((size_t)n == bufsz) {	/* didn't fit; grow and redo */
+			free(buf);
+			bufsz *= 4;
+			buf = malloc(bufsz);
+			if (!buf || bufsz > MAXSNAP)
+				break;
+			gen = 0;
+			continue;
+		}
+		rec = (struct llkd_taskdelta_rec *)(hdr + 1);
+		if (hdr->flags & LLKD_TASKDELTA_FULL) {
+			printf("--- gen %llu: full listing, %u threads ---\n",
+				(unsigned long long)hdr->gen, hdr->nrecs);
+		} else {
+			printf("--- gen %llu: %u changes since gen %llu ---\n",
+				(unsigned long long)hdr->gen, hdr->nrecs, gen);
+			for (i = 0; i < hdr->nrecs; i++)
+				printf("%-8s %8d %8d  %s\n",
+					evname[rec[i].event <= 3 ? rec[i].event : 0],
+					rec[i].task.tgid, rec[i].task.pid,
+					rec[i].task.comm);
+		}
+		fflush(stdout);
+		gen = hdr->gen;
+		sleep(secs);
+	}
+	free(buf);
+	close(fd);
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+	const char *snapfile = DEF_SNAPFILE;
+	struct llkd_tasksnap_hdr *hdr;
+	struct llkd_task_rec *rec;
+	size_t bufsz = 1024 * 1024;
+	int fd, quiet = 0, opt, secs = 0;
+	unsigned int i, nkthrd = 0;
+	ssize_t n;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "qw:h")) != -1) {
+		switch (opt) {
+		case 'q':
+			quiet = 1;
+			break;
+		case 'w':
+			secs = atoi(optarg);
+			if (secs > 0)
+				break;
+			/* fallthrough */
+		default:
+			fprintf(stderr, "Usage: %s [-q] [snapshot-file] | -w secs\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (secs)
+		exit(delta_watch(secs));
+	if (optind < argc)
+		snapfile = argv[optind];
+
+	fd = open(snapfile, O_RDONLY);	/* the kernel takes the snapshot here */
+	if (fd < 0) {
+		perror("tasksnap_rd: open");
+		exit(EXIT_FAILURE);
+	}
+	/* One read(2) fetches it all, provided our buffer's large enough;
+	 * if it isn't, grow it and re-read from the start (it's the same
+	 * snapshot, as long as we keep the file open) */
+	for (;;) {
+		buf = malloc(bufsz);
+		if (!buf) {
+			fprintf(stderr, "tasksnap_rd: out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		n = pread(fd, buf, bufsz, 0);
+		if (n < 0) {
+			perror("tasksnap_rd: read");
+			exit(EXIT_FAILURE);
+		}
+		if ((size_t)n < bufsz || bufsz >= MAXSNAP)
+			break;
+		free(buf);
+		bufsz *= 4;
+	}
+	close(fd);
+
+	hdr = (struct llkd_tasksnap_hdr *)buf;
+	if ((size_t)n < sizeof(*hdr) || hdr->magic != LLKD_TASKSNAP_MAGIC ||
+	    hdr->recsz != sizeof(struct llkd_task_rec) ||
+	    (size_t)n < sizeof(*hdr) + (size_t)hdr->nrecs * hdr->recsz) {
+		fprintf(stderr, "tasksnap_rd: %s: invalid snapshot\n", snapfile);
+		exit(EXIT_FAILURE);
+	}
+
+	rec = (struct llkd_task_rec *)(hdr + 1);
+	if (!quiet)
+		printf("    TGID     PID  Flags       #thrds  Name\n");
+	for (i = 0; i < hdr->nrecs; i++) {
+		if (rec[i].flags & PF_KTHREAD)
+			nkthrd++;
+		if (quiet)
+			continue;
+		printf("%8d %8d  0x%08x %6d  %s%s%s\n",
+			rec[i].tgid, rec[i].pid, rec[i].flags, rec[i].nr_threads,
+			rec[i].flags & PF_KTHREAD ? "[" : "", rec[i].comm,
+			rec[i].flags & PF_KTHREAD ? "]" : "");
+	}
+	printf("%u tasks (%u kernel, %u user) in a %zd byte snapshot%s\n",
+		hdr->nrecs, nkthrd, hdr->nrecs - nkthrd, n,
+		hdr->flags & LLKD_TASKSNAP_TRUNCATED ? " (truncated)" : "");
+	free(buf);
+	exit(EXIT_SUCCESS);
+}
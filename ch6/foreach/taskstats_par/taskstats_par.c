@@ -0,0 +1,292 @@
+/*
+ * ch6/foreach/taskstats_par/taskstats_par.c
+ ***************************************************************
+ * Brief Description:
+ * A parallel, system-wide thread statistics aggregator.
+ * Rather than one CPU walking the whole task list (as thrd_showall's
+ * showthrds() does), we split the walk across work items, one per online CPU
+ * (or the nworkers parameter), each queued on it's own CPU. Each work item
+ * repeatedly claims a chunk of the PID space (an atomic cursor, so the load
+ * balances itself), walks the threads in it under RCU via find_ge_pid() (as
+ * /proc's readdir does) and accumulates private partial statistics - no
+ * shared cache lines, no locks; the partials are merged once all are done.
+ * The statistics:
+ *  - # of threads, kernel vs user threads, (multithreaded) processes
+ *  - threads per process histogram (power-of-2 buckets)
+ *  - task state histogram (R, S, D, ..., as in ps(1))
+ *  - distribution of the CPU each thread last ran on
+ * and are (re)computed on every read of <debugfs_mount>/taskstats_par/stats,
+ * a seq_file, in a simple 'key [subkey] value' text format meant for scraping.
+ *
+ * For details, please refer the book, Ch 6.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/pid.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define OURMODNAME   "taskstats_par"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LLKD book:ch6/foreach/taskstats_par:"
+		   " parallel (per-CPU) thread statistics aggregator");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static uint nworkers;
+module_param(nworkers, uint, 0644);
+MODULE_PARM_DESC(nworkers,
+ "# of parallel work items (each on a different online CPU) to split the walk"
+ " across; 0 (default) => all online CPUs, 1 => a serial walk");
+
+static uint chunk = 1024;
+module_param(chunk, uint, 0644);
+MODULE_PARM_DESC(chunk,
+ "# of PIDs a work item claims at a time (default 1024, min 16)");
+
+#define NSTATES		(1 + ilog2(TASK_REPORT_MAX))	/* "RSDTtXZPI" */
+#define NTPP		16	/* threads-per-process buckets: 1, 2-3, 4-7, ... */
+#define RCU_BATCH	256	/* threads walked per RCU read-side section */
+
+struct tstat {
+	unsigned long nthreads, nkthreads, nprocs, nmtprocs;
+	unsigned long state[NSTATES];
+	unsigned long tpp[NTPP];
+	unsigned long lastcpu[];	/* [nr_cpu_ids] */
+};
+
+struct tswork {
+	struct work_struct work;
+	atomic_t *cursor;		/* the next PID chunk to claim */
+	struct tstat *st;		/* this worker's partial stats */
+};
+
+static DEFINE_MUTEX(ts_mtx);		/* one aggregation at a time */
+static struct dentry *gparent;
+
+static inline size_t tstat_size(void)
+{
+	return struct_size((struct tstat *)NULL, lastcpu, nr_cpu_ids);
+}
+
+static void account(struct tstat *st, struct task_struct *t)
+{
+	unsigned int n;
+
+	st->nthreads++;
+	if (t->flags & PF_KTHREAD)
+		st->nkthreads++;
+	st->state[task_state_index(t)]++;
+	st->lastcpu[task_cpu(t)]++;
+	if (thread_group_leader(t)) {
+		st->nprocs++;
+		n = get_nr_threads(t);
+		if (n > 1)
+			st->nmtprocs++;
+		st->tpp[min_t(unsigned int, ilog2(max(n, 1U)), NTPP - 1)]++;
+	}
+}
+
+/* A work item: claim PID chunks until we run off the end of the PID space */
+static void ts_worker(struct work_struct *work)
+{
+	struct tswork *w = container_of(work, struct tswork, work);
+	unsigned int batch, sz = max(READ_ONCE(chunk), 16U);
+	int lo, hi, nr;
+	struct task_struct *t;
+	struct pid *pid;
+
+	for (;;) {
+		lo = atomic_fetch_add(sz, w->cursor);
+		if (lo < 0 || lo >= PID_MAX_LIMIT)
+			return;
+		hi = lo + sz;
+
+		nr = lo;
+		rcu_read_lock();
+		for (batch = 0; ; batch++) {
+			pid = find_ge_pid(nr, &init_pid_ns);
+			if (!pid) {	/* nothing beyond; we're all done */
+				rcu_read_unlock();
+				atomic_set(w->cursor, PID_MAX_LIMIT);
+				return;
+			}
+			nr = pid_nr(pid);
+			if (nr >= hi)
+				break;
+			t = pid_task(pid, PIDTYPE_PID);
+			if (t)
+				account(w->st, t);
+			nr++;
+			/* don't hold up RCU grace periods for too long; our
+			 * cursor's a PID, so resuming's trivial */
+			if (batch == RCU_BATCH) {
+				rcu_read_unlock();
+				cond_resched();
+				rcu_read_lock();
+				batch = 0;
+			}
+		}
+		rcu_read_unlock();
+	}
+}
+
+/*
+ * Aggregate: run the workers and merge their partials into @res (zeroed by
+ * the caller). Returns the # of workers used, or -ENOMEM.
+ */
+static int ts_aggregate(struct tstat *res)
+{
+	unsigned int n = 0, maxw, i, j;
+	struct tswork *w;
+	atomic_t cursor = ATOMIC_INIT(1);	/* PID 0 (the idle threads)
+						 * isn't hashed; not counted */
+	int cpu;
+
+	cpus_read_lock();
+	maxw = nworkers ? min(nworkers, num_online_cpus()) : num_online_cpus();
+	w = kcalloc(maxw, sizeof(*w), GFP_KERNEL);
+	if (!w)
+		goto out_nomem;
+	for (i = 0; i < maxw; i++) {
+		w[i].st = kzalloc(tstat_size(), GFP_KERNEL);
+		if (!w[i].st)
+			goto out_nomem;
+	}
+
+	for_each_online_cpu(cpu) {
+		if (n == maxw)
+			break;
+		INIT_WORK(&w[n].work, ts_worker);
+		w[n].cursor = &cursor;
+		queue_work_on(cpu, system_wq, &w[n].work);
+		n++;
+	}
+	for (i = 0; i < n; i++)
+		flush_work(&w[i].work);
+	cpus_read_unlock();
+
+	/* Merge */
+	for (i = 0; i < n; i++) {
+		struct tstat *st = w[i].st;
+
+		res->nthreads += st->nthreads;
+		res->nkthreads += st->nkthreads;
+		res->nprocs += st->nprocs;
+		res->nmtprocs += st->nmtprocs;
+		for (j = 0; j < NSTATES; j++)
+			res->state[j] += st->state[j];
+		for (j = 0; j < NTPP; j++)
+			res->tpp[j] += st->tpp[j];
+		for (j = 0; j < nr_cpu_ids; j++)
+			res->lastcpu[j] += st->lastcpu[j];
+	}
+	for (i = 0; i < maxw; i++)
+		kfree(w[i].st);
+	kfree(w);
+	return n;
+
+ out_nomem:
+	cpus_read_unlock();
+	if (w)
+		for (i = 0; i < maxw; i++)
+			kfree(w[i].st);
+	kfree(w);
+	return -ENOMEM;
+}
+
+static int ts_show(struct seq_file *m, void *v)
+{
+	static const char states[] = "RSDTtXZPI";
+	struct tstat *res;
+	u64 t0, t1;
+	int ret, i;
+
+	BUILD_BUG_ON(sizeof(states) - 1 != NSTATES);
+	res = kzalloc(tstat_size(), GFP_KERNEL);
+	if (!res)
+		return -ENOMEM;
+
+	mutex_lock(&ts_mtx);
+	t0 = ktime_get_ns();
+	ret = ts_aggregate(res);
+	t1 = ktime_get_ns();
+	mutex_unlock(&ts_mtx);
+	if (ret < 0)
+		goto out;
+
+	seq_printf(m, "threads %lu\n", res->nthreads);
+	seq_printf(m, "kthreads %lu\n", res->nkthreads);
+	seq_printf(m, "uthreads %lu\n", res->nthreads - res->nkthreads);
+	seq_printf(m, "processes %lu\n", res->nprocs);
+	seq_printf(m, "mt_processes %lu\n", res->nmtprocs);
+	for (i = 0; i < NSTATES; i++)
+		seq_printf(m, "state %c %lu\n", states[i], res->state[i]);
+	for (i = 0; i < NTPP; i++) {
+		if (!res->tpp[i])
+			continue;
+		if (i == 0)
+			seq_printf(m, "threads_per_process 1 %lu\n", res->tpp[i]);
+		else if (i == NTPP - 1)
+			seq_printf(m, "threads_per_process %u+ %lu\n",
+				   1U << i, res->tpp[i]);
+		else
+			seq_printf(m, "threads_per_process %u-%u %lu\n",
+				   1U << i, (2U << i) - 1, res->tpp[i]);
+	}
+	for_each_possible_cpu(i)
+		seq_printf(m, "lastcpu %d %lu\n", i, res->lastcpu[i]);
+	seq_printf(m, "walk_ns %llu\nworkers %d\n", t1 - t0, ret);
+	ret = 0;
+ out:
+	kfree(res);
+	return ret;
+}
+
+static int ts_open(struct inode *inode, struct file *filp)
+{
+	/* a sizeable initial buffer: there's a line per possible CPU */
+	return single_open_size(filp, ts_show, NULL,
+				PAGE_SIZE + nr_cpu_ids * 32);
+}
+
+static const struct file_operations ts_fops = {
+	.owner = THIS_MODULE,
+	.open = ts_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init taskstats_par_init(void)
+{
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("stats", 0444, gparent, NULL,
+					       &ts_fops))) {
+		pr_warn("%s: debugfs setup failed\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		return -ENODEV;
+	}
+	pr_info("%s: inserted (<debugfs_mount>/%s/stats)\n",
+		OURMODNAME, OURMODNAME);
+	return 0;		/* success */
+}
+
+static void __exit taskstats_par_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	pr_info("%s: removed\n", OURMODNAME);
+}
+
+module_init(taskstats_par_init);
+module_exit(taskstats_par_exit);
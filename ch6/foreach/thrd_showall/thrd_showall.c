@@ -15,6 +15,10 @@
  * currently alive on the box, printing out some details.
  * We use the do_each_thread() { ... } while_each_thread() macros to do
  * so here.
+ * It also sets up a debugfs file, <debugfs_mount>/thrd_showall/snapshot,
+ * that - on every open - takes a binary snapshot of all threads, walking
+ * the task list under RCU only (no per-task locks, no printk's); see
+ * ../tasksnap.h. (Pass print=0 to skip the printk-based walk at insmod.)
  *
  * For details, please refer the book, Ch 6.
  */
@@ -27,6 +31,9 @@
 #include <linux/sched/signal.h>
 #endif
 
+#define LLKD_TASKSNAP_FILE	/* the debugfs snapshot file */
+#include "../tasksnap.h"
+
 #define OURMODNAME   "thrd_showall"
 
 MODULE_AUTHOR("Kaiwan N Billimoria");
@@ -35,6 +42,14 @@ MODULE_DESCRIPTION("LLKD book:ch6/foreach/thrd_showall:"
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
 
+static bool print = true;
+module_param(print, bool, 0444);
+MODULE_PARM_DESC(print,
+ "Print all threads to the kernel log at insmod (default 1); the binary"
+ " snapshot (debugfs) file is available regardless");
+
+static struct dentry *gsnapdir;
+
 /* Display just this CPU's idle thread, i.e., the pid 0 task,
  * the (terribly named) 'swapper/n'; n = 0, 1, 2,...
  * Again, init_task is always the task structure of the first CPU's
@@ -131,15 +146,23 @@ static int __init thrd_showall_init(void)
 	int total;
 
 	pr_debug("%s: inserted\n", OURMODNAME);
-	total = showthrds();
-	pr_info("%s: total # of threads on the system: %d\n",
-		OURMODNAME, total);
+	if (print) {
+		total = showthrds();
+		pr_info("%s: total # of threads on the system: %d\n",
+			OURMODNAME, total);
+	}
+
+	gsnapdir = llkd_tasksnap_init(OURMODNAME, true);
+	if (!gsnapdir)		/* not fatal */
+		pr_notice("%s: couldn't setup the debugfs snapshot file\n",
+			OURMODNAME);
 
 	return 0;		/* success */
 }
 
 static void __exit thrd_showall_exit(void)
 {
+	debugfs_remove_recursive(gsnapdir);
 	pr_debug("%s: removed\n", OURMODNAME);
 }
 
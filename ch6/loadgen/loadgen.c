@@ -0,0 +1,384 @@
+/*
+ * ch6/loadgen/loadgen.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Learn Linux Kernel Development"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Learn-Linux-Kernel-Development
+ *
+ * From: Ch 6: Kernel and Memory Management Internals Essentials
+ ****************************************************************
+ * Brief Description:
+ * A calibrated synthetic load generator; unlike convenient.h's DELAY_LOOP
+ * (whose run time depends on the compiler, the CPU and HZ), the load here's
+ * specified in time: on each of the selected CPUs, a (bound) kernel thread
+ * does work_us microseconds of 'work' and then sleeps, for a duty cycle of
+ * duty_pct percent. The work is of one of three flavors:
+ *  compute : integer arithmetic, in registers
+ *  memory  : read-modify-write streaming through a (per-thread, node local)
+ *            memkb KB buffer - size it above the LLC to load the memory bus
+ *  lock    : short critical sections on one global spinlock, contended by
+ *            all the threads (and bouncing it's cacheline around)
+ * At load time, we calibrate each flavor: how many work 'units' take a
+ * millisecond (on this CPU, uncontended). Under contention (or CPU frequency
+ * changes, or preemption) a period's work takes longer than work_us, of
+ * course; that's the point, and we measure it: the actual time each period's
+ * work took goes into a latency histogram (see convenient.h), readable via
+ *  <debugfs_mount>/loadgen/work_ns
+ * and <debugfs_mount>/loadgen/stats shows the calibration and per-CPU counts.
+ * work_us and duty_pct can be retuned at runtime (via
+ * /sys/module/loadgen/parameters/), the rest are fixed at load time.
+ *
+ * F.e.:
+ *  sudo insmod ./loadgen.ko cpus=2-3 flavor=memory work_us=500 duty_pct=25
+ *
+ * For details, please refer the book, Ch 6.
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <linux/sizes.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define LLKD_USE_TIMING		/* the work time histogram */
+#include "../../convenient.h"
+
+#define OURMODNAME   "loadgen"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LLKD book:ch6/loadgen: calibrated per-CPU synthetic load generator");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static char *cpus;
+module_param(cpus, charp, 0444);
+MODULE_PARM_DESC(cpus,
+ "The CPUs to run the load on, as a cpulist (f.e. \"0,2-3\"); default: all"
+ " online CPUs");
+
+static char *flavor = "compute";
+module_param(flavor, charp, 0444);
+MODULE_PARM_DESC(flavor,
+ "The flavor of work: compute (default), memory or lock");
+
+static uint work_us = 1000;
+module_param(work_us, uint, 0644);
+MODULE_PARM_DESC(work_us, "Work per period, in microseconds (default 1000)");
+
+static uint duty_pct = 50;
+module_param(duty_pct, uint, 0644);
+MODULE_PARM_DESC(duty_pct,
+ "Duty cycle: the % of each period spent working, [1-100] (default 50)");
+
+static uint memkb = 8192;
+module_param(memkb, uint, 0444);
+MODULE_PARM_DESC(memkb,
+ "'memory' flavor: per-thread buffer size, in KB (default 8192)");
+
+static uint duration_s;
+module_param(duration_s, uint, 0444);
+MODULE_PARM_DESC(duration_s,
+ "Stop generating load after this many seconds; 0 (default) => until unload");
+
+enum lg_flavor { LG_COMPUTE, LG_MEMORY, LG_LOCK, LG_NFLAVORS };
+static const char * const flavor_names[LG_NFLAVORS] = {
+	"compute", "memory", "lock"
+};
+
+#define UNIT_MEMSZ	SZ_4K		/* bytes streamed per 'memory' unit */
+#define RESCHED_US	100		/* a rescheduling point every ~this */
+
+/* Per-thread state */
+struct lg_thread {
+	struct task_struct *task;
+	int cpu;
+	u64 *buf;			/* 'memory' flavor */
+	size_t bufwords, pos;
+	u64 sink;			/* keeps the compiler from eliding work */
+	u64 periods, units;
+};
+
+static enum lg_flavor gflavor;
+static u64 units_per_ms;		/* calibrated, for gflavor */
+static struct cpumask gcpus;
+static struct lg_thread *gthreads;	/* one per CPU in gcpus */
+static int gnthreads;
+static DEFINE_SPINLOCK(glock);		/* 'lock' flavor: the contended lock */
+static u64 gshared ____cacheline_aligned_in_smp;	/* ... and data */
+static struct llkd_hist ghist;
+static struct dentry *gparent;
+static u64 gend_ns;
+
+/*--- the work 'units' ---*/
+static inline u64 mix(u64 x, int n)
+{
+	while (n--)
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+	return x;
+}
+
+static void unit_compute(struct lg_thread *t)
+{
+	t->sink = mix(t->sink, 64);
+}
+
+static void unit_memory(struct lg_thread *t)
+{
+	u64 *p = t->buf + t->pos;
+	size_t i;
+
+	for (i = 0; i < UNIT_MEMSZ / sizeof(u64); i++)
+		p[i] += i;
+	t->pos += UNIT_MEMSZ / sizeof(u64);
+	if (t->pos >= t->bufwords)
+		t->pos = 0;
+}
+
+static void unit_lock(struct lg_thread *t)
+{
+	spin_lock(&glock);
+	gshared = mix(gshared, 8);
+	spin_unlock(&glock);
+}
+
+static void (* const units[LG_NFLAVORS])(struct lg_thread *) = {
+	unit_compute, unit_memory, unit_lock
+};
+
+/*
+ * Calibrate: the # of @fn units in a ms. Double the # of units until a run
+ * takes >= 2 ms, then take the fastest of a few such runs (the least
+ * disturbed by interrupts, preemption, ...).
+ */
+static u64 calibrate(void (*fn)(struct lg_thread *), struct lg_thread *t)
+{
+	u64 n = 16, i, t0, ns, best = U64_MAX;
+	int run;
+
+	for (;;) {
+		t0 = ktime_get_ns();
+		for (i = 0; i < n; i++)
+			fn(t);
+		ns = ktime_get_ns() - t0;
+		if (ns >= 2 * NSEC_PER_MSEC)
+			break;
+		n *= 2;
+		cond_resched();
+	}
+	for (run = 0; run < 5; run++) {
+		t0 = ktime_get_ns();
+		for (i = 0; i < n; i++)
+			fn(t);
+		best = min(best, ktime_get_ns() - t0);
+		cond_resched();
+	}
+	return max(div64_u64(n * NSEC_PER_MSEC, max(best, 1ULL)), 1ULL);
+}
+
+/* Allocate the 'memory' flavor buffer, on @cpu's node */
+static int thread_buf_alloc(struct lg_thread *t, int cpu)
+{
+	size_t sz = round_up((size_t)max(memkb, 4U) * 1024, UNIT_MEMSZ);
+
+	t->buf = vzalloc_node(sz, cpu_to_node(cpu));
+	if (!t->buf)
+		return -ENOMEM;
+	t->bufwords = sz / sizeof(u64);
+	return 0;
+}
+
+static int lg_thread_fn(void *data)
+{
+	struct lg_thread *t = data;
+	void (*fn)(struct lg_thread *) = units[gflavor];
+	/* a rescheduling point every RESCHED_US worth of units */
+	u64 rs = div_u64(units_per_ms * RESCHED_US, USEC_PER_MSEC) + 1;
+	u64 n, i, k, t0, idle_us;
+	unsigned int wus, duty;
+
+	while (!kthread_should_stop()) {
+		if (gend_ns && ktime_get_ns() >= gend_ns)
+			break;
+		/* run-time tunable; a torn read of the pair is harmless */
+		wus = max(READ_ONCE(work_us), 1U);
+		duty = clamp(READ_ONCE(duty_pct), 1U, 100U);
+		n = div_u64(units_per_ms * wus, USEC_PER_MSEC);
+		idle_us = div_u64((u64)wus * (100 - duty), duty);
+
+		t0 = llkd_now_ns();
+		for (i = 0, k = 0; i < n; i++) {
+			fn(t);
+			/* we're a CPU hog, at normal priority, like any other:
+			 * preemptible, at a reasonable granularity */
+			if (unlikely(++k >= rs)) {
+				k = 0;
+				cond_resched();
+			}
+		}
+		llkd_hist_add(&ghist, llkd_now_ns() - t0);
+		t->units += n;
+		t->periods++;
+
+		if (idle_us)
+			usleep_range(idle_us, idle_us + idle_us / 16 + 1);
+		else
+			cond_resched();
+	}
+	/* done (duration_s elapsed): wait to be stopped */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			break;
+		}
+		schedule();
+	}
+	return 0;
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	seq_printf(m, "flavor %s\nunits_per_ms %llu\nwork_us %u\nduty_pct %u\n",
+		   flavor_names[gflavor], units_per_ms, READ_ONCE(work_us),
+		   READ_ONCE(duty_pct));
+	seq_puts(m, "# cpu  periods  units\n");
+	for (i = 0; i < gnthreads; i++)
+		seq_printf(m, "%d %llu %llu\n", gthreads[i].cpu,
+			   READ_ONCE(gthreads[i].periods),
+			   READ_ONCE(gthreads[i].units));
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void threads_stop(void)
+{
+	int i;
+
+	for (i = 0; i < gnthreads; i++) {
+		if (gthreads[i].task)
+			kthread_stop(gthreads[i].task);
+		vfree(gthreads[i].buf);
+	}
+	kfree(gthreads);
+}
+
+static int __init loadgen_init(void)
+{
+	struct lg_thread calt = { .sink = 1 };
+	int ret, cpu, i = 0;
+
+	ret = match_string(flavor_names, LG_NFLAVORS, flavor);
+	if (ret < 0) {
+		pr_warn("%s: invalid flavor \"%s\"\n", OURMODNAME, flavor);
+		return -EINVAL;
+	}
+	gflavor = ret;
+	if (cpus) {
+		ret = cpulist_parse(cpus, &gcpus);
+		if (ret) {
+			pr_warn("%s: invalid cpulist \"%s\"\n", OURMODNAME, cpus);
+			return ret;
+		}
+		cpumask_and(&gcpus, &gcpus, cpu_online_mask);
+	} else
+		cpumask_copy(&gcpus, cpu_online_mask);
+	if (cpumask_empty(&gcpus)) {
+		pr_warn("%s: no (online) CPUs to run on\n", OURMODNAME);
+		return -EINVAL;
+	}
+
+	/* calibrate (on a scratch buffer for the 'memory' flavor) */
+	if (gflavor == LG_MEMORY && thread_buf_alloc(&calt, raw_smp_processor_id()))
+		return -ENOMEM;
+	units_per_ms = calibrate(units[gflavor], &calt);
+	vfree(calt.buf);
+	pr_info("%s: flavor %s: %llu units/ms\n",
+		OURMODNAME, flavor_names[gflavor], units_per_ms);
+
+	ret = llkd_hist_init(&ghist, "work_ns");
+	if (ret)
+		return ret;
+	gthreads = kcalloc(cpumask_weight(&gcpus), sizeof(*gthreads), GFP_KERNEL);
+	if (!gthreads) {
+		ret = -ENOMEM;
+		goto out_hist;
+	}
+	if (duration_s)
+		gend_ns = ktime_get_ns() + (u64)duration_s * NSEC_PER_SEC;
+
+	for_each_cpu(cpu, &gcpus) {
+		struct lg_thread *t = &gthreads[i];
+
+		t->cpu = cpu;
+		t->sink = cpu + 1;
+		gnthreads = ++i;
+		if (gflavor == LG_MEMORY) {
+			ret = thread_buf_alloc(t, cpu);
+			if (ret)
+				goto out_threads;
+		}
+		t->task = kthread_create_on_node(lg_thread_fn, t, cpu_to_node(cpu),
+						 "llkd_load/%d", cpu);
+		if (IS_ERR(t->task)) {
+			ret = PTR_ERR(t->task);
+			t->task = NULL;
+			goto out_threads;
+		}
+		kthread_bind(t->task, cpu);
+		wake_up_process(t->task);
+	}
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("stats", 0444, gparent, NULL,
+					       &stats_fops)) ||
+	    IS_ERR_OR_NULL(llkd_hist_debugfs(&ghist, gparent)))
+		pr_notice("%s: debugfs setup failed (not fatal)\n", OURMODNAME);
+
+	pr_info("%s: %d thread(s), cpus %*pbl: %u us work per period, %u%% duty\n",
+		OURMODNAME, gnthreads, cpumask_pr_args(&gcpus), work_us, duty_pct);
+	return 0;		/* success */
+
+ out_threads:
+	threads_stop();
+ out_hist:
+	llkd_hist_destroy(&ghist);
+	return ret;
+}
+
+static void __exit loadgen_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	threads_stop();
+	llkd_hist_destroy(&ghist);
+	pr_info("%s: removed\n", OURMODNAME);
+}
+
+module_init(loadgen_init);
+module_exit(loadgen_exit);
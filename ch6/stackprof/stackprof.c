@@ -0,0 +1,445 @@
+/*
+ * ch6/stackprof/stackprof.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Learn Linux Kernel Development"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Learn-Linux-Kernel-Development
+ *
+ * From: Ch 6: Kernel and Memory Management Internals Essentials
+ ****************************************************************
+ * Brief Description:
+ * An in-kernel sampling stack profiler; no BPF toolchain (as the
+ * ebpf_stacktrace_eg demo's BCC stackcount needs) required.
+ * We take a kernel stack trace - via stack_trace_save() -
+ *  - on a (pinned) hrtimer on every online CPU, every period_us
+ *    microseconds (the default), or
+ *  - on every hit of a kprobe on the kernel function probe=<symbol>
+ *    (f.e. probe=ksys_write, much as stackcount does)
+ * of whatever's running there (or hitting the probe), optionally only of
+ * process (TGID) pid=<n>. Samples of the idle task are skipped, and of a task
+ * running in userspace, simply counted as the one frame '[user]'.
+ * Identical stacks are aggregated in kernel, in a (fixed size, lock-free)
+ * hash table, so only the deduplicated stacks - and their counts - are read
+ * out, via
+ *  <debugfs_mount>/stackprof/stacks
+ * one per line, in 'folded' format: root;...;leaf <count> ; just what
+ * Brendan Gregg's flamegraph.pl wants. Write to it to reset the profile.
+ * <debugfs_mount>/stackprof/stats has the sample counts (and drops, if the
+ * table filled up).
+ *
+ * F.e.:
+ *  sudo insmod ./stackprof.ko pid=$(pgrep helloworld_dbg) probe=ksys_write
+ *  sleep 5; sudo cat /sys/kernel/debug/stackprof/stacks | flamegraph.pl > out.svg
+ *
+ * Caveats: CPUs that come online later aren't sampled (and one that goes
+ * offline has it's timer migrated, so it's neighbour gets sampled twice as
+ * often); the hottest stacks' counters are shared, atomic, cache lines.
+ *
+ * For details, please refer the book, Ch 6.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/kprobes.h>
+#include <linux/stacktrace.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/log2.h>
+#include <linux/sizes.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <asm/irq_regs.h>	/* get_irq_regs() */
+
+#define OURMODNAME   "stackprof"
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LLKD book:ch6/stackprof: in-kernel sampling stack profiler");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+#define SP_MAXDEPTH	32	/* frames kept per stack */
+#define SP_SKIPMAX	16	/* ... plus (upto) this many of our own, trimmed */
+#define SP_MAXPROBES	16	/* hash table probes, before we give up */
+#define SP_USER_IP	1UL	/* the 'frame' of a sample in userspace */
+
+static int pid;
+module_param(pid, int, 0444);
+MODULE_PARM_DESC(pid, "Sample only this process (TGID); 0 (default) => all");
+
+static uint period_us = 1000;
+module_param(period_us, uint, 0444);
+MODULE_PARM_DESC(period_us,
+ "hrtimer mode: the sampling period (per CPU), in microseconds (default 1000)");
+
+static char *probe;
+module_param(probe, charp, 0444);
+MODULE_PARM_DESC(probe,
+ "kprobe mode: sample on each hit of this kernel function (instead of on a timer)");
+
+static uint depth = SP_MAXDEPTH;
+module_param(depth, uint, 0444);
+MODULE_PARM_DESC(depth,
+ "Max # of frames per stack (default, and max, " __stringify(SP_MAXDEPTH) ")");
+
+static uint nslots = 4096;
+module_param(nslots, uint, 0444);
+MODULE_PARM_DESC(nslots,
+ "# of distinct stacks we can hold; rounded up to a power of 2 (default 4096)");
+
+/*
+ * A hash table slot: claimed by cmpxchg()'ing in the (nonzero) hash, then
+ * filled in; setting nr (with release semantics) publishes it
+ */
+struct sp_slot {
+	u32 hash;		/* 0 => free */
+	u32 nr;			/* # of frames; 0 => being filled in */
+	atomic64_t count;
+	unsigned long ips[SP_MAXDEPTH];	/* innermost frame first */
+};
+
+struct sp_stats {
+	u64 samples;		/* stacks recorded */
+	u64 idle;		/* skipped: the idle task */
+	u64 filtered;		/* skipped: not our pid */
+	u64 user;		/* recorded as '[user]' */
+	u64 dropped;		/* the table's full (or the slot's busy) */
+};
+
+static struct sp_slot *gtab;
+static unsigned int gmask;
+static bool gpaused;
+static DEFINE_MUTEX(gmtx);		/* readers vs reset */
+static DEFINE_PER_CPU(struct sp_stats, sp_stats);
+static DEFINE_PER_CPU(struct hrtimer, sp_timers);
+static ktime_t gperiod;
+static struct dentry *gparent;
+#ifdef CONFIG_KPROBES
+static struct kprobe gkp;
+#endif
+
+/* Count the stack @ips[0..@nr - 1] in the table; any context */
+static void sp_insert(const unsigned long *ips, unsigned int nr)
+{
+	u32 h = jhash(ips, nr * sizeof(*ips), 0) | 1;	/* never 0 */
+	struct sp_slot *s;
+	u32 cur;
+	int i;
+
+	for (i = 0; i < SP_MAXPROBES; i++) {
+		s = &gtab[(h + i) & gmask];
+		cur = READ_ONCE(s->hash);
+		if (!cur) {
+			cur = cmpxchg(&s->hash, 0, h);
+			if (!cur) {		/* it's ours */
+				memcpy(s->ips, ips, nr * sizeof(*ips));
+				atomic64_set(&s->count, 1);
+				smp_store_release(&s->nr, nr);
+				return;
+			}
+		}
+		if (cur != h)
+			continue;
+		if (smp_load_acquire(&s->nr) == nr &&
+		    !memcmp(s->ips, ips, nr * sizeof(*ips))) {
+			atomic64_inc(&s->count);
+			return;
+		}
+		/* a collision, or another CPU's still filling it in */
+	}
+	this_cpu_inc(sp_stats.dropped);
+}
+
+/*
+ * Take a sample of current; @regs are those of the interrupted (or probed)
+ * context, if we have them. Runs with interrupts (timer) or preemption
+ * (kprobe) off.
+ */
+static void sp_sample(struct pt_regs *regs)
+{
+	unsigned long ips[SP_MAXDEPTH + SP_SKIPMAX], ip;
+	unsigned int nr, i;
+
+	if (unlikely(READ_ONCE(gpaused)))
+		return;
+	if (is_idle_task(current)) {
+		this_cpu_inc(sp_stats.idle);
+		return;
+	}
+	if (pid && task_tgid_nr(current) != pid) {
+		this_cpu_inc(sp_stats.filtered);
+		return;
+	}
+	this_cpu_inc(sp_stats.samples);
+
+	if (regs && user_mode(regs)) {
+		this_cpu_inc(sp_stats.user);
+		ips[0] = SP_USER_IP;
+		sp_insert(ips, 1);
+		return;
+	}
+	nr = stack_trace_save(ips, ARRAY_SIZE(ips), 0);
+	/*
+	 * The trace starts with our own frames - this function, the hrtimer
+	 * or kprobe machinery, the interrupt entry; trim them: the sampled
+	 * context's starts at it's IP (if the unwinder reports it as such)
+	 */
+	if (regs) {
+		ip = instruction_pointer(regs);
+		for (i = 0; i < nr; i++)
+			if (ips[i] == ip)
+				break;
+		if (i < nr) {
+			memmove(ips, ips + i, (nr - i) * sizeof(*ips));
+			nr -= i;
+		}
+	}
+	if (unlikely(!nr)) {
+		this_cpu_inc(sp_stats.dropped);
+		return;
+	}
+	sp_insert(ips, min(nr, depth));
+}
+
+static enum hrtimer_restart sp_tick(struct hrtimer *timer)
+{
+	sp_sample(get_irq_regs());
+	hrtimer_forward_now(timer, gperiod);
+	return HRTIMER_RESTART;
+}
+
+/* on_each_cpu() callback: start this CPU's sampling timer */
+static void sp_timer_start(void *unused)
+{
+	hrtimer_start(this_cpu_ptr(&sp_timers), gperiod, HRTIMER_MODE_REL_PINNED);
+}
+
+#ifdef CONFIG_KPROBES
+static int sp_kprobe_pre(struct kprobe *p, struct pt_regs *regs)
+{
+	sp_sample(regs);
+	return 0;
+}
+#endif
+
+/* Stop sampling, wait for samplers in flight, clear it all, restart */
+static void sp_reset(void)
+{
+	int cpu;
+
+	mutex_lock(&gmtx);
+	WRITE_ONCE(gpaused, true);
+	/* the samplers run with interrupts, or preemption, off */
+	synchronize_rcu();
+	memset(gtab, 0, (gmask + 1) * sizeof(*gtab));
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&sp_stats, cpu), 0, sizeof(struct sp_stats));
+	WRITE_ONCE(gpaused, false);
+	mutex_unlock(&gmtx);
+}
+
+/*--- debugfs ---*/
+/* The first in-use slot at index >= *@pos (which we update), or NULL */
+static struct sp_slot *sp_next_used(loff_t *pos)
+{
+	for (; *pos <= gmask; ++*pos)
+		if (smp_load_acquire(&gtab[*pos].nr))
+			return &gtab[*pos];
+	return NULL;
+}
+
+static void *sp_seq_start(struct seq_file *m, loff_t *pos)
+{
+	mutex_lock(&gmtx);
+	return sp_next_used(pos);
+}
+
+static void *sp_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return sp_next_used(pos);
+}
+
+static void sp_seq_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&gmtx);
+}
+
+/* One stack, folded: root first, leaf last, then the count */
+static int sp_seq_show(struct seq_file *m, void *v)
+{
+	struct sp_slot *s = v;
+	int i;
+
+	for (i = s->nr - 1; i >= 0; i--) {
+		if (s->ips[i] == SP_USER_IP)
+			seq_puts(m, "[user]");
+		else
+			seq_printf(m, "%ps", (void *)s->ips[i]);
+		if (i)
+			seq_putc(m, ';');
+	}
+	seq_printf(m, " %lld\n", atomic64_read(&s->count));
+	return 0;
+}
+
+static const struct seq_operations sp_seq_ops = {
+	.start = sp_seq_start,
+	.next = sp_seq_next,
+	.stop = sp_seq_stop,
+	.show = sp_seq_show,
+};
+
+static int sp_stacks_open(struct inode *inode, struct file *filp)
+{
+	return seq_open(filp, &sp_seq_ops);
+}
+
+/* A write - of anything - resets the profile */
+static ssize_t sp_stacks_write(struct file *filp, const char __user *ubuf,
+			       size_t count, loff_t *off)
+{
+	sp_reset();
+	return count;
+}
+
+static const struct file_operations sp_stacks_fops = {
+	.open = sp_stacks_open,
+	.read = seq_read,
+	.write = sp_stacks_write,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+static int sp_stats_show(struct seq_file *m, void *v)
+{
+	struct sp_stats st = { 0 }, *p;
+	unsigned int i, used = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		p = per_cpu_ptr(&sp_stats, cpu);
+		st.samples += READ_ONCE(p->samples);
+		st.idle += READ_ONCE(p->idle);
+		st.filtered += READ_ONCE(p->filtered);
+		st.user += READ_ONCE(p->user);
+		st.dropped += READ_ONCE(p->dropped);
+	}
+	for (i = 0; i <= gmask; i++)
+		used += !!READ_ONCE(gtab[i].nr);
+	seq_printf(m, "mode %s\npid %d\nsamples %llu\nuser %llu\nidle %llu\n"
+		   "filtered %llu\ndropped %llu\nstacks %u/%u\n",
+		   probe ? probe : "hrtimer", pid, st.samples, st.user, st.idle,
+		   st.filtered, st.dropped, used, gmask + 1);
+	return 0;
+}
+
+static int sp_stats_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, sp_stats_show, NULL);
+}
+
+static const struct file_operations sp_stats_fops = {
+	.open = sp_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init stackprof_init(void)
+{
+	int cpu, ret = -ENOMEM;
+
+	if (!depth || depth > SP_MAXDEPTH || !nslots || nslots > SZ_1M ||
+	    (!probe && !period_us)) {
+		pr_warn("%s: invalid depth/nslots/period_us (%u/%u/%u)\n",
+			OURMODNAME, depth, nslots, period_us);
+		return -EINVAL;
+	}
+#ifndef CONFIG_KPROBES
+	if (probe) {
+		pr_warn("%s: no kprobes (CONFIG_KPROBES) on this kernel\n",
+			OURMODNAME);
+		return -EOPNOTSUPP;
+	}
+#endif
+	nslots = roundup_pow_of_two(nslots);
+	gmask = nslots - 1;
+	gtab = vzalloc(array_size(nslots, sizeof(*gtab)));
+	if (!gtab)
+		return -ENOMEM;
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("%s: debugfs_create_dir failed, aborting...\n", OURMODNAME);
+		ret = gparent ? PTR_ERR(gparent) : -ENOMEM;
+		goto out_free;
+	}
+	if (IS_ERR_OR_NULL(debugfs_create_file("stacks", 0644, gparent, NULL,
+					       &sp_stacks_fops)) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("stats", 0444, gparent, NULL,
+					       &sp_stats_fops))) {
+		pr_warn("%s: debugfs_create_file failed, aborting...\n", OURMODNAME);
+		goto out_debugfs;
+	}
+
+#ifdef CONFIG_KPROBES
+	if (probe) {
+		gkp.symbol_name = probe;
+		gkp.pre_handler = sp_kprobe_pre;
+		ret = register_kprobe(&gkp);
+		if (ret) {
+			pr_warn("%s: register_kprobe(%s) failed (%d)\n",
+				OURMODNAME, probe, ret);
+			goto out_debugfs;
+		}
+		pr_info("%s: sampling on kprobe %s, pid %d\n", OURMODNAME,
+			probe, pid);
+		return 0;	/* success */
+	}
+#endif
+	gperiod = ns_to_ktime((u64)period_us * NSEC_PER_USEC);
+	for_each_possible_cpu(cpu) {
+		hrtimer_init(per_cpu_ptr(&sp_timers, cpu), CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL_PINNED);
+		per_cpu_ptr(&sp_timers, cpu)->function = sp_tick;
+	}
+	cpus_read_lock();
+	on_each_cpu(sp_timer_start, NULL, 1);
+	cpus_read_unlock();
+	pr_info("%s: sampling every %u us on %u CPUs, pid %d\n", OURMODNAME,
+		period_us, num_online_cpus(), pid);
+	return 0;		/* success */
+
+ out_debugfs:
+	debugfs_remove_recursive(gparent);
+ out_free:
+	vfree(gtab);
+	return ret;
+}
+
+static void __exit stackprof_exit(void)
+{
+	int cpu;
+
+#ifdef CONFIG_KPROBES
+	if (probe)
+		unregister_kprobe(&gkp);
+	else
+#endif
+		for_each_possible_cpu(cpu)
+			hrtimer_cancel(per_cpu_ptr(&sp_timers, cpu));
+	debugfs_remove_recursive(gparent);
+	vfree(gtab);
+	pr_info("%s: removed\n", OURMODNAME);
+}
+
+module_init(stackprof_init);
+module_exit(stackprof_exit);
@@ -24,6 +24,16 @@
  * (Also, fyi, for a more detailed view of the user VAS, see our 'vasu_grapher'
  * utility).
  *
+ * The same layout is also available on demand - no need to reload the module
+ * (or scrape the kernel log) - via debugfs:
+ *  <debugfs_mount>/kernel_seg/layout : as text, a line per region
+ *  <debugfs_mount>/kernel_seg/table  : as a binary table (see kernel_seg.h),
+ *                                      in a single read
+ * The kernel regions are computed just once, at init; the user VAS ones on
+ * each read, for the reader itself or any process whose PID is written to
+ * the (open) file - provided the reader may ptrace-read it, as for
+ * /proc/PID/maps.
+ *
  * For details, please refer the book, Ch 6.
  */
 #include <linux/init.h>
@@ -34,8 +44,16 @@
 #include <linux/highmem.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/sched/mm.h>
+#include <linux/pid.h>
+#include <linux/ptrace.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
 #include <asm/pgtable.h>
 #include "../../klib_llkd.h"
+#include "kernel_seg.h"
 #include "../../convenient.h"
 
 #define OURMODNAME   "kernel_seg"
@@ -230,10 +248,300 @@ static void show_kernelseg_info(void)
 	pr_info(ELLPS);
 }
 
+/*------------------ the layout tables, via debugfs -------------------------*/
+/* The kernel regions: fixed after boot, so computed once (at init) */
+#define KSEG_MAX_KREGS	16
+static struct kseg_region kseg_kregs[KSEG_MAX_KREGS] __ro_after_init;
+static int kseg_nkregs __ro_after_init;
+static struct dentry *gparent;
+
+static void __init add_kreg(const char *name, unsigned long start,
+			    unsigned long end)
+{
+	struct kseg_region *r;
+
+	if (WARN_ON(kseg_nkregs >= KSEG_MAX_KREGS))
+		return;
+	r = &kseg_kregs[kseg_nkregs++];
+	r->start = start;
+	r->end = end;
+	strscpy(r->name, name, sizeof(r->name));
+}
+
+/* As in show_kernelseg_info(), by decreasing address (mostly) */
+static void __init kseg_kregs_init(void)
+{
+	/* the user VAS adds 6 regions (see kseg_build()) */
+	BUILD_BUG_ON(KSEG_MAX_KREGS + 6 > KSEG_MAX_REGIONS);
+#ifdef ARM
+	add_kreg("vector_table", VECTORS_BASE, VECTORS_BASE + PAGE_SIZE);
+#endif
+#ifdef CONFIG_ARM
+	add_kreg("fixmap", FIXADDR_START, FIXADDR_END);
+#else
+	add_kreg("fixmap", FIXADDR_START, FIXADDR_START + FIXADDR_SIZE);
+#endif
+#if(BITS_PER_LONG == 64)
+	add_kreg("modules", MODULES_VADDR, MODULES_END);
+#endif
+#ifdef CONFIG_X86_64
+	/* the kernel image (text, data, bss, ...) mapping */
+	add_kreg("kernel_image", __START_KERNEL_map,
+		 __START_KERNEL_map + KERNEL_IMAGE_SIZE);
+#endif
+#ifdef CONFIG_KASAN
+	add_kreg("kasan_shadow", KASAN_SHADOW_START, KASAN_SHADOW_END);
+#endif
+	add_kreg("vmalloc", VMALLOC_START, VMALLOC_END);
+	add_kreg("lowmem", PAGE_OFFSET, (unsigned long)high_memory);
+#ifdef CONFIG_HIGHMEM
+	add_kreg("highmem", PKMAP_BASE, PKMAP_BASE + LAST_PKMAP * PAGE_SIZE);
+#endif
+#if(BITS_PER_LONG == 32)
+	add_kreg("modules", MODULES_VADDR, MODULES_END);
+#endif
+}
+
+/* Per open file: the target PID (0 => the reader) and the last built table */
+struct kseg_file {
+	struct mutex mtx;
+	pid_t pid;
+	size_t len;
+	union {
+		struct kseg_table tbl;
+		u8 buf[KSEG_TABLE_MAXSZ];
+	};
+};
+
+static void add_ureg(struct kseg_table *t, const char *name, unsigned long start,
+		     unsigned long end, u32 flags)
+{
+	struct kseg_region *r = &t->regions[t->nregions++];
+
+	r->start = start;
+	r->end = end;
+	r->flags = KSEG_F_USER | flags;
+	strscpy(r->name, name, sizeof(r->name));
+}
+
+/*
+ * (Re)build the table in @f, for the target process; the kernel part's just
+ * a copy of what we computed at init.
+ */
+static int kseg_build(struct kseg_file *f)
+{
+	struct kseg_table *t = &f->tbl;
+	struct task_struct *task;
+	struct mm_struct *mm;
+
+	memset(f->buf, 0, sizeof(f->buf));
+	t->magic = KSEG_MAGIC;
+	t->version = KSEG_VERSION;
+	t->hdrsize = sizeof(*t);
+	t->entsize = sizeof(struct kseg_region);
+	t->page_offset = PAGE_OFFSET;
+	t->task_size = TASK_SIZE;
+	memcpy(t->regions, kseg_kregs, kseg_nkregs * sizeof(kseg_kregs[0]));
+	t->nregions = kseg_nkregs;
+
+	if (f->pid) {
+		struct pid *pid = find_get_pid(f->pid);
+
+		task = get_pid_task(pid, PIDTYPE_PID);
+		put_pid(pid);
+		if (!task)
+			return -ESRCH;
+		/* the file mode's not enough: same rule as /proc/PID/maps */
+		if (!ptrace_may_access(task, PTRACE_MODE_READ_FSCREDS)) {
+			put_task_struct(task);
+			return -EACCES;
+		}
+	} else
+		task = get_task_struct(current);
+	mm = get_task_mm(task);
+	if (mm) {
+		t->pid = task_pid_vnr(task);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+		mmap_read_lock(mm);
+#else
+		down_read(&mm->mmap_sem);
+#endif
+		/* as in show_userspace_info(), by decreasing address */
+		add_ureg(t, "env", mm->env_start, mm->env_end, 0);
+		add_ureg(t, "args", mm->arg_start, mm->arg_end, 0);
+		add_ureg(t, "stack_start", mm->start_stack, mm->start_stack,
+			 KSEG_F_POINT);
+		add_ureg(t, "heap", mm->start_brk, mm->brk, 0);
+		add_ureg(t, "data", mm->start_data, mm->end_data, 0);
+		add_ureg(t, "text", mm->start_code, mm->end_code, 0);
+		t->map_count = mm->map_count;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+		mmap_read_unlock(mm);
+#else
+		up_read(&mm->mmap_sem);
+#endif
+		mmput(mm);
+	}
+	put_task_struct(task);
+	f->len = sizeof(*t) + t->nregions * sizeof(struct kseg_region);
+	return 0;
+}
+
+static int kseg_open(struct inode *inode, struct file *filp)
+{
+	struct kseg_file *f = kzalloc(sizeof(*f), GFP_KERNEL);
+
+	if (!f)
+		return -ENOMEM;
+	mutex_init(&f->mtx);
+	filp->private_data = f;
+	return 0;
+}
+
+static int kseg_release(struct inode *inode, struct file *filp)
+{
+	kfree(filp->private_data);
+	return 0;
+}
+
+/* Write a PID (0 => the reader) to target that process's user VAS */
+static int kseg_set_pid(struct kseg_file *f, const char __user *ubuf,
+			size_t count)
+{
+	int ret, pid;
+
+	ret = kstrtoint_from_user(ubuf, count, 0, &pid);
+	if (ret)
+		return ret;
+	if (pid < 0)
+		return -EINVAL;
+	mutex_lock(&f->mtx);
+	f->pid = pid;
+	mutex_unlock(&f->mtx);
+	return 0;
+}
+
+static ssize_t kseg_tbl_read(struct file *filp, char __user *ubuf,
+			     size_t count, loff_t *off)
+{
+	struct kseg_file *f = filp->private_data;
+	ssize_t ret;
+
+	mutex_lock(&f->mtx);
+	if (*off == 0) {
+		ret = kseg_build(f);
+		if (ret)
+			goto out_unlock;
+	}
+	ret = simple_read_from_buffer(ubuf, count, off, f->buf, f->len);
+ out_unlock:
+	mutex_unlock(&f->mtx);
+	return ret;
+}
+
+static ssize_t kseg_tbl_write(struct file *filp, const char __user *ubuf,
+			      size_t count, loff_t *off)
+{
+	int ret = kseg_set_pid(filp->private_data, ubuf, count);
+
+	if (ret)
+		return ret;
+	*off = 0;	/* the next read's of the new target, from the top */
+	return count;
+}
+
+static const struct file_operations kseg_tbl_fops = {
+	.owner = THIS_MODULE,
+	.open = kseg_open,
+	.read = kseg_tbl_read,
+	.write = kseg_tbl_write,
+	.llseek = default_llseek,
+	.release = kseg_release,
+};
+
+/* The text version: the same table, a line per region */
+static int kseg_layout_show(struct seq_file *m, void *v)
+{
+	struct kseg_file *f = m->private;
+	const struct kseg_region *r;
+	int ret;
+	u32 i;
+
+	mutex_lock(&f->mtx);
+	ret = kseg_build(f);
+	if (ret)
+		goto out_unlock;
+	seq_printf(m, "# pid=%d map_count=%u page_offset=0x%llx task_size=0x%llx\n"
+		   "# kind name start end size\n", f->tbl.pid, f->tbl.map_count,
+		   f->tbl.page_offset, f->tbl.task_size);
+	for (i = 0; i < f->tbl.nregions; i++) {
+		r = &f->tbl.regions[i];
+		seq_printf(m, "%s %s 0x%llx 0x%llx %llu\n",
+			   r->flags & KSEG_F_USER ? "user" : "kernel", r->name,
+			   r->start, r->end, r->end - r->start);
+	}
+ out_unlock:
+	mutex_unlock(&f->mtx);
+	return ret;
+}
+
+static int kseg_layout_open(struct inode *inode, struct file *filp)
+{
+	struct kseg_file *f = kzalloc(sizeof(*f), GFP_KERNEL);
+	int ret;
+
+	if (!f)
+		return -ENOMEM;
+	mutex_init(&f->mtx);
+	ret = single_open(filp, kseg_layout_show, f);
+	if (ret)
+		kfree(f);
+	return ret;
+}
+
+static int kseg_layout_release(struct inode *inode, struct file *filp)
+{
+	kfree(((struct seq_file *)filp->private_data)->private);
+	return single_release(inode, filp);
+}
+
+static ssize_t kseg_layout_write(struct file *filp, const char __user *ubuf,
+				 size_t count, loff_t *off)
+{
+	struct seq_file *m = filp->private_data;
+	int ret = kseg_set_pid(m->private, ubuf, count);
+
+	if (ret)
+		return ret;
+	/* have the next read regenerate it from the top */
+	return seq_lseek(filp, 0, SEEK_SET) < 0 ? -EIO : count;
+}
+
+static const struct file_operations kseg_layout_fops = {
+	.owner = THIS_MODULE,
+	.open = kseg_layout_open,
+	.read = seq_read,
+	.write = kseg_layout_write,
+	.llseek = seq_lseek,
+	.release = kseg_layout_release,
+};
+
 static int __init kernel_seg_init(void)
 {
 	pr_debug("%s: inserted\n", OURMODNAME);
 
+	kseg_kregs_init();
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("layout", 0600, gparent, NULL,
+					       &kseg_layout_fops)) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("table", 0600, gparent, NULL,
+					       &kseg_tbl_fops))) {
+		pr_warn("%s: debugfs setup failed\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		return -ENODEV;
+	}
+
 	/* Display some minimal system info
 	 * Note: this function is within our kernel 'library' here:
 	 *  ../../llkd_klib.c
@@ -254,6 +562,7 @@ static int __init kernel_seg_init(void)
 
 static void __exit kernel_seg_exit(void)
 {
+	debugfs_remove_recursive(gparent);
 	pr_debug("%s: removed\n", OURMODNAME);
 }
 
@@ -0,0 +1,57 @@
+/*
+ * ch7/show_kernel_seg/kernel_seg.h
+ *
+ * Common header for the kernel_seg kernel module and userspace consumers
+ * of it's binary layout table:
+ *  <debugfs_mount>/kernel_seg/table
+ * A read(2) at offset 0 returns a struct kseg_table followed by nregions
+ * struct kseg_region's (each entsize bytes): the kernel segment's regions,
+ * then those of the user VAS of the target process. By default, the target
+ * is the reader itself; write(2) a PID to the (open) file to target that
+ * process instead, for the following reads on that file descriptor.
+ * Read with a buffer of at least KSEG_TABLE_MAXSZ bytes to get it all in a
+ * single read; the table's rebuilt on each read at offset 0.
+ * (The <debugfs_mount>/kernel_seg/layout file is the same, as text, a line
+ * per region: kind name start end size.)
+ */
+#ifndef __KERNEL_SEG_H__
+#define __KERNEL_SEG_H__
+
+#include <linux/types.h>
+
+#define KSEG_TABLE_PATH		"/sys/kernel/debug/kernel_seg/table"
+#define KSEG_MAGIC		0x4b534547	/* "KSEG" */
+#define KSEG_VERSION		1
+#define KSEG_NAMELEN		24
+#define KSEG_MAX_REGIONS	32
+
+/* kseg_region.flags */
+#define KSEG_F_USER		0x1	/* a user VAS region (else kernel) */
+#define KSEG_F_POINT		0x2	/* just an address (start == end), f.e.
+					 * the start of the stack */
+
+struct kseg_region {
+	__u64 start, end;
+	__u32 flags;
+	char name[KSEG_NAMELEN];
+	__u32 __pad;
+};
+
+struct kseg_table {
+	__u32 magic;
+	__u16 version;
+	__u16 hdrsize;		/* sizeof(struct kseg_table) */
+	__u32 entsize;		/* sizeof(struct kseg_region) */
+	__u32 nregions;
+	__s32 pid;		/* the target process; 0 if it has no user VAS
+				 * (a kernel thread) */
+	__u32 map_count;	/* # of VMAs in it's user VAS */
+	__u64 page_offset;
+	__u64 task_size;
+	struct kseg_region regions[];
+};
+
+#define KSEG_TABLE_MAXSZ	(sizeof(struct kseg_table) + \
+				 KSEG_MAX_REGIONS * sizeof(struct kseg_region))
+
+#endif
@@ -25,12 +25,39 @@
  * to the 'correct' %pK style (for security). We do this here to see the actual
  * virtual addresses (and not some hashed value). Don't do this in production.
  *
+ * With bench=1, it instead benchmarks these very APIs: for orders 0 to
+ * bench_maxorder, bench_iters times each, we time an allocation (and it's
+ * freeing) via:
+ *  gfp          : __get_free_pages()                (__get_free_page() @ 0)
+ *  gfp_zero     : __get_free_pages(__GFP_ZERO)      (get_zeroed_page() @ 0)
+ *  manual_zero  : __get_free_pages() + memset()
+ *  alloc_pages  : alloc_pages()                     (alloc_page() @ 0)
+ *  pages_exact  : alloc_pages_exact() of 3/4ths of 2^order pages (+1)
+ *  node         : alloc_pages_node(__GFP_THISNODE), on every online node
+ * (each page's freed right after it's allocated, so order 0 mostly hits the
+ * per-CPU page lists; that's the realistic case). To see how it fares under
+ * fragmentation, set frag_mb: we first allocate that much memory a page at a
+ * time and free every other page, pinning the rest - scattered - until done.
+ * The results - failure rate, mean alloc and free latency and a log2 alloc
+ * latency histogram per (API, order[, node]) - are in
+ * <debugfs_mount>/lowlevel_mem/results; write to .../run to rerun (picking up
+ * changes to the (writable) parameters).
+ *
  * For details, please refer the book, Ch 8.
  */
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/nodemask.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "../../klib_llkd.h"
 
 #define OURMODNAME    "lowlevel_mem"
@@ -52,6 +79,31 @@ static int bsa_alloc_order = 3;
 module_param_named(order, bsa_alloc_order, int, 0660);
 MODULE_PARM_DESC(order, "order of the allocation (power-to-raise-2-to)");
 
+static bool bench;
+module_param(bench, bool, 0444);
+MODULE_PARM_DESC(bench, "if set to 1, benchmark the page allocator APIs"
+" (results via debugfs) instead of running the demo (default 0)");
+
+static uint bench_iters = 256;
+module_param(bench_iters, uint, 0644);
+MODULE_PARM_DESC(bench_iters, "(bench mode) # of allocations per API per"
+" order (default 256)");
+
+static uint bench_maxorder = MAX_ORDER - 1;
+module_param(bench_maxorder, uint, 0644);
+MODULE_PARM_DESC(bench_maxorder, "(bench mode) highest order to benchmark"
+" (default, and max, MAX_ORDER-1)");
+
+static uint frag_mb;
+module_param(frag_mb, uint, 0644);
+MODULE_PARM_DESC(frag_mb, "(bench mode) fragment this much memory (MB) first"
+" (default 0)");
+
+static bool noretry = true;
+module_param(noretry, bool, 0644);
+MODULE_PARM_DESC(noretry, "(bench mode) allocate with __GFP_NORETRY, so that"
+" (while fragmented) we see failures, not reclaim & compaction (default 1)");
+
 /*
  * bsa_alloc : test some of the bsa (buddy system allocator
  * aka page allocator) APIs
@@ -79,7 +131,7 @@ static int bsa_alloc(void)
 		OURMODNAME, gptr1, gptr1);
 
 	/* 2. Allocate 2^bsa_alloc_order pages with the __get_free_pages() API */
-	numpg2alloc = powerof(2, bsa_alloc_order); // returns 2^bsa_alloc_order
+	numpg2alloc = llkd_order_pages(bsa_alloc_order); // 2^bsa_alloc_order
 	gptr2 = (void *) __get_free_pages(GFP_KERNEL|__GFP_ZERO, bsa_alloc_order);
 	if (!gptr2) {
 		/* no error/warning printk now; see above comment */
@@ -87,7 +139,7 @@ static int bsa_alloc(void)
 	}
 	pr_info("%s: 2. __get_free_pages() alloc'ed 2^%d = %lld page(s) = %lld bytes\n"
 		" from the BSA @ 0x%pK (" FMTSPC ")\n",
-		OURMODNAME, bsa_alloc_order, powerof(2, bsa_alloc_order),
+		OURMODNAME, bsa_alloc_order, numpg2alloc,
 		numpg2alloc * PAGE_SIZE, gptr2, gptr2);
 	pr_info(" (PAGE_SIZE = %ld bytes)\n", PAGE_SIZE);
 
@@ -130,8 +182,8 @@ static int bsa_alloc(void)
 	if (!gptr5) {
 		goto out5;
 	}
-	pr_info("%s: 5. alloc_pages() alloc'ed %lld pages from the BSA @ 0x%pK (" FMTSPC ")\n",
-		OURMODNAME, powerof(2, 5), (void *)gptr5, (void *)gptr5);
+	pr_info("%s: 5. alloc_pages() alloc'ed %lu pages from the BSA @ 0x%pK (" FMTSPC ")\n",
+		OURMODNAME, llkd_order_pages(5), (void *)gptr5, (void *)gptr5);
 
 	return 0;
 out5:
@@ -146,18 +198,299 @@ out1:
 	return stat;
 }
 
+/*------------------ bench mode --------------------------------------------*/
+enum {
+	PB_GFP,
+	PB_GFP_ZERO,
+	PB_MANUAL_ZERO,
+	PB_ALLOC_PAGES,
+	PB_PAGES_EXACT,
+	PB_NODE,		/* must be the last; one per online node */
+};
+
+static const char * const pb_api_name[] = {
+	"gfp", "gfp_zero", "manual_zero", "alloc_pages", "pages_exact", "node",
+};
+
+#define PB_NHIST	32	/* log2(ns) buckets: [2^i, 2^(i+1)) ns */
+
+struct pb_res {
+	int api, order, nid;
+	unsigned int iters, fails;
+	u64 sum_alloc_ns, sum_free_ns, max_alloc_ns;
+	unsigned int hist[PB_NHIST];
+};
+
+static DEFINE_MUTEX(pb_mtx);	/* one run at a time; protects below */
+static struct pb_res *gpbres;
+static unsigned int gpbnres;
+static unsigned long gpb_fragged;	/* # of pages pinned by the last run */
+static struct dentry *gparent;
+
+static inline size_t pb_exact_size(int order)
+{
+	return order ? PAGE_SIZE * ((llkd_order_pages(order) * 3) / 4 + 1) : PAGE_SIZE;
+}
+
+/* One timed allocation (and freeing); returns false if the allocation failed */
+static bool pb_one(struct pb_res *r, gfp_t gfp)
+{
+	struct page *pg = NULL;
+	void *p = NULL;
+	u64 t0, t1, t2;
+
+	t0 = ktime_get_ns();
+	switch (r->api) {
+	case PB_GFP:
+		p = (void *)__get_free_pages(gfp, r->order);
+		break;
+	case PB_GFP_ZERO:
+		p = (void *)__get_free_pages(gfp | __GFP_ZERO, r->order);
+		break;
+	case PB_MANUAL_ZERO:
+		p = (void *)__get_free_pages(gfp, r->order);
+		if (p)
+			memset(p, 0, PAGE_SIZE << r->order);
+		break;
+	case PB_ALLOC_PAGES:
+		pg = alloc_pages(gfp, r->order);
+		break;
+	case PB_PAGES_EXACT:
+		p = alloc_pages_exact(pb_exact_size(r->order), gfp);
+		break;
+	case PB_NODE:
+		pg = alloc_pages_node(r->nid, gfp | __GFP_THISNODE, r->order);
+		break;
+	}
+	t1 = ktime_get_ns();
+	if (!p && !pg)
+		return false;
+
+	if (r->api == PB_PAGES_EXACT)
+		free_pages_exact(p, pb_exact_size(r->order));
+	else if (pg)
+		__free_pages(pg, r->order);
+	else
+		free_pages((unsigned long)p, r->order);
+	t2 = ktime_get_ns();
+
+	r->sum_alloc_ns += t1 - t0;
+	r->sum_free_ns += t2 - t1;
+	r->max_alloc_ns = max(r->max_alloc_ns, t1 - t0);
+	r->hist[min_t(unsigned int, ilog2(max(t1 - t0, 1ULL)), PB_NHIST - 1)]++;
+	return true;
+}
+
+/*
+ * Fragment @mb MB of memory: allocate it a page at a time, then free every
+ * other page; the pinned ones are left on @pinned (via page->lru).
+ * Returns the # of pages pinned.
+ */
+static unsigned long pb_fragment(unsigned int mb, struct list_head *pinned)
+{
+	unsigned long i, n = ((unsigned long)mb << 20) >> PAGE_SHIFT, npinned = 0;
+	struct page *pg, *tmp;
+	LIST_HEAD(all);
+
+	for (i = 0; i < n; i++) {
+		pg = alloc_page(GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY);
+		if (!pg)
+			break;
+		list_add_tail(&pg->lru, &all);
+		if (!(i % 1024))
+			cond_resched();
+	}
+	i = 0;
+	list_for_each_entry_safe(pg, tmp, &all, lru) {
+		list_del(&pg->lru);
+		if (i++ & 1) {
+			__free_page(pg);
+		} else {
+			list_add_tail(&pg->lru, pinned);
+			npinned++;
+		}
+	}
+	return npinned;
+}
+
+static void pb_unfragment(struct list_head *pinned)
+{
+	struct page *pg, *tmp;
+
+	list_for_each_entry_safe(pg, tmp, pinned, lru) {
+		list_del(&pg->lru);
+		__free_page(pg);
+	}
+}
+
+/* Run the benchmark; called with pb_mtx held */
+static int pb_run(void)
+{
+	gfp_t gfp = GFP_KERNEL | __GFP_NOWARN | (noretry ? __GFP_NORETRY : 0);
+	unsigned int maxorder = min_t(unsigned int, bench_maxorder, MAX_ORDER - 1);
+	unsigned int nmax, n = 0, i;
+	struct pb_res *res;
+	LIST_HEAD(pinned);
+	int api, order, nid;
+
+	if (!bench_iters)
+		return -EINVAL;
+	nmax = (PB_NODE + num_online_nodes()) * (maxorder + 1);
+	res = kcalloc(nmax, sizeof(*res), GFP_KERNEL);
+	if (!res)
+		return -ENOMEM;
+	kfree(gpbres);
+	gpbres = res;
+
+	gpb_fragged = frag_mb ? pb_fragment(frag_mb, &pinned) : 0;
+	for (api = PB_GFP; api <= PB_NODE; api++) {
+		nid = first_online_node;
+		do {
+			for (order = 0; order <= maxorder; order++) {
+				struct pb_res *r = &res[n++];
+
+				r->api = api;
+				r->order = order;
+				r->nid = api == PB_NODE ? nid : NUMA_NO_NODE;
+				r->iters = bench_iters;
+				for (i = 0; i < bench_iters; i++) {
+					if (!pb_one(r, gfp))
+						r->fails++;
+					cond_resched();
+				}
+			}
+			if (api != PB_NODE)
+				break;
+			nid = next_online_node(nid);
+			/* (a node coming online meanwhile has to wait) */
+		} while (nid < MAX_NUMNODES && n + maxorder + 1 <= nmax);
+	}
+	pb_unfragment(&pinned);
+	gpbnres = n;
+	pr_info("%s: benchmark done: orders 0-%u, %u iters, %lu pages pinned\n",
+		OURMODNAME, maxorder, bench_iters, gpb_fragged);
+	return 0;
+}
+
+static int pb_show(struct seq_file *m, void *v)
+{
+	unsigned int i, j, ok, cum, p50, p99;
+
+	mutex_lock(&pb_mtx);
+	seq_printf(m, "# iters=%u frag_mb=%u (pinned %lu pages) noretry=%d\n",
+		   bench_iters, frag_mb, gpb_fragged, noretry);
+	seq_puts(m, "# api order node fails fail% alloc_ns free_ns max_ns"
+		 " p50_ns<= p99_ns<= | hist log2(ns):count ...\n");
+	for (i = 0; i < gpbnres; i++) {
+		struct pb_res *r = &gpbres[i];
+
+		ok = r->iters - r->fails;
+		seq_printf(m, "%s %d %d %u %u", pb_api_name[r->api], r->order,
+			   r->nid, r->fails, r->fails * 100 / r->iters);
+		if (!ok) {
+			seq_puts(m, " - - - - -\n");
+			continue;
+		}
+		p50 = p99 = 0;
+		for (j = 0, cum = 0; j < PB_NHIST; j++) {
+			cum += r->hist[j];
+			if (!p50 && cum * 2 >= ok)
+				p50 = j + 1;
+			if (!p99 && cum * 100 >= ok * 99)
+				p99 = j + 1;
+		}
+		seq_printf(m, " %llu %llu %llu %llu %llu |",
+			   div_u64(r->sum_alloc_ns, ok), div_u64(r->sum_free_ns, ok),
+			   r->max_alloc_ns, llkd_pow2(p50), llkd_pow2(p99));
+		for (j = 0; j < PB_NHIST; j++)
+			if (r->hist[j])
+				seq_printf(m, " %u:%u", j, r->hist[j]);
+		seq_putc(m, '\n');
+	}
+	mutex_unlock(&pb_mtx);
+	return 0;
+}
+
+static int pb_open(struct inode *inode, struct file *filp)
+{
+	return single_open_size(filp, pb_show, NULL,
+				PAGE_SIZE + (PB_NODE + nr_node_ids) * MAX_ORDER * 200);
+}
+
+static const struct file_operations pb_results_fops = {
+	.owner = THIS_MODULE,
+	.open = pb_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Any write reruns the benchmark; it returns once done */
+static ssize_t pb_run_write(struct file *filp, const char __user *ubuf,
+			    size_t count, loff_t *off)
+{
+	int ret;
+
+	if (mutex_lock_interruptible(&pb_mtx))
+		return -ERESTARTSYS;
+	ret = pb_run();
+	mutex_unlock(&pb_mtx);
+	return ret ? ret : count;
+}
+
+static const struct file_operations pb_run_fops = {
+	.owner = THIS_MODULE,
+	.write = pb_run_write,
+	.llseek = no_llseek,
+};
+
+static int pb_init(void)
+{
+	int ret;
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("results", 0444, gparent, NULL,
+					       &pb_results_fops)) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("run", 0200, gparent, NULL,
+					       &pb_run_fops))) {
+		pr_warn("%s: debugfs setup failed\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		return -ENODEV;
+	}
+	mutex_lock(&pb_mtx);
+	ret = pb_run();
+	mutex_unlock(&pb_mtx);
+	if (ret) {
+		debugfs_remove_recursive(gparent);
+		kfree(gpbres);
+		return ret;
+	}
+	pr_info("%s: bench mode (<debugfs_mount>/%s/{results,run})\n",
+		OURMODNAME, OURMODNAME);
+	return 0;
+}
+
 static int __init lowlevel_mem_init(void)
 {
+	if (bench)
+		return pb_init();
 	return bsa_alloc();
 }
 
 static void __exit lowlevel_mem_exit(void)
 {
+	if (bench) {
+		debugfs_remove_recursive(gparent);
+		kfree(gpbres);
+		pr_info("%s: removed\n", OURMODNAME);
+		return;
+	}
 	pr_info("%s: free-ing up the BSA memory chunks...\n", OURMODNAME);
 	/* Free 'em! We follow the convention of freeing them in the reverse
 	 * order from which they were allocated 
 	 */
-	free_pages((unsigned long) gptr5, 3);
+	free_pages((unsigned long) gptr5, 5);
 	free_page((unsigned long) gptr4);
 	free_page((unsigned long) gptr3);
 	free_pages((unsigned long) gptr2, bsa_alloc_order);
@@ -16,12 +16,33 @@
  * larger memory chunks via the page allocator.
  * (But pl read the rest of the chapter and Ch 9 as well!).
  *
+ * With fallback=1, we instead use our klib's llkd_buf_alloc() buffer
+ * provider: it tries a single (huge page mapped, if large enough) block
+ * first and, should that fail, falls back to smaller and smaller blocks,
+ * vmap()'ed together; so, fragmentation degrades the buffers (we show which
+ * tier each one got) rather than failing the load. It can thus provide
+ * buffers larger than the page allocator's max too (see the bufsz param).
+ *
+ * Once allocated, the buffers are filled with a 64-bit pattern and
+ * verified, via crc32c, in parallel across CPUs, with the throughput (GB/s)
+ * of both reported; every read of <debugfs_mount>/page_exact_loop/verify
+ * re-verifies them (f.e. to burn in memory over time).
+ *
  * For details, please refer the book, Ch 8.
  */
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
-#include <linux/delay.h>
+#include <linux/mm.h>
+#include <linux/crc32c.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "../../klib_llkd.h"
 
 #define OURMODNAME   "page_exact_loop"
 
@@ -29,49 +50,361 @@ MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LLKD ch8/page_exact_loop: demo using the superior [alloc|free]_pages_exact() APIs");
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
-
-#if(BITS_PER_LONG == 32)
- #define FMTSPC "0x%08x"
- #define TYPECST unsigned int
-#elif(BITS_PER_LONG == 64)
- #define FMTSPC "0x%016lx"
- #define TYPECST unsigned long
-#endif
+MODULE_SOFTDEP("pre: crc32c");
 
 #define MAXTIMES    25 /* the higher you make this, the more the chance of the
  alloc failing, as we only free in the cleanup code path... */
-void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check);
 
 static void *gptr[MAXTIMES];
-static size_t gsz = 4*1024*1024;  /* 4 MB; the largest possible alloc w/ a
+static struct llkd_buf gbuf[MAXTIMES];	/* (fallback mode) */
+static int gnr;				/* # of buffers allocated */
+
+static ulong gsz = 4*1024*1024;  /* 4 MB; the largest possible alloc w/ a
  single call to the page allocator is 4 MB (assuming MAX_ORDER of 11 and
  page size of 4096) */
+module_param_named(bufsz, gsz, ulong, 0444);
+MODULE_PARM_DESC(bufsz, "size of each buffer (bytes; default 4 MB, the max"
+" for alloc_pages_exact(), though not for fallback mode)");
+
+static bool fallback;
+module_param(fallback, bool, 0444);
+MODULE_PARM_DESC(fallback, "if set to 1, allocate via our klib's"
+" llkd_buf_alloc(), degrading to smaller blocks rather than failing"
+" (default 0)");
+
+static ullong pattern = 0x7878787878787878ULL;	/* 'xxxxxxxx' */
+module_param(pattern, ullong, 0444);
+MODULE_PARM_DESC(pattern, "64-bit pattern to fill the buffers with"
+" (default 0x7878787878787878, i.e. 'x' bytes)");
+
+static bool addrpat = true;
+module_param(addrpat, bool, 0444);
+MODULE_PARM_DESC(addrpat, "XOR the pattern with each word's buffer # and"
+" offset, catching misdirected writes too (default 1)");
+
+static uint nworkers;
+module_param(nworkers, uint, 0644);
+MODULE_PARM_DESC(nworkers, "# of parallel (per-CPU) fill/verify workers;"
+" 0 (default) => all online CPUs");
+
+static void buf_free(int i)
+{
+	if (fallback)
+		llkd_buf_free(&gbuf[i]);
+	else
+		free_pages_exact(gptr[i], gsz);
+}
+
+/*------------------ buffer integrity: fill & verify -----------------------*/
+/*
+ * Each buffer is split into SEG_SZ segments; a pass - fill or verify - has a
+ * work item per online CPU (or nworkers) claim segments off an atomic cursor
+ * till there are none left (as ch6's taskstats_par does with PIDs).
+ * fill  : write the 64-bit pattern - XOR'ed with the buffer # and word
+ *         offset, so that aliased or misdirected writes show up too - and
+ *         remember the segment's crc32c;
+ * verify: recompute every segment's crc32c and compare; on a mismatch, find
+ *         the first bad word.
+ * crc32c() goes via the kernel crypto API, so it's the accelerated
+ * implementation (SSE4.2 crc32 on x86, the ARMv8 CRC instructions on arm64)
+ * whenever there's one.
+ */
+#define SEG_SZ		(256 * 1024)
+
+struct seg {
+	void *addr;
+	size_t len;
+	unsigned int buf;	/* which buffer (gptr[] index) */
+	size_t off;		/* offset within it */
+	u32 crc;		/* as filled */
+};
+
+enum { PASS_FILL, PASS_VERIFY };
+
+struct pv_work {
+	struct work_struct work;
+	int pass;
+	atomic_t *cursor;
+	unsigned long nbad;	/* bad segments */
+	long first_bad;		/* seg # of the first one we saw, or -1 */
+	size_t first_bad_off;	/* ... and the offset of it's first bad word */
+};
+
+struct pv_result {
+	unsigned long nbad;
+	long first_bad;
+	size_t first_bad_off;
+	u64 ns;
+	int workers;
+};
+
+static struct seg *gsegs;
+static unsigned int gnsegs;
+static DEFINE_MUTEX(pv_mtx);	/* one pass at a time */
+static struct dentry *gparent;
+
+static inline u64 seg_word(const struct seg *s, size_t j)
+{
+	u64 w = pattern;
+
+	if (addrpat)
+		w ^= ((u64)s->buf << 40) | ((s->off >> 3) + j);
+	return w;
+}
+
+static void pv_fill(struct seg *s)
+{
+	u64 *p = s->addr;
+	size_t j;
+
+	for (j = 0; j < s->len / sizeof(u64); j++)
+		p[j] = seg_word(s, j);
+	s->crc = crc32c(~0, s->addr, s->len);
+}
+
+/* Returns true if the segment's intact; else, @*bad_off is the first bad
+ * word's offset within the buffer */
+static bool pv_verify(const struct seg *s, size_t *bad_off)
+{
+	const u64 *p = s->addr;
+	size_t j;
+
+	if (likely(crc32c(~0, s->addr, s->len) == s->crc))
+		return true;
+	for (j = 0; j < s->len / sizeof(u64); j++)
+		if (p[j] != seg_word(s, j))
+			break;
+	*bad_off = s->off + j * sizeof(u64);	/* (== the end if the crc
+						 * alone was hit) */
+	return false;
+}
+
+static void pv_worker(struct work_struct *work)
+{
+	struct pv_work *w = container_of(work, struct pv_work, work);
+	size_t bad_off;
+	int i;
+
+	while ((i = atomic_fetch_inc(w->cursor)) < gnsegs) {
+		if (w->pass == PASS_FILL) {
+			pv_fill(&gsegs[i]);
+		} else if (!pv_verify(&gsegs[i], &bad_off)) {
+			if (!w->nbad++ || i < w->first_bad) {
+				w->first_bad = i;
+				w->first_bad_off = bad_off;
+			}
+		}
+		cond_resched();
+	}
+}
+
+/* Run a fill or verify pass across CPUs */
+static int pv_pass(int pass, struct pv_result *res)
+{
+	unsigned int n = 0, maxw, i;
+	atomic_t cursor = ATOMIC_INIT(0);
+	struct pv_work *w;
+	u64 t0;
+	int cpu;
+
+	memset(res, 0, sizeof(*res));
+	res->first_bad = -1;
+	cpus_read_lock();
+	maxw = nworkers ? min(nworkers, num_online_cpus()) : num_online_cpus();
+	w = kcalloc(maxw, sizeof(*w), GFP_KERNEL);
+	if (!w) {
+		cpus_read_unlock();
+		return -ENOMEM;
+	}
+	t0 = ktime_get_ns();
+	for_each_online_cpu(cpu) {
+		if (n == maxw)
+			break;
+		INIT_WORK(&w[n].work, pv_worker);
+		w[n].pass = pass;
+		w[n].cursor = &cursor;
+		w[n].first_bad = -1;
+		queue_work_on(cpu, system_wq, &w[n].work);
+		n++;
+	}
+	for (i = 0; i < n; i++)
+		flush_work(&w[i].work);
+	res->ns = ktime_get_ns() - t0;
+	cpus_read_unlock();
+
+	res->workers = n;
+	for (i = 0; i < n; i++) {
+		if (!w[i].nbad)
+			continue;
+		if (!res->nbad || w[i].first_bad < res->first_bad) {
+			res->first_bad = w[i].first_bad;
+			res->first_bad_off = w[i].first_bad_off;
+		}
+		res->nbad += w[i].nbad;
+	}
+	kfree(w);
+	return 0;
+}
+
+/* Split the gnr buffers into segments */
+static int pv_setup(void)
+{
+	unsigned int i, n = 0;
+	size_t off;
+
+	gnsegs = gnr * DIV_ROUND_UP(gsz, SEG_SZ);
+	gsegs = kvcalloc(gnsegs, sizeof(*gsegs), GFP_KERNEL);
+	if (!gsegs)
+		return -ENOMEM;
+	for (i = 0; i < gnr; i++) {
+		for (off = 0; off < gsz; off += SEG_SZ) {
+			gsegs[n].addr = gptr[i] + off;
+			/* whole words only; a trailing partial one isn't covered */
+			gsegs[n].len = round_down(min_t(size_t, SEG_SZ, gsz - off),
+						  sizeof(u64));
+			gsegs[n].buf = i;
+			gsegs[n].off = off;
+			n++;
+		}
+	}
+	return 0;
+}
+
+static void pv_report(struct seq_file *m, const char *which,
+		      const struct pv_result *r)
+{
+	u64 bytes = (u64)gnr * gsz, g;
+	u32 frac;
+
+	/* bytes per ns == GB/s */
+	g = llkd_div_frac(bytes, r->ns, 2, &frac);
+	if (m)
+		seq_printf(m, "%s bytes %llu ns %llu gbps %llu.%02u workers %d",
+			   which, bytes, r->ns, g, frac, r->workers);
+	else
+		pr_info("%s: %s: %llu bytes in %llu ns: %llu.%02u GB/s (%d workers)\n",
+			OURMODNAME, which, bytes, r->ns, g, frac,
+			r->workers);
+	if (strcmp(which, "verify"))
+		goto out;
+	if (m) {
+		seq_printf(m, " bad_segments %lu", r->nbad);
+		if (r->nbad)
+			seq_printf(m, " first_bad buf %u offset %zu",
+				   gsegs[r->first_bad].buf, r->first_bad_off);
+	} else if (r->nbad) {
+		pr_warn("%s: verify: %lu bad segment(s)! the first in buffer %u,"
+			" @ offset %zu\n", OURMODNAME, r->nbad,
+			gsegs[r->first_bad].buf, r->first_bad_off);
+	}
+ out:
+	if (m)
+		seq_putc(m, '\n');
+}
+
+/* Reading <debugfs_mount>/page_exact_loop/verify runs a verify pass */
+static int pv_show(struct seq_file *m, void *v)
+{
+	struct pv_result r;
+	int ret;
+
+	mutex_lock(&pv_mtx);
+	ret = pv_pass(PASS_VERIFY, &r);
+	if (!ret)
+		pv_report(m, "verify", &r);
+	mutex_unlock(&pv_mtx);
+	return ret;
+}
+
+static int pv_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, pv_show, NULL);
+}
+
+static const struct file_operations pv_fops = {
+	.owner = THIS_MODULE,
+	.open = pv_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int pv_init(void)
+{
+	struct pv_result r;
+	int ret;
+
+	ret = pv_setup();
+	if (ret)
+		return ret;
+	ret = pv_pass(PASS_FILL, &r);
+	if (ret)
+		goto out_free;
+	pv_report(NULL, "fill", &r);
+	ret = pv_pass(PASS_VERIFY, &r);
+	if (ret)
+		goto out_free;
+	pv_report(NULL, "verify", &r);
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("verify", 0444, gparent, NULL,
+					       &pv_fops))) {
+		pr_warn("%s: debugfs setup failed\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		ret = -ENODEV;
+		goto out_free;
+	}
+	return 0;
+
+ out_free:
+	kvfree(gsegs);
+	return ret;
+}
 
 static int __init page_exact_loop_init(void)
 {
-	int i, j;
+	int i, ret;
 
 	pr_info("%s: inserted\n", OURMODNAME);
 
 	for (i=0; i < MAXTIMES; i++) {
-		gptr[i] = alloc_pages_exact(gsz, GFP_KERNEL);
+		if (fallback)
+			gptr[i] = llkd_buf_alloc(&gbuf[i], gsz, GFP_KERNEL) ?
+					NULL : gbuf[i].vaddr;
+		else
+			gptr[i] = alloc_pages_exact(gsz, GFP_KERNEL);
 		if (!gptr[i]) {
-			pr_warn("%s: alloc_pages_exact() failed! (loop index %d)\n", OURMODNAME, i);
+			pr_warn("%s: %s() failed! (loop index %d)\n", OURMODNAME,
+				fallback ? "llkd_buf_alloc" : "alloc_pages_exact", i);
 			/* it failed; don't leak, ensure we free the memory taken so far! */
-			for (j=i; j>=0; j--)
-				free_pages_exact(gptr[j], gsz);
+			while (--i >= 0)
+				buf_free(i);
 			return -ENOMEM;
 		}
-		pr_info("%s:%d: alloc_pages_exact() alloc'ed %zu bytes memory (%zu pages)"
-		" from the BSA @ 0x%pK (actual=" FMTSPC ")\n",
-			OURMODNAME, i, gsz, gsz/PAGE_SIZE, gptr[i], gptr[i]);
-		// lets 'poison' it..
-		memset(gptr[i], 'x', gsz);
-
-		show_phy_pages(gptr[i], gsz, 1);
-		msleep(100);
+		gnr = i + 1;
+		if (fallback)
+			pr_info("%s:%d: llkd_buf_alloc() alloc'ed %lu bytes memory:"
+				" tier %s, %u chunk(s) of order %u-%u @ 0x%pK\n",
+				OURMODNAME, i, gsz, llkd_buf_tier_name(gbuf[i].tier),
+				gbuf[i].nchunks, gbuf[i].min_order,
+				gbuf[i].max_order, gptr[i]);
+		else
+			pr_info("%s:%d: alloc_pages_exact() alloc'ed %lu bytes memory (%lu pages)"
+			" from the BSA @ 0x%pK (actual=" FMTSPC ")\n",
+				OURMODNAME, i, gsz, gsz/PAGE_SIZE, gptr[i], gptr[i]);
+		/* a line per run of physically contiguous pages (just the one,
+		 * here), not per page; no need to throttle the kernel log */
+		llkd_show_phy_runs(NULL, gptr[i], gsz);
 	}
 
+	/* lets 'poison' them.. with a pattern we can verify */
+	ret = pv_init();
+	if (ret) {
+		for (i = 0; i < gnr; i++)
+			buf_free(i);
+		return ret;
+	}
 	return 0;		/* success */
 }
 
@@ -79,8 +412,10 @@ static void __exit page_exact_loop_exit(void)
 {
 	int i;
 
-	for (i=0; i < MAXTIMES; i++)
-		free_pages_exact(gptr[i], gsz);
+	debugfs_remove_recursive(gparent);
+	kvfree(gsegs);
+	for (i=0; i < gnr; i++)
+		buf_free(i);
 	pr_debug("%s: mem freed, removed\n", OURMODNAME);
 }
 
@@ -18,11 +18,22 @@
  * parameter (it actually becomes a double-free bug)! On our test system,
  * the entire machine just froze. 
  *
+ * Tools like KASAN catch this sort of thing, but are too heavy for
+ * production. So, we allocate via our klib_llkd 'library's llkd_kmalloc() /
+ * llkd_kfree(): with the module parameter gmem_rate = N, one in every N
+ * allocations is guarded (see llkd_gmem in klib_llkd.c), cheaply enough to
+ * be left on always. Here, the default's to guard every allocation: the
+ * use-after-free and double-free above are then reported (with the stack
+ * traces of the allocation and the free) rather than crashing the box.
+ * Also, try oob=-1 (an underflow: reported on free) or oob=1 (an overflow:
+ * it faults, right away, on the guard page).
+ *
  * For details, please refer the book, Ch 8.
  */
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include "../../klib_llkd.h"
 
 #define OURMODNAME   "slab2_buggy"
 
@@ -31,12 +42,24 @@ MODULE_DESCRIPTION("LLKD book:ch8/slab2_buggy: kmalloc/kfree bug demo");
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
 
+static uint gmem_rate = 1;
+module_param(gmem_rate, uint, 0444);
+MODULE_PARM_DESC(gmem_rate,
+ "Guard one in every gmem_rate allocations (default 1: all); 0 => none");
+
+static int oob;
+module_param(oob, int, 0444);
+MODULE_PARM_DESC(oob,
+ "Also perform an out-of-bounds write: -1 => one byte before the buffer,"
+ " 1 => one byte past it; 0 (default) => don't");
+
 static int __init slab2_buggy_init(void)
 {
 	int i = 0;
 	char *kptr = NULL;
 
 	pr_info("%s: inserted\n", OURMODNAME);
+	llkd_gmem_set_rate(gmem_rate);
 
 #define BUGGY    1   /* by default it's set to 0 to rm the bug(s) :-) */
 
@@ -44,17 +67,20 @@ static int __init slab2_buggy_init(void)
 #if (BUGGY == 1)
 		if (kptr == NULL)
 #endif
-		  kptr = kmalloc(1024, GFP_KERNEL);
+		  kptr = llkd_kmalloc(1024, GFP_KERNEL);
 		if (!kptr) {
 			pr_warn("%s: kmalloc failed!\n", OURMODNAME);
 			/* Bug: we don't free the prev allocated mem, if any,
 			 * resulting in possible memory leakage !
 			 */
+			llkd_gmem_exit();
 			return -ENOMEM;
 		}
 		memset(kptr, i-1+0x61, 1024); // 0x61 = 'a'
+		if (oob && i == 1)
+			kptr[oob < 0 ? -1 : 1024] = 'x';
 		print_hex_dump_bytes("kptr: ", DUMP_PREFIX_OFFSET, kptr, 16);
-		kfree(kptr);
+		llkd_kfree(kptr);
 #if (BUGGY == 1)
 		pr_info(" %d: kfree on %pK\n", i, kptr);
 #endif
@@ -65,6 +91,7 @@ static int __init slab2_buggy_init(void)
 
 static void __exit slab2_buggy_exit(void)
 {
+	llkd_gmem_exit();
 	pr_info("%s: removed\n", OURMODNAME);
 }
 
@@ -3,18 +3,24 @@
 # Book: Learn Linux Kernel Development, Kaiwan N Billimoria, Packt.
 # Part of the ch8/slab4_actualsz_wstg_plot code.
 #
-# Script to help prepare the data file from kernel log.
+# Script to help prepare the data file for gnuplot.
 # We assume that:
-# a) sudo dmesg -C   ; was done prior to the kernel module being inserted
-#    (clearing any stale messages from the kernel log)
-# b) the cut(1) below gets rid of the dmesg timestamp; we assume it's
-#    (timestamp) there
-# c) you will comment out or delete any extraneous lines in the final o/p
-#    file 2plotdata.txt after this :-)
+# a) the slab4_actualsz_wstg_plot kernel module is inserted (optionally with
+#    the stepsz and maxsz parameters set as you'd like)
+# b) debugfs is mounted (we look it up in /proc/mounts)
+# The module's sweep table has the columns:
+#  requested-size  ksize  waste%  backing-cache
+# gnuplot needs just the requested size and the waste percentage.
 # (To save you the trouble, we've (also) kept the 2plotdata.txt file in the repo)
-dmesg > /tmp/plotdata
-cut -c16- /tmp/plotdata | grep -v -i "^[a-z]" > 2plotdata.txt
-rm -f /tmp/plotdata
+name=slab4_actualsz_wstg_plot
+DBGFS=$(mount |grep -w "^debugfs" |awk '{print $3}' |head -n1)
+[ -z "${DBGFS}" ] && DBGFS=/sys/kernel/debug
+TBL=${DBGFS}/${name}/table
+sudo test -f ${TBL} || {
+  echo "${TBL} not found; is the ${name} module inserted (and debugfs mounted)?"
+  exit 1
+}
+sudo cat ${TBL} | grep -v "^#" | awk '{printf("%s  %3s\n", $1, $3)}' > 2plotdata.txt
 echo "Done, data file for gnuplot is 2plotdata.txt
 (follow the steps in the LLKD book, Ch 8, to plot the graph)."
 ls -l 2plotdata.txt
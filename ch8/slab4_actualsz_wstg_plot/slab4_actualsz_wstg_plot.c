@@ -11,15 +11,35 @@
  * From: Ch 8 : Kernel Memory Allocation for Module Authors, Part 1
  ****************************************************************
  * Brief Description:
- * Here, we have slightly modified the ch8/slab4_actualsize LKM to print just
- * what's required in order to get a good data file, in order to plot a nice
- * graph with gnuplot(1) !
+ * Here, we have slightly modified the ch8/slab4_actualsize LKM to generate
+ * just what's required in order to get a good data file, in order to plot a
+ * nice graph with gnuplot(1) !
+ *
+ * Rather than kmalloc'ing in ever larger steps until it fails (and scraping
+ * the kernel log), we do a bounded sweep - from 100 bytes up to maxsz, in
+ * stepsz increments - and generate a table, one line per step:
+ *  requested-size  ksize  waste%  backing-cache
+ * on reading <debugfs_mount>/slab4_actualsz_wstg_plot/table.
+ * Sizes beyond KMALLOC_MAX_CACHE_SIZE aren't served by the slab layer at all,
+ * but straight from the page allocator; for them, we compute the size (a
+ * power-of-2 # of pages) rather than allocate megabytes at a time.
+ *
+ * A 'size-class advisor' too: write a comma-separated list of struct sizes
+ * to <debugfs_mount>/slab4_actualsz_wstg_plot/advise (or pass them via the
+ * structsz parameter) and read it back for, per size, the kmalloc() waste vs
+ * that of a custom slab cache - word aligned, or cacheline aligned
+ * (SLAB_HWCACHE_ALIGN) - and a recommendation.
  *
  * For details, please refer the book, Ch 8.
  */
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/cache.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #define OURMODNAME   "slab4_actualsz_wstg_plot"
 
@@ -31,39 +51,264 @@ MODULE_VERSION("0.1");
 static int stepsz = 20000;
 module_param(stepsz, int, 0644);
 MODULE_PARM_DESC(stepsz,
- "Amount to increase allocation by on each loop iteration (default=200000");
+ "Amount to increase allocation by on each step of the sweep (default=20000)");
+
+static ulong maxsz = KMALLOC_MAX_SIZE;
+module_param(maxsz, ulong, 0644);
+MODULE_PARM_DESC(maxsz,
+ "Size to sweep up to (default (and max) KMALLOC_MAX_SIZE)");
+
+#define MAX_STRUCTS	32
+static int structsz[MAX_STRUCTS];
+static int nstructsz;
+module_param_array(structsz, int, &nstructsz, 0444);
+MODULE_PARM_DESC(structsz,
+ "Comma-separated list of struct sizes for the advisor (max "
+ __stringify(MAX_STRUCTS) "); can also be written to debugfs 'advise'");
 
-static int test_maxallocsz(void)
+#define MINSZ		100	/* 0 would give us a divide error! */
+#define WASTE_OK_PCT	12	/* we consider up to ~1/8th waste acceptable */
+
+static DEFINE_MUTEX(adv_mtx);	/* protects structsz[] */
+static struct dentry *gparent;
+
+static inline size_t waste_pct(size_t req, size_t actual)
 {
-	/* This time, initialize size2alloc to 100 (not 0), as otherwise we'll
-	 * likely get a divide error!
-	 */
-	size_t size2alloc = 100, actual_alloced;
+	return ((actual - req) * 100) / req;
+}
+
+/*
+ * What backs a kmalloc(@sz)? Returns the actual size allocated (ksize()),
+ * filling in @cache with the slab cache name (or "page_alloc" when it's
+ * the page allocator that serves it); 0 on allocation failure.
+ */
+static size_t kmalloc_actual(size_t sz, char *cache, size_t len)
+{
+	size_t actual;
 	void *p;
 
-	while (1) {
-		p = kmalloc(size2alloc, GFP_KERNEL);
-		if (!p) {
-			pr_alert("kmalloc fail, size2alloc=%zu\n", size2alloc);
-			return -ENOMEM;
-		}
-		actual_alloced = ksize(p);
-		/* Only print the size2alloc (required) and the percentage of waste */
-		pr_info("%zu  %3zu\n",
-			size2alloc, (((actual_alloced-size2alloc)*100)/size2alloc));
-		kfree(p);
-		size2alloc += stepsz;
+	if (sz > KMALLOC_MAX_CACHE_SIZE) {
+		snprintf(cache, len, "page_alloc(order:%d)", get_order(sz));
+		return PAGE_SIZE << get_order(sz);
+	}
+	p = kmalloc(sz, GFP_KERNEL | __GFP_NOWARN);
+	if (!p)
+		return 0;
+	actual = ksize(p);
+#if defined(CONFIG_SLUB) || defined(CONFIG_SLAB)
+	/* the slab layer stores the cache a (slab) page belongs to in it's
+	 * struct page */
+	strscpy(cache, virt_to_head_page(p)->slab_cache->name, len);
+#else
+	snprintf(cache, len, "kmalloc-%zu", actual);
+#endif
+	kfree(p);
+	return actual;
+}
+
+/*------------------ the 'table' file: the sweep, as a seq_file ------------*/
+/* Our iterator is simply the step #; the size's MINSZ + pos * stepsz */
+static void *tbl_start(struct seq_file *m, loff_t *pos)
+{
+	if (stepsz <= 0)
+		return NULL;
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	if (MINSZ + (unsigned long)(*pos - 1) * stepsz >
+	    min_t(unsigned long, maxsz, KMALLOC_MAX_SIZE))
+		return NULL;
+	return pos;
+}
+
+static void *tbl_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return tbl_start(m, pos);
+}
+
+static void tbl_stop(struct seq_file *m, void *v)
+{
+}
+
+static int tbl_show(struct seq_file *m, void *v)
+{
+	char cache[32];
+	size_t sz, actual;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "# requested  ksize  waste%  cache\n");
+		return 0;
 	}
+	sz = MINSZ + (size_t)(*(loff_t *)v - 1) * stepsz;
+	actual = kmalloc_actual(sz, cache, sizeof(cache));
+	if (!actual)
+		seq_printf(m, "%zu  -  -  (kmalloc failed)\n", sz);
+	else
+		seq_printf(m, "%zu  %zu  %3zu  %s\n",
+			   sz, actual, waste_pct(sz, actual), cache);
 	return 0;
 }
 
+static const struct seq_operations tbl_seqops = {
+	.start = tbl_start,
+	.next = tbl_next,
+	.stop = tbl_stop,
+	.show = tbl_show,
+};
+
+static int tbl_open(struct inode *inode, struct file *filp)
+{
+	return seq_open(filp, &tbl_seqops);
+}
+
+static const struct file_operations tbl_fops = {
+	.owner = THIS_MODULE,
+	.open = tbl_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+/*------------------ the 'advise' file -------------------------------------*/
+/*
+ * The actual object size of a custom cache for @sz byte objects, @align'ed
+ * (0 => word aligned) or @hwalign'ed; we create the cache and ask it (the
+ * slab layer may well merge it with an existing compatible cache, as it
+ * would a real one). Returns 0 on failure.
+ */
+static size_t cache_actual(size_t sz, unsigned int align, bool hwalign)
+{
+	struct kmem_cache *cachep;
+	size_t actual = 0;
+	void *p;
+
+	cachep = kmem_cache_create(OURMODNAME "_adv", sz, align,
+				   hwalign ? SLAB_HWCACHE_ALIGN : 0, NULL);
+	if (!cachep)
+		return 0;
+	p = kmem_cache_alloc(cachep, GFP_KERNEL | __GFP_NOWARN);
+	if (p) {
+		actual = ksize(p);
+		kmem_cache_free(cachep, p);
+	}
+	kmem_cache_destroy(cachep);
+	return actual;
+}
+
+static void advise_one(struct seq_file *m, size_t sz)
+{
+	size_t km, cw, ch, kmw, cww, chw;
+	char cache[32];
+
+	km = kmalloc_actual(sz, cache, sizeof(cache));
+	cw = sz <= KMALLOC_MAX_CACHE_SIZE ? cache_actual(sz, 0, false) : 0;
+	ch = sz <= KMALLOC_MAX_CACHE_SIZE ? cache_actual(sz, 0, true) : 0;
+	if (!km || (sz <= KMALLOC_MAX_CACHE_SIZE && (!cw || !ch))) {
+		seq_printf(m, "%zu  -  (allocation failed)\n", sz);
+		return;
+	}
+	kmw = waste_pct(sz, km);
+	seq_printf(m, "%zu  %zu:%zu%%(%s)", sz, km, kmw, cache);
+	if (sz > KMALLOC_MAX_CACHE_SIZE) {
+		seq_puts(m, "  -  -  page allocator (alloc_pages[_exact]());"
+			 " too large for a slab cache\n");
+		return;
+	}
+	cww = waste_pct(sz, cw);
+	chw = waste_pct(sz, ch);
+	seq_printf(m, "  %zu:%zu%%  %zu:%zu%%  ", cw, cww, ch, chw);
+
+	/*
+	 * The generic kmalloc caches are shared, hot and already there; only
+	 * if they waste too much is a custom cache worth it. Then, cacheline
+	 * alignment's the thing for objects of half a line or more (no false
+	 * sharing between two hot objects), as long as it doesn't itself
+	 * waste too much; for smaller ones, we'd rather pack them.
+	 */
+	if (kmw <= WASTE_OK_PCT)
+		seq_puts(m, "kmalloc\n");
+	else if (sz >= cache_line_size() / 2 && chw <= WASTE_OK_PCT)
+		seq_printf(m, "custom cache, SLAB_HWCACHE_ALIGN (%d bytes)\n",
+			   cache_line_size());
+	else if (cww < kmw)
+		seq_printf(m, "custom cache, align %zu\n", sizeof(void *));
+	else
+		seq_puts(m, "kmalloc\n");
+}
+
+static int adv_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	seq_puts(m, "# size  kmalloc:waste%(cache)  custom-word:waste%"
+		 "  custom-hwalign:waste%  advice\n");
+	mutex_lock(&adv_mtx);
+	if (!nstructsz)
+		seq_puts(m, "# (no sizes; write f.e. \"24,96,200,1500\" to this file)\n");
+	for (i = 0; i < nstructsz; i++)
+		advise_one(m, structsz[i]);
+	mutex_unlock(&adv_mtx);
+	return 0;
+}
+
+static int adv_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, adv_show, NULL);
+}
+
+/* A comma-separated list of sizes (as for the structsz parameter) */
+static ssize_t adv_write(struct file *filp, const char __user *ubuf,
+			 size_t count, loff_t *off)
+{
+	int ints[MAX_STRUCTS + 1], i;
+	char *kbuf;
+
+	if (count >= PAGE_SIZE)
+		return -E2BIG;
+	kbuf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+	get_options(kbuf, ARRAY_SIZE(ints), ints);
+	kfree(kbuf);
+	for (i = 1; i <= ints[0]; i++)
+		if (ints[i] <= 0 || (unsigned long)ints[i] > KMALLOC_MAX_SIZE)
+			return -EINVAL;
+
+	mutex_lock(&adv_mtx);
+	nstructsz = ints[0];
+	memcpy(structsz, &ints[1], nstructsz * sizeof(int));
+	mutex_unlock(&adv_mtx);
+	return count;
+}
+
+static const struct file_operations adv_fops = {
+	.owner = THIS_MODULE,
+	.open = adv_open,
+	.read = seq_read,
+	.write = adv_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init slab4_actualsz_wstg_plot_init(void)
 {
-	pr_info("%s: inserted\n", OURMODNAME);
-	return test_maxallocsz();
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("table", 0444, gparent, NULL,
+					       &tbl_fops)) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("advise", 0644, gparent, NULL,
+					       &adv_fops))) {
+		pr_warn("%s: debugfs setup failed\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		return -ENODEV;
+	}
+	pr_info("%s: inserted (<debugfs_mount>/%s/{table,advise})\n",
+		OURMODNAME, OURMODNAME);
+	return 0;
 }
 static void __exit slab4_actualsz_wstg_plot_exit(void)
 {
+	debugfs_remove_recursive(gparent);
 	pr_info("%s: removed\n", OURMODNAME);
 }
 
@@ -0,0 +1,551 @@
+/*
+ * ch9/slab_bench/slab_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Learn Linux Kernel Development"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Learn-Linux-Kernel-Development
+ *
+ * From: Ch 9 : Kernel Memory Allocation for Module Authors, Part 2
+ ****************************************************************
+ * Brief Description:
+ * A slab allocation microbenchmark: generic kmalloc() vs a custom slab cache
+ * (vs our klib llkd_pool), single vs bulk APIs, one vs many CPUs.
+ *
+ * For each test, we run it with 1, 2, 4, ... up to nthreads kernel threads,
+ * each bound to a different online CPU; every thread does 'iters' rounds of
+ * allocating 'batch' objects of 'objsz' bytes and then freeing them all:
+ *  kmalloc         : kmalloc() x batch, kfree() x batch
+ *  kmalloc_bulk    : kmalloc() x batch, one kfree_bulk()
+ *  cache           : kmem_cache_alloc() x batch, kmem_cache_free() x batch
+ *  cache_bulk      : one kmem_cache_alloc_bulk(), one kmem_cache_free_bulk()
+ *  llkd_pool       : llkd_pool_alloc() x batch, llkd_pool_free() x batch
+ *  llkd_pool_bulk  : one llkd_pool_alloc_bulk(), one llkd_pool_free_bulk()
+ * An 'op' is one object allocated and freed. The results - ns/op (per
+ * thread, averaged), aggregate throughput (Mops/s, over the wall clock time
+ * of the slowest thread) and the scaling vs one thread, plus a per-CPU
+ * breakdown of the widest run - are in <debugfs_mount>/slab_bench/results.
+ * The benchmark runs at insmod time (unless autorun=0) and on every write
+ * to <debugfs_mount>/slab_bench/run, picking up the current parameters
+ * (they're writable under /sys/module/slab_bench_lkm/parameters/).
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "../../klib_llkd.h"
+
+#define OURMODNAME   "slab_bench"
+#define SB_MAXBATCH  1024
+
+/*
+ * A thread that signals completion and then returns is still running our code
+ * (up to the kthread core) when the waiter - and, soon after, rmmod - goes on;
+ * the *complete_and_exit() helpers signal and exit in core kernel code.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+#define sb_complete_and_exit(c)	kthread_complete_and_exit(c, 0)
+#else
+#define sb_complete_and_exit(c)	complete_and_exit(c, 0)
+#endif
+
+MODULE_AUTHOR("<insert your name here>");
+MODULE_DESCRIPTION("LLKD book:ch9/slab_bench: slab allocation microbenchmark"
+		   " (kmalloc vs custom cache, single vs bulk, scaling across CPUs)");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static uint objsz = 64;
+module_param(objsz, uint, 0644);
+MODULE_PARM_DESC(objsz, "Object size (bytes) to allocate (default 64)");
+
+static uint batch = 32;
+module_param(batch, uint, 0644);
+MODULE_PARM_DESC(batch,
+ "# of objects allocated, then freed, per round (default 32, max "
+ __stringify(SB_MAXBATCH) ")");
+
+static uint iters = 10000;
+module_param(iters, uint, 0644);
+MODULE_PARM_DESC(iters, "# of rounds per thread per test (default 10000)");
+
+static uint nthreads;
+module_param(nthreads, uint, 0644);
+MODULE_PARM_DESC(nthreads,
+ "Max # of benchmark threads, one per online CPU; 0 (default) => all online CPUs");
+
+static char *gfp = "kernel";
+module_param(gfp, charp, 0644);
+MODULE_PARM_DESC(gfp,
+ "GFP flags to allocate with: one of kernel (GFP_KERNEL, default), atomic"
+ " (GFP_ATOMIC) or nowait (GFP_NOWAIT)");
+
+static bool autorun = true;
+module_param(autorun, bool, 0444);
+MODULE_PARM_DESC(autorun, "Run the benchmark at insmod time (default 1)");
+
+enum {
+	T_KMALLOC,
+	T_KMALLOC_BULK,
+	T_CACHE,
+	T_CACHE_BULK,
+	T_POOL,
+	T_POOL_BULK,
+	NTESTS
+};
+
+static const char * const test_name[NTESTS] = {
+	"kmalloc", "kmalloc_bulk", "cache", "cache_bulk",
+	"llkd_pool", "llkd_pool_bulk",
+};
+
+/* The setup shared by all threads of a run */
+struct sb_cfg {
+	int test;
+	unsigned int objsz, batch, iters;
+	gfp_t gfp;
+	struct kmem_cache *cachep;
+	struct llkd_pool *pool;
+	struct completion go;	/* all threads start together */
+};
+
+struct sb_thread {
+	struct sb_cfg *cfg;
+	int cpu;
+	int err;
+	u64 ns;			/* time taken for all our rounds */
+	void **objs;		/* [batch] */
+	struct completion done;
+};
+
+/* The result of one (test, # of threads) run */
+struct sb_result {
+	int test;
+	int err;
+	unsigned int nthr;
+	u64 ops;		/* total, across all threads */
+	u64 wall_ns;		/* the slowest thread's time */
+	u64 sum_ns;		/* all threads' times, summed */
+	struct {
+		int cpu;
+		u64 ns;
+	} th[];			/* [nthr] */
+};
+
+static DEFINE_MUTEX(sb_mtx);		/* one run at a time; protects below */
+static struct sb_result **gres;
+static unsigned int gnres;
+static struct sb_cfg glastcfg;		/* the parameters of the last run */
+static struct dentry *gparent;
+
+/* One round: allocate, then free, cfg->batch objects. Returns 0 or -ENOMEM */
+static int sb_round(struct sb_cfg *cfg, void **objs)
+{
+	unsigned int i, n = cfg->batch;
+
+	switch (cfg->test) {
+	case T_KMALLOC:
+	case T_KMALLOC_BULK:
+		for (i = 0; i < n; i++) {
+			objs[i] = kmalloc(cfg->objsz, cfg->gfp);
+			if (unlikely(!objs[i]))
+				goto out_nomem;
+		}
+		if (cfg->test == T_KMALLOC_BULK) {
+			kfree_bulk(n, objs);
+		} else {
+			for (i = 0; i < n; i++)
+				kfree(objs[i]);
+		}
+		break;
+	case T_CACHE:
+		for (i = 0; i < n; i++) {
+			objs[i] = kmem_cache_alloc(cfg->cachep, cfg->gfp);
+			if (unlikely(!objs[i]))
+				goto out_nomem;
+		}
+		for (i = 0; i < n; i++)
+			kmem_cache_free(cfg->cachep, objs[i]);
+		break;
+	case T_CACHE_BULK:
+		if (unlikely(!kmem_cache_alloc_bulk(cfg->cachep, cfg->gfp, n, objs)))
+			return -ENOMEM;
+		kmem_cache_free_bulk(cfg->cachep, n, objs);
+		break;
+	case T_POOL:
+		for (i = 0; i < n; i++) {
+			objs[i] = llkd_pool_alloc(cfg->pool, cfg->gfp);
+			if (unlikely(!objs[i]))
+				goto out_nomem;
+		}
+		for (i = 0; i < n; i++)
+			llkd_pool_free(cfg->pool, objs[i]);
+		break;
+	case T_POOL_BULK:
+		if (unlikely(!llkd_pool_alloc_bulk(cfg->pool, cfg->gfp, n, objs)))
+			return -ENOMEM;
+		llkd_pool_free_bulk(cfg->pool, n, objs);
+		break;
+	}
+	return 0;
+
+ out_nomem:
+	/* free the ones we did get; objs[i] is the one that failed */
+	while (i--) {
+		if (cfg->test == T_CACHE)
+			kmem_cache_free(cfg->cachep, objs[i]);
+		else if (cfg->test == T_POOL)
+			llkd_pool_free(cfg->pool, objs[i]);
+		else
+			kfree(objs[i]);
+	}
+	return -ENOMEM;
+}
+
+static int sb_threadfn(void *arg)
+{
+	struct sb_thread *th = arg;
+	struct sb_cfg *cfg = th->cfg;
+	unsigned int r;
+	u64 t0;
+
+	wait_for_completion(&cfg->go);
+	t0 = ktime_get_ns();
+	for (r = 0; r < cfg->iters; r++) {
+		th->err = sb_round(cfg, th->objs);
+		if (th->err)
+			break;
+		/* with GFP_KERNEL, we don't necessarily ever sleep; be nice */
+		if ((r & 127) == 127)
+			cond_resched();
+	}
+	th->ns = ktime_get_ns() - t0;
+	sb_complete_and_exit(&th->done);
+}
+
+/*
+ * Run cfg->test on @nthr threads, on the first @nthr online CPUs (the caller
+ * holds the CPU hotplug lock); returns the result, or an ERR_PTR().
+ */
+static struct sb_result *sb_run(struct sb_cfg *cfg, unsigned int nthr)
+{
+	struct sb_result *res;
+	struct sb_thread *th;
+	struct task_struct *tsk;
+	unsigned int i, n = 0;
+	int cpu, ret = 0;
+
+	res = kzalloc(struct_size(res, th, nthr), GFP_KERNEL);
+	th = kcalloc(nthr, sizeof(*th), GFP_KERNEL);
+	if (!res || !th) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	init_completion(&cfg->go);
+
+	for_each_online_cpu(cpu) {
+		if (n == nthr)
+			break;
+		th[n].cfg = cfg;
+		th[n].cpu = cpu;
+		init_completion(&th[n].done);
+		th[n].objs = kmalloc_array(cfg->batch, sizeof(void *), GFP_KERNEL);
+		if (!th[n].objs) {
+			ret = -ENOMEM;
+			break;
+		}
+		tsk = kthread_create_on_cpu(sb_threadfn, &th[n], cpu,
+					    OURMODNAME "/%u");
+		if (IS_ERR(tsk)) {
+			ret = PTR_ERR(tsk);
+			kfree(th[n].objs);
+			break;
+		}
+		wake_up_process(tsk);
+		n++;
+	}
+	/* the ones we did create are waiting on 'go'; let them run regardless */
+	complete_all(&cfg->go);
+	for (i = 0; i < n; i++) {
+		wait_for_completion(&th[i].done);
+		kfree(th[i].objs);
+	}
+	if (ret)
+		goto out_free;
+
+	res->test = cfg->test;
+	res->nthr = n;
+	for (i = 0; i < n; i++) {
+		res->th[i].cpu = th[i].cpu;
+		res->th[i].ns = th[i].ns;
+		res->wall_ns = max(res->wall_ns, th[i].ns);
+		res->sum_ns += th[i].ns;
+		if (th[i].err)
+			res->err = th[i].err;
+	}
+	res->ops = (u64)n * cfg->iters * cfg->batch;
+	kfree(th);
+	return res;
+
+ out_free:
+	kfree(th);
+	kfree(res);
+	return ERR_PTR(ret);
+}
+
+static void sb_free_results(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < gnres; i++)
+		kfree(gres[i]);
+	kfree(gres);
+	gres = NULL;
+	gnres = 0;
+}
+
+static int sb_parse_gfp(gfp_t *flags)
+{
+	if (!strcmp(gfp, "kernel"))
+		*flags = GFP_KERNEL;
+	else if (!strcmp(gfp, "atomic"))
+		*flags = GFP_ATOMIC;
+	else if (!strcmp(gfp, "nowait"))
+		*flags = GFP_NOWAIT;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+/* Run all tests, with 1, 2, 4, ..., maxthr threads; called with sb_mtx held */
+static int sb_bench(void)
+{
+	struct sb_cfg *cfg = &glastcfg;
+	unsigned int maxthr, nthr, nsteps = 0, maxres;
+	struct sb_result *res;
+	gfp_t flags;
+	int ret;
+
+	if (!objsz || !batch || batch > SB_MAXBATCH || !iters) {
+		pr_warn("%s: invalid objsz/batch/iters (%u/%u/%u)\n",
+			OURMODNAME, objsz, batch, iters);
+		return -EINVAL;
+	}
+	ret = sb_parse_gfp(&flags);
+	if (ret) {
+		pr_warn("%s: invalid gfp '%s'\n", OURMODNAME, gfp);
+		return ret;
+	}
+	sb_free_results();
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->gfp = flags;
+	cfg->objsz = objsz;
+	cfg->batch = batch;
+	cfg->iters = iters;
+
+	cfg->cachep = kmem_cache_create(OURMODNAME, objsz, 0,
+					SLAB_HWCACHE_ALIGN, NULL);
+	if (!cfg->cachep)
+		return -ENOMEM;
+	cfg->pool = llkd_pool_create(OURMODNAME "_pool", objsz, 0, 0, false,
+				     NULL);
+	if (!cfg->pool) {
+		ret = -ENOMEM;
+		goto out_cache;
+	}
+
+	cpus_read_lock();
+	maxthr = num_online_cpus();
+	if (nthreads)
+		maxthr = min(nthreads, maxthr);
+	for (nthr = 1; nthr < maxthr; nthr <<= 1)
+		nsteps++;
+	nsteps++;		/* maxthr itself */
+	maxres = NTESTS * nsteps;
+	gres = kcalloc(maxres, sizeof(*gres), GFP_KERNEL);
+	if (!gres) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	for (cfg->test = 0; cfg->test < NTESTS; cfg->test++) {
+		nthr = 1;
+		for (;;) {
+			res = sb_run(cfg, nthr);
+			if (IS_ERR(res)) {
+				ret = PTR_ERR(res);
+				goto out_unlock;
+			}
+			gres[gnres++] = res;
+			if (nthr == maxthr)
+				break;
+			nthr = min(nthr << 1, maxthr);
+		}
+	}
+	pr_info("%s: done: objsz=%u batch=%u iters=%u gfp=%s threads=1..%u\n",
+		OURMODNAME, objsz, batch, iters, gfp, maxthr);
+
+ out_unlock:
+	cpus_read_unlock();
+	llkd_pool_destroy(cfg->pool);
+ out_cache:
+	kmem_cache_destroy(cfg->cachep);
+	return ret;
+}
+
+/*--- debugfs ---*/
+/* Print @num / @den with @dec decimal places */
+static void seq_put_ratio(struct seq_file *m, u64 num, u64 den, int dec)
+{
+	u32 frac;
+	u64 q;
+
+	if (!den) {
+		seq_puts(m, " -");
+		return;
+	}
+	q = llkd_div_frac(num, den, dec, &frac);
+	seq_printf(m, " %llu.%0*u", q, dec, frac);
+}
+
+static int sb_show(struct seq_file *m, void *v)
+{
+	struct sb_result *r, *r1 = NULL, *widest;
+	unsigned int i, j;
+
+	mutex_lock(&sb_mtx);
+	if (!gnres) {
+		seq_puts(m, "# no results yet; write to the 'run' file\n");
+		goto out;
+	}
+	seq_printf(m, "# objsz=%u batch=%u iters=%u gfp=0x%x\n",
+		   glastcfg.objsz, glastcfg.batch, glastcfg.iters,
+		   (unsigned int)glastcfg.gfp);
+	seq_puts(m, "# test threads ops ns_per_op Mops_per_sec scaling\n");
+	for (i = 0; i < gnres; i++) {
+		r = gres[i];
+		if (r->nthr == 1)
+			r1 = r;
+		seq_printf(m, "%s %u %llu", test_name[r->test], r->nthr, r->ops);
+		if (r->err) {
+			seq_printf(m, " failed (%d)\n", r->err);
+			continue;
+		}
+		/* per thread: each did ops/nthr ops */
+		seq_put_ratio(m, r->sum_ns, r->ops, 1);
+		/* ops/ns * 1000 = Mops/s */
+		seq_put_ratio(m, r->ops * 1000, r->wall_ns, 2);
+		/* throughput relative to the 1-thread run of this test */
+		if (r1 && r1->test == r->test && !r1->err)
+			seq_put_ratio(m, r->ops * r1->wall_ns,
+				      r1->ops * r->wall_ns, 2);
+		else
+			seq_puts(m, " -");
+		seq_putc(m, '\n');
+	}
+
+	seq_puts(m, "# per-CPU, widest run: test cpu ns_per_op\n");
+	for (i = 0; i < gnres; i++) {
+		widest = gres[i];
+		if (i + 1 < gnres && gres[i + 1]->test == widest->test)
+			continue;	/* not the last (widest) run of this test */
+		if (widest->err)
+			continue;
+		for (j = 0; j < widest->nthr; j++) {
+			seq_printf(m, "percpu %s %d", test_name[widest->test],
+				   widest->th[j].cpu);
+			seq_put_ratio(m, widest->th[j].ns,
+				      (u64)glastcfg.iters * glastcfg.batch, 1);
+			seq_putc(m, '\n');
+		}
+	}
+ out:
+	mutex_unlock(&sb_mtx);
+	return 0;
+}
+
+static int sb_open(struct inode *inode, struct file *filp)
+{
+	return single_open_size(filp, sb_show, NULL,
+				PAGE_SIZE + NTESTS * nr_cpu_ids * 40);
+}
+
+static const struct file_operations sb_results_fops = {
+	.owner = THIS_MODULE,
+	.open = sb_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Any write (re)runs the benchmark; it returns once done */
+static ssize_t sb_run_write(struct file *filp, const char __user *ubuf,
+			    size_t count, loff_t *off)
+{
+	int ret;
+
+	if (mutex_lock_interruptible(&sb_mtx))
+		return -ERESTARTSYS;
+	ret = sb_bench();
+	mutex_unlock(&sb_mtx);
+	return ret ? ret : count;
+}
+
+static const struct file_operations sb_run_fops = {
+	.owner = THIS_MODULE,
+	.write = sb_run_write,
+	.llseek = no_llseek,
+};
+
+static int __init slab_bench_init(void)
+{
+	int ret;
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("results", 0444, gparent, NULL,
+					       &sb_results_fops)) ||
+	    IS_ERR_OR_NULL(debugfs_create_file("run", 0200, gparent, NULL,
+					       &sb_run_fops))) {
+		pr_warn("%s: debugfs setup failed\n", OURMODNAME);
+		debugfs_remove_recursive(gparent);
+		return -ENODEV;
+	}
+
+	if (autorun) {
+		mutex_lock(&sb_mtx);
+		ret = sb_bench();
+		mutex_unlock(&sb_mtx);
+		if (ret) {
+			debugfs_remove_recursive(gparent);
+			sb_free_results();
+			return ret;
+		}
+	}
+	pr_info("%s: inserted (<debugfs_mount>/%s/{results,run})\n",
+		OURMODNAME, OURMODNAME);
+	return 0;		/* success */
+}
+
+static void __exit slab_bench_exit(void)
+{
+	debugfs_remove_recursive(gparent);
+	sb_free_results();
+	pr_info("%s: removed\n", OURMODNAME);
+}
+
+module_init(slab_bench_init);
+module_exit(slab_bench_exit);
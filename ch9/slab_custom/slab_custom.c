@@ -13,6 +13,11 @@
  * Brief Description:
  * Simple demo of using the slab layer (exorted) APIs to create our very own
  * custom slab cache.
+ * With prod=1, it instead demos the 'production' way: an object pool
+ * (klib_llkd.c:llkd_pool_*()) - a custom cache with no debug flags and a
+ * cheap ctor, fronted by per-CPU magazines of ready objects, with bulk
+ * alloc/free entry points - whose hit/miss counters are visible via
+ * <debugfs_mount>/slab_custom/pool_stats.
  *
  * For details, please refer the book, Ch 9.
  */
@@ -22,6 +27,11 @@
 #include <linux/slab.h>
 #include <linux/version.h>
 #include <linux/sched.h>   /* current */
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "../../klib_llkd.h"
+#define CREATE_TRACE_POINTS
+#include "slab_custom_trace.h"	/* our slab_custom:slab_custom_{alloc,free} tracepoints */
 
 #define OURMODNAME   "slab_custom"
 #define OURCACHENAME "our_ctx"
@@ -31,6 +41,16 @@ module_param(use_ctor, uint, 0);
 MODULE_PARM_DESC(use_ctor, "if set to 1 (default), our custom ctor routine"
 " will initialize slabmem; when 0, no custom constructor will run");
 
+static bool prod;
+module_param(prod, bool, 0);
+MODULE_PARM_DESC(prod, "if set to 1, demo the production mode - an object"
+" pool with per-CPU magazines - instead (default 0)");
+
+static uint nobjs = 1000;
+module_param(nobjs, uint, 0);
+MODULE_PARM_DESC(nobjs, "(production mode) # of objects to cycle through"
+" the pool (default 1000)");
+
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LLKD book:ch9/slab_custom: simple demo of creating a custom slab cache");
 MODULE_LICENSE("Dual MIT/GPL");
@@ -46,6 +66,8 @@ struct myctx {
 	char uname[128], passwd[16], config[64];
 };
 static struct kmem_cache *gctx_cachep;
+static struct llkd_pool *gctx_pool;	/* production mode */
+static struct dentry *gparent;
 
 static void use_our_cache(void)
 {
@@ -62,12 +84,14 @@ static void use_our_cache(void)
 		pr_warn("%s:%s():kmem_cache_alloc() failed\n",
 			OURMODNAME, __func__);
 	}
+	trace_slab_custom_alloc(obj, kmem_cache_size(gctx_cachep));
 
 	pr_info("Our cache object (@ %pK, actual=%llx) size is %u bytes; ksize=%zu\n",
 		obj, (unsigned long long)obj, kmem_cache_size(gctx_cachep), ksize(obj));
 	print_hex_dump_bytes("obj: ", DUMP_PREFIX_OFFSET, obj, sizeof(struct myctx));
 
 	/* free it */
+	trace_slab_custom_free(obj);
 	kmem_cache_free(gctx_cachep, obj);
 }
 
@@ -126,16 +150,100 @@ static int create_our_cache(void)
 	return ret;
 }
 
+/*------------------ production mode: an object pool --------------------*/
+/* A cheap ctor: no printk's, no formatting; it runs only when the slab
+ * layer constructs a fresh object (not on every alloc) */
+static void our_cheap_ctor(void *new)
+{
+	memset(new, 0, sizeof(struct myctx));
+}
+
+#define BULK	32
+static int use_our_pool(void)
+{
+	void *objs[BULK];
+	struct myctx *obj;
+	unsigned int i;
+
+	gctx_pool = llkd_pool_create(OURCACHENAME, sizeof(struct myctx),
+			sizeof(long), 0, false, use_ctor ? our_cheap_ctor : NULL);
+	if (!gctx_pool) {
+		pr_warn("%s:%s():llkd_pool_create() failed\n",
+			OURMODNAME, __func__);
+		return -ENOMEM;
+	}
+
+	/* Single objects: after the first (bulk) refill, they're all hits */
+	for (i = 0; i < nobjs; i++) {
+		obj = llkd_pool_alloc(gctx_pool, GFP_KERNEL);
+		if (!obj)
+			return -ENOMEM;
+		trace_slab_custom_alloc(obj, sizeof(struct myctx));
+		obj->iarr[0] = i;	/* "use" it */
+		trace_slab_custom_free(obj);
+		llkd_pool_free(gctx_pool, obj);
+	}
+	/* ... and in bulk */
+	for (i = 0; i < nobjs / BULK; i++) {
+		if (!llkd_pool_alloc_bulk(gctx_pool, GFP_KERNEL, BULK, objs))
+			return -ENOMEM;
+		llkd_pool_free_bulk(gctx_pool, BULK, objs);
+	}
+	return 0;
+}
+
+static int pool_stats_show(struct seq_file *m, void *v)
+{
+	llkd_pool_show_stats(m, gctx_pool);
+	return 0;
+}
+
+static int pool_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pool_stats_show, NULL);
+}
+
+static const struct file_operations pool_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = pool_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init slab_custom_init(void)
 {
+	int ret;
+
 	pr_info("%s: inserted\n", OURMODNAME);
-	create_our_cache();
-	use_our_cache();
+	if (!prod) {
+		create_our_cache();
+		use_our_cache();
+		return 0;		/* success */
+	}
+
+	ret = use_our_pool();
+	if (ret) {
+		llkd_pool_destroy(gctx_pool);
+		return ret;
+	}
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (!IS_ERR_OR_NULL(gparent))	/* not fatal */
+		debugfs_create_file("pool_stats", 0444, gparent, NULL,
+				    &pool_stats_fops);
+	pr_info("%s: object pool ready (counters: <debugfs_mount>/%s/pool_stats)\n",
+		OURMODNAME, OURMODNAME);
 	return 0;		/* success */
 }
 
 static void __exit slab_custom_exit(void)
 {
+	if (prod) {
+		debugfs_remove_recursive(gparent);
+		llkd_pool_destroy(gctx_pool);
+		pr_info("%s: object pool destroyed; removed\n", OURMODNAME);
+		return;
+	}
 	kmem_cache_destroy(gctx_cachep);
 	pr_info("%s: custom cache destroyed; removed\n", OURMODNAME);
 }
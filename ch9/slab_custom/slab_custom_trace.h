@@ -0,0 +1,52 @@
+/*
+ * ch9/slab_custom/slab_custom_trace.h
+ *
+ * Tracepoints for the slab_custom kernel module: allocations from, and frees
+ * to, our custom slab cache.
+ * When nothing is attached, each tracepoint costs just a NOP (it's gated by a
+ * static key); attach via ftrace, perf or eBPF, f.e.:
+ *  echo 1 > /sys/kernel/debug/tracing/events/slab_custom/enable
+ *  perf record -e 'slab_custom:*' -a
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM slab_custom
+
+#if !defined(_SLAB_CUSTOM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SLAB_CUSTOM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(slab_custom_alloc,
+	TP_PROTO(const void *obj, unsigned int size),
+	TP_ARGS(obj, size),
+	TP_STRUCT__entry(
+		__field(const void *, obj)
+		__field(unsigned int, size)
+	),
+	TP_fast_assign(
+		__entry->obj = obj;
+		__entry->size = size;
+	),
+	TP_printk("obj=%p size=%u", __entry->obj, __entry->size)
+);
+
+TRACE_EVENT(slab_custom_free,
+	TP_PROTO(const void *obj),
+	TP_ARGS(obj),
+	TP_STRUCT__entry(
+		__field(const void *, obj)
+	),
+	TP_fast_assign(
+		__entry->obj = obj;
+	),
+	TP_printk("obj=%p", __entry->obj)
+);
+
+#endif /* _SLAB_CUSTOM_TRACE_H */
+
+/* This part must be outside the multi-read protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE slab_custom_trace
+#include <trace/define_trace.h>
@@ -44,6 +44,11 @@
       trace_printk's : cat /sys/kernel/debug/tracing/trace
 
 	 Default: printk (with rate-limiting)
+
+	Note though, that production kernels typically reject trace_printk() (and
+	printk is slow). For always-available, near-zero overhead instrumentation,
+	prefer proper tracepoints (TRACE_EVENT()); see f.e. our
+	ch12/miscdrv_rdwr/miscdrv_rdwr_trace.h .
  */
 /* Keep this defined to use the FTRACE-style trace_printk(), else will use
    regular printk() */
@@ -196,6 +201,465 @@
 #endif
 #endif
 
+/*------------------------ VPRINT, VPRINT_CTX -------------------------
+ * Runtime-switchable 'verbose' diagnostics for hot code paths.
+ * The check is gated by a static key (a jump label); when verbosity is off
+ * (the default), it costs just one (patched-in) NOP instruction - no load,
+ * no compare, no branch - so it's fine to leave these in even the hottest
+ * paths. It can be toggled at runtime via a debugfs file:
+ *    echo 1 > <debugfs_mount>/<dirname>/verbose   # on
+ *    echo 0 > <debugfs_mount>/<dirname>/verbose   # off
+ *
+ *** Kernel module authors Note: ***
+ * This is opt-in: #define LLKD_USE_VERBOSE before including this header,
+ * (in just one .c file of the module), then call
+ *  llkd_verbose_init(<dirname>, <initially on?>) in the module init code and
+ *  llkd_verbose_exit() in the cleanup code.
+ * Then use VPRINT() just as you would DBGPRINT(), and VPRINT_CTX() instead
+ * of PRINT_CTX().
+ */
+#if defined(__KERNEL__) && defined(LLKD_USE_VERBOSE)
+#include <linux/jump_label.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+
+static DEFINE_STATIC_KEY_FALSE(llkd_verbose_key);
+static struct dentry *llkd_verbose_dir;
+
+#define VPRINT(string, args...) do {                                    \
+	if (static_branch_unlikely(&llkd_verbose_key))                  \
+		DBGPRINT(string, ##args);                               \
+} while (0)
+
+#define VPRINT_CTX() do {                                               \
+	if (static_branch_unlikely(&llkd_verbose_key))                  \
+		PRINT_CTX();                                            \
+} while (0)
+
+static ssize_t llkd_verbose_read(struct file *filp, char __user *ubuf,
+				 size_t count, loff_t *fpos)
+{
+	char buf[2] = { '0', '\n' };
+
+	if (static_key_enabled(&llkd_verbose_key))
+		buf[0] = '1';
+	return simple_read_from_buffer(ubuf, count, fpos, buf, sizeof(buf));
+}
+
+static ssize_t llkd_verbose_write(struct file *filp, const char __user *ubuf,
+				  size_t count, loff_t *fpos)
+{
+	bool on;
+	int ret = kstrtobool_from_user(ubuf, count, &on);
+
+	if (ret)
+		return ret;
+	/* (Re)patches the code at every VPRINT*() site; can sleep */
+	if (on)
+		static_branch_enable(&llkd_verbose_key);
+	else
+		static_branch_disable(&llkd_verbose_key);
+	return count;
+}
+
+static const struct file_operations llkd_verbose_fops = {
+	.read = llkd_verbose_read,
+	.write = llkd_verbose_write,
+	.llseek = default_llseek,
+};
+
+/*
+ * llkd_verbose_init
+ * Set the initial verbosity and create the <debugfs_mount>/@dirname/verbose
+ * file to toggle it at runtime. The debugfs directory is available to the
+ * module (as llkd_verbose_dir) to add it's own files into, if it wishes to.
+ */
+static inline int llkd_verbose_init(const char *dirname, bool on)
+{
+	if (on)
+		static_branch_enable(&llkd_verbose_key);
+	if (!IS_ENABLED(CONFIG_DEBUG_FS))
+		return 0;	/* not fatal; we just can't toggle it at runtime */
+
+	llkd_verbose_dir = debugfs_create_dir(dirname, NULL);
+	if (IS_ERR_OR_NULL(llkd_verbose_dir))
+		return llkd_verbose_dir ? PTR_ERR(llkd_verbose_dir) : -ENOMEM;
+	debugfs_create_file("verbose", 0644, llkd_verbose_dir, NULL,
+			    &llkd_verbose_fops);
+	return 0;
+}
+
+static inline void llkd_verbose_exit(void)
+{
+	debugfs_remove_recursive(llkd_verbose_dir);
+}
+#endif  /* __KERNEL__ && LLKD_USE_VERBOSE */
+
+/*------------------------ timing & latency histograms ------------------
+ * A (cheap) measurement core, for both kernel and user builds:
+ *  llkd_now_ns()     : monotonic time in ns (ktime_get_ns() / CLOCK_MONOTONIC)
+ *  llkd_cycles()     : the CPU cycle counter (get_cycles() / rdtsc / cntvct)
+ *  LLKD_TIMED_SCOPE(&hist) : time (in ns) from here to the end of the
+ *                      enclosing scope, into the histogram (also the _CYC
+ *                      variant, in cycles)
+ *  struct llkd_hist  : a log2 histogram, each power of 2 further split into
+ *                      LLKD_HIST_SUB linear sub-buckets (so, <= 12.5% error);
+ *                      add to it from any context via llkd_hist_add(). In
+ *                      the kernel, the counters are per-CPU (this_cpu ops: no
+ *                      atomics, no locks, no shared cache lines); in
+ *                      userspace, they're relaxed atomics.
+ *  llkd_hist_snapshot() / llkd_hist_pct() : sum it up; get the (f.e.) p99
+ *                      (in parts per 10000, so 9990 => p99.9)
+ *  llkd_hist_debugfs() : (kernel) a debugfs file to read it (count, mean,
+ *                      max, percentiles and the non-empty buckets) from; a
+ *                      write to it resets it
+ *  llkd_hist_print() : (user) the same, to a FILE
+ *
+ * This is opt-in: #define LLKD_USE_TIMING before including this header (in
+ * just one .c file of a kernel module), then llkd_hist_init() each histogram
+ * (in the kernel, it can fail: -ENOMEM) and llkd_hist_destroy() it when done.
+ */
+#ifdef LLKD_USE_TIMING
+#ifdef __KERNEL__
+#include <linux/ktime.h>
+#include <linux/timex.h>	/* get_cycles() */
+#include <linux/percpu.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+
+#define llkd_div_u64(a, b)	div64_u64((a), (b))
+#define llkd_fls64(v)		fls64(v)
+#define LLKD_HIST_OUT(out, fmt, args...) seq_printf((struct seq_file *)(out), fmt, ##args)
+
+static inline __u64 llkd_now_ns(void)
+{
+	return ktime_get_ns();
+}
+
+static inline __u64 llkd_cycles(void)
+{
+	return get_cycles();
+}
+#else
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <linux/types.h>
+
+#define llkd_div_u64(a, b)	((a) / (b))
+#define llkd_fls64(v)		((v) ? 64 - __builtin_clzll(v) : 0)
+#define LLKD_HIST_OUT(out, fmt, args...) fprintf((FILE *)(out), fmt, ##args)
+
+static inline __u64 llkd_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline __u64 llkd_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((__u64)hi << 32) | lo;
+#elif defined(__aarch64__)
+	__u64 v;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r" (v));
+	return v;
+#else
+	return llkd_now_ns();
+#endif
+}
+#endif
+
+#define LLKD_HIST_SUBBITS	3
+#define LLKD_HIST_SUB		(1 << LLKD_HIST_SUBBITS)
+#define LLKD_HIST_MAXLOG	40	/* values >= 2^40 (in ns, ~18 min) all go
+					 * into the last bucket */
+#define LLKD_HIST_NBUCKETS	((LLKD_HIST_MAXLOG - LLKD_HIST_SUBBITS + 1) * LLKD_HIST_SUB)
+
+/* The bucket value @v goes into */
+static inline unsigned int llkd_hist_bucket(__u64 v)
+{
+	unsigned int msb;
+
+	if (v < LLKD_HIST_SUB)
+		return v;
+	msb = llkd_fls64(v) - 1;
+	if (msb >= LLKD_HIST_MAXLOG)
+		return LLKD_HIST_NBUCKETS - 1;
+	return (msb - LLKD_HIST_SUBBITS + 1) * LLKD_HIST_SUB +
+		((v >> (msb - LLKD_HIST_SUBBITS)) & (LLKD_HIST_SUB - 1));
+}
+
+/* The largest value that goes into bucket @i */
+static inline __u64 llkd_hist_bucket_max(unsigned int i)
+{
+	unsigned int shift;
+
+	if (i < LLKD_HIST_SUB)
+		return i;
+	shift = i / LLKD_HIST_SUB - 1;
+	return ((__u64)(LLKD_HIST_SUB + i % LLKD_HIST_SUB + 1) << shift) - 1;
+}
+
+struct llkd_hist_snap {
+	__u64 count, sum, max;
+	__u64 b[LLKD_HIST_NBUCKETS];
+};
+
+#ifdef __KERNEL__
+struct llkd_hist_cpu {
+	__u64 count, sum, max;
+	__u64 b[LLKD_HIST_NBUCKETS];
+};
+
+struct llkd_hist {
+	const char *name;
+	struct llkd_hist_cpu __percpu *pc;
+};
+
+static inline int llkd_hist_init(struct llkd_hist *h, const char *name)
+{
+	h->name = name;
+	h->pc = alloc_percpu(struct llkd_hist_cpu);
+	return h->pc ? 0 : -ENOMEM;
+}
+
+static inline void llkd_hist_destroy(struct llkd_hist *h)
+{
+	free_percpu(h->pc);
+	h->pc = NULL;
+}
+
+/*
+ * Any context; each this_cpu op is irq-safe, the set of them needn't be.
+ * The max update is a read-compare-write though: with irqs off, so that we
+ * can't be migrated (or interrupted) in between and clobber a larger max.
+ */
+static inline void llkd_hist_add(struct llkd_hist *h, __u64 v)
+{
+	unsigned long flags;
+
+	this_cpu_inc(h->pc->b[llkd_hist_bucket(v)]);
+	this_cpu_inc(h->pc->count);
+	this_cpu_add(h->pc->sum, v);
+	local_irq_save(flags);
+	if (v > __this_cpu_read(h->pc->max))
+		__this_cpu_write(h->pc->max, v);
+	local_irq_restore(flags);
+}
+
+/* A racy (wrt concurrent adds), but good enough, sum over all CPUs */
+static inline void llkd_hist_snapshot(struct llkd_hist *h,
+				      struct llkd_hist_snap *s)
+{
+	int cpu, i;
+
+	memset(s, 0, sizeof(*s));
+	for_each_possible_cpu(cpu) {
+		const struct llkd_hist_cpu *pc = per_cpu_ptr(h->pc, cpu);
+
+		s->count += READ_ONCE(pc->count);
+		s->sum += READ_ONCE(pc->sum);
+		s->max = max_t(__u64, s->max, READ_ONCE(pc->max));
+		for (i = 0; i < LLKD_HIST_NBUCKETS; i++)
+			s->b[i] += READ_ONCE(pc->b[i]);
+	}
+}
+
+static inline void llkd_hist_reset(struct llkd_hist *h)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(h->pc, cpu), 0, sizeof(struct llkd_hist_cpu));
+}
+#else
+struct llkd_hist {
+	const char *name;
+	__u64 count, sum, max;
+	__u64 b[LLKD_HIST_NBUCKETS];
+};
+
+static inline int llkd_hist_init(struct llkd_hist *h, const char *name)
+{
+	memset(h, 0, sizeof(*h));
+	h->name = name;
+	return 0;
+}
+
+static inline void llkd_hist_destroy(struct llkd_hist *h)
+{
+	(void)h;
+}
+
+/* Thread-safe (and lock-free) */
+static inline void llkd_hist_add(struct llkd_hist *h, __u64 v)
+{
+	__u64 max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&h->b[llkd_hist_bucket(v)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+	while (v > max && !__atomic_compare_exchange_n(&h->max, &max, v, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static inline void llkd_hist_snapshot(struct llkd_hist *h,
+				      struct llkd_hist_snap *s)
+{
+	int i;
+
+	s->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	s->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+	s->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	for (i = 0; i < LLKD_HIST_NBUCKETS; i++)
+		s->b[i] = __atomic_load_n(&h->b[i], __ATOMIC_RELAXED);
+}
+
+static inline void llkd_hist_reset(struct llkd_hist *h)
+{
+	llkd_hist_init(h, h->name);
+}
+#endif
+
+/*
+ * The value at percentile @pct (in parts per 10000: 5000 => the median,
+ * 9990 => p99.9); the top of it's bucket, but never above the max seen
+ */
+static inline __u64 llkd_hist_pct(const struct llkd_hist_snap *s,
+				  unsigned int pct)
+{
+	__u64 want, seen = 0;
+	unsigned int i;
+
+	if (!s->count)
+		return 0;
+	want = llkd_div_u64(s->count * pct + 9999, 10000);
+	for (i = 0; i < LLKD_HIST_NBUCKETS; i++) {
+		seen += s->b[i];
+		if (seen >= want && seen)
+			return llkd_hist_bucket_max(i) < s->max ?
+				llkd_hist_bucket_max(i) : s->max;
+	}
+	return s->max;
+}
+
+/* Render the snapshot @s to @out (a seq_file in the kernel, else a FILE) */
+static inline void llkd_hist_render(void *out, const char *name,
+				    const struct llkd_hist_snap *s)
+{
+	unsigned int i;
+
+	LLKD_HIST_OUT(out, "%s: count %llu mean %llu max %llu\n"
+		"p50 %llu p90 %llu p99 %llu p99.9 %llu\n",
+		name, (unsigned long long)s->count,
+		(unsigned long long)(s->count ? llkd_div_u64(s->sum, s->count) : 0),
+		(unsigned long long)s->max,
+		(unsigned long long)llkd_hist_pct(s, 5000),
+		(unsigned long long)llkd_hist_pct(s, 9000),
+		(unsigned long long)llkd_hist_pct(s, 9900),
+		(unsigned long long)llkd_hist_pct(s, 9990));
+	LLKD_HIST_OUT(out, "# <= value  count\n");
+	for (i = 0; i < LLKD_HIST_NBUCKETS; i++)
+		if (s->b[i])
+			LLKD_HIST_OUT(out, "%llu %llu\n",
+				(unsigned long long)llkd_hist_bucket_max(i),
+				(unsigned long long)s->b[i]);
+}
+
+#ifdef __KERNEL__
+static int llkd_hist_show(struct seq_file *m, void *v)
+{
+	struct llkd_hist *h = m->private;
+	struct llkd_hist_snap *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (!s)
+		return -ENOMEM;
+	llkd_hist_snapshot(h, s);
+	llkd_hist_render(m, h->name, s);
+	kfree(s);
+	return 0;
+}
+
+static int llkd_hist_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, llkd_hist_show, inode->i_private);
+}
+
+static ssize_t llkd_hist_write(struct file *filp, const char __user *ubuf,
+			       size_t count, loff_t *off)
+{
+	llkd_hist_reset(((struct seq_file *)filp->private_data)->private);
+	return count;
+}
+
+static const struct file_operations llkd_hist_fops __maybe_unused = {
+	.open = llkd_hist_open,
+	.read = seq_read,
+	.write = llkd_hist_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * llkd_hist_debugfs
+ * Create the debugfs file <parent>/<histogram name> to read the histogram
+ * @h from (and reset it by writing to it). Returns the dentry (an
+ * IS_ERR_OR_NULL() one on failure); it goes away with it's parent.
+ */
+static inline struct dentry *llkd_hist_debugfs(struct llkd_hist *h,
+					       struct dentry *parent)
+{
+	return debugfs_create_file(h->name, 0644, parent, h, &llkd_hist_fops);
+}
+#else
+static inline void llkd_hist_print(FILE *fp, struct llkd_hist *h)
+{
+	static struct llkd_hist_snap s;	/* ~2.4 KB; keep it off the stack */
+
+	llkd_hist_snapshot(h, &s);
+	llkd_hist_render(fp, h->name, &s);
+}
+#endif
+
+/* Scoped timers: the elapsed time is added to the histogram on scope exit */
+struct llkd_timer {
+	struct llkd_hist *h;
+	__u64 t0;
+};
+
+static inline void llkd_timer_stop_ns(struct llkd_timer *t)
+{
+	llkd_hist_add(t->h, llkd_now_ns() - t->t0);
+}
+
+static inline void llkd_timer_stop_cyc(struct llkd_timer *t)
+{
+	llkd_hist_add(t->h, llkd_cycles() - t->t0);
+}
+
+#define __LLKD_CAT2(a, b)	a##b
+#define __LLKD_CAT(a, b)	__LLKD_CAT2(a, b)
+#define LLKD_TIMED_SCOPE(hist)                                               \
+	struct llkd_timer __LLKD_CAT(__llkd_tmr, __LINE__)                   \
+	__attribute__((cleanup(llkd_timer_stop_ns))) = { (hist), llkd_now_ns() }
+#define LLKD_TIMED_SCOPE_CYC(hist)                                           \
+	struct llkd_timer __LLKD_CAT(__llkd_tmr, __LINE__)                   \
+	__attribute__((cleanup(llkd_timer_stop_cyc))) = { (hist), llkd_cycles() }
+#endif  /* LLKD_USE_TIMING */
+
 /*------------------------ assert ---------------------------------------
  * Hey, careful!
  * Using assertions is great *but* be aware of traps & pitfalls:
@@ -235,6 +699,9 @@ static inline void beep(int what)
  * to emulate 'work' :-)
  * @val        : ASCII value to print
  * @loop_count : times to loop around
+ * (How long this takes depends on the compiler, the CPU and HZ; for load
+ * that's specified in time - calibrated, with a duty cycle, on chosen CPUs -
+ * see the ch6/loadgen module).
  */
 #define DELAY_LOOP(val,loop_count)                                         \
 {                                                                          \
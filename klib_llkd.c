@@ -16,61 +16,154 @@
  * For details, please refer the book.
  */
 #include "klib_llkd.h"
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/vmalloc.h>
+#include <linux/gfp.h>
+#include <linux/huge_mm.h>
+#include <linux/cache.h>
+#include <linux/nodemask.h>
+#include <linux/cpumask.h>
+#include <linux/log2.h>
+#include <linux/overflow.h>
+#include <linux/spinlock.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
+#include <linux/stacktrace.h>
+#include <linux/poison.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/sched/clock.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/rcupdate.h>
+#include <linux/debugfs.h>
+#include <linux/rhashtable.h>
+#include <linux/pid.h>
+#include <linux/sched/signal.h>	/* task_tgid() */
+#ifdef CONFIG_X86
+#include <asm/processor.h>	/* boot_cpu_data */
+#endif
 
-/* llkd_minsysinfo:
- * Similar to our ch5/min_sysinfo code; it's just simpler (avoiding deps) to
- * package this code into this small 'library' of sorts rather than to use it
- * via the module stacking approach.
- *
- * A more security-aware version of the llkd_sysinfo routine. We used
- * David Wheeler's flawfinder(1) tool to detect possible vulnerabilities;
- * so, we change the strlen, and replace the strncat with strlcat.
+/*
+ * The platform descriptor: the parts known at build time are constants, in
+ * .rodata; the rest we fill in just once, on first use (this 'library' is
+ * linked into every module that uses it, so that's the earliest point we
+ * have), and everyone gets a const pointer to it.
  */
-void llkd_minsysinfo(void)
-{
-#define MSGLEN   128
-        char msg[MSGLEN];
-
-        memset(msg, 0, MSGLEN);
-        snprintf(msg, 48, "%s(): minimal platform info:\nCPU: ", __func__);
-
-        /* Strictly speaking, all this #if... is considered ugly and should be
-           isolated as far as is possible */
 #ifdef CONFIG_X86
 #if(BITS_PER_LONG == 32)
-        strlcat(msg, "x86_32, ", MSGLEN);
+#define LLKD_ARCH	"x86_32"
 #else
-        strlcat(msg, "x86_64, ", MSGLEN);
-#endif
-#endif
-#ifdef CONFIG_ARM
-        strlcat(msg, "ARM-32, ", MSGLEN);
-#endif
-#ifdef CONFIG_ARM64
-        strlcat(msg, "Aarch64, ", MSGLEN);
+#define LLKD_ARCH	"x86_64"
 #endif
-#ifdef CONFIG_MIPS
-        strlcat(msg, "MIPS, ", MSGLEN);
-#endif
-#ifdef CONFIG_PPC
-    strlcat(msg, "PowerPC, ", MSGLEN);
-#endif
-#ifdef CONFIG_S390
-    strlcat(msg, "IBM S390, ", MSGLEN);
+#elif defined(CONFIG_ARM)
+#define LLKD_ARCH	"ARM-32"
+#elif defined(CONFIG_ARM64)
+#define LLKD_ARCH	"Aarch64"
+#elif defined(CONFIG_MIPS)
+#define LLKD_ARCH	"MIPS"
+#elif defined(CONFIG_PPC)
+#define LLKD_ARCH	"PowerPC"
+#elif defined(CONFIG_S390)
+#define LLKD_ARCH	"IBM S390"
+#else
+#define LLKD_ARCH	"unknown"
 #endif
 
 #ifdef __BIG_ENDIAN
-    strlcat(msg, "big-endian; ", MSGLEN);
+#define LLKD_ENDIAN	"big-endian"
 #else
-    strlcat(msg, "little-endian; ", MSGLEN);
+#define LLKD_ENDIAN	"little-endian"
 #endif
 
-#if(BITS_PER_LONG == 32)
-    strlcat(msg, "32-bit OS.\n", MSGLEN);
-#elif(BITS_PER_LONG == 64)
-    strlcat(msg, "64-bit OS.\n", MSGLEN);
+static struct llkd_platform llkd_plat = {
+	.arch = LLKD_ARCH,
+	.endian = LLKD_ENDIAN,
+	.bits = BITS_PER_LONG,
+	.page_size = PAGE_SIZE,
+	.desc = LLKD_ARCH ", " LLKD_ENDIAN "; " __stringify(BITS_PER_LONG) "-bit OS",
+};
+
+static void llkd_platform_fill(struct llkd_platform *p)
+{
+	p->cache_line = cache_line_size();
+#ifdef CONFIG_X86
+	/* CPUID's (last level) cache size, in KB; -1 if it's not reported */
+	if (boot_cpu_data.x86_cache_size > 0)
+		p->cache_kb = boot_cpu_data.x86_cache_size;
 #endif
-    pr_info("%s", msg);
+	p->nr_nodes = num_online_nodes();
+	p->nr_cpus_possible = num_possible_cpus();
+	p->nr_cpus_online = num_online_cpus();
+}
+
+/*
+ * llkd_platform - the (cached) platform descriptor.
+ * Cheap after the first call; it doesn't sleep. Note that the node and CPU
+ * counts are as of that first call.
+ */
+const struct llkd_platform *llkd_platform(void)
+{
+	/*
+	 * Not DO_ONCE(): before 5.16, it defers a static key update to a work
+	 * item that can run after the (calling) module - and the key - are
+	 * gone. A plain flag has no such tail; release / acquire on it orders
+	 * the fill against the fast path.
+	 */
+	static bool filled;
+	static DEFINE_SPINLOCK(fill_lock);
+	unsigned long flags;
+
+	if (likely(smp_load_acquire(&filled)))
+		return &llkd_plat;
+	spin_lock_irqsave(&fill_lock, flags);
+	if (!filled) {
+		llkd_platform_fill(&llkd_plat);
+		smp_store_release(&filled, true);
+	}
+	spin_unlock_irqrestore(&fill_lock, flags);
+	return &llkd_plat;
+}
+
+/*
+ * llkd_show_platform - export the platform descriptor as 'key=value' lines,
+ * for tools; to seq_file @m, or into the kernel log if @m is NULL.
+ */
+void llkd_show_platform(struct seq_file *m)
+{
+	const struct llkd_platform *p = llkd_platform();
+
+	if (!m) {
+		pr_info("platform: arch=%s endian=%s bits=%u page_size=%u cache_line=%u"
+			" cache_kb=%u nr_nodes=%u nr_cpus_possible=%u nr_cpus_online=%u\n",
+			p->arch, p->endian, p->bits, p->page_size, p->cache_line,
+			p->cache_kb, p->nr_nodes, p->nr_cpus_possible,
+			p->nr_cpus_online);
+		return;
+	}
+	seq_printf(m, "arch=%s\nendian=%s\nbits=%u\npage_size=%u\ncache_line=%u\n"
+		   "cache_kb=%u\nnr_nodes=%u\nnr_cpus_possible=%u\nnr_cpus_online=%u\n",
+		   p->arch, p->endian, p->bits, p->page_size, p->cache_line,
+		   p->cache_kb, p->nr_nodes, p->nr_cpus_possible,
+		   p->nr_cpus_online);
+}
+
+/* llkd_minsysinfo:
+ * Similar to our ch5/min_sysinfo code; it's just simpler (avoiding deps) to
+ * package this code into this small 'library' of sorts rather than to use it
+ * via the module stacking approach.
+ * The string's built just once, at compile time, into the cached platform
+ * descriptor (see llkd_platform()); no more strlcat'ing on every call.
+ */
+void llkd_minsysinfo(void)
+{
+	pr_info("%s(): minimal platform info:\nCPU: %s.\n",
+		__func__, llkd_platform()->desc);
 }
 
 /* 
@@ -89,6 +182,8 @@ void llkd_minsysinfo(void)
  * 'Walk' the virtually contiguous 'array' of pages one by one (i.e. page by
  * page), printing the virt and physical address (& PFN- page frame number).
  * This way, we can see if the memory really is *physically* contiguous or not.
+ * (For anything but small ranges, prefer llkd_show_phy_runs() below: a line
+ * per run of contiguous pages rather than per page.)
  */
 void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check)
 {
@@ -141,27 +236,386 @@ void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check)
 	}
 }
 
+/*
+ * Physical contiguity analysis.
+ * Rather than a line per page (as show_phy_pages() does), we summarize a
+ * memory range as the runs of physically contiguous pages it's made of; a
+ * physically contiguous range (f.e. from alloc_pages_exact()) is a single
+ * run, a vmalloc'ed one typically as many as it has pages. It's one cheap
+ * pass over the range, with no per-page output.
+ */
+typedef void (*llkd_run_fn)(const struct llkd_pfn_run *run, void *arg);
+
+/*
+ * Walk [@kaddr, @kaddr+@len) a page at a time, invoking @fn on every run;
+ * returns the # of runs, or -EINVAL if @kaddr is neither a lowmem (direct
+ * mapped) nor a vmalloc address
+ */
+static int llkd_phy_walk(const void *kaddr, size_t len, llkd_run_fn fn,
+		void *arg)
+{
+	unsigned long va = (unsigned long)kaddr & PAGE_MASK;
+	unsigned long end = (unsigned long)kaddr + len, pfn;
+	bool vmalloced = is_vmalloc_addr(kaddr);
+	struct llkd_pfn_run run = { .npages = 0 };
+	struct page *pg;
+	int nruns = 0;
+
+	if (!len)
+		return 0;
+	if (!vmalloced && (!virt_addr_valid(kaddr) ||
+			   !virt_addr_valid((void *)(end - 1))))
+		return -EINVAL;
+
+	for (; va < end; va += PAGE_SIZE) {
+		pfn = vmalloced ? vmalloc_to_pfn((void *)va) :
+				   PHYS_PFN(virt_to_phys((void *)va));
+		pg = pfn_to_page(pfn);
+		if (run.npages && pfn == run.pfn + run.npages &&
+		    page_to_nid(pg) == run.nid &&
+		    page_zone(pg)->name == run.zone) {
+			run.npages++;
+			continue;
+		}
+		if (run.npages) {
+			fn(&run, arg);
+			nruns++;
+		}
+		run.pfn = pfn;
+		run.npages = 1;
+		run.nid = page_to_nid(pg);
+		run.zone = page_zone(pg)->name;
+	}
+	fn(&run, arg);
+	return nruns + 1;
+}
+
+struct llkd_runs_buf {
+	struct llkd_pfn_run *runs;
+	int max, n;
+};
+
+static void llkd_runs_store(const struct llkd_pfn_run *run, void *arg)
+{
+	struct llkd_runs_buf *b = arg;
+
+	if (b->n < b->max)
+		b->runs[b->n] = *run;
+	b->n++;
+}
+
+/*
+ * llkd_phy_runs - the physically contiguous runs of pages making up a range
+ * @kaddr: the starting kernel virtual address; a lowmem (direct-mapped) or
+ *         a vmalloc address
+ * @len: length of the range (bytes)
+ * @runs: the caller's buffer, to fill in
+ * @maxruns: # of entries in @runs
+ * Returns the total # of runs - which, like snprintf(), may exceed @maxruns,
+ * only the first @maxruns being stored - or -EINVAL for a bad address.
+ */
+int llkd_phy_runs(const void *kaddr, size_t len, struct llkd_pfn_run *runs,
+		int maxruns)
+{
+	struct llkd_runs_buf b = { .runs = runs, .max = maxruns };
+
+	return llkd_phy_walk(kaddr, len, llkd_runs_store, &b);
+}
+
+struct llkd_runs_show {
+	struct seq_file *m;
+	unsigned long largest;
+};
+
+static void llkd_runs_print(const struct llkd_pfn_run *run, void *arg)
+{
+	struct llkd_runs_show *sh = arg;
+
+	sh->largest = max(sh->largest, run->npages);
+	if (sh->m)
+		seq_printf(sh->m, "pfn %lu npages %lu node %d zone %s\n",
+			   run->pfn, run->npages, run->nid, run->zone);
+	else
+		pr_info(" pfn %lu npages %lu node %d zone %s\n",
+			run->pfn, run->npages, run->nid, run->zone);
+}
+
+/*
+ * llkd_show_phy_runs - show the physically contiguous runs of pages making
+ * up a range (see llkd_phy_runs()), a line per run, plus a summary line
+ * @m: the seq_file to show them in; NULL => the kernel log
+ * Returns the # of runs, or -EINVAL for a bad address.
+ */
+int llkd_show_phy_runs(struct seq_file *m, const void *kaddr, size_t len)
+{
+	struct llkd_runs_show sh = { .m = m };
+	int nruns = llkd_phy_walk(kaddr, len, llkd_runs_print, &sh);
+
+	if (nruns < 0) {
+		if (!m)
+			pr_info("%s(): invalid virtual address (%px)\n",
+				__func__, kaddr);
+		return nruns;
+	}
+	if (m)
+		seq_printf(m, "summary len %zu runs %d largest_run_pages %lu\n",
+			   len, nruns, sh.largest);
+	else
+		pr_info("%s(): %zu bytes: %d physically contiguous run(s), the"
+			" largest %lu page(s)\n", __func__, len, nruns, sh.largest);
+	return nruns;
+}
+
+/*
+ * llkd_buf: a large buffer provider with a fallback chain.
+ * A single high-order allocation is the best case: physically contiguous
+ * (one scatterlist entry) and, if it's PMD-sized or larger, mapped by huge
+ * pages in the kernel direct map (TLB-friendly). Under fragmentation though,
+ * it may well fail; rather than failing the caller, we then fall back to
+ * progressively smaller orders, stitching the pieces into a scatterlist and
+ * - via vmap() - a virtually contiguous region. The tier we got is reported.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define LLKD_BUF_HUGE_ORDER	HPAGE_PMD_ORDER
+#else
+#define LLKD_BUF_HUGE_ORDER	MAX_ORDER	/* never */
+#endif
+
+const char *llkd_buf_tier_name(enum llkd_buf_tier tier)
+{
+	static const char * const names[] = { "huge", "contig", "vmap" };
+
+	return tier <= LLKD_BUF_VMAP ? names[tier] : "?";
+}
+
+static void llkd_buf_free_chunks(struct llkd_buf *buf)
+{
+	unsigned int i;
+
+	for (i = 0; i < buf->nchunks; i++)
+		__free_pages(buf->chunks[i].page, buf->chunks[i].order);
+	kvfree(buf->chunks);
+	buf->chunks = NULL;
+	buf->nchunks = 0;
+}
+
+/* Fill the chunks[] array, from order @order down; returns 0 or -ENOMEM */
+static int llkd_buf_get_chunks(struct llkd_buf *buf, unsigned int order,
+		gfp_t gfp)
+{
+	size_t left = PAGE_ALIGN(buf->len);
+	struct page *pg;
+	unsigned int o;
+
+	buf->min_order = order;
+	buf->max_order = 0;
+	while (left) {
+		o = min_t(unsigned int, order, get_order(left));
+		/* the smaller orders are cheap; only order 0 may try hard */
+		pg = alloc_pages(gfp | __GFP_NOWARN |
+				 (o ? __GFP_NORETRY : 0), o);
+		if (!pg) {
+			if (!order)
+				return -ENOMEM;
+			order--;	/* fall back to the next smaller order */
+			continue;
+		}
+		buf->chunks[buf->nchunks].page = pg;
+		buf->chunks[buf->nchunks++].order = o;
+		buf->min_order = min(buf->min_order, o);
+		buf->max_order = max(buf->max_order, o);
+		left -= min_t(size_t, left, PAGE_SIZE << o);
+	}
+	return 0;
+}
+
+/* vmap() the chunks into one virtually contiguous region */
+static void *llkd_buf_vmap(struct llkd_buf *buf)
+{
+	unsigned int npages = PAGE_ALIGN(buf->len) >> PAGE_SHIFT, n = 0, i, j;
+	struct page **pages;
+	void *vaddr;
+
+	pages = kvmalloc_array(npages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return NULL;
+	for (i = 0; i < buf->nchunks; i++)
+		for (j = 0; j < (1U << buf->chunks[i].order) && n < npages; j++)
+			pages[n++] = buf->chunks[i].page + j;
+	vaddr = vmap(pages, npages, VM_MAP, PAGE_KERNEL);
+	kvfree(pages);	/* vmap() doesn't need it once done */
+	return vaddr;
+}
+
+/*
+ * llkd_buf_alloc - allocate a buffer of @len bytes, as contiguous as possible
+ * @buf: the buffer descriptor, to fill in
+ * @len: length (bytes); rounded up to whole pages
+ * @gfp: GFP flags (f.e. GFP_KERNEL); there's no point in atomic ones here
+ * The fallback chain: a single allocation of order get_order(@len) (if
+ * that's <= MAX_ORDER-1) - tier huge or contig - then, chunks of ever
+ * smaller orders, down to 0, vmap()'ed - tier vmap. buf->sgt always
+ * describes the pages, an entry per chunk.
+ * Returns 0, or -ENOMEM if even order 0 pages can't be had.
+ */
+int llkd_buf_alloc(struct llkd_buf *buf, size_t len, gfp_t gfp)
+{
+	unsigned int order = get_order(len), i;
+	struct scatterlist *sg;
+	int ret = -ENOMEM;
+
+	memset(buf, 0, sizeof(*buf));
+	if (!len)
+		return -EINVAL;
+	buf->len = len;
+	buf->chunks = kvmalloc_array(PAGE_ALIGN(len) >> PAGE_SHIFT,
+				     sizeof(*buf->chunks), GFP_KERNEL);
+	if (!buf->chunks)
+		return -ENOMEM;
+
+	/* tiers huge & contig: one block */
+	if (order < MAX_ORDER) {
+		struct page *pg = alloc_pages(gfp | __GFP_COMP | __GFP_NOWARN |
+					      __GFP_NORETRY, order);
+		if (pg) {
+			buf->chunks[0].page = pg;
+			buf->chunks[0].order = order;
+			buf->nchunks = 1;
+			buf->min_order = buf->max_order = order;
+			buf->vaddr = page_address(pg);
+			buf->tier = order >= LLKD_BUF_HUGE_ORDER ?
+					LLKD_BUF_HUGE : LLKD_BUF_CONTIG;
+			goto out_sg;
+		}
+		if (!order)
+			goto out_free;
+		order--;
+	} else {
+		order = MAX_ORDER - 1;
+	}
+
+	/* tier vmap: smaller blocks, stitched together */
+	ret = llkd_buf_get_chunks(buf, order, gfp);
+	if (ret)
+		goto out_free;
+	ret = -ENOMEM;
+	buf->vaddr = llkd_buf_vmap(buf);
+	if (!buf->vaddr)
+		goto out_free;
+	buf->tier = LLKD_BUF_VMAP;
+
+ out_sg:
+	ret = sg_alloc_table(&buf->sgt, buf->nchunks, GFP_KERNEL);
+	if (ret)
+		goto out_unmap;
+	for_each_sg(buf->sgt.sgl, sg, buf->nchunks, i)
+		sg_set_page(sg, buf->chunks[i].page,
+			    PAGE_SIZE << buf->chunks[i].order, 0);
+	return 0;
+
+ out_unmap:
+	if (buf->tier == LLKD_BUF_VMAP)
+		vunmap(buf->vaddr);
+ out_free:
+	llkd_buf_free_chunks(buf);
+	buf->vaddr = NULL;
+	return ret;
+}
+
+/* Free a buffer allocated by llkd_buf_alloc() */
+void llkd_buf_free(struct llkd_buf *buf)
+{
+	if (!buf->vaddr)
+		return;
+	sg_free_table(&buf->sgt);
+	if (buf->tier == LLKD_BUF_VMAP)
+		vunmap(buf->vaddr);
+	llkd_buf_free_chunks(buf);
+	buf->vaddr = NULL;
+}
+
+/*------------------ integer math -------------------------------------------*/
+/*
+ * llkd_pow_u64 - @base to-the-power-of @exp, by repeated squaring: O(log exp)
+ * multiplies rather than O(exp). Powers of 2 are just a shift.
+ * Returns 0 and the result in *@res, or -EOVERFLOW if it doesn't fit in a u64.
+ */
+int llkd_pow_u64(u64 base, unsigned int exp, u64 *res)
+{
+	u64 r = 1;
+
+	if (base && is_power_of_2(base)) {
+		unsigned int shift = ilog2(base);
+
+		/* (1 << shift)^exp = 1 << (shift * exp) */
+		if (exp && shift > 63 / exp)
+			return -EOVERFLOW;
+		*res = 1ULL << (shift * exp);
+		return 0;
+	}
+	while (exp) {
+		if (exp & 1) {
+			if (check_mul_overflow(r, base, &r))
+				return -EOVERFLOW;
+		}
+		exp >>= 1;
+		/* squaring base after the last bit's been used would overflow
+		 * spuriously */
+		if (exp && check_mul_overflow(base, base, &base))
+			return -EOVERFLOW;
+	}
+	*res = r;
+	return 0;
+}
+
 /*
  * powerof - a simple 'library' function to calculate and return
  *  @base to-the-power-of @exponent
  * f.e. powerof(2, 5) returns 2^5 = 32.
- * Returns -1UL on failure.
+ * Returns U64_MAX on failure, including when the result would overflow a u64.
+ * (For 2^order, prefer the llkd_order_pages() / llkd_pow2() shifts.)
  */
 u64 powerof(int base, int exponent)
 {
-	u64 res = 1;
+	u64 res;
 
 	if (base == 0)		// 0^e = 0
 		return 0;
-	if (base <= 0 || exponent < 0)
-		return -1UL;
-	if (exponent == 0)	// b^0 = 1
-		return 1;
-	while (exponent--)
-		res *= base;
+	if (base < 0 || exponent < 0)
+		return U64_MAX;
+	if (llkd_pow_u64(base, exponent, &res))
+		return U64_MAX;
 	return res;
 }
 
+/*
+ * llkd_div_frac - @num / @den as an integer part (returned) and @dec (<= 9)
+ * decimal digits of fraction, in *@frac; f.e. 7/4, @dec 2 => 1 and 75.
+ * The fraction's truncated, not rounded. Uses the div64 helpers, so it's safe
+ * on 32-bit (where a plain u64 '/' or '%' doesn't link in the kernel).
+ * @den 0 gives 0.0.
+ */
+u64 llkd_div_frac(u64 num, u64 den, unsigned int dec, u32 *frac)
+{
+	u64 q, r, scale = 1;
+
+	*frac = 0;
+	if (!den)
+		return 0;
+	if (dec > 9)
+		dec = 9;
+	while (dec--)
+		scale *= 10;
+	q = div64_u64_rem(num, den, &r);
+	/* r < den; keep r * scale from overflowing by dropping low bits of both */
+	while (r > div64_u64(U64_MAX, scale)) {
+		r >>= 1;
+		den >>= 1;
+	}
+	*frac = div64_u64(r * scale, den);
+	return q;
+}
+
 /*
  * show_sizeof()
  * Simply displays the sizeof data types on the platform.
@@ -187,3 +641,1162 @@ void show_sizeof(void)
 			sizeof(long), sizeof(long long), sizeof(void *),
 			sizeof(float), sizeof(double), sizeof(long double));
 }
+
+/*------------------------ llkd_pool --------------------------------------
+ * A (high-performance) object pool on top of a custom slab cache.
+ * Each CPU has a 'magazine': a small stack of ready-to-use (constructed)
+ * objects. An alloc pops one off this CPU's magazine and a free pushes it
+ * back - a handful of instructions with interrupts briefly off, no atomics,
+ * no shared cache lines. Only when the magazine's empty (a 'miss') or full (a
+ * 'flush') do we go to the slab layer, and then in bulk, via
+ * kmem_cache_{alloc|free}_bulk(), LLKD_POOL_BATCH objects at a time.
+ *
+ * As with any slab cache, the ctor runs only when the slab layer constructs
+ * an object, not on every alloc; objects must thus be freed back in their
+ * constructed state.
+ * In debug mode, the cache is created with SLAB_POISON | SLAB_RED_ZONE and
+ * the magazines are bypassed (so that the slab debug checks see every alloc
+ * and free); use it while developing, not in production.
+ */
+#define LLKD_POOL_BATCH		16	/* objects per bulk slab call */
+#define LLKD_POOL_MAGMAX	256	/* max magazine size */
+
+struct llkd_pool_mag {
+	unsigned int count;
+	u64 hits, misses, frees, flushes;
+	void *objs[];		/* [magsz] */
+};
+
+struct llkd_pool {
+	struct kmem_cache *cachep;
+	unsigned int magsz;	/* 0 => no magazines (debug mode) */
+	struct llkd_pool_mag __percpu *mag;
+};
+
+/*
+ * llkd_pool_create - create an object pool
+ * @name: name of the underlying slab cache (shows up in /proc/slabinfo)
+ * @objsz: object size (bytes)
+ * @align: object alignment (0 => the default); the objects are cacheline
+ *         aligned in any case (SLAB_HWCACHE_ALIGN)
+ * @magsz: # of objects per per-CPU magazine (max LLKD_POOL_MAGMAX), at least
+ *         2 * LLKD_POOL_BATCH; 0 => LLKD_POOL_MAGMAX / 4
+ * @debug: create a debug (poisoned, red-zoned, magazine-less) pool
+ * @ctor: constructor, as for kmem_cache_create() (keep it cheap); can be NULL
+ * Returns the pool, or NULL on failure.
+ */
+struct llkd_pool *llkd_pool_create(const char *name, unsigned int objsz,
+		unsigned int align, unsigned int magsz, bool debug,
+		void (*ctor)(void *))
+{
+	slab_flags_t flags = SLAB_HWCACHE_ALIGN;
+	struct llkd_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	if (debug) {
+		flags |= SLAB_POISON | SLAB_RED_ZONE;
+		magsz = 0;
+	} else {
+		if (!magsz)
+			magsz = LLKD_POOL_MAGMAX / 4;
+		magsz = clamp_t(unsigned int, magsz, 2 * LLKD_POOL_BATCH,
+				LLKD_POOL_MAGMAX);
+	}
+	pool->magsz = magsz;
+
+	pool->cachep = kmem_cache_create(name, objsz, align, flags, ctor);
+	if (!pool->cachep)
+		goto out_free;
+	pool->mag = __alloc_percpu(struct_size((struct llkd_pool_mag *)NULL,
+				   objs, magsz), __alignof__(u64));
+	if (!pool->mag)
+		goto out_cache;
+	return pool;
+
+ out_cache:
+	kmem_cache_destroy(pool->cachep);
+ out_free:
+	kfree(pool);
+	return NULL;
+}
+
+/* Destroy the pool; every object allocated from it must've been freed */
+void llkd_pool_destroy(struct llkd_pool *pool)
+{
+	int cpu;
+
+	if (!pool)
+		return;
+	for_each_possible_cpu(cpu) {
+		struct llkd_pool_mag *mag = per_cpu_ptr(pool->mag, cpu);
+
+		if (mag->count)
+			kmem_cache_free_bulk(pool->cachep, mag->count, mag->objs);
+		mag->count = 0;
+	}
+	free_percpu(pool->mag);
+	kmem_cache_destroy(pool->cachep);
+	kfree(pool);
+}
+
+/*
+ * Stash up to @n of the objects in @objs into this CPU's magazine; returns
+ * the # stashed (taken from the end of @objs)
+ */
+static size_t llkd_pool_stash(struct llkd_pool *pool, size_t n, void **objs)
+{
+	struct llkd_pool_mag *mag;
+	unsigned long flags;
+	size_t i = 0;
+
+	local_irq_save(flags);
+	mag = this_cpu_ptr(pool->mag);
+	while (i < n && mag->count < pool->magsz)
+		mag->objs[mag->count++] = objs[n - ++i];
+	local_irq_restore(flags);
+	return i;
+}
+
+/*
+ * Get @n objects from the slab layer, all or nothing (returns @n or 0). In
+ * bulk where we can; SLUB's kmem_cache_alloc_bulk() must be called with irqs
+ * enabled though, so with them off, it's one kmem_cache_alloc() at a time.
+ */
+static int llkd_pool_slab_alloc(struct llkd_pool *pool, gfp_t gfp, size_t n,
+		void **objs)
+{
+	size_t i;
+
+	if (!irqs_disabled())
+		return kmem_cache_alloc_bulk(pool->cachep, gfp, n, objs);
+	for (i = 0; i < n; i++) {
+		objs[i] = kmem_cache_alloc(pool->cachep, gfp);
+		if (!objs[i]) {
+			kmem_cache_free_bulk(pool->cachep, i, objs);
+			return 0;
+		}
+	}
+	return n;
+}
+
+/*
+ * llkd_pool_alloc - allocate an object from the pool
+ * May sleep, depending on @gfp (as with kmem_cache_alloc()); safe to call
+ * from any context with a suitable @gfp - with irqs off too, though a miss
+ * then doesn't refill the magazine.
+ */
+void *llkd_pool_alloc(struct llkd_pool *pool, gfp_t gfp)
+{
+	void *batch[LLKD_POOL_BATCH], *obj = NULL;
+	struct llkd_pool_mag *mag;
+	unsigned long flags;
+	int n;
+
+	local_irq_save(flags);
+	mag = this_cpu_ptr(pool->mag);
+	if (likely(mag->count)) {
+		obj = mag->objs[--mag->count];
+		mag->hits++;
+	} else {
+		mag->misses++;
+	}
+	local_irq_restore(flags);
+	if (likely(obj))
+		return obj;
+
+	/* debug mode; or irqs off, so no kmem_cache_alloc_bulk() */
+	if (!pool->magsz || irqs_disabled())
+		return kmem_cache_alloc(pool->cachep, gfp);
+
+	/* A miss: refill (part of) the magazine in one go; we may have been
+	 * migrated meanwhile, no matter, any CPU's magazine will do */
+	n = kmem_cache_alloc_bulk(pool->cachep, gfp, LLKD_POOL_BATCH, batch);
+	if (!n)
+		return NULL;
+	obj = batch[0];
+	n--;
+	n -= llkd_pool_stash(pool, n, batch + 1);
+	if (n)			/* no room (other allocs refilled it) */
+		kmem_cache_free_bulk(pool->cachep, n, batch + 1);
+	return obj;
+}
+
+/* llkd_pool_free - free @obj (that's from @pool) back to the pool */
+void llkd_pool_free(struct llkd_pool *pool, void *obj)
+{
+	void *batch[LLKD_POOL_BATCH];
+	struct llkd_pool_mag *mag;
+	unsigned long flags;
+	unsigned int n = 0;
+
+	if (!pool->magsz) {	/* debug mode */
+		this_cpu_inc(pool->mag->flushes);
+		kmem_cache_free(pool->cachep, obj);
+		return;
+	}
+
+	local_irq_save(flags);
+	mag = this_cpu_ptr(pool->mag);
+	if (unlikely(mag->count == pool->magsz)) {
+		/* Full: flush the oldest (coldest) objects, in bulk */
+		n = LLKD_POOL_BATCH;
+		memcpy(batch, mag->objs, n * sizeof(void *));
+		memmove(mag->objs, mag->objs + n,
+			(mag->count - n) * sizeof(void *));
+		mag->count -= n;
+		mag->flushes++;
+	} else {
+		mag->frees++;
+	}
+	mag->objs[mag->count++] = obj;
+	local_irq_restore(flags);
+
+	if (n)
+		kmem_cache_free_bulk(pool->cachep, n, batch);
+}
+
+/*
+ * llkd_pool_alloc_bulk - allocate @n objects into @objs
+ * From this CPU's magazine as far as possible, the rest in bulk from the
+ * slab layer (one by one, with irqs off). All or nothing: returns @n on
+ * success, 0 on failure.
+ */
+int llkd_pool_alloc_bulk(struct llkd_pool *pool, gfp_t gfp, size_t n,
+		void **objs)
+{
+	struct llkd_pool_mag *mag;
+	unsigned long flags;
+	size_t got = 0;
+
+	local_irq_save(flags);
+	mag = this_cpu_ptr(pool->mag);
+	while (got < n && mag->count)
+		objs[got++] = mag->objs[--mag->count];
+	mag->hits += got;
+	if (got < n)
+		mag->misses += n - got;
+	local_irq_restore(flags);
+	if (got == n)
+		return n;
+
+	if (!llkd_pool_slab_alloc(pool, gfp, n - got, objs + got)) {
+		if (got)
+			llkd_pool_free_bulk(pool, got, objs);
+		return 0;
+	}
+	return n;
+}
+
+/*
+ * llkd_pool_free_bulk - free the @n objects in @objs
+ * Into this CPU's magazine as far as there's room, the rest in bulk to the
+ * slab layer.
+ */
+void llkd_pool_free_bulk(struct llkd_pool *pool, size_t n, void **objs)
+{
+	size_t stashed = 0;
+
+	if (pool->magsz)
+		stashed = llkd_pool_stash(pool, n, objs);
+	this_cpu_add(pool->mag->frees, stashed);
+	if (stashed < n) {
+		this_cpu_add(pool->mag->flushes, n - stashed);
+		kmem_cache_free_bulk(pool->cachep, n - stashed, objs);
+	}
+}
+
+/* Sum up the per-CPU counters (a racy, but good enough, snapshot) */
+void llkd_pool_get_stats(struct llkd_pool *pool, struct llkd_pool_stats *st)
+{
+	int cpu;
+
+	memset(st, 0, sizeof(*st));
+	for_each_possible_cpu(cpu) {
+		struct llkd_pool_mag *mag = per_cpu_ptr(pool->mag, cpu);
+
+		st->hits += READ_ONCE(mag->hits);
+		st->misses += READ_ONCE(mag->misses);
+		st->frees += READ_ONCE(mag->frees);
+		st->flushes += READ_ONCE(mag->flushes);
+	}
+}
+
+/* A seq_file show helper: the pool's counters, one 'key value' per line */
+void llkd_pool_show_stats(struct seq_file *m, struct llkd_pool *pool)
+{
+	struct llkd_pool_stats st;
+	u64 allocs;
+
+	llkd_pool_get_stats(pool, &st);
+	allocs = st.hits + st.misses;
+	seq_printf(m, "magazine_size %u\n"
+		   "alloc_hits %llu\nalloc_misses %llu\n"
+		   "free_hits %llu\nfree_flushes %llu\n"
+		   "hit_rate_pct %llu\n",
+		   pool->magsz, st.hits, st.misses, st.frees, st.flushes,
+		   allocs ? div64_u64(st.hits * 100, allocs) : 0);
+}
+
+/*------------------------ llkd_gmem --------------------------------------
+ * A sampling, guard-page based, memory error detector (a la KFENCE), for
+ * always-on use: llkd_kmalloc() / llkd_kfree() are kmalloc() / kfree(),
+ * except that one in every 'rate' allocations (per-CPU countdown; a single
+ * this_cpu op on the fast path) is instead placed on it's own vmalloc()'ed
+ * page(s), right-aligned, so that it ends right where the vmalloc guard page
+ * starts:
+ * - an overflow off the end of the object faults immediately, on the guard
+ *   page - the resulting Oops has the stack trace of the offending access;
+ * - the slack before (and, from alignment, after) the object is filled with
+ *   a canary, checked on free: an underflow, or a small overflow, is
+ *   reported along with the stack traces of the allocation and the free;
+ * - on free, the object is poisoned and it's pages released only later
+ *   (off a work item); a write to it in between - a use-after-free - is
+ *   reported then. Accesses after that fault (the pages are unmapped);
+ * - a freed object's metadata is kept until it's slot is reused, so that a
+ *   double (or invalid) free is reported with all the relevant stacks.
+ * Only blocking (f.e. GFP_KERNEL) allocations are sampled, and at most
+ * LLKD_GMEM_NSLOTS can be live at a time; the rest are plain kmalloc()'s.
+ * As this 'library' is linked into each module that uses it, so is this
+ * state; a module must call llkd_gmem_exit() on it's way out.
+ */
+#define LLKD_GMEM_NSLOTS	64
+#define LLKD_GMEM_STACK		16	/* stack trace depth */
+#define LLKD_GMEM_CANARY	0xaa
+
+enum llkd_gmem_state {
+	GMEM_UNUSED,
+	GMEM_LIVE,
+	GMEM_FREEING,	/* freed, poisoned; not yet vfree()'d */
+	GMEM_FREED,	/* vfree()'d; kept for double-free detection */
+};
+
+struct llkd_gmem_slot {
+	enum llkd_gmem_state state;
+	void *area;		/* the vmalloc()'ed area */
+	size_t areasz;
+	void *obj;		/* the object, right-aligned within the area */
+	size_t size;
+	pid_t alloc_pid, free_pid;
+	u64 free_ns;		/* the oldest FREED slot is reused first */
+	struct llist_node fnode;
+#ifdef CONFIG_STACKTRACE
+	unsigned int nr_alloc, nr_free;
+	unsigned long alloc_stack[LLKD_GMEM_STACK];
+	unsigned long free_stack[LLKD_GMEM_STACK];
+#endif
+};
+
+static struct llkd_gmem_slot gmem_slots[LLKD_GMEM_NSLOTS];
+static DEFINE_SPINLOCK(gmem_lock);
+static unsigned int gmem_rate;
+static DEFINE_PER_CPU(int, gmem_countdown);
+static atomic64_t gmem_nsampled, gmem_nerrors;
+static LLIST_HEAD(gmem_freeq);
+
+static void gmem_free_work(struct work_struct *work);
+static DECLARE_WORK(gmem_work, gmem_free_work);
+
+/* Sample one in every @rate llkd_kmalloc()'s; 0 => off (the default) */
+void llkd_gmem_set_rate(unsigned int rate)
+{
+	WRITE_ONCE(gmem_rate, rate);
+}
+
+static void gmem_report(const char *what, const struct llkd_gmem_slot *s,
+			const void *addr)
+{
+	atomic64_inc(&gmem_nerrors);
+	pr_err("llkd_gmem: BUG: %s at %px (object %px, %zu bytes; offset %td)\n",
+	       what, addr, s->obj, s->size, (const u8 *)addr - (u8 *)s->obj);
+	dump_stack();
+#ifdef CONFIG_STACKTRACE
+	pr_err("llkd_gmem: allocated by pid %d:\n", s->alloc_pid);
+	stack_trace_print(s->alloc_stack, s->nr_alloc, 4);
+	if (s->state != GMEM_LIVE) {
+		pr_err("llkd_gmem: freed by pid %d:\n", s->free_pid);
+		stack_trace_print(s->free_stack, s->nr_free, 4);
+	}
+#endif
+}
+
+/* Returns the 1st byte in [@p, @p + @len) that isn't @c, or NULL */
+static const u8 *gmem_check(const void *p, size_t len, u8 c)
+{
+	const u8 *q = p;
+
+	for (; len; len--, q++)
+		if (*q != c)
+			return q;
+	return NULL;
+}
+
+/* A free slot: an unused one, else the longest-freed one; NULL if none */
+static struct llkd_gmem_slot *gmem_get_slot(void)
+{
+	struct llkd_gmem_slot *s, *best = NULL;
+
+	for (s = gmem_slots; s < gmem_slots + LLKD_GMEM_NSLOTS; s++) {
+		if (s->state == GMEM_UNUSED)
+			return s;
+		if (s->state == GMEM_FREED && (!best || s->free_ns < best->free_ns))
+			best = s;
+	}
+	return best;
+}
+
+static void *gmem_alloc(size_t size, gfp_t gfp)
+{
+	size_t areasz = PAGE_ALIGN(size);
+	struct llkd_gmem_slot *s;
+	unsigned long flags;
+	void *area;
+
+	area = vmalloc(areasz);
+	if (!area)
+		return NULL;
+	spin_lock_irqsave(&gmem_lock, flags);
+	s = gmem_get_slot();
+	if (!s) {
+		spin_unlock_irqrestore(&gmem_lock, flags);
+		vfree(area);
+		return NULL;
+	}
+	memset(s, 0, sizeof(*s));
+	s->state = GMEM_LIVE;
+	s->area = area;
+	s->areasz = areasz;
+	s->size = size;
+	s->obj = area + areasz - ALIGN(size, ARCH_KMALLOC_MINALIGN);
+	s->alloc_pid = task_pid_nr(current);
+#ifdef CONFIG_STACKTRACE
+	s->nr_alloc = stack_trace_save(s->alloc_stack, LLKD_GMEM_STACK, 2);
+#endif
+	spin_unlock_irqrestore(&gmem_lock, flags);
+
+	memset(area, LLKD_GMEM_CANARY, areasz);
+	if (gfp & __GFP_ZERO)
+		memset(s->obj, 0, size);
+	atomic64_inc(&gmem_nsampled);
+	return s->obj;
+}
+
+/*
+ * llkd_kmalloc - kmalloc(@size, @gfp), occasionally guarded; see above.
+ * Free it with llkd_kfree() (and _only_ with it).
+ */
+void *llkd_kmalloc(size_t size, gfp_t gfp)
+{
+	unsigned int rate = READ_ONCE(gmem_rate);
+	void *p;
+
+	if (unlikely(rate) && size && gfpflags_allow_blocking(gfp) &&
+	    this_cpu_dec_return(gmem_countdown) <= 0) {
+		this_cpu_write(gmem_countdown, rate);
+		p = gmem_alloc(size, gfp);
+		if (p)
+			return p;
+	}
+	return kmalloc(size, gfp);
+}
+
+/* The slot @p belongs to: a live (or being freed) one first; NULL if none */
+static struct llkd_gmem_slot *gmem_find(const void *p)
+{
+	struct llkd_gmem_slot *s, *freed = NULL;
+
+	for (s = gmem_slots; s < gmem_slots + LLKD_GMEM_NSLOTS; s++) {
+		if (s->state == GMEM_UNUSED || (u8 *)p < (u8 *)s->area ||
+		    (u8 *)p >= (u8 *)s->area + s->areasz)
+			continue;
+		if (s->state != GMEM_FREED)
+			return s;
+		if (!freed || s->free_ns > freed->free_ns)
+			freed = s;
+	}
+	return freed;
+}
+
+/* llkd_kfree - free memory from llkd_kmalloc(); any context, as kfree() */
+void llkd_kfree(const void *p)
+{
+	struct llkd_gmem_slot *s;
+	size_t before, after;
+	unsigned long flags;
+	const u8 *bad;
+
+	if (likely(!is_vmalloc_addr(p))) {
+		kfree(p);
+		return;
+	}
+	spin_lock_irqsave(&gmem_lock, flags);
+	s = gmem_find(p);
+	if (!s) {
+		spin_unlock_irqrestore(&gmem_lock, flags);
+		pr_err("llkd_gmem: BUG: invalid free of %px (not ours)\n", p);
+		atomic64_inc(&gmem_nerrors);
+		dump_stack();
+		return;
+	}
+	if (s->state != GMEM_LIVE || p != s->obj) {
+		gmem_report(s->state != GMEM_LIVE ? "double free" : "invalid free",
+			    s, p);
+		spin_unlock_irqrestore(&gmem_lock, flags);
+		return;
+	}
+	before = (u8 *)s->obj - (u8 *)s->area;
+	after = ALIGN(s->size, ARCH_KMALLOC_MINALIGN) - s->size;
+	bad = gmem_check(s->area, before, LLKD_GMEM_CANARY);
+	if (!bad)
+		bad = gmem_check((u8 *)s->obj + s->size, after, LLKD_GMEM_CANARY);
+	if (bad)
+		gmem_report("out-of-bounds write", s, bad);
+
+	s->state = GMEM_FREEING;
+	s->free_pid = task_pid_nr(current);
+#ifdef CONFIG_STACKTRACE
+	s->nr_free = stack_trace_save(s->free_stack, LLKD_GMEM_STACK, 1);
+#endif
+	memset(s->obj, POISON_FREE, s->size);
+	llist_add(&s->fnode, &gmem_freeq);
+	spin_unlock_irqrestore(&gmem_lock, flags);
+	schedule_work(&gmem_work);
+}
+
+/* Check the freed objects' poison, then really free them */
+static void gmem_free_work(struct work_struct *work)
+{
+	struct llkd_gmem_slot *s, *tmp;
+	struct llist_node *list = llist_del_all(&gmem_freeq);
+	unsigned long flags;
+	const u8 *bad;
+	void *area;
+
+	llist_for_each_entry_safe(s, tmp, list, fnode) {
+		bad = gmem_check(s->obj, s->size, POISON_FREE);
+		spin_lock_irqsave(&gmem_lock, flags);
+		if (bad)
+			gmem_report("use-after-free write", s, bad);
+		/* once it's FREED, gmem_alloc() can reuse the slot - and
+		 * it's area field - as soon as we unlock */
+		area = s->area;
+		s->state = GMEM_FREED;
+		s->free_ns = ktime_get_ns();
+		spin_unlock_irqrestore(&gmem_lock, flags);
+		vfree(area);
+	}
+}
+
+void llkd_gmem_get_stats(struct llkd_gmem_stats *st)
+{
+	int i;
+
+	st->sampled = atomic64_read(&gmem_nsampled);
+	st->errors = atomic64_read(&gmem_nerrors);
+	st->live = 0;
+	for (i = 0; i < LLKD_GMEM_NSLOTS; i++)
+		st->live += READ_ONCE(gmem_slots[i].state) == GMEM_LIVE;
+}
+
+/* A seq_file show helper: the counters, one 'key value' per line */
+void llkd_gmem_show_stats(struct seq_file *m)
+{
+	struct llkd_gmem_stats st;
+
+	llkd_gmem_get_stats(&st);
+	seq_printf(m, "sample_rate %u\nsampled %llu\nlive %u\nerrors %llu\n",
+		   READ_ONCE(gmem_rate), st.sampled, st.live, st.errors);
+}
+
+/*
+ * llkd_gmem_exit - stop sampling, finish pending frees and report (and
+ * free) any still live sampled objects - leaks. Call it on module exit,
+ * once you're done with llkd_kmalloc() / llkd_kfree().
+ */
+void llkd_gmem_exit(void)
+{
+	struct llkd_gmem_slot *s;
+
+	llkd_gmem_set_rate(0);
+	flush_work(&gmem_work);
+	for (s = gmem_slots; s < gmem_slots + LLKD_GMEM_NSLOTS; s++) {
+		if (s->state == GMEM_LIVE) {
+			pr_warn("llkd_gmem: leak: object %px, %zu bytes\n",
+				s->obj, s->size);
+#ifdef CONFIG_STACKTRACE
+			stack_trace_print(s->alloc_stack, s->nr_alloc, 4);
+#endif
+			vfree(s->area);
+		}
+		s->state = GMEM_UNUSED;
+	}
+}
+
+/*------------------------ llkd_dlog --------------------------------------
+ * Deferred logging. printk() formats the message, takes the log buffer lock
+ * and (maybe) pushes it out to the console(s) - right there, on the caller's
+ * CPU; on a hot path, on many CPUs, that's a bottleneck. llkd_dlog() instead
+ * just stores a binary record - a timestamp, the format string pointer and
+ * the arguments, as vbin_printf() packs them (%s strings are copied) - in
+ * this CPU's ring: no locks, no atomics, no shared cache lines (interrupts
+ * are briefly off, as this CPU's interrupt handlers might log too).
+ * The formatting's done later, by the reader: a read of the debugfs file
+ * <parent>/dlog drains all the rings, merged in timestamp order, formatting
+ * each record as it goes. When a CPU's ring is full, the new record's
+ * dropped - and counted, see <parent>/dlog_stats - never waited for.
+ *
+ * Each ring has a single producer (it's CPU) and a single consumer (the
+ * reader, under dlog_mtx): the producer owns head, the consumer tail, and a
+ * release / acquire pair on each orders the record's contents.
+ * Caveats:
+ * - the format string must outlive the records; a literal in the (calling)
+ *   module's fine, the rings go away in llkd_dlog_exit();
+ * - it's not NMI-safe;
+ * - the timestamps are local_clock()'s, so (as with printk) the order across
+ *   CPUs is approximate;
+ * - without CONFIG_BINARY_PRINTF (CONFIG_TRACING selects it), the message is
+ *   formatted right away, into the record: still no locks, just not lazy.
+ */
+#define LLKD_DLOG_RECSZ		128	/* bytes per record */
+#define LLKD_DLOG_DATASZ	(LLKD_DLOG_RECSZ - 24)
+#define LLKD_DLOG_MAXRECS	65536U	/* per CPU */
+
+struct llkd_dlog_rec {
+	u64 ts;			/* local_clock() */
+	const char *fmt;
+	u32 trunc;		/* the args didn't fit: show just the format */
+	union {
+		u32 bin[LLKD_DLOG_DATASZ / sizeof(u32)];
+		char text[LLKD_DLOG_DATASZ];
+	};
+};
+
+struct llkd_dlog_ring {
+	unsigned long head;		/* producer: the next slot to fill */
+	u64 logged, dropped;
+	struct llkd_dlog_rec *recs;	/* [dlog_nrecs] */
+	unsigned long tail ____cacheline_aligned_in_smp; /* consumer: the next to read */
+};
+
+static struct llkd_dlog_ring __percpu *dlog_rings;
+static unsigned int dlog_nrecs;		/* per CPU; a power of 2 */
+static bool dlog_on;
+static DEFINE_MUTEX(dlog_mtx);		/* one reader at a time; protects below */
+static int dlog_cpu;			/* the CPU of the record being read */
+static char dlog_line[256];
+
+/*
+ * llkd_dlog - log a message, printk() style (no KERN_<level> though), to
+ * this CPU's ring; any context but NMI. Does nothing until llkd_dlog_init().
+ */
+void llkd_dlog(const char *fmt, ...)
+{
+	struct llkd_dlog_ring *r;
+	struct llkd_dlog_rec *rec;
+	unsigned long flags, head;
+	va_list args;
+
+	local_irq_save(flags);
+	if (unlikely(!smp_load_acquire(&dlog_on)))
+		goto out;
+	r = this_cpu_ptr(dlog_rings);
+	head = r->head;
+	if (unlikely(head - smp_load_acquire(&r->tail) >= dlog_nrecs)) {
+		r->dropped++;
+		goto out;
+	}
+	rec = &r->recs[head & (dlog_nrecs - 1)];
+	rec->ts = local_clock();
+	rec->fmt = fmt;
+	va_start(args, fmt);
+#ifdef CONFIG_BINARY_PRINTF
+	rec->trunc = vbin_printf(rec->bin, ARRAY_SIZE(rec->bin), fmt, args) >
+		     (int)ARRAY_SIZE(rec->bin);
+#else
+	vsnprintf(rec->text, sizeof(rec->text), fmt, args);
+	rec->trunc = 0;
+#endif
+	va_end(args);
+	smp_store_release(&r->head, head + 1);
+	r->logged++;
+ out:
+	local_irq_restore(flags);
+}
+
+/* The oldest unread record, across all the rings (and it's CPU); or NULL */
+static struct llkd_dlog_rec *dlog_oldest(int *cpup)
+{
+	struct llkd_dlog_rec *rec, *best = NULL;
+	struct llkd_dlog_ring *r;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		r = per_cpu_ptr(dlog_rings, cpu);
+		if (smp_load_acquire(&r->head) == r->tail)
+			continue;
+		rec = &r->recs[r->tail & (dlog_nrecs - 1)];
+		if (!best || rec->ts < best->ts) {
+			best = rec;
+			*cpup = cpu;
+		}
+	}
+	return best;
+}
+
+/*
+ * The seq_file iterator consumes a record only in ->next(), i.e., once it's
+ * been shown (seq_read() calls ->next() only after a successful ->show());
+ * a record that didn't fit in the user's buffer is shown again on the next
+ * read(2). *pos is thus meaningless; the file isn't seekable.
+ */
+static void *dlog_seq_start(struct seq_file *m, loff_t *pos)
+{
+	mutex_lock(&dlog_mtx);
+	return dlog_oldest(&dlog_cpu);
+}
+
+static void *dlog_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct llkd_dlog_ring *r = per_cpu_ptr(dlog_rings, dlog_cpu);
+
+	smp_store_release(&r->tail, r->tail + 1);
+	++*pos;
+	return dlog_oldest(&dlog_cpu);
+}
+
+static void dlog_seq_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&dlog_mtx);
+}
+
+static int dlog_seq_show(struct seq_file *m, void *v)
+{
+	struct llkd_dlog_rec *rec = v;
+	const char *msg;
+	u64 secs = rec->ts;
+	u32 usecs = do_div(secs, NSEC_PER_SEC) / NSEC_PER_USEC;
+	size_t len;
+
+#ifdef CONFIG_BINARY_PRINTF
+	if (rec->trunc) {
+		msg = rec->fmt;
+	} else {
+		bstr_printf(dlog_line, sizeof(dlog_line), rec->fmt, rec->bin);
+		msg = dlog_line;
+	}
+#else
+	msg = rec->text;
+#endif
+	len = strlen(msg);
+	seq_printf(m, "[%5llu.%06u] cpu%d: %s%s", secs, usecs, dlog_cpu,
+		   rec->trunc ? "(args truncated) " : "", msg);
+	if (!len || msg[len - 1] != '\n')
+		seq_putc(m, '\n');
+	return 0;
+}
+
+static const struct seq_operations dlog_seq_ops = {
+	.start = dlog_seq_start,
+	.next = dlog_seq_next,
+	.stop = dlog_seq_stop,
+	.show = dlog_seq_show,
+};
+
+static int dlog_open(struct inode *inode, struct file *filp)
+{
+	return seq_open(filp, &dlog_seq_ops);
+}
+
+static const struct file_operations dlog_fops = {
+	.open = dlog_open,
+	.read = seq_read,
+	.llseek = no_llseek,
+	.release = seq_release,
+};
+
+/* Sum up the per-CPU counters (a racy, but good enough, snapshot) */
+void llkd_dlog_get_stats(struct llkd_dlog_stats *st)
+{
+	struct llkd_dlog_ring *r;
+	int cpu;
+
+	memset(st, 0, sizeof(*st));
+	if (!dlog_rings)
+		return;
+	for_each_possible_cpu(cpu) {
+		r = per_cpu_ptr(dlog_rings, cpu);
+		st->logged += READ_ONCE(r->logged);
+		st->dropped += READ_ONCE(r->dropped);
+		st->pending += READ_ONCE(r->head) - READ_ONCE(r->tail);
+	}
+}
+
+/*
+ * A seq_file show helper: the totals, one 'key value' per line, then a
+ * 'cpu logged dropped' line per CPU that's logged anything
+ */
+void llkd_dlog_show_stats(struct seq_file *m)
+{
+	struct llkd_dlog_stats st;
+	struct llkd_dlog_ring *r;
+	int cpu;
+
+	llkd_dlog_get_stats(&st);
+	seq_printf(m, "records_per_cpu %u\nlogged %llu\ndropped %llu\npending %llu\n",
+		   dlog_nrecs, st.logged, st.dropped, st.pending);
+	if (!dlog_rings)
+		return;
+	seq_puts(m, "# cpu logged dropped\n");
+	for_each_possible_cpu(cpu) {
+		r = per_cpu_ptr(dlog_rings, cpu);
+		if (READ_ONCE(r->logged) || READ_ONCE(r->dropped))
+			seq_printf(m, "%d %llu %llu\n", cpu, READ_ONCE(r->logged),
+				   READ_ONCE(r->dropped));
+	}
+}
+
+static int dlog_stats_show(struct seq_file *m, void *v)
+{
+	llkd_dlog_show_stats(m);
+	return 0;
+}
+
+static int dlog_stats_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, dlog_stats_show, NULL);
+}
+
+static const struct file_operations dlog_stats_fops = {
+	.open = dlog_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void dlog_free(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		vfree(per_cpu_ptr(dlog_rings, cpu)->recs);
+	free_percpu(dlog_rings);
+	dlog_rings = NULL;
+}
+
+/*
+ * llkd_dlog_init - set up the rings and (if @parent isn't NULL) the debugfs
+ * files <parent>/dlog and <parent>/dlog_stats
+ * @nrecs: records per CPU; rounded up to a power of 2, at most
+ *         LLKD_DLOG_MAXRECS (of LLKD_DLOG_RECSZ bytes each); 0 => 1024
+ * Returns 0 or -ENOMEM; on failure, remove @parent (as you would anyway).
+ */
+int llkd_dlog_init(unsigned int nrecs, struct dentry *parent)
+{
+	struct llkd_dlog_ring *r;
+	int cpu;
+
+	BUILD_BUG_ON(sizeof(struct llkd_dlog_rec) > LLKD_DLOG_RECSZ);
+	if (!nrecs)
+		nrecs = 1024;
+	dlog_nrecs = roundup_pow_of_two(clamp(nrecs, 16U, LLKD_DLOG_MAXRECS));
+	dlog_rings = alloc_percpu(struct llkd_dlog_ring);
+	if (!dlog_rings)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu) {
+		r = per_cpu_ptr(dlog_rings, cpu);
+		r->recs = vmalloc_node(array_size(dlog_nrecs, sizeof(*r->recs)),
+				       cpu_to_node(cpu));
+		if (!r->recs)
+			goto out_free;
+	}
+	if (parent &&
+	    (IS_ERR_OR_NULL(debugfs_create_file("dlog", 0440, parent, NULL,
+						&dlog_fops)) ||
+	     IS_ERR_OR_NULL(debugfs_create_file("dlog_stats", 0440, parent,
+						NULL, &dlog_stats_fops))))
+		goto out_free;
+	smp_store_release(&dlog_on, true);
+	return 0;
+
+ out_free:
+	dlog_free();
+	return -ENOMEM;
+}
+
+/*
+ * llkd_dlog_exit - stop logging and free the rings; report what was dropped,
+ * or never read. Call it on module exit, after removing the debugfs parent.
+ */
+void llkd_dlog_exit(void)
+{
+	struct llkd_dlog_stats st;
+
+	if (!dlog_rings)
+		return;
+	WRITE_ONCE(dlog_on, false);
+	/* llkd_dlog() runs with interrupts off: an RCU read-side section */
+	synchronize_rcu();
+	llkd_dlog_get_stats(&st);
+	if (st.dropped || st.pending)
+		pr_info("llkd_dlog: %llu records logged, %llu dropped, %llu never read\n",
+			st.logged, st.dropped, st.pending);
+	dlog_free();
+}
+
+/*------------------------ llkd_tctx --------------------------------------
+ * Per-task context: a driver's private state for each of it's callers,
+ * found from any of it's methods in O(1), without taking a lock. It's an
+ * rhashtable (a resizable, RCU-protected, hash table) keyed by TGID (or PID),
+ * of entries from a custom slab cache. llkd_tctx_get() looks up current's
+ * entry under rcu_read_lock() alone, creating it (zeroed) on first use.
+ * Each entry holds a reference to it's task's struct pid; that tells us,
+ * cheaply, whether the task's still around - or gone, and it's PID maybe
+ * since reused. A periodic work item reaps the entries of tasks that have
+ * gone (calling the dtor, in process context, after an RCU grace period),
+ * so there's no task exit hook to register (modules can't, portably).
+ * With LLKD_TCTX_TGID, the data is shared by all the process' threads:
+ * update it with atomics (or your own lock). A pointer to it stays valid as
+ * long as the task does; f.e., in the driver method that looked it up.
+ */
+#define LLKD_TCTX_GC_MS		1000	/* reap the dead this often */
+
+struct llkd_tctx {
+	struct rhash_head node;
+	pid_t key;
+	struct pid *pid;		/* we hold a reference */
+	struct llist_node free_node;
+	unsigned long data[];		/* the caller's */
+};
+
+struct llkd_tctx_table {
+	struct rhashtable ht;
+	struct kmem_cache *cachep;
+	enum llkd_tctx_key keytype;
+	void (*dtor)(void *data);
+	struct llist_head freeq;	/* removed; awaiting a grace period */
+	struct delayed_work gc;
+};
+
+static const struct rhashtable_params tctx_params = {
+	.key_len = sizeof(pid_t),
+	.key_offset = offsetof(struct llkd_tctx, key),
+	.head_offset = offsetof(struct llkd_tctx, node),
+	.automatic_shrinking = true,
+};
+
+static struct pid *tctx_mypid(const struct llkd_tctx_table *t)
+{
+	return t->keytype == LLKD_TCTX_TGID ? task_tgid(current) :
+					      task_pid(current);
+}
+
+/* Has @e's task gone? Call under rcu_read_lock() */
+static bool tctx_dead(const struct llkd_tctx_table *t,
+		      const struct llkd_tctx *e)
+{
+	return !pid_task(e->pid, t->keytype == LLKD_TCTX_TGID ? PIDTYPE_TGID :
+								PIDTYPE_PID);
+}
+
+/* Unhash @e (if no one else has) and queue it for freeing; under RCU */
+static void tctx_retire(struct llkd_tctx_table *t, struct llkd_tctx *e)
+{
+	if (!rhashtable_remove_fast(&t->ht, &e->node, tctx_params))
+		llist_add(&e->free_node, &t->freeq);
+}
+
+static void tctx_free(struct llkd_tctx_table *t, struct llkd_tctx *e)
+{
+	if (t->dtor)
+		t->dtor(e->data);
+	put_pid(e->pid);
+	kmem_cache_free(t->cachep, e);
+}
+
+static void tctx_free_queued(struct llkd_tctx_table *t)
+{
+	struct llist_node *freeq = llist_del_all(&t->freeq);
+	struct llkd_tctx *e, *n;
+
+	if (!freeq)
+		return;
+	synchronize_rcu();	/* lock-free lookups might still see them */
+	llist_for_each_entry_safe(e, n, freeq, free_node)
+		tctx_free(t, e);
+}
+
+static void tctx_gc(struct work_struct *work)
+{
+	struct llkd_tctx_table *t = container_of(to_delayed_work(work),
+					struct llkd_tctx_table, gc);
+	struct rhashtable_iter iter;
+	struct llkd_tctx *e;
+
+	rhashtable_walk_enter(&t->ht, &iter);
+	rhashtable_walk_start(&iter);
+	while ((e = rhashtable_walk_next(&iter))) {
+		if (IS_ERR(e))		/* -EAGAIN: a resize; carry on */
+			continue;
+		if (tctx_dead(t, e))
+			tctx_retire(t, e);
+	}
+	rhashtable_walk_stop(&iter);
+	rhashtable_walk_exit(&iter);
+
+	tctx_free_queued(t);
+	schedule_delayed_work(&t->gc, msecs_to_jiffies(LLKD_TCTX_GC_MS));
+}
+
+/*
+ * llkd_tctx_create - create a per-task context table
+ * @name: name of the entries' slab cache (shows up in /proc/slabinfo)
+ * @datasz: size of the per-task data (bytes)
+ * @keytype: per process (LLKD_TCTX_TGID) or per thread (LLKD_TCTX_PID)
+ * @dtor: called on the data before it's freed (in process context); can be
+ *        NULL
+ * Returns the table, or NULL on failure.
+ */
+struct llkd_tctx_table *llkd_tctx_create(const char *name, size_t datasz,
+		enum llkd_tctx_key keytype, void (*dtor)(void *data))
+{
+	struct llkd_tctx_table *t;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return NULL;
+	/* cacheline aligned: different callers' data don't false-share */
+	t->cachep = kmem_cache_create(name, sizeof(struct llkd_tctx) + datasz,
+				      0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!t->cachep)
+		goto out_free;
+	if (rhashtable_init(&t->ht, &tctx_params))
+		goto out_cache;
+	t->keytype = keytype;
+	t->dtor = dtor;
+	init_llist_head(&t->freeq);
+	INIT_DELAYED_WORK(&t->gc, tctx_gc);
+	schedule_delayed_work(&t->gc, msecs_to_jiffies(LLKD_TCTX_GC_MS));
+	return t;
+
+ out_cache:
+	kmem_cache_destroy(t->cachep);
+ out_free:
+	kfree(t);
+	return NULL;
+}
+
+static void tctx_free_one(void *ptr, void *arg)
+{
+	tctx_free(arg, ptr);
+}
+
+/* Destroy the table, freeing all the contexts; no lookups may be in flight */
+void llkd_tctx_destroy(struct llkd_tctx_table *t)
+{
+	if (!t)
+		return;
+	cancel_delayed_work_sync(&t->gc);
+	tctx_free_queued(t);
+	rhashtable_free_and_destroy(&t->ht, tctx_free_one, t);
+	kmem_cache_destroy(t->cachep);
+	kfree(t);
+}
+
+/*
+ * llkd_tctx_find - current's context data, or NULL if it has none (yet);
+ * lock-free, any context
+ */
+void *llkd_tctx_find(struct llkd_tctx_table *t)
+{
+	struct pid *me = tctx_mypid(t);
+	pid_t key = pid_nr(me);
+	struct llkd_tctx *e;
+	void *data = NULL;
+
+	rcu_read_lock();
+	e = rhashtable_lookup(&t->ht, &key, tctx_params);
+	if (likely(e && e->pid == me))
+		data = e->data;
+	rcu_read_unlock();
+	return data;
+}
+
+/*
+ * llkd_tctx_get - current's context data, created (zeroed) if it has none
+ * yet; NULL only if that fails. The lookup's lock-free; creating it might
+ * sleep if @gfp allows.
+ */
+void *llkd_tctx_get(struct llkd_tctx_table *t, gfp_t gfp)
+{
+	struct pid *me = tctx_mypid(t);
+	pid_t key = pid_nr(me);
+	struct llkd_tctx *e, *old;
+	void *data = NULL;
+
+	rcu_read_lock();
+	e = rhashtable_lookup(&t->ht, &key, tctx_params);
+	if (likely(e && e->pid == me))
+		data = e->data;
+	else if (e)		/* a dead task's, whose PID's been reused */
+		tctx_retire(t, e);
+	rcu_read_unlock();
+	if (likely(data))
+		return data;
+
+	e = kmem_cache_zalloc(t->cachep, gfp);
+	if (!e)
+		return NULL;
+	e->key = key;
+	e->pid = get_pid(me);
+	rcu_read_lock();
+	for (;;) {
+		old = rhashtable_lookup_get_insert_fast(&t->ht, &e->node,
+							tctx_params);
+		if (!old) {
+			data = e->data;
+			break;
+		}
+		if (IS_ERR(old))
+			break;
+		if (old->pid == me) {	/* another of our threads beat us to it */
+			data = old->data;
+			break;
+		}
+		tctx_retire(t, old);	/* as above; and retry */
+	}
+	rcu_read_unlock();
+	if (data != e->data) {
+		put_pid(e->pid);
+		kmem_cache_free(t->cachep, e);
+	}
+	return data;
+}
+
+/* The # of contexts in the table (including those of tasks yet to be reaped) */
+unsigned int llkd_tctx_count(struct llkd_tctx_table *t)
+{
+	return atomic_read(&t->ht.nelems);
+}
+
+/*
+ * A seq_file show helper: call @show for each live task's context, under
+ * RCU (so @show mustn't sleep); in no particular order
+ */
+void llkd_tctx_show(struct seq_file *m, struct llkd_tctx_table *t,
+		void (*show)(struct seq_file *m, pid_t key, void *data))
+{
+	struct rhashtable_iter iter;
+	struct llkd_tctx *e;
+
+	rhashtable_walk_enter(&t->ht, &iter);
+	rhashtable_walk_start(&iter);
+	while ((e = rhashtable_walk_next(&iter))) {
+		if (IS_ERR(e))
+			continue;
+		if (!tctx_dead(t, e))
+			show(m, e->key, e->data);
+	}
+	rhashtable_walk_stop(&iter);
+	rhashtable_walk_exit(&iter);
+}
@@ -21,6 +21,10 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/scatterlist.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <asm/page.h>
 
 /* Portability */
 #if(BITS_PER_LONG == 32)
@@ -31,9 +35,201 @@
  #define TYPECST unsigned long
 #endif
 
+/*
+ * The platform descriptor; computed once, see llkd_platform(). Handy f.e. to
+ * lay out per-CPU data in cache_line sized (and aligned) chunks.
+ */
+struct llkd_platform {
+	const char *arch;		/* f.e. "x86_64", "Aarch64" */
+	const char *endian;		/* "little-endian" or "big-endian" */
+	unsigned int bits;		/* 32 or 64 */
+	unsigned int page_size;
+	unsigned int cache_line;	/* bytes */
+	unsigned int cache_kb;		/* last-level cache size; 0 if unknown */
+	unsigned int nr_nodes;		/* online NUMA nodes */
+	unsigned int nr_cpus_possible;
+	unsigned int nr_cpus_online;
+	const char *desc;		/* "<arch>, <endian>; <bits>-bit OS" */
+};
+
+struct seq_file;
+const struct llkd_platform *llkd_platform(void);
+void llkd_show_platform(struct seq_file *m);
 void llkd_minsysinfo(void);
+
+/*
+ * Integer math. The 64-bit divides all go via the div64 helpers, so that
+ * they link on 32-bit (ARM) too.
+ */
+int llkd_pow_u64(u64 base, unsigned int exp, u64 *res);
 u64 powerof(int base, int exponent);
+u64 llkd_div_frac(u64 num, u64 den, unsigned int dec, u32 *frac);
+
+/* 2^@n; 0 if it doesn't fit in a u64 */
+static inline u64 llkd_pow2(unsigned int n)
+{
+	return n < 64 ? 1ULL << n : 0;
+}
+
+/* The # of pages, and bytes, in an @order allocation */
+static inline unsigned long llkd_order_pages(unsigned int order)
+{
+	return 1UL << order;
+}
+
+static inline size_t llkd_order_bytes(unsigned int order)
+{
+	return PAGE_SIZE << order;
+}
+
+/* The smallest order that holds @npages pages (0 for 0 or 1 page) */
+static inline unsigned int llkd_pages_order(unsigned long npages)
+{
+	return npages > 1 ? ilog2(npages - 1) + 1 : 0;
+}
+
+/* floor(log2(@v)); -1 for 0 */
+static inline int llkd_ilog2_u64(u64 v)
+{
+	return v ? ilog2(v) : -1;
+}
+
+/* @n / @d, rounded up; without the n + d - 1 overflow */
+static inline u64 llkd_div_round_up_u64(u64 n, u64 d)
+{
+	u64 r, q = div64_u64_rem(n, d, &r);
+
+	return q + !!r;
+}
 void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check);
 void show_sizeof(void);
 
+/*
+ * A run of physically contiguous pages, all of them on the same node and in
+ * the same zone; see llkd_phy_runs()
+ */
+struct llkd_pfn_run {
+	unsigned long pfn;	/* the first page's PFN */
+	unsigned long npages;
+	int nid;
+	const char *zone;	/* the zone's name (f.e. "DMA32", "Normal") */
+};
+
+int llkd_phy_runs(const void *kaddr, size_t len, struct llkd_pfn_run *runs,
+		int maxruns);
+int llkd_show_phy_runs(struct seq_file *m, const void *kaddr, size_t len);
+
+/*
+ * llkd_buf: a large (physically contiguous if at all possible) buffer, with
+ * a fallback chain; see llkd_buf_alloc()
+ */
+enum llkd_buf_tier {
+	LLKD_BUF_HUGE,		/* one block, PMD-sized or larger: huge-page
+				 * mapped in the kernel direct map */
+	LLKD_BUF_CONTIG,	/* one physically contiguous block */
+	LLKD_BUF_VMAP,		/* smaller blocks, vmap()'ed virtually
+				 * contiguous */
+};
+
+struct llkd_buf_chunk {
+	struct page *page;
+	unsigned int order;
+};
+
+struct llkd_buf {
+	void *vaddr;		/* the (virtually contiguous) buffer */
+	size_t len;
+	enum llkd_buf_tier tier;
+	unsigned int min_order, max_order;	/* of the chunks we got */
+	unsigned int nchunks;
+	struct llkd_buf_chunk *chunks;
+	struct sg_table sgt;	/* an entry per chunk, f.e. for DMA mapping */
+};
+
+int llkd_buf_alloc(struct llkd_buf *buf, size_t len, gfp_t gfp);
+void llkd_buf_free(struct llkd_buf *buf);
+const char *llkd_buf_tier_name(enum llkd_buf_tier tier);
+
+/*
+ * llkd_pool: an object pool on top of a (custom) slab cache, with per-CPU
+ * 'magazines' of ready-to-use objects; see klib_llkd.c
+ */
+struct llkd_pool;
+
+struct llkd_pool_stats {
+	u64 hits;	/* allocs satisfied from a per-CPU magazine */
+	u64 misses;	/* allocs that had to go to the slab layer */
+	u64 frees;	/* frees absorbed by a per-CPU magazine */
+	u64 flushes;	/* frees that had to go to the slab layer */
+};
+
+struct llkd_pool *llkd_pool_create(const char *name, unsigned int objsz,
+		unsigned int align, unsigned int magsz, bool debug,
+		void (*ctor)(void *));
+void llkd_pool_destroy(struct llkd_pool *pool);
+void *llkd_pool_alloc(struct llkd_pool *pool, gfp_t gfp);
+void llkd_pool_free(struct llkd_pool *pool, void *obj);
+int llkd_pool_alloc_bulk(struct llkd_pool *pool, gfp_t gfp, size_t n,
+		void **objs);
+void llkd_pool_free_bulk(struct llkd_pool *pool, size_t n, void **objs);
+void llkd_pool_get_stats(struct llkd_pool *pool, struct llkd_pool_stats *st);
+void llkd_pool_show_stats(struct seq_file *m, struct llkd_pool *pool);
+
+/*
+ * llkd_gmem: a sampling, guard-page based, memory error detector; use
+ * llkd_kmalloc() / llkd_kfree() in place of kmalloc() / kfree(). See
+ * klib_llkd.c
+ */
+struct llkd_gmem_stats {
+	u64 sampled;		/* allocations placed on guarded pages */
+	u64 errors;		/* memory errors detected */
+	unsigned int live;	/* sampled objects currently allocated */
+};
+
+void llkd_gmem_set_rate(unsigned int rate);
+void *llkd_kmalloc(size_t size, gfp_t gfp);
+void llkd_kfree(const void *p);
+void llkd_gmem_get_stats(struct llkd_gmem_stats *st);
+void llkd_gmem_show_stats(struct seq_file *m);
+void llkd_gmem_exit(void);
+
+/*
+ * llkd_dlog: deferred logging; per-CPU lockless rings of binary log records,
+ * formatted only when read (via debugfs). See klib_llkd.c
+ */
+struct llkd_dlog_stats {
+	u64 logged;		/* records stored */
+	u64 dropped;		/* records dropped, their CPU's ring being full */
+	u64 pending;		/* stored, not yet read */
+};
+
+struct dentry;
+int llkd_dlog_init(unsigned int nrecs, struct dentry *parent);
+__printf(1, 2) void llkd_dlog(const char *fmt, ...);
+void llkd_dlog_get_stats(struct llkd_dlog_stats *st);
+void llkd_dlog_show_stats(struct seq_file *m);
+void llkd_dlog_exit(void);
+
+/*
+ * llkd_tctx: per-task (per-process or per-thread) private state for a
+ * driver's callers; a lock-free lookup (an RCU-protected rhashtable keyed by
+ * TGID or PID), slab-cached entries, reaped automatically once the task's
+ * gone. See klib_llkd.c
+ */
+enum llkd_tctx_key {
+	LLKD_TCTX_TGID,		/* one context per process */
+	LLKD_TCTX_PID,		/* one context per thread */
+};
+
+struct llkd_tctx_table;
+
+struct llkd_tctx_table *llkd_tctx_create(const char *name, size_t datasz,
+		enum llkd_tctx_key keytype, void (*dtor)(void *data));
+void llkd_tctx_destroy(struct llkd_tctx_table *t);
+void *llkd_tctx_get(struct llkd_tctx_table *t, gfp_t gfp);
+void *llkd_tctx_find(struct llkd_tctx_table *t);
+unsigned int llkd_tctx_count(struct llkd_tctx_table *t);
+void llkd_tctx_show(struct seq_file *m, struct llkd_tctx_table *t,
+		void (*show)(struct seq_file *m, pid_t key, void *data));
+
 #endif
@@ -32,7 +32,9 @@
 #include <linux/init.h>
 #include <linux/sched.h>
 #include <linux/debugfs.h>
-#include <linux/vmalloc.h>
+#include <linux/seq_file.h>
+#include <linux/pid.h>
+#include <linux/rcupdate.h>
 
 #include <linux/version.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
@@ -60,106 +62,120 @@ MODULE_VERSION("0.1");
 
 static struct dentry *gparent;
 
-static ssize_t showall_threads(struct file *filp, char __user *ubuf,
-			       size_t count, loff_t *fpos)
+/*
+ * The output is generated via the seq_file iterator interface: the seq_file
+ * core calls our start/next/show/stop methods to fill it's (page-sized)
+ * buffer, copying it out to userspace whenever it fills up; so, no matter how
+ * many threads are alive, there's no large allocation, and each thread costs
+ * just one (O(1)) show call.
+ * We walk the threads in PID order (via find_ge_pid(), as /proc's readdir
+ * does) under RCU, rather than with do_each_thread(): our position in the
+ * walk (*pos) is then simply the PID of the thread to show next, so we can
+ * drop the RCU read lock whenever the seq_file core returns to userspace
+ * (in our stop method) and cheaply pick up from where we left off (in start).
+ * Threads that are created or that die while we're walking may or may not be
+ * shown; that's the price of not holding any lock across the whole walk.
+ * *pos == 0 corresponds to the idle thread ('swapper', PID 0), which isn't on
+ * the PID hash; it's shown via the SEQ_START_TOKEN.
+ */
+static struct task_struct *thrd_from(loff_t *pos)
 {
-	struct task_struct *g, *t;	/* 'g' : process ptr; 't': thread ptr */
-	char *data;
-#define MEM_REQD_PER_THREAD 128
-	int nr_thrds = 1, total = 1;   /* total init to 1 for the idle thread */
-#define TMPMAX		128
-	char tmp[TMPMAX];
-	ssize_t numthrds = 0, n = 0;
-
-	do_each_thread(g, t) {
-		numthrds++;
-	} while_each_thread(g, t);
-	pr_debug("# threads alive: %zd\n", numthrds);
-
-	/* We attempt to calculate the max amt of memory required; this,
-	 * of course, is fraught with assumptions! It's a bit fragile;
-	 * for this demo, we just leave it at this...
-	 */
-	data = vzalloc(numthrds * MEM_REQD_PER_THREAD);
-	if (!data) {
-		pr_alert("%s: vzalloc() failure!\n", OURMODNAME);
-		return -ENOMEM;
+	struct task_struct *t;
+	struct pid *pid;
+
+	do {
+		pid = find_ge_pid(*pos, &init_pid_ns);
+		if (!pid)
+			return NULL;	/* end of the walk */
+		*pos = pid_nr(pid);
+		t = pid_task(pid, PIDTYPE_PID);
+		if (!t)		/* not a thread (f.e. a pgrp or sid only) */
+			(*pos)++;
+	} while (!t);
+	return t;
+}
+
+static void *showall_start(struct seq_file *m, loff_t *pos)
+	__acquires(RCU)
+{
+	rcu_read_lock();
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	return thrd_from(pos);
+}
+
+static void *showall_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return thrd_from(pos);
+}
+
+static void showall_stop(struct seq_file *m, void *v)
+	__releases(RCU)
+{
+	rcu_read_unlock();
+}
+
+/*--- All output in CSV format ---*/
+static int showall_show(struct seq_file *m, void *v)
+{
+	struct task_struct *t = v, *g;
+	int nr_thrds;
+
+	if (v == SEQ_START_TOKEN) {
+		/* We know that the swapper is a kernel thread */
+		t = &init_task;
+		seq_printf(m, "%d,%d,0x%016lx,0x%016lx,[%s]\n",
+			   t->pid, t->pid, (unsigned long)t,
+			   (unsigned long)t->stack, t->comm);
+		return 0;
 	}
 
-	/* The majority of the code below is pretty much a copy of this:
-	 *  ch6/foreach/thrd_showall/thrd_showall.c:showthrds()
-	 * And why not! Here, we change the *output format* to CSV, as the
-	 * spec requires... simply loop around collecting all the output in
-	 * our 'data' buffer and hand it off to userspace with just one call
-	 * to simple_read_from_buffer().
+	g = t->group_leader;	/* 'g' : process ptr; 't': thread ptr */
+	task_lock(t);
+	/* tgid,pid, task_struct addr and kernel-mode stack addr */
+	seq_printf(m, "%d,%d,0x%016lx,0x%016lx", g->tgid, t->pid,
+		   (unsigned long)t, (unsigned long)t->stack);
+	if (!t->mm)	// kernel thread
+		/* (Why not get_task_comm()? We hold the task lock already;
+		 * it'd deadlock. See the chapter on Synchronization) */
+		seq_printf(m, ",[%s]", t->comm);
+	else
+		seq_printf(m, ",%s", t->comm);
+
+	/* Is this the "main" thread of a multithreaded process?
+	 * We check by seeing if (a) it's a userspace thread,
+	 * (b) it's TGID == it's PID, and (c), there are >1 threads in
+	 * the process.
+	 * If so, display the number of threads in the overall process
+	 * to the right..
 	 */
-#if 0
-	/* the tasklist_lock reader-writer spinlock for the task list 'should'
-	 * be used here, but, it's not exported, hence unavailable to our
-	 * kernel module */
-	read_lock(&tasklist_lock);
-#endif
-	/*--- All output in CSV format ---*/
-	/* We know that the swapper is a kernel thread */
-	snprintf(data, TMPMAX, "%d,%d,0x%016lx,0x%016lx,[%s]\n",
-		 t->pid, t->pid, (unsigned long)t,
-		 (unsigned long)t->stack, t->comm);
-
-	do_each_thread(g, t) {	/* 'g' : process ptr; 't': thread ptr */
-		task_lock(t);
-
-		memset(tmp, 0, sizeof(tmp));
-		snprintf(tmp, TMPMAX - 1, "%d,%d", g->tgid, t->pid);
-		strncat(data, tmp, TMPMAX);
-
-		/* task_struct addr and kernel-mode stack addr */
-		snprintf(tmp, TMPMAX - 1, ",0x%016lx", (unsigned long)t);
-		strncat(data, tmp, TMPMAX);
-		snprintf(tmp, TMPMAX - 1, ",0x%016lx", (unsigned long)t->stack);
-		strncat(data, tmp, TMPMAX);
-
-		if (!g->mm)	// kernel thread
-		  /* One might question why we don't use the get_task_comm() to
-		   * obtain the task's name here; the short reason: it causes a
-		   * deadlock! We shall explore this (and how to avoid it) in
-		   * some detail in the chapter on Synchronization. For now, we
-		   * just do it the simple way ...
-		   */
-			snprintf(tmp, TMPMAX - 1, ",[%s]", t->comm);
-		else
-			snprintf(tmp, TMPMAX - 1, ",%s", t->comm);
-		strncat(data, tmp, TMPMAX);
-
-		/* Is this the "main" thread of a multithreaded process?
-		 * We check by seeing if (a) it's a userspace thread,
-		 * (b) it's TGID == it's PID, and (c), there are >1 threads in
-		 * the process.
-		 * If so, display the number of threads in the overall process
-		 * to the right..
-		 */
-		nr_thrds = get_nr_threads(g);
-		if (g->mm && (g->tgid == t->pid) && (nr_thrds > 1)) {
-			snprintf(tmp, TMPMAX - 1, ",%d", nr_thrds);
-			strncat(data, tmp, TMPMAX);
-		}
-
-		snprintf(tmp, 2, "\n");
-		strncat(data, tmp, 2);
-		total++;
-		task_unlock(t);
-	} while_each_thread(g, t);
-#if 0
-	/* <same as above, reg the reader-writer spinlock for the task list> */
-	read_unlock(&tasklist_lock);
-#endif
-	n = simple_read_from_buffer(ubuf, strlen(data), fpos, data,
-				    strlen(data));
-	vfree(data);
-	return n;
+	nr_thrds = get_nr_threads(g);
+	if (t->mm && (g->tgid == t->pid) && (nr_thrds > 1))
+		seq_printf(m, ",%d", nr_thrds);
+	seq_putc(m, '\n');
+	task_unlock(t);
+	return 0;
+}
+
+static const struct seq_operations showall_seq_ops = {
+	.start = showall_start,
+	.next = showall_next,
+	.stop = showall_stop,
+	.show = showall_show,
+};
+
+static int showall_open(struct inode *inode, struct file *filp)
+{
+	return seq_open(filp, &showall_seq_ops);
 }
 
 static const struct file_operations dbg_fops1 = {
-	.read = showall_threads,
+	.owner = THIS_MODULE,
+	.open = showall_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
 };
 
 static int __init dbgfs_showall_threads_init(void)
@@ -22,6 +22,17 @@
  * have the driver read and translate the kva into it's corresponding physical
  * address (pa); then reading from the same file should cause the pa to be
  * displayed. Vice-versa with the addrxlate_pa2kva sysfs file.
+ *
+ * Beyond the assignment: translating one address per write/read pair costs
+ * several syscalls (and two global mutexes) per address; tools that need to
+ * translate very many can instead use the IOCTL_ADDRXLATE_BULK ioctl on our
+ * misc device, /dev/addrxlate, translating an array of them - each either
+ * way, each validated and with it's own status - per call. It's lockless;
+ * there's no shared state. See sysfs_addrxlate.h.
+ * /dev/addrxlate also does single translations with the sysfs files'
+ * write-then-read protocol, but with the result kept per open file: write
+ * "k <kva>" or "p <pa>", then read the result; concurrent users thus neither
+ * serialize on (global) mutexes nor see each other's results.
  */
 #include <linux/kernel.h>
 #include <linux/module.h>
@@ -30,6 +41,10 @@
 #include <linux/platform_device.h>
 #include <linux/mutex.h>
 #include <linux/mm.h>	    // for high_memory
+#include <linux/slab.h>
+#include <linux/sched/signal.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
 
 // copy_[to|from]_user()
 #include <linux/version.h>
@@ -39,6 +54,8 @@
 #include <asm/uaccess.h>
 #endif
 
+#include "sysfs_addrxlate.h"
+
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION
     ("LLKD book:solutions_to_assgn/ch12/sysfs_addrxlate: simple sysfs interfacing to translate linear addr");
@@ -276,6 +293,190 @@ static ssize_t addrxlate_kva2pa_store(struct device *dev,
  */
 static DEVICE_ATTR_RW(SYSFS_FILE1);	/* it's show/store callbacks are above */
 
+/*------------------ the /dev/addrxlate misc device -----------------------*/
+#define XLATE_CHUNK	256	/* (bulk) entries copied in/out at a time */
+
+/* Per open file state: the last translation requested via write(2) */
+struct xlate_file {
+	struct mutex mtx;	/* this file's only; serializes it's users */
+	bool valid;		/* there's a result to read */
+	struct addrxlate_ent ent;
+};
+
+/* Translate one entry; as the sysfs methods do, but without the printk's */
+static void xlate_one(struct addrxlate_ent *e)
+{
+	e->xlated = 0;
+	e->status = 0;
+	switch (e->dir) {
+	case ADDRXLATE_KVA2PA:
+		if (e->addr != (unsigned long)e->addr ||
+		    !virt_addr_valid((void *)(unsigned long)e->addr)) {
+			e->status = -EFAULT;
+			break;
+		}
+		e->xlated = virt_to_phys((void *)(unsigned long)e->addr);
+		break;
+	case ADDRXLATE_PA2KVA:
+		/* it must be a direct-mapped (lowmem) RAM page */
+		if (!pfn_valid(PHYS_PFN(e->addr)) ||
+		    e->addr >= __pa(high_memory - 1) + 1) {
+			e->status = -EFAULT;
+			break;
+		}
+		e->xlated = (unsigned long)phys_to_virt(e->addr);
+		break;
+	default:
+		e->status = -EINVAL;
+	}
+}
+
+static long addrxlate_bulk(struct addrxlate_bulk __user *ubulk)
+{
+	struct addrxlate_bulk bulk;
+	struct addrxlate_ent *kents;
+	struct addrxlate_ent __user *uents;
+	u32 done = 0, ok = 0, n, i;
+	long ret = 0;
+
+	if (copy_from_user(&bulk, ubulk, sizeof(bulk)))
+		return -EFAULT;
+	uents = u64_to_user_ptr(bulk.ents);
+	kents = kmalloc_array(XLATE_CHUNK, sizeof(*kents), GFP_KERNEL);
+	if (!kents)
+		return -ENOMEM;
+
+	while (done < bulk.nents) {
+		n = min_t(u32, bulk.nents - done, XLATE_CHUNK);
+		if (copy_from_user(kents, uents + done, n * sizeof(*kents))) {
+			ret = -EFAULT;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			xlate_one(&kents[i]);
+			if (!kents[i].status)
+				ok++;
+		}
+		if (copy_to_user(uents + done, kents, n * sizeof(*kents))) {
+			ret = -EFAULT;
+			break;
+		}
+		done += n;
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+	kfree(kents);
+
+	if (put_user(ok, &ubulk->ndone))
+		ret = -EFAULT;
+	return ret;
+}
+
+static int addrxlate_open(struct inode *inode, struct file *filp)
+{
+	struct xlate_file *xf = kzalloc(sizeof(*xf), GFP_KERNEL);
+
+	if (!xf)
+		return -ENOMEM;
+	mutex_init(&xf->mtx);
+	filp->private_data = xf;
+	return 0;
+}
+
+static int addrxlate_release(struct inode *inode, struct file *filp)
+{
+	kfree(filp->private_data);
+	return 0;
+}
+
+/* "k <kva>" (kva -> pa) or "p <pa>" (pa -> kva); the address in any base
+ * kstrtoull() understands */
+static ssize_t addrxlate_write(struct file *filp, const char __user *ubuf,
+			       size_t count, loff_t *off)
+{
+	struct xlate_file *xf = filp->private_data;
+	struct addrxlate_ent e = { };
+	char kbuf[ADDR_MAXLEN + 3];
+	int ret;
+
+	if (count < 3 || count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, ubuf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+	if ((kbuf[0] != 'k' && kbuf[0] != 'p') || kbuf[1] != ' ')
+		return -EINVAL;
+	e.dir = kbuf[0] == 'k' ? ADDRXLATE_KVA2PA : ADDRXLATE_PA2KVA;
+	ret = kstrtoull(strim(kbuf + 2), 0, &e.addr);
+	if (ret)
+		return ret;
+	xlate_one(&e);
+
+	mutex_lock(&xf->mtx);
+	xf->ent = e;
+	xf->valid = !e.status;
+	mutex_unlock(&xf->mtx);
+	if (e.status)
+		return e.status;
+	*off = 0;		/* read the new result from the start */
+	return count;
+}
+
+/* The result of the last (successful) translation on this file */
+static ssize_t addrxlate_read(struct file *filp, char __user *ubuf,
+			      size_t count, loff_t *off)
+{
+	struct xlate_file *xf = filp->private_data;
+	char kbuf[ADDR_MAXLEN + 1];
+	int n;
+	ssize_t ret;
+
+	mutex_lock(&xf->mtx);
+	if (!xf->valid) {
+		mutex_unlock(&xf->mtx);
+		return -ENODATA;
+	}
+	n = snprintf(kbuf, sizeof(kbuf), "0x%016llx\n", xf->ent.xlated);
+	ret = simple_read_from_buffer(ubuf, count, off, kbuf, n);
+	mutex_unlock(&xf->mtx);
+	return ret;
+}
+
+static long addrxlate_ioctl(struct file *filp, unsigned int cmd,
+			    unsigned long arg)
+{
+	if (_IOC_TYPE(cmd) != IOCTL_ADDRXLATE_MAGIC ||
+	    _IOC_NR(cmd) > IOCTL_ADDRXLATE_MAXIOCTL)
+		return -ENOTTY;
+
+	switch (cmd) {
+	case IOCTL_ADDRXLATE_BULK:
+		return addrxlate_bulk((struct addrxlate_bulk __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations addrxlate_fops = {
+	.owner = THIS_MODULE,
+	.open = addrxlate_open,
+	.read = addrxlate_read,
+	.write = addrxlate_write,
+	.unlocked_ioctl = addrxlate_ioctl,
+	.release = addrxlate_release,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice addrxlate_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "addrxlate",	/* /dev/addrxlate */
+	.mode = 0600,		/* kernel addresses: root only */
+	.fops = &addrxlate_fops,
+};
+
 /*
  * From <linux/device.h>:
 DEVICE_ATTR{_RW} helper interfaces (linux/device.h):
@@ -346,9 +547,21 @@ static int __init sysfs_addrxlate_init(void)
 	pr_info("sysfs file [2] (/sys/devices/platform/%s/%s) created\n",
 	    PLAT_NAME, __stringify(SYSFS_FILE2));
 
+	// 3. Register the misc device for the bulk interface
+	stat = misc_register(&addrxlate_miscdev);
+	if (stat) {
+		pr_info("%s: misc device registration failed (%d), aborting now\n",
+			OURMODNAME, stat);
+		goto out4;
+	}
+	pr_info("misc device (%s) for bulk translation registered\n",
+		ADDRXLATE_DEV_PATH);
+
 	pr_info("%s initialized\n", OURMODNAME);
 	return 0;		/* success */
 
+ out4:
+	device_remove_file(&sysfs_demo_platdev->dev, &dev_attr_SYSFS_FILE2);
  out3:
 	device_remove_file(&sysfs_demo_platdev->dev, &dev_attr_SYSFS_FILE1);
  out2:
@@ -359,6 +572,7 @@ static int __init sysfs_addrxlate_init(void)
 
 static void __exit sysfs_addrxlate_cleanup(void)
 {
+	misc_deregister(&addrxlate_miscdev);
 	/* Cleanup sysfs nodes */
 	device_remove_file(&sysfs_demo_platdev->dev, &dev_attr_SYSFS_FILE2);
 	device_remove_file(&sysfs_demo_platdev->dev, &dev_attr_SYSFS_FILE1);
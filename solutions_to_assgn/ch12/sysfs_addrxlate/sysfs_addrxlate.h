@@ -0,0 +1,51 @@
+/*
+ * sysfs_addrxlate.h
+ *
+ * Common header for the sysfs_addrxlate kernel module and it's userspace
+ * consumers.
+ * Besides the one-address-at-a-time sysfs files, the module provides a
+ * misc device, /dev/addrxlate, whose IOCTL_ADDRXLATE_BULK ioctl translates
+ * a whole array of addresses - kva -> pa or pa -> kva, per entry - in one
+ * call, with a per-entry status.
+ * The device also does single translations, keeping the result per open
+ * file: write(2) "k <kva>" (kva -> pa) or "p <pa>" (pa -> kva), then read(2)
+ * back the result, as "0x<16 hex digits>\n" (-ENODATA if there's none yet).
+ */
+#ifndef __SYSFS_ADDRXLATE_H__
+#define __SYSFS_ADDRXLATE_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define ADDRXLATE_DEV_PATH	"/dev/addrxlate"
+
+/* addrxlate_ent.dir */
+#define ADDRXLATE_KVA2PA	0
+#define ADDRXLATE_PA2KVA	1
+
+struct addrxlate_ent {
+	__u64 addr;		/* in: the address to translate */
+	__u64 xlated;		/* out: the translated address (if status 0) */
+	__u32 dir;		/* in: ADDRXLATE_{KVA2PA|PA2KVA} */
+	__s32 status;		/* out: 0, or -EFAULT (not a valid lowmem kva /
+				 * direct-mapped pa), -EINVAL (bad dir) */
+};
+
+/*
+ * IOCTL_ADDRXLATE_BULK: translate the nents entries of the user array at
+ * 'ents' in place; on return, ndone is the # translated successfully (the
+ * others have a non-zero status). The ioctl itself fails only if the array
+ * can't be accessed (-EFAULT) or on a fatal signal (-EINTR; entries before
+ * the first untouched one are valid).
+ */
+#define IOCTL_ADDRXLATE_MAGIC		0xAB
+#define IOCTL_ADDRXLATE_MAXIOCTL	0
+
+struct addrxlate_bulk {
+	__u64 ents;		/* user virtual address of the array */
+	__u32 nents;
+	__u32 ndone;		/* out */
+};
+#define IOCTL_ADDRXLATE_BULK	_IOWR(IOCTL_ADDRXLATE_MAGIC, 0, struct addrxlate_bulk)
+
+#endif